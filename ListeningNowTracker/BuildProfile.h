@@ -0,0 +1,94 @@
+#ifndef __BUILDPROFILE_H__
+#define __BUILDPROFILE_H__
+
+/*
+ * Compile-time feature switches of the application.
+ *
+ * "Minimal" project configuration defines LNT_MINIMAL_BUILD. It is meant for fleet installations
+ * where the app runs on every workstation, so the footprint (working set, private bytes, threads)
+ * matters more than features. Individual switches can be overridden with /D compiler option,
+ * for example /DLNT_SINK_TRAY=0 builds the app without tray icon updates.
+*/
+
+#ifdef LNT_MINIMAL_BUILD
+
+	// Watchdog runs as a WM_TIMER in the main thread (no idle thread with its own OLE apartment)
+	#ifndef LNT_FEATURE_WATCHDOG_THREAD
+	#define LNT_FEATURE_WATCHDOG_THREAD 0
+	#endif
+
+	// No local music library tag index (INI file [LIBRARY] section is ignored)
+	#ifndef LNT_FEATURE_LIBRARY_INDEX
+	#define LNT_FEATURE_LIBRARY_INDEX 0
+	#endif
+
+	// No localhost broadcast server (INI file [BROADCAST] section is ignored, winsock is not loaded)
+	#ifndef LNT_FEATURE_BROADCAST
+	#define LNT_FEATURE_BROADCAST 0
+	#endif
+
+	// Trim the working set after this many seconds without events (INI file TrimWorkingSetAfterIdleSecs overrides)
+	#ifndef LNT_DEFAULT_TRIM_IDLE_SECS
+	#define LNT_DEFAULT_TRIM_IDLE_SECS 60
+	#endif
+
+	// Footprint budget (KB). Exceeding it fails "/trace" (exit code 2) and "/soak" runs
+	#ifndef LNT_WORKINGSET_BUDGET_KB
+	#define LNT_WORKINGSET_BUDGET_KB 3072
+	#endif
+
+	#ifndef LNT_PRIVATEBYTES_BUDGET_KB
+	#define LNT_PRIVATEBYTES_BUDGET_KB 1536
+	#endif
+
+#endif //LNT_MINIMAL_BUILD
+
+
+//
+// Default values (full build)
+//
+
+#ifndef LNT_FEATURE_WATCHDOG_THREAD
+#define LNT_FEATURE_WATCHDOG_THREAD 1
+#endif
+
+#ifndef LNT_FEATURE_LIBRARY_INDEX
+#define LNT_FEATURE_LIBRARY_INDEX 1
+#endif
+
+#ifndef LNT_FEATURE_BROADCAST
+#define LNT_FEATURE_BROADCAST 1
+#endif
+
+#ifndef LNT_DEFAULT_TRIM_IDLE_SECS
+#define LNT_DEFAULT_TRIM_IDLE_SECS 0
+#endif
+
+#ifndef LNT_WORKINGSET_BUDGET_KB
+#define LNT_WORKINGSET_BUDGET_KB 0
+#endif
+
+#ifndef LNT_PRIVATEBYTES_BUDGET_KB
+#define LNT_PRIVATEBYTES_BUDGET_KB 0
+#endif
+
+// Startup time budget (ms from WinMain entry until the message window is listening). Exceeding it
+// fails "/trace" runs (exit code 2)
+#ifndef LNT_LISTENING_BUDGET_MS
+#define LNT_LISTENING_BUDGET_MS 100
+#endif
+
+// Sinks ("listening now" text targets). Set to 0 to leave out the code of the sink
+#ifndef LNT_SINK_SKYPE
+#define LNT_SINK_SKYPE 1
+#endif
+
+#ifndef LNT_SINK_TRAY
+#define LNT_SINK_TRAY 1
+#endif
+
+#ifndef LNT_SINK_SHARED_MEMORY
+#define LNT_SINK_SHARED_MEMORY 1
+#endif
+
+#endif //__BUILDPROFILE_H__
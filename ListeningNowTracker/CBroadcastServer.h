@@ -0,0 +1,644 @@
+#ifndef __CBROADCASTSERVER_H__
+#define __CBROADCASTSERVER_H__
+
+#include <winsock2.h>
+#include <wincrypt.h>
+#include <string>
+#include <map>
+
+#include "CEventRecord.h"
+
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "advapi32.lib")
+
+/*
+ * Localhost "now playing" broadcast server for stream overlays, status widgets and dashboards.
+ * All protocols share the same port (127.0.0.1 only)
+ *
+ *   Line protocol	Client sends a line (for example an empty line) and receives one JSON object per line
+ *   Server-sent events	"GET /events" HTTP request. Each event is a "data: <json>" message
+ *   WebSocket		HTTP upgrade request (any path). Each event is a JSON text frame
+ *   Binary WebSocket	HTTP upgrade request to "/records". Each event is a binary frame (see EventRecord.h)
+ *   Snapshot		"GET /" or "GET /nowplaying". The current track as JSON document
+ *
+ * Sockets are non-blocking and driven by WSAAsyncSelect notifications to the main window, so the
+ * server runs in the main thread like the other sinks and doesn't need any locking.
+ *
+ * Each event is serialized once into a reference counted packet which holds the framing of all
+ * protocols. The JSON text is built from the UTF-8 texts of the event record. Clients send straight
+ * from the shared packet (no per-client copies). A client has at most one packet being sent and one
+ * packet waiting. A newer event replaces the waiting packet (drop-to-latest), so a slow or stalled
+ * client never holds more than two packets.
+*/
+
+//
+// One serialized event shared by all clients. Reference counting is not interlocked, because
+// packets are used only in the main thread.
+//
+class CBroadcastPacket
+{
+  public:
+	enum { FORMAT_LINE, FORMAT_SSE, FORMAT_WEBSOCKET, FORMAT_JSON, FORMAT_RECORD, FORMAT_COUNT };
+
+  protected:
+	std::string m_strData;					// Framed copies of the JSON text and the record (FORMAT_xxx order)
+	size_t      m_arrOffsets[FORMAT_COUNT + 1];
+	LONG        m_lRefCount;
+
+	~CBroadcastPacket() {}
+
+  public:
+	CBroadcastPacket(const std::string& strJson, const CEventRecordView& objRecord)
+	{
+		BYTE arrFrameHeader[10];
+		size_t iFrameHeaderLen = MakeWebSocketFrameHeader(0x81, strJson.size(), arrFrameHeader);
+
+		m_lRefCount = 1;
+		m_strData.reserve(strJson.size() * 4 + objRecord.GetRecordSize() + 2 * sizeof(arrFrameHeader) + 10);
+
+		m_arrOffsets[FORMAT_LINE] = m_strData.size();
+		m_strData.append(strJson).append("\n");
+
+		m_arrOffsets[FORMAT_SSE] = m_strData.size();
+		m_strData.append("data: ").append(strJson).append("\n\n");
+
+		m_arrOffsets[FORMAT_WEBSOCKET] = m_strData.size();
+		m_strData.append((const char*) arrFrameHeader, iFrameHeaderLen).append(strJson);
+
+		m_arrOffsets[FORMAT_JSON] = m_strData.size();
+		m_strData.append(strJson);
+
+		iFrameHeaderLen = MakeWebSocketFrameHeader(0x82, objRecord.GetRecordSize(), arrFrameHeader);
+		m_arrOffsets[FORMAT_RECORD] = m_strData.size();
+		m_strData.append((const char*) arrFrameHeader, iFrameHeaderLen).append((const char*) objRecord.GetData(), objRecord.GetRecordSize());
+
+		m_arrOffsets[FORMAT_COUNT] = m_strData.size();
+	}
+
+	void AddRef()  { m_lRefCount++; }
+	void Release() { if (--m_lRefCount == 0) delete this; }
+
+	const char* GetData(int iFormat) const { return m_strData.data() + m_arrOffsets[iFormat]; }
+	size_t GetLength(int iFormat) const { return m_arrOffsets[iFormat + 1] - m_arrOffsets[iFormat]; }
+
+  protected:
+	// Unmasked final frame, 0x81 = text, 0x82 = binary (server-to-client frames are never masked)
+	static size_t MakeWebSocketFrameHeader(BYTE bFirstByte, size_t iPayloadLen, BYTE* pHeader)
+	{
+		pHeader[0] = bFirstByte;
+		if (iPayloadLen < 126)
+		{
+			pHeader[1] = (BYTE) iPayloadLen;
+			return 2;
+		}
+
+		if (iPayloadLen <= 0xFFFF)
+		{
+			pHeader[1] = 126;
+			pHeader[2] = (BYTE) (iPayloadLen >> 8);
+			pHeader[3] = (BYTE) iPayloadLen;
+			return 4;
+		}
+
+		pHeader[1] = 127;
+		for (int idx = 0; idx < 8; idx++) pHeader[2 + idx] = (BYTE) ((ULONGLONG) iPayloadLen >> (8 * (7 - idx)));
+		return 10;
+	}
+};
+
+
+class CBroadcastServer
+{
+  public:
+	enum { MAX_CLIENTS = 1024, MAX_REQUEST_LEN = 4096 };
+
+	struct CStats
+	{
+		DWORD dwClientCount;		// Connected clients (subscribers and clients still sending a request)
+		DWORD dwPublishedCount;		// Events published
+		DWORD dwDroppedCount;		// Packets replaced by a newer one before a slow client got them
+		DWORD dwRejectedCount;		// Connections refused because of MAX_CLIENTS limit
+	};
+
+  protected:
+	enum { STATE_REQUEST, STATE_SUBSCRIBED, STATE_CLOSING };
+
+	struct CClient
+	{
+		SOCKET            hSocket;
+		int               iState;
+		int               iFormat;			// CBroadcastPacket::FORMAT_xxx
+		std::string       strInput;			// Request text (STATE_REQUEST) or incoming WebSocket frames
+		std::string       strPreamble;		// Client specific response header (HTTP response, WebSocket handshake)
+		size_t            iPreambleSent;
+		CBroadcastPacket* pCurrent;			// Packet being sent
+		size_t            iCurrentSent;
+		CBroadcastPacket* pNext;			// The latest packet waiting for pCurrent to complete
+	};
+
+	SOCKET            m_hListenSocket;
+	HWND              m_hWnd;
+	UINT              m_uMsg;
+	bool              m_bWSAStarted;
+	CBroadcastPacket* m_pLatest;			// The latest event (sent to new subscribers and snapshot requests)
+	CStats            m_objStats;
+
+	std::map<SOCKET, CClient*> m_mapClients;
+
+  public:
+	CBroadcastServer()
+	{
+		m_hListenSocket = INVALID_SOCKET;
+		m_hWnd = NULL;
+		m_uMsg = 0;
+		m_bWSAStarted = false;
+		m_pLatest = NULL;
+		ZeroMemory(&m_objStats, sizeof(m_objStats));
+	}
+
+	~CBroadcastServer()
+	{
+		Stop();
+	}
+
+	bool IsRunning() const { return m_hListenSocket != INVALID_SOCKET; }
+
+	const CStats& GetStats() const { return m_objStats; }
+
+	//
+	// Start listening the localhost port. Socket notifications are posted to hWnd as uMsg
+	// messages, which the window procedure must pass to OnSocketMessage.
+	//
+	bool Start(HWND hWnd, UINT uMsg, WORD wPort)
+	{
+		WSADATA objWSAData;
+		sockaddr_in objAddr;
+
+		Stop();
+
+		if (::WSAStartup(MAKEWORD(2, 2), &objWSAData) != 0) return false;
+		m_bWSAStarted = true;
+
+		m_hWnd = hWnd;
+		m_uMsg = uMsg;
+
+		ZeroMemory(&objAddr, sizeof(objAddr));
+		objAddr.sin_family      = AF_INET;
+		objAddr.sin_port        = htons(wPort);
+		objAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		m_hListenSocket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (m_hListenSocket == INVALID_SOCKET
+			|| ::bind(m_hListenSocket, (const sockaddr*) &objAddr, sizeof(objAddr)) == SOCKET_ERROR
+			|| ::listen(m_hListenSocket, SOMAXCONN) == SOCKET_ERROR
+			|| ::WSAAsyncSelect(m_hListenSocket, m_hWnd, m_uMsg, FD_ACCEPT) == SOCKET_ERROR)
+		{
+			Stop();
+			return false;
+		}
+
+		// Nothing played yet. New clients get "stopped" state until the first event
+		CTrackEvent objNoEvent;
+		BYTE arrRecord[EVENTRECORD_MAX_SIZE];
+		CEventRecordView objRecord;
+
+		objRecord.Attach(arrRecord, CEventRecord::Encode(objNoEvent, L"", 0, 0, arrRecord));
+		Publish(objRecord);
+		return true;
+	}
+
+	void Stop()
+	{
+		while (!m_mapClients.empty()) CloseClient(m_mapClients.begin()->second);
+
+		if (m_hListenSocket != INVALID_SOCKET) ::closesocket(m_hListenSocket);
+		m_hListenSocket = INVALID_SOCKET;
+
+		if (m_pLatest != NULL) m_pLatest->Release();
+		m_pLatest = NULL;
+
+		if (m_bWSAStarted) ::WSACleanup();
+		m_bWSAStarted = false;
+	}
+
+	// Serialize the event once and push it to all subscribers
+	void Publish(const CEventRecordView& objRecord)
+	{
+		if (!IsRunning() || !objRecord.IsValid()) return;
+
+		CBroadcastPacket* pPacket = new CBroadcastPacket(MakeJson(objRecord), objRecord);
+		if (m_pLatest != NULL) m_pLatest->Release();
+		m_pLatest = pPacket;
+		m_objStats.dwPublishedCount++;
+
+		// Flush may close the client (and remove it from the map), so the iterator is moved first
+		std::map<SOCKET, CClient*>::iterator it = m_mapClients.begin();
+		while (it != m_mapClients.end())
+		{
+			CClient* pClient = it->second;
+			++it;
+
+			if (pClient->iState != STATE_SUBSCRIBED) continue;
+
+			QueuePacket(pClient, pPacket);
+			FlushClient(pClient);
+		}
+	}
+
+	// WSAAsyncSelect notification (wParam = socket, lParam = event and error code)
+	void OnSocketMessage(WPARAM wParam, LPARAM lParam)
+	{
+		SOCKET hSocket = (SOCKET) wParam;
+		WORD   wEvent  = WSAGETSELECTEVENT(lParam);
+
+		if (hSocket == m_hListenSocket)
+		{
+			if (wEvent == FD_ACCEPT) AcceptClient();
+			return;
+		}
+
+		// Notifications may still arrive after the client socket was closed
+		std::map<SOCKET, CClient*>::iterator it = m_mapClients.find(hSocket);
+		if (it == m_mapClients.end()) return;
+
+		CClient* pClient = it->second;
+
+		if (WSAGETSELECTERROR(lParam) != 0 || wEvent == FD_CLOSE)
+			CloseClient(pClient);
+		else if (wEvent == FD_READ)
+			ReadClient(pClient);
+		else if (wEvent == FD_WRITE)
+			FlushClient(pClient);
+	}
+
+  protected:
+	void AcceptClient()
+	{
+		SOCKET hSocket = ::accept(m_hListenSocket, NULL, NULL);
+		if (hSocket == INVALID_SOCKET) return;
+
+		if (m_mapClients.size() >= MAX_CLIENTS || ::WSAAsyncSelect(hSocket, m_hWnd, m_uMsg, FD_READ | FD_WRITE | FD_CLOSE) == SOCKET_ERROR)
+		{
+			::closesocket(hSocket);
+			m_objStats.dwRejectedCount++;
+			return;
+		}
+
+		// Events are small and latency matters more than the packet count
+		BOOL bNoDelay = TRUE;
+		::setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (const char*) &bNoDelay, sizeof(bNoDelay));
+
+		CClient* pClient = new CClient();
+		pClient->hSocket       = hSocket;
+		pClient->iState        = STATE_REQUEST;
+		pClient->iFormat       = CBroadcastPacket::FORMAT_LINE;
+		pClient->iPreambleSent = 0;
+		pClient->pCurrent      = pClient->pNext = NULL;
+		pClient->iCurrentSent  = 0;
+
+		m_mapClients[hSocket] = pClient;
+		m_objStats.dwClientCount = (DWORD) m_mapClients.size();
+	}
+
+	void CloseClient(CClient* pClient)
+	{
+		::closesocket(pClient->hSocket);
+
+		if (pClient->pCurrent != NULL) pClient->pCurrent->Release();
+		if (pClient->pNext != NULL) pClient->pNext->Release();
+
+		m_mapClients.erase(pClient->hSocket);
+		m_objStats.dwClientCount = (DWORD) m_mapClients.size();
+		delete pClient;
+	}
+
+	void ReadClient(CClient* pClient)
+	{
+		char szBuffer[512];
+
+		int iRead = ::recv(pClient->hSocket, szBuffer, sizeof(szBuffer), 0);
+		if (iRead == SOCKET_ERROR && ::WSAGetLastError() == WSAEWOULDBLOCK) return;
+		if (iRead <= 0)
+		{
+			CloseClient(pClient);
+			return;
+		}
+
+		// Line and SSE subscribers have nothing to say. Incoming data is ignored.
+		if (pClient->iState == STATE_SUBSCRIBED && pClient->iFormat != CBroadcastPacket::FORMAT_WEBSOCKET && pClient->iFormat != CBroadcastPacket::FORMAT_RECORD) return;
+		if (pClient->iState == STATE_CLOSING) return;
+
+		pClient->strInput.append(szBuffer, iRead);
+		if (pClient->strInput.size() > MAX_REQUEST_LEN)
+		{
+			CloseClient(pClient);
+			return;
+		}
+
+		if (pClient->iState == STATE_SUBSCRIBED)
+		{
+			ReadWebSocketFrames(pClient);
+			return;
+		}
+
+		// "GET " starts a HTTP request (wait for the end of headers). Anything else is a line protocol client.
+		std::string& strInput = pClient->strInput;
+		size_t iPrefixLen = (strInput.size() < 4 ? strInput.size() : 4);
+
+		if (strInput.compare(0, iPrefixLen, "GET ", iPrefixLen) == 0)
+		{
+			if (strInput.find("\r\n\r\n") != std::string::npos) ProcessHttpRequest(pClient);
+		}
+		else if (strInput.find('\n') != std::string::npos)
+		{
+			Subscribe(pClient, CBroadcastPacket::FORMAT_LINE);
+		}
+	}
+
+	// Client-to-server WebSocket frames. Only a close frame matters, other frames are skipped.
+	void ReadWebSocketFrames(CClient* pClient)
+	{
+		std::string& strInput = pClient->strInput;
+
+		while (strInput.size() >= 2)
+		{
+			BYTE   bOpCode = (BYTE) strInput[0] & 0x0F;
+			BYTE   bLen    = (BYTE) strInput[1] & 0x7F;
+			size_t iHeaderLen = 2 + (bLen == 126 ? 2 : (bLen == 127 ? 8 : 0)) + (((BYTE) strInput[1] & 0x80) ? 4 : 0);
+			size_t iPayloadLen = bLen;
+
+			if (strInput.size() < iHeaderLen) return;
+
+			if (bLen == 126) iPayloadLen = ((BYTE) strInput[2] << 8) | (BYTE) strInput[3];
+			else if (bLen == 127)
+			{
+				// Control and status frames are small. 64-bit lengths are treated as a protocol error.
+				CloseClient(pClient);
+				return;
+			}
+
+			if (strInput.size() < iHeaderLen + iPayloadLen) return;
+
+			if (bOpCode == 0x08)
+			{
+				CloseClient(pClient);
+				return;
+			}
+
+			strInput.erase(0, iHeaderLen + iPayloadLen);
+		}
+	}
+
+	void ProcessHttpRequest(CClient* pClient)
+	{
+		const std::string& strRequest = pClient->strInput;
+
+		size_t iPathEnd = strRequest.find(' ', 4);
+		std::string strPath = strRequest.substr(4, (iPathEnd != std::string::npos ? iPathEnd : strRequest.size()) - 4);
+		std::string strUpgrade = GetHeaderValue(strRequest, "upgrade");
+
+		if (_strnicmp(strUpgrade.c_str(), "websocket", 9) == 0)
+		{
+			std::string strAccept = MakeWebSocketAccept(GetHeaderValue(strRequest, "sec-websocket-key"));
+			if (strAccept.empty())
+			{
+				CloseClient(pClient);
+				return;
+			}
+
+			pClient->strPreamble = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " + strAccept + "\r\n\r\n";
+			Subscribe(pClient, (strPath.compare(0, 8, "/records") == 0 ? CBroadcastPacket::FORMAT_RECORD : CBroadcastPacket::FORMAT_WEBSOCKET));
+		}
+		else if (strPath.compare(0, 7, "/events") == 0)
+		{
+			pClient->strPreamble = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nAccess-Control-Allow-Origin: *\r\nConnection: keep-alive\r\n\r\n";
+			Subscribe(pClient, CBroadcastPacket::FORMAT_SSE);
+		}
+		else if (strPath == "/" || strPath == "/nowplaying")
+		{
+			char szHeader[200];
+			_snprintf_s(szHeader, sizeof(szHeader), _TRUNCATE,
+				"HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: %u\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+				(unsigned) m_pLatest->GetLength(CBroadcastPacket::FORMAT_JSON));
+
+			pClient->strPreamble = szHeader;
+			pClient->iFormat = CBroadcastPacket::FORMAT_JSON;
+			pClient->iState = STATE_CLOSING;
+			QueuePacket(pClient, m_pLatest);
+			FlushClient(pClient);
+		}
+		else
+		{
+			pClient->strPreamble = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+			pClient->iState = STATE_CLOSING;
+			FlushClient(pClient);
+		}
+	}
+
+	// New subscribers get the current state right away
+	void Subscribe(CClient* pClient, int iFormat)
+	{
+		pClient->iState  = STATE_SUBSCRIBED;
+		pClient->iFormat = iFormat;
+		pClient->strInput.clear();
+
+		QueuePacket(pClient, m_pLatest);
+		FlushClient(pClient);
+	}
+
+	void QueuePacket(CClient* pClient, CBroadcastPacket* pPacket)
+	{
+		pPacket->AddRef();
+
+		if (pClient->pCurrent == NULL)
+		{
+			pClient->pCurrent = pPacket;
+			pClient->iCurrentSent = 0;
+			return;
+		}
+
+		// Drop-to-latest. The packet being sent is completed (frames must stay intact), the waiting one is replaced.
+		if (pClient->pNext != NULL)
+		{
+			pClient->pNext->Release();
+			m_objStats.dwDroppedCount++;
+		}
+		pClient->pNext = pPacket;
+	}
+
+	// Send as much as the socket accepts. FD_WRITE notification continues when the socket has room again.
+	// Returns false if the client was closed.
+	bool FlushClient(CClient* pClient)
+	{
+		if (!SendPending(pClient, pClient->strPreamble.data(), pClient->strPreamble.size(), pClient->iPreambleSent)) return false;
+		if (pClient->iPreambleSent < pClient->strPreamble.size()) return true;
+
+		while (pClient->pCurrent != NULL)
+		{
+			size_t iLen = pClient->pCurrent->GetLength(pClient->iFormat);
+
+			if (!SendPending(pClient, pClient->pCurrent->GetData(pClient->iFormat), iLen, pClient->iCurrentSent)) return false;
+			if (pClient->iCurrentSent < iLen) return true;
+
+			pClient->pCurrent->Release();
+			pClient->pCurrent = pClient->pNext;
+			pClient->pNext = NULL;
+			pClient->iCurrentSent = 0;
+		}
+
+		if (pClient->iState == STATE_CLOSING)
+		{
+			::shutdown(pClient->hSocket, SD_SEND);
+			CloseClient(pClient);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool SendPending(CClient* pClient, const char* pData, size_t iLen, size_t& iSent)
+	{
+		while (iSent < iLen)
+		{
+			int iResult = ::send(pClient->hSocket, pData + iSent, (int) (iLen - iSent), 0);
+			if (iResult == SOCKET_ERROR)
+			{
+				if (::WSAGetLastError() == WSAEWOULDBLOCK) return true;
+
+				CloseClient(pClient);
+				return false;
+			}
+			iSent += iResult;
+		}
+		return true;
+	}
+
+	// Value of the HTTP request header (case-insensitive name, leading spaces removed)
+	static std::string GetHeaderValue(const std::string& strRequest, const char* szName)
+	{
+		size_t iNameLen = strlen(szName);
+		size_t iPos = strRequest.find("\r\n");
+
+		while (iPos != std::string::npos && iPos + 2 < strRequest.size())
+		{
+			iPos += 2;
+			size_t iLineEnd = strRequest.find("\r\n", iPos);
+			if (iLineEnd == std::string::npos || iLineEnd == iPos) break;
+
+			if (iLineEnd - iPos > iNameLen && strRequest[iPos + iNameLen] == ':' && _strnicmp(strRequest.c_str() + iPos, szName, iNameLen) == 0)
+			{
+				size_t iValue = iPos + iNameLen + 1;
+				while (iValue < iLineEnd && strRequest[iValue] == ' ') iValue++;
+				return strRequest.substr(iValue, iLineEnd - iValue);
+			}
+
+			iPos = iLineEnd;
+		}
+
+		return std::string();
+	}
+
+	// Sec-WebSocket-Accept = base64(SHA1(key + fixed GUID))
+	static std::string MakeWebSocketAccept(const std::string& strKey)
+	{
+		std::string strInput = strKey + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+		BYTE  arrHash[20];
+		DWORD dwHashLen = sizeof(arrHash);
+		bool  bSucceeded = false;
+
+		HCRYPTPROV hProv = 0;
+		HCRYPTHASH hHash = 0;
+
+		if (strKey.empty()) return std::string();
+
+		if (::CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+		{
+			if (::CryptCreateHash(hProv, CALG_SHA1, 0, 0, &hHash))
+			{
+				bSucceeded = (::CryptHashData(hHash, (const BYTE*) strInput.data(), (DWORD) strInput.size(), 0)
+					&& ::CryptGetHashParam(hHash, HP_HASHVAL, arrHash, &dwHashLen, 0));
+				::CryptDestroyHash(hHash);
+			}
+			::CryptReleaseContext(hProv, 0);
+		}
+
+		return (bSucceeded ? EncodeBase64(arrHash, dwHashLen) : std::string());
+	}
+
+	static std::string EncodeBase64(const BYTE* pData, size_t iLen)
+	{
+		static const char szChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		std::string strResult;
+
+		for (size_t idx = 0; idx < iLen; idx += 3)
+		{
+			DWORD dwBits = (DWORD) pData[idx] << 16;
+			if (idx + 1 < iLen) dwBits |= (DWORD) pData[idx + 1] << 8;
+			if (idx + 2 < iLen) dwBits |= pData[idx + 2];
+
+			strResult += szChars[(dwBits >> 18) & 0x3F];
+			strResult += szChars[(dwBits >> 12) & 0x3F];
+			strResult += (idx + 1 < iLen ? szChars[(dwBits >> 6) & 0x3F] : '=');
+			strResult += (idx + 2 < iLen ? szChars[dwBits & 0x3F] : '=');
+		}
+
+		return strResult;
+	}
+
+	static std::string MakeJson(const CEventRecordView& objRecord)
+	{
+		const CEventRecordHeader& objHeader = objRecord.GetHeader();
+		char szNumbers[120];
+		std::string strJson;
+
+		strJson.reserve(256);
+		strJson.append("{\"status\":").append(objRecord.IsStopped() ? "\"stopped\"" : "\"playing\"");
+		strJson.append(",\"title\":");  AppendJsonString(strJson, objRecord, EVENTRECORD_TEXT_TITLE);
+		strJson.append(",\"artist\":"); AppendJsonString(strJson, objRecord, EVENTRECORD_TEXT_ARTIST);
+		strJson.append(",\"album\":");  AppendJsonString(strJson, objRecord, EVENTRECORD_TEXT_ALBUM);
+		strJson.append(",\"genre\":");  AppendJsonString(strJson, objRecord, EVENTRECORD_TEXT_GENRE);
+		strJson.append(",\"text\":");   AppendJsonString(strJson, objRecord, EVENTRECORD_TEXT_LISTENING);
+
+		_snprintf_s(szNumbers, sizeof(szNumbers), _TRUNCATE, ",\"year\":%u,\"track\":%u,\"durationMs\":%lu,\"seq\":%lu}",
+			(unsigned) objHeader.wYear, (unsigned) objHeader.wTrackNumber, (unsigned long) objHeader.dwDurationMS, (unsigned long) objHeader.dwSequence);
+		strJson.append(szNumbers);
+
+		return strJson;
+	}
+
+	// JSON string of a record text (already UTF-8, so only quotes, backslashes and control chars are escaped)
+	static void AppendJsonString(std::string& strJson, const CEventRecordView& objRecord, int iText)
+	{
+		size_t iLength;
+		const char* szText = objRecord.GetText(iText, &iLength);
+		size_t iStart = 0;
+
+		strJson += '"';
+
+		for (size_t iPos = 0; iPos < iLength; iPos++)
+		{
+			BYTE ch = (BYTE) szText[iPos];
+			if (ch >= 0x20 && ch != '"' && ch != '\\') continue;
+
+			strJson.append(szText + iStart, iPos - iStart);
+			iStart = iPos + 1;
+
+			if (ch == '"' || ch == '\\')
+			{
+				strJson += '\\';
+				strJson += (char) ch;
+			}
+			else
+			{
+				char szEscape[8];
+				_snprintf_s(szEscape, sizeof(szEscape), _TRUNCATE, "\\u%04x", (unsigned) ch);
+				strJson += szEscape;
+			}
+		}
+
+		strJson.append(szText + iStart, iLength - iStart);
+		strJson += '"';
+	}
+};
+
+#endif //__CBROADCASTSERVER_H__
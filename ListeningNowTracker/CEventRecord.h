@@ -0,0 +1,276 @@
+#ifndef __CEVENTRECORD_H__
+#define __CEVENTRECORD_H__
+
+#include <new>
+
+#include "EventRecord.h"
+#include "CTrackEvent.h"
+
+/*
+ * Writer side of the binary event records (see EventRecord.h for the layout and the reader).
+ * Each event is encoded once into a pooled record and the sinks share the same record, so the
+ * texts are converted to UTF-8 only once per event.
+ *
+ * Records are reference counted. The last Release returns the buffer to the pool, so the event
+ * path stops allocating memory after the first few events. Records and the pool are used only
+ * in the main thread (reference counting is not interlocked).
+ *
+ * A record is allocated to the size of the encoded event (rounded up to RECORD_SIZE_GRANULE), not
+ * to EVENTRECORD_MAX_SIZE. The pool encodes into its own buffer of the maximum size and copies the
+ * result to a free record which is big enough.
+*/
+
+// Header of this writer must be the version 1 header (texts are located by wHeaderSize anyway)
+typedef char CEventRecordHeaderSizeCheck[sizeof(CEventRecordHeader) == EVENTRECORD_MIN_HEADER_SIZE ? 1 : -1];
+
+class CEventRecordPool;
+
+class CEventRecord
+{
+	friend class CEventRecordPool;
+
+  protected:
+	CEventRecordPool* m_pPool;
+	CEventRecord*     m_pNextFree;
+	LONG              m_lRefCount;
+	DWORD             m_dwSize;
+	DWORD             m_dwCapacity;
+
+	// Record bytes (m_dwCapacity of them, the allocation extends past the end of the object)
+	union
+	{
+		CEventRecordHeader objHeader;		// Aligns the buffer for the header
+		BYTE               arrBytes[sizeof(CEventRecordHeader)];
+	} m_objData;
+
+	CEventRecord() {}
+	~CEventRecord() {}
+
+	static CEventRecord* Allocate(CEventRecordPool* pPool, DWORD dwCapacity)
+	{
+		CEventRecord* pRecord = new (::operator new(sizeof(CEventRecord) - sizeof(CEventRecordHeader) + dwCapacity)) CEventRecord();
+		pRecord->m_pPool = pPool;
+		pRecord->m_dwCapacity = dwCapacity;
+		return pRecord;
+	}
+
+	static void Free(CEventRecord* pRecord)
+	{
+		pRecord->~CEventRecord();
+		::operator delete(pRecord);
+	}
+
+	BYTE* GetBuffer() { return (BYTE*) &m_objData; }
+
+  public:
+	void AddRef() { m_lRefCount++; }
+	inline void Release();
+
+	const BYTE* GetData() const { return (const BYTE*) &m_objData; }
+	DWORD GetSize() const { return m_dwSize; }
+	DWORD GetCapacity() const { return m_dwCapacity; }
+
+	CEventRecordView GetView() const
+	{
+		CEventRecordView objView;
+		objView.Attach(GetData(), m_dwSize);
+		return objView;
+	}
+
+	//
+	// Encode the event into pBuffer (EVENTRECORD_MAX_SIZE bytes). Returns the size of the record.
+	// szText is the formatted "listening now" text. Too long texts are truncated at a char boundary.
+	//
+	static DWORD Encode(const CTrackEvent& objEvent, const WCHAR* szText, DWORD dwSequence, ULONGLONG ullEventTime, BYTE* pBuffer)
+	{
+		CEventRecordHeader* pHeader = (CEventRecordHeader*) pBuffer;
+		CEventRecordField*  pFields = (CEventRecordField*) (pBuffer + sizeof(CEventRecordHeader));
+		DWORD dwPos = sizeof(CEventRecordHeader) + EVENTRECORD_TEXT_COUNT * sizeof(CEventRecordField);
+
+		pHeader->dwMagic      = EVENTRECORD_MAGIC;
+		pHeader->wVersion     = EVENTRECORD_VERSION;
+		pHeader->wHeaderSize  = sizeof(CEventRecordHeader);
+		pHeader->wFieldCount  = EVENTRECORD_TEXT_COUNT;
+		pHeader->wFlags       = (objEvent.IsStopped() ? EVENTRECORD_FLAG_STOPPED : 0);
+		pHeader->ullEventTime = ullEventTime;
+		pHeader->dwSequence   = dwSequence;
+		pHeader->dwDurationMS = objEvent.m_dwDurationMS;
+		pHeader->wYear        = objEvent.m_wYear;
+		pHeader->wTrackNumber = objEvent.m_wTrackNumber;
+		pHeader->dwReserved   = 0;
+
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_TITLE],     objEvent.m_szTitle);
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_ARTIST],    objEvent.m_szArtist);
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_ALBUM],     objEvent.m_szAlbum);
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_GENRE],     objEvent.m_szGenre);
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_FORMAT],    objEvent.m_szFormat);
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_SOURCE],    objEvent.m_szSource);
+		AppendText(pBuffer, dwPos, pFields[EVENTRECORD_TEXT_LISTENING], szText);
+
+		pHeader->dwRecordSize = dwPos;
+		return dwPos;
+	}
+
+	// Event of the record (pending event queue keeps records instead of events)
+	static void Decode(const CEventRecordView& objView, CTrackEvent& objEvent)
+	{
+		const CEventRecordHeader& objHeader = objView.GetHeader();
+
+		objEvent.Clear();
+		wcscpy_s(objEvent.m_szStatus, (objView.IsStopped() ? L"0" : L"1"));
+
+		objView.GetTextW(EVENTRECORD_TEXT_TITLE,  objEvent.m_szTitle,  CTrackEvent::MAX_FIELD_LEN);
+		objView.GetTextW(EVENTRECORD_TEXT_ARTIST, objEvent.m_szArtist, CTrackEvent::MAX_FIELD_LEN);
+		objView.GetTextW(EVENTRECORD_TEXT_ALBUM,  objEvent.m_szAlbum,  CTrackEvent::MAX_FIELD_LEN);
+		objView.GetTextW(EVENTRECORD_TEXT_GENRE,  objEvent.m_szGenre,  CTrackEvent::MAX_GENRE_LEN);
+		objView.GetTextW(EVENTRECORD_TEXT_FORMAT, objEvent.m_szFormat, CTrackEvent::MAX_FORMAT_LEN);
+		objView.GetTextW(EVENTRECORD_TEXT_SOURCE, objEvent.m_szSource, CTrackEvent::MAX_SOURCE_LEN);
+
+		objEvent.m_dwDurationMS = objHeader.dwDurationMS;
+		objEvent.m_wYear        = objHeader.wYear;
+		objEvent.m_wTrackNumber = objHeader.wTrackNumber;
+	}
+
+  protected:
+	// UTF-8 text and its null byte (surrogate pairs are combined, a lone surrogate becomes U+FFFD)
+	static void AppendText(BYTE* pBuffer, DWORD& dwPos, CEventRecordField& objField, const WCHAR* szText)
+	{
+		DWORD dwEnd = EVENTRECORD_MAX_SIZE - 1;		// Room for the null byte
+
+		objField.wOffset = (WORD) dwPos;
+
+		for (; *szText != L'\0'; szText++)
+		{
+			DWORD ch = *szText;
+
+			if (ch >= 0xD800 && ch <= 0xDBFF && szText[1] >= 0xDC00 && szText[1] <= 0xDFFF)
+			{
+				ch = 0x10000 + ((ch - 0xD800) << 10) + (szText[1] - 0xDC00);
+				szText++;
+			}
+			else if (ch >= 0xD800 && ch <= 0xDFFF) ch = 0xFFFD;
+
+			if (ch < 0x80)
+			{
+				if (dwPos + 1 > dwEnd) break;
+				pBuffer[dwPos++] = (BYTE) ch;
+			}
+			else if (ch < 0x800)
+			{
+				if (dwPos + 2 > dwEnd) break;
+				pBuffer[dwPos++] = (BYTE) (0xC0 | (ch >> 6));
+				pBuffer[dwPos++] = (BYTE) (0x80 | (ch & 0x3F));
+			}
+			else if (ch < 0x10000)
+			{
+				if (dwPos + 3 > dwEnd) break;
+				pBuffer[dwPos++] = (BYTE) (0xE0 | (ch >> 12));
+				pBuffer[dwPos++] = (BYTE) (0x80 | ((ch >> 6) & 0x3F));
+				pBuffer[dwPos++] = (BYTE) (0x80 | (ch & 0x3F));
+			}
+			else
+			{
+				if (dwPos + 4 > dwEnd) break;
+				pBuffer[dwPos++] = (BYTE) (0xF0 | (ch >> 18));
+				pBuffer[dwPos++] = (BYTE) (0x80 | ((ch >> 12) & 0x3F));
+				pBuffer[dwPos++] = (BYTE) (0x80 | ((ch >> 6) & 0x3F));
+				pBuffer[dwPos++] = (BYTE) (0x80 | (ch & 0x3F));
+			}
+		}
+
+		objField.wLength = (WORD) (dwPos - objField.wOffset);
+		pBuffer[dwPos++] = 0;
+	}
+};
+
+
+class CEventRecordPool
+{
+  public:
+	enum
+	{
+		MAX_FREE_RECORDS    = 8,		// More than this many free records are released to the heap
+		RECORD_SIZE_GRANULE = 256		// Records of similar events fit the same buffer
+	};
+
+  protected:
+	CEventRecord* m_pFreeList;
+	DWORD         m_dwFreeCount;
+	DWORD         m_dwSequence;
+
+	union
+	{
+		CEventRecordHeader objHeader;
+		BYTE               arrBytes[EVENTRECORD_MAX_SIZE];
+	} m_objEncodeBuffer;
+
+  public:
+	CEventRecordPool()
+	{
+		m_pFreeList = NULL;
+		m_dwFreeCount = 0;
+		m_dwSequence = 0;
+	}
+
+	~CEventRecordPool()
+	{
+		while (m_pFreeList != NULL)
+		{
+			CEventRecord* pRecord = m_pFreeList;
+			m_pFreeList = pRecord->m_pNextFree;
+			CEventRecord::Free(pRecord);
+		}
+	}
+
+	// Encode the event into a pooled record (reference count 1, the caller releases it)
+	CEventRecord* Encode(const CTrackEvent& objEvent, const WCHAR* szText)
+	{
+		FILETIME ftNow;
+		::GetSystemTimeAsFileTime(&ftNow);
+
+		DWORD dwSize = CEventRecord::Encode(objEvent, szText, ++m_dwSequence,
+			((ULONGLONG) ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime, m_objEncodeBuffer.arrBytes);
+
+		// Smallest free record which is big enough (a big record is kept for a big event)
+		CEventRecord** ppBest = NULL;
+		for (CEventRecord** ppLink = &m_pFreeList; *ppLink != NULL; ppLink = &(*ppLink)->m_pNextFree)
+		{
+			if ((*ppLink)->m_dwCapacity >= dwSize && (ppBest == NULL || (*ppLink)->m_dwCapacity < (*ppBest)->m_dwCapacity)) ppBest = ppLink;
+		}
+
+		CEventRecord* pRecord = (ppBest != NULL ? *ppBest : NULL);
+		if (pRecord != NULL)
+		{
+			*ppBest = pRecord->m_pNextFree;
+			m_dwFreeCount--;
+		}
+		else pRecord = CEventRecord::Allocate(this, (dwSize + RECORD_SIZE_GRANULE - 1) / RECORD_SIZE_GRANULE * RECORD_SIZE_GRANULE);
+
+		pRecord->m_pNextFree = NULL;
+		pRecord->m_lRefCount = 1;
+		pRecord->m_dwSize = dwSize;
+		memcpy(pRecord->GetBuffer(), m_objEncodeBuffer.arrBytes, dwSize);
+
+		return pRecord;
+	}
+
+	void Recycle(CEventRecord* pRecord)
+	{
+		if (m_dwFreeCount >= MAX_FREE_RECORDS)
+		{
+			CEventRecord::Free(pRecord);
+			return;
+		}
+
+		pRecord->m_pNextFree = m_pFreeList;
+		m_pFreeList = pRecord;
+		m_dwFreeCount++;
+	}
+};
+
+inline void CEventRecord::Release()
+{
+	if (--m_lRefCount == 0) m_pPool->Recycle(this);
+}
+
+#endif //__CEVENTRECORD_H__
@@ -2,6 +2,8 @@
 #define __CINIFILE_H__
 
 #include <string> 
+#include <vector> 
+#include <shlobj.h> 
 
 /*
  * Simple class to handle Windows INI files (read support only here)
@@ -30,11 +32,70 @@ class CIniFile
 			return strResult.substr(0, strResult.rfind('\\'));
 		}
 
+		// Class function to return the per-user data folder of this app (created if missing). 
+		// Falls back to the application folder if the user profile folder is not available.
+		static std::wstring GetUserDataPath()
+		{
+			TCHAR szDataPath[_MAX_PATH + 1];
+
+			if (FAILED(::SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA | CSIDL_FLAG_CREATE, NULL, 0, szDataPath)))
+				return GetApplicationPath();
+
+			std::wstring strResult(szDataPath);
+			strResult.append(L"\\ListeningNowTracker");
+
+			if (!::CreateDirectory(strResult.c_str(), NULL) && ::GetLastError() != ERROR_ALREADY_EXISTS)
+				return GetApplicationPath();
+
+			return strResult;
+		}
+
 		int ReadInteger(const TCHAR* szSection, const TCHAR* szKey, int iDefaultValue = 0)
 		{
 			return ::GetPrivateProfileInt(szSection, szKey, iDefaultValue, m_strFileName.c_str()); 
 		}
 
+		// Read a list of values separated by delimiter char (for example "c:\\music;d:\\mp3"). Empty values are skipped.
+		std::vector<std::wstring> ReadStringList(const TCHAR* szSection, const TCHAR* szKey, TCHAR chDelimiter = ';')
+		{
+			std::vector<std::wstring> arrResult;
+			std::wstring strValue = ReadString(szSection, szKey, L"");
+			size_t iStart = 0;
+
+			while (iStart <= strValue.size())
+			{
+				size_t iEnd = strValue.find(chDelimiter, iStart);
+				if (iEnd == std::wstring::npos) iEnd = strValue.size();
+
+				if (iEnd > iStart) arrResult.push_back(strValue.substr(iStart, iEnd - iStart));
+				iStart = iEnd + 1;
+			}
+
+			return arrResult;
+		}
+
+		// Read values of all "key=value" lines with the given key (the same key may be repeated in the section)
+		std::vector<std::wstring> ReadSectionValues(const TCHAR* szSection, const TCHAR* szKey)
+		{
+			std::vector<std::wstring> arrResult;
+			std::vector<TCHAR> arrBuffer(32767);
+			size_t iKeyLen = _tcslen(szKey);
+
+			DWORD dwResultLen = ::GetPrivateProfileSection(szSection, &arrBuffer[0], (DWORD) arrBuffer.size(), m_strFileName.c_str());
+
+			// The section is a list of null-terminated "key=value" lines
+			for (const TCHAR* szLine = &arrBuffer[0]; szLine < &arrBuffer[0] + dwResultLen && *szLine != '\0'; szLine += _tcslen(szLine) + 1)
+			{
+				if (_tcsnicmp(szLine, szKey, iKeyLen) != 0) continue;
+
+				const TCHAR* szValue = szLine + iKeyLen;
+				while (*szValue == ' ' || *szValue == '\t') szValue++;
+				if (*szValue == '=') arrResult.push_back(std::wstring(szValue + 1));
+			}
+
+			return arrResult;
+		}
+
 		std::wstring ReadString(const TCHAR* szSection, const TCHAR* szKey, const TCHAR* szDefaultValue)
 		{
 			TCHAR szResult[255];
@@ -0,0 +1,499 @@
+#ifndef __CMUSICLIBRARYINDEX_H__
+#define __CMUSICLIBRARYINDEX_H__
+
+#include <string>
+#include <vector>
+
+#include "CThread.h"
+#include "CTagReader.h"
+#include "CTrackEvent.h"
+
+/*
+ * Tag index of the local music library. "Now playing" events have only title, artist and album
+ * texts. The index adds genre, year, track number and duration of the track if the same track
+ * (artist + title) is found in local music folders.
+ *
+ * The index is built by scanning the music folders with parallel worker threads and saved to a
+ * compact binary file (fixed size records). Next scan is incremental: files with the same
+ * modification time as in the previous index are not read again.
+ *
+ * Lookups use a hash table keyed by normalized "artist + title" hash, so enriching an event is
+ * an O(1) operation. A rescan builds a new index in the background and swaps it in at the end.
+*/
+
+class CMusicLibraryIndex
+{
+  public:
+	enum { MAX_SCAN_THREADS = 16 };
+
+	// One file in the index. Fixed size record (written to the index file as such)
+	struct CRecord
+	{
+		ULONGLONG ullTrackKey;		// Hash of normalized artist and title (0 = File has no usable tags)
+		ULONGLONG ullPathKey;		// Hash of normalized file path
+		ULONGLONG ullModifiedTime;	// Last modification time of the file (FILETIME)
+		DWORD     dwDurationMS;
+		WORD      wYear;
+		WORD      wTrackNumber;
+		WORD      wGenreID;			// Index to the genre name table (NO_GENRE = Unknown)
+		WORD      wReserved;
+		DWORD     dwReserved;
+	};
+
+	// Results of the latest scan (reported in the debugger output)
+	struct CScanStats
+	{
+		DWORD dwFileCount;		// Music files found
+		DWORD dwParsedCount;	// Files read because they were new or modified
+		DWORD dwElapsedMS;
+		DWORD dwIndexBytes;		// Size of the saved index file
+	};
+
+  protected:
+	enum { FILE_MAGIC = 0x5849544C /* "LTIX" */, FILE_VERSION = 1, NO_GENRE = 0xFFFF };
+
+	// Immutable snapshot of the index. Rescan builds a new snapshot and swaps it in.
+	class CIndexData
+	{
+	  public:
+		std::vector<CRecord>      m_arrRecords;
+		std::vector<std::wstring> m_arrGenres;
+		std::vector<DWORD>        m_arrTrackSlots;	// Open addressing hash table of record index + 1 (0 = empty slot)
+	};
+
+	// File found by the folder scan
+	struct CScanItem
+	{
+		std::wstring strPath;
+		ULONGLONG    ullModifiedTime;
+		ULONGLONG    ullPathKey;
+	};
+
+	// Shared state of the scan worker threads. Workers pick the next file with an interlocked counter
+	// and write the result to their own slot of the result array, so no locking is needed except for
+	// the genre name table.
+	struct CScanJob
+	{
+		const std::vector<CScanItem>* pItems;
+		const CIndexData*             pOldData;
+		std::vector<DWORD>            arrOldPathSlots;	// Hash table of the old records by path key
+
+		std::vector<CRecord>          arrResults;
+		std::vector<std::wstring>     arrGenres;
+		CCriticalSection              objGenresCS;
+
+		volatile LONG                 lNextItem;
+		volatile LONG                 lParsedCount;
+		volatile LONG                 lCancel;
+	};
+
+	CCriticalSection m_objCS;		// Protects m_pData pointer (lookups vs. swap after a rescan)
+	CIndexData*      m_pData;
+
+  public:
+	CMusicLibraryIndex()
+	{
+		m_pData = NULL;
+	}
+
+	~CMusicLibraryIndex()
+	{
+		delete m_pData;
+	}
+
+	//
+	// Add library metadata (genre, year, track number and duration) to the event. Returns false
+	// if the track was not found in the index. Called in the event path, so this must stay cheap.
+	//
+	bool Enrich(CTrackEvent& objEvent)
+	{
+		bool bFound = false;
+
+		if (objEvent.m_szTitle[0] == L'\0') return false;
+		ULONGLONG ullTrackKey = CTrackEvent::MakeTrackKey(objEvent.m_szArtist, objEvent.m_szTitle);
+
+		m_objCS.Enter();
+		if (m_pData != NULL)
+		{
+			const CRecord* pRecord = FindRecord(m_pData->m_arrRecords, m_pData->m_arrTrackSlots, &CRecord::ullTrackKey, ullTrackKey);
+			if (pRecord != NULL)
+			{
+				objEvent.m_dwDurationMS = pRecord->dwDurationMS;
+				objEvent.m_wYear        = pRecord->wYear;
+				objEvent.m_wTrackNumber = pRecord->wTrackNumber;
+
+				if (pRecord->wGenreID < m_pData->m_arrGenres.size())
+					wcsncpy_s(objEvent.m_szGenre, m_pData->m_arrGenres[pRecord->wGenreID].c_str(), _TRUNCATE);
+
+				bFound = true;
+			}
+		}
+		m_objCS.Leave();
+
+		return bFound;
+	}
+
+	// Load the index saved by the previous scan. Returns false if the file is missing or not valid.
+	bool Load(const std::wstring& strFileName)
+	{
+		std::vector<BYTE> arrFile;
+		if (!ReadWholeFile(strFileName, arrFile) || arrFile.size() < 5 * sizeof(DWORD)) return false;
+
+		const DWORD* pHeader = (const DWORD*) &arrFile[0];
+		if (pHeader[0] != FILE_MAGIC || pHeader[1] != FILE_VERSION || pHeader[2] != sizeof(CRecord)) return false;
+
+		DWORD  dwRecordCount = pHeader[3];
+		DWORD  dwGenreCount  = pHeader[4];
+		size_t iPos = 5 * sizeof(DWORD);
+
+		CIndexData* pData = new CIndexData();
+
+		for (DWORD idx = 0; idx < dwGenreCount; idx++)
+		{
+			WORD wLen;
+			if (iPos + sizeof(WORD) > arrFile.size()) break;
+			memcpy(&wLen, &arrFile[iPos], sizeof(WORD));
+			iPos += sizeof(WORD);
+
+			if (iPos + wLen * sizeof(WCHAR) > arrFile.size()) break;
+			pData->m_arrGenres.push_back(std::wstring((const WCHAR*) &arrFile[iPos], wLen));
+			iPos += wLen * sizeof(WCHAR);
+		}
+
+		// Record count is checked against the rest of the file before the multiplication (may overflow)
+		if (pData->m_arrGenres.size() != dwGenreCount || dwRecordCount > (arrFile.size() - iPos) / sizeof(CRecord) ||
+			iPos + (size_t) dwRecordCount * sizeof(CRecord) != arrFile.size())
+		{
+			delete pData;
+			return false;
+		}
+
+		pData->m_arrRecords.resize(dwRecordCount);
+		if (dwRecordCount > 0) memcpy(&pData->m_arrRecords[0], &arrFile[iPos], dwRecordCount * sizeof(CRecord));
+
+		BuildSlots(pData->m_arrRecords, &CRecord::ullTrackKey, pData->m_arrTrackSlots);
+		SwapData(pData);
+		return true;
+	}
+
+	//
+	// Scan the music folders (incremental update of the current index), save the new index and take
+	// it into use. Runs in the calling thread plus iThreadCount worker threads. hStopEvent cancels the scan.
+	//
+	bool Rebuild(const std::vector<std::wstring>& arrFolders, int iThreadCount, const std::wstring& strFileName, HANDLE hStopEvent, CScanStats& objStats)
+	{
+		std::vector<CScanItem> arrItems;
+		DWORD dwStartTimeMS = ::GetTickCount();
+
+		ZeroMemory(&objStats, sizeof(objStats));
+
+		for (size_t idx = 0; idx < arrFolders.size(); idx++)
+			if (!CollectFiles(arrFolders[idx], arrItems, hStopEvent)) return false;
+
+		// Only the scan thread replaces m_pData, so the old snapshot can be read without locking here
+		CScanJob objJob;
+		objJob.pItems       = &arrItems;
+		objJob.pOldData     = m_pData;
+		objJob.lNextItem    = 0;
+		objJob.lParsedCount = 0;
+		objJob.lCancel      = 0;
+		objJob.arrResults.resize(arrItems.size());
+
+		if (m_pData != NULL)
+		{
+			// Keep the old genre IDs valid, so unchanged records can be copied as such
+			objJob.arrGenres = m_pData->m_arrGenres;
+			BuildSlots(m_pData->m_arrRecords, &CRecord::ullPathKey, objJob.arrOldPathSlots);
+		}
+
+		if (iThreadCount < 1) iThreadCount = 1;
+		if (iThreadCount > MAX_SCAN_THREADS) iThreadCount = MAX_SCAN_THREADS;
+
+		CThread arrWorkers[MAX_SCAN_THREADS];
+		HANDLE  arrHandles[MAX_SCAN_THREADS + 1];
+		DWORD   dwHandleCount = 0;
+
+		for (int idx = 0; idx < iThreadCount; idx++)
+		{
+			arrWorkers[idx].Attach(ThreadScanWorker);
+			arrWorkers[idx].Start(&objJob);
+			if (arrWorkers[idx].GetHandle() != NULL) arrHandles[dwHandleCount++] = arrWorkers[idx].GetHandle();
+		}
+
+		if (dwHandleCount == 0) return false;
+
+		// Wait for all workers (or the stop signal, then cancel the workers and wait them to quit)
+		arrHandles[dwHandleCount] = hStopEvent;
+		DWORD dwResult = ::WaitForMultipleObjects(dwHandleCount + (hStopEvent != NULL ? 1 : 0), arrHandles, FALSE, INFINITE);
+
+		while (dwResult != WAIT_FAILED && dwResult - WAIT_OBJECT_0 < dwHandleCount)
+		{
+			// One of the workers completed. Wait the rest of them.
+			arrHandles[dwResult - WAIT_OBJECT_0] = arrHandles[--dwHandleCount];
+			arrHandles[dwHandleCount] = hStopEvent;
+			if (dwHandleCount == 0) break;
+
+			dwResult = ::WaitForMultipleObjects(dwHandleCount + (hStopEvent != NULL ? 1 : 0), arrHandles, FALSE, INFINITE);
+		}
+
+		if (dwHandleCount > 0)
+		{
+			::InterlockedExchange(&objJob.lCancel, 1);
+			::WaitForMultipleObjects(dwHandleCount, arrHandles, TRUE, INFINITE);
+			return false;
+		}
+
+		// New index snapshot
+		CIndexData* pData = new CIndexData();
+		pData->m_arrRecords.swap(objJob.arrResults);
+		pData->m_arrGenres.swap(objJob.arrGenres);
+		BuildSlots(pData->m_arrRecords, &CRecord::ullTrackKey, pData->m_arrTrackSlots);
+
+		objStats.dwIndexBytes  = Save(pData, strFileName);
+		objStats.dwFileCount   = (DWORD) arrItems.size();
+		objStats.dwParsedCount = (DWORD) objJob.lParsedCount;
+		objStats.dwElapsedMS   = ::GetTickCount() - dwStartTimeMS;
+
+		SwapData(pData);
+		return true;
+	}
+
+  protected:
+	void SwapData(CIndexData* pNewData)
+	{
+		CIndexData* pOldData;
+
+		m_objCS.Enter();
+		pOldData = m_pData;
+		m_pData = pNewData;
+		m_objCS.Leave();
+
+		delete pOldData;
+	}
+
+	static DWORD SlotOf(ULONGLONG ullKey, size_t iMask)
+	{
+		return (DWORD) ((ullKey ^ (ullKey >> 32)) & iMask);
+	}
+
+	// Build open addressing hash table (power of two size, at most 50% full) of records by the given key field
+	static void BuildSlots(const std::vector<CRecord>& arrRecords, ULONGLONG CRecord::*pKey, std::vector<DWORD>& arrSlots)
+	{
+		size_t iSize = 16;
+		while (iSize < arrRecords.size() * 2) iSize *= 2;
+
+		arrSlots.assign(iSize, 0);
+
+		for (size_t idx = 0; idx < arrRecords.size(); idx++)
+		{
+			ULONGLONG ullKey = arrRecords[idx].*pKey;
+			if (ullKey == 0) continue;
+
+			DWORD dwSlot = SlotOf(ullKey, iSize - 1);
+			while (arrSlots[dwSlot] != 0)
+			{
+				// Duplicate key (same track in several albums etc). The first record wins.
+				if (arrRecords[arrSlots[dwSlot] - 1].*pKey == ullKey) break;
+				dwSlot = (DWORD) ((dwSlot + 1) & (iSize - 1));
+			}
+
+			if (arrSlots[dwSlot] == 0) arrSlots[dwSlot] = (DWORD) idx + 1;
+		}
+	}
+
+	static const CRecord* FindRecord(const std::vector<CRecord>& arrRecords, const std::vector<DWORD>& arrSlots, ULONGLONG CRecord::*pKey, ULONGLONG ullKey)
+	{
+		if (arrSlots.empty() || ullKey == 0) return NULL;
+
+		DWORD dwSlot = SlotOf(ullKey, arrSlots.size() - 1);
+		while (arrSlots[dwSlot] != 0)
+		{
+			const CRecord& objRecord = arrRecords[arrSlots[dwSlot] - 1];
+			if (objRecord.*pKey == ullKey) return &objRecord;
+			dwSlot = (DWORD) ((dwSlot + 1) & (arrSlots.size() - 1));
+		}
+
+		return NULL;
+	}
+
+	static bool IsMusicFile(const WCHAR* szFileName)
+	{
+		const WCHAR* szExt = wcsrchr(szFileName, L'.');
+		if (szExt == NULL) return false;
+
+		return (_wcsicmp(szExt, L".mp3") == 0 || _wcsicmp(szExt, L".flac") == 0 || _wcsicmp(szExt, L".m4a") == 0 || _wcsicmp(szExt, L".mp4") == 0);
+	}
+
+	// Recursive folder scan. Returns false if the scan was cancelled.
+	static bool CollectFiles(const std::wstring& strFolder, std::vector<CScanItem>& arrItems, HANDLE hStopEvent)
+	{
+		WIN32_FIND_DATA objFindData;
+		std::vector<std::wstring> arrSubFolders;
+
+		if (hStopEvent != NULL && ::WaitForSingleObject(hStopEvent, 0) != WAIT_TIMEOUT) return false;
+
+		HANDLE hFind = ::FindFirstFile((strFolder + L"\\*").c_str(), &objFindData);
+		if (hFind == INVALID_HANDLE_VALUE) return true;
+
+		do
+		{
+			if (objFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if (wcscmp(objFindData.cFileName, L".") != 0 && wcscmp(objFindData.cFileName, L"..") != 0)
+					arrSubFolders.push_back(strFolder + L"\\" + objFindData.cFileName);
+			}
+			else if (IsMusicFile(objFindData.cFileName))
+			{
+				CScanItem objItem;
+				objItem.strPath = strFolder + L"\\" + objFindData.cFileName;
+				objItem.ullModifiedTime = ((ULONGLONG) objFindData.ftLastWriteTime.dwHighDateTime << 32) | objFindData.ftLastWriteTime.dwLowDateTime;
+				objItem.ullPathKey = CTrackEvent::HashNormalized(14695981039346656037ULL, objItem.strPath.c_str());
+				arrItems.push_back(objItem);
+			}
+		} while (::FindNextFile(hFind, &objFindData));
+
+		::FindClose(hFind);
+
+		for (size_t idx = 0; idx < arrSubFolders.size(); idx++)
+			if (!CollectFiles(arrSubFolders[idx], arrItems, hStopEvent)) return false;
+
+		return true;
+	}
+
+	static WORD InternGenre(CScanJob& objJob, const WCHAR* szGenre)
+	{
+		WORD wGenreID = NO_GENRE;
+		if (szGenre[0] == L'\0') return NO_GENRE;
+
+		objJob.objGenresCS.Enter();
+		for (size_t idx = 0; idx < objJob.arrGenres.size(); idx++)
+		{
+			if (_wcsicmp(objJob.arrGenres[idx].c_str(), szGenre) == 0)
+			{
+				wGenreID = (WORD) idx;
+				break;
+			}
+		}
+
+		if (wGenreID == NO_GENRE && objJob.arrGenres.size() < NO_GENRE)
+		{
+			wGenreID = (WORD) objJob.arrGenres.size();
+			objJob.arrGenres.push_back(szGenre);
+		}
+		objJob.objGenresCS.Leave();
+
+		return wGenreID;
+	}
+
+	static void ScanItem(CScanJob& objJob, size_t iItem, CTrackTags& objTags)
+	{
+		const CScanItem& objItem = (*objJob.pItems)[iItem];
+		CRecord& objRecord = objJob.arrResults[iItem];
+
+		// Unchanged file. Use the record of the previous index
+		if (objJob.pOldData != NULL)
+		{
+			const CRecord* pOldRecord = FindRecord(objJob.pOldData->m_arrRecords, objJob.arrOldPathSlots, &CRecord::ullPathKey, objItem.ullPathKey);
+			if (pOldRecord != NULL && pOldRecord->ullModifiedTime == objItem.ullModifiedTime)
+			{
+				objRecord = *pOldRecord;
+				return;
+			}
+		}
+
+		ZeroMemory(&objRecord, sizeof(objRecord));
+		objRecord.ullPathKey      = objItem.ullPathKey;
+		objRecord.ullModifiedTime = objItem.ullModifiedTime;
+		objRecord.wGenreID        = NO_GENRE;
+
+		::InterlockedIncrement(&objJob.lParsedCount);
+
+		// Files without tags are kept in the index also (track key 0), so those are not read again next time
+		if (CTagReader::ReadTags(objItem.strPath, objTags) && objTags.m_szTitle[0] != L'\0')
+		{
+			objRecord.ullTrackKey  = CTrackEvent::MakeTrackKey(objTags.m_szArtist, objTags.m_szTitle);
+			objRecord.dwDurationMS = objTags.m_dwDurationMS;
+			objRecord.wYear        = objTags.m_wYear;
+			objRecord.wTrackNumber = objTags.m_wTrackNumber;
+			objRecord.wGenreID     = InternGenre(objJob, objTags.m_szGenre);
+		}
+	}
+
+	// Worker thread of the parallel scan (see CThread)
+	static unsigned __stdcall ThreadScanWorker(void* pArg)
+	{
+		CThreadContext* pThreadCtx = (CThreadContext*) pArg;
+		CScanJob* pJob = (CScanJob*) pThreadCtx->m_pUserData;
+		CTrackTags objTags;
+
+		LONG lItemCount = (LONG) pJob->pItems->size();
+		for (;;)
+		{
+			LONG lItem = ::InterlockedIncrement(&pJob->lNextItem) - 1;
+			if (lItem >= lItemCount || pJob->lCancel) break;
+
+			ScanItem(*pJob, (size_t) lItem, objTags);
+		}
+
+		_endthreadex(0);
+		return 0;
+	}
+
+	// Write the index to a temp file and replace the old index file with it. Returns the size of the file (0 = failed)
+	static DWORD Save(const CIndexData* pData, const std::wstring& strFileName)
+	{
+		std::vector<BYTE> arrFile;
+		DWORD arrHeader[5] = { FILE_MAGIC, FILE_VERSION, sizeof(CRecord), (DWORD) pData->m_arrRecords.size(), (DWORD) pData->m_arrGenres.size() };
+
+		arrFile.insert(arrFile.end(), (const BYTE*) arrHeader, (const BYTE*) (arrHeader + 5));
+
+		for (size_t idx = 0; idx < pData->m_arrGenres.size(); idx++)
+		{
+			const std::wstring& strGenre = pData->m_arrGenres[idx];
+			WORD wLen = (WORD) (strGenre.size() < 0xFFFF ? strGenre.size() : 0xFFFF);
+
+			arrFile.insert(arrFile.end(), (const BYTE*) &wLen, (const BYTE*) (&wLen + 1));
+			if (wLen > 0) arrFile.insert(arrFile.end(), (const BYTE*) strGenre.c_str(), (const BYTE*) (strGenre.c_str() + wLen));
+		}
+
+		if (!pData->m_arrRecords.empty())
+			arrFile.insert(arrFile.end(), (const BYTE*) &pData->m_arrRecords[0], (const BYTE*) (&pData->m_arrRecords[0] + pData->m_arrRecords.size()));
+
+		std::wstring strTempFileName = strFileName + L".tmp";
+		HANDLE hFile = ::CreateFile(strTempFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) return 0;
+
+		DWORD dwWritten = 0;
+		BOOL  bSucceeded = ::WriteFile(hFile, &arrFile[0], (DWORD) arrFile.size(), &dwWritten, NULL);
+		::CloseHandle(hFile);
+
+		if (!bSucceeded || dwWritten != arrFile.size() || !::MoveFileEx(strTempFileName.c_str(), strFileName.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			::DeleteFile(strTempFileName.c_str());
+			return 0;
+		}
+
+		return dwWritten;
+	}
+
+	static bool ReadWholeFile(const std::wstring& strFileName, std::vector<BYTE>& arrFile)
+	{
+		HANDLE hFile = ::CreateFile(strFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) return false;
+
+		DWORD dwFileSize = ::GetFileSize(hFile, NULL);
+		DWORD dwRead = 0;
+		bool  bSucceeded = false;
+
+		if (dwFileSize != INVALID_FILE_SIZE && dwFileSize > 0)
+		{
+			arrFile.resize(dwFileSize);
+			bSucceeded = (::ReadFile(hFile, &arrFile[0], dwFileSize, &dwRead, NULL) && dwRead == dwFileSize);
+		}
+
+		::CloseHandle(hFile);
+		return bSucceeded;
+	}
+};
+
+#endif //__CMUSICLIBRARYINDEX_H__
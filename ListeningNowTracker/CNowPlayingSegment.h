@@ -0,0 +1,172 @@
+#ifndef __CNOWPLAYINGSEGMENT_H__
+#define __CNOWPLAYINGSEGMENT_H__
+
+#include "NowPlayingReader.h"
+#include "CThread.h"
+#include "CEventRecord.h"
+
+/*
+ * Writer of the "now playing" shared memory segment (see NowPlayingReader.h for the layout and
+ * the reader side). The segment is a named file mapping backed by the paging file, so publishing
+ * a track is just a memory copy between two sequence number updates.
+ *
+ * The sequence lock allows only one writer at a time. Main thread publishes the events and marks
+ * the track stopped (also when the watchdog deadline expires). The writes are still serialized with
+ * a critical section, so a write from another thread can't break the lock. Readers never take the lock.
+ *
+ * A named section keeps its size while any process has it open. If a reader of an older or newer
+ * tracker version still holds the segment, Open fails and IsIncompatible() tells why (the caller
+ * reports it). Writing our layout over a section of another layout would corrupt that reader.
+*/
+
+class CNowPlayingSegment
+{
+  protected:
+	HANDLE             m_hMapping;
+	CNowPlayingLayout* m_pLayout;
+	DWORD              m_dwEventCount;
+	bool               m_bIncompatible;
+	CCriticalSection   m_objWriteCS;
+
+  public:
+	CNowPlayingSegment()
+	{
+		m_hMapping = NULL;
+		m_pLayout = NULL;
+		m_dwEventCount = 0;
+		m_bIncompatible = false;
+	}
+
+	~CNowPlayingSegment()
+	{
+		Close();
+	}
+
+	bool IsOpen() const { return m_pLayout != NULL; }
+
+	// Latest Open failed because the existing section is too small or has another layout version
+	bool IsIncompatible() const { return m_bIncompatible; }
+
+	// Create the segment (or re-use the segment of the previous instance if a reader still has it open)
+	bool Open(const WCHAR* szName = NOWPLAYING_SEGMENT_NAME)
+	{
+		MEMORY_BASIC_INFORMATION objInfo;
+
+		Close();
+		m_bIncompatible = false;
+
+		m_hMapping = ::CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(CNowPlayingLayout), szName);
+		if (m_hMapping == NULL) return false;
+
+		bool bExisting = (::GetLastError() == ERROR_ALREADY_EXISTS);
+
+		// Whole section is mapped, so an existing smaller section doesn't fail the mapping but the size check
+		m_pLayout = (CNowPlayingLayout*) ::MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, 0);
+		if (m_pLayout == NULL || ::VirtualQuery(m_pLayout, &objInfo, sizeof(objInfo)) == 0)
+		{
+			Close();
+			return false;
+		}
+
+		if (objInfo.RegionSize < sizeof(CNowPlayingLayout) || (bExisting && m_pLayout->dwMagic == NOWPLAYING_MAGIC && m_pLayout->dwVersion != NOWPLAYING_VERSION))
+		{
+			Close();
+			m_bIncompatible = true;
+			return false;
+		}
+
+		m_objWriteCS.Enter();
+		LONG lSequence = BeginWrite();
+
+		m_pLayout->dwMagic           = NOWPLAYING_MAGIC;
+		m_pLayout->dwVersion         = NOWPLAYING_VERSION;
+		m_pLayout->dwSize            = sizeof(CNowPlayingLayout);
+		m_pLayout->dwWriterProcessID = ::GetCurrentProcessId();
+		ZeroMemory(&m_pLayout->objData, sizeof(m_pLayout->objData));
+		m_pLayout->dwRecordSize = 0;
+
+		EndWrite(lSequence);
+		m_objWriteCS.Leave();
+
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_pLayout != NULL) ::UnmapViewOfFile(m_pLayout);
+		if (m_hMapping != NULL) ::CloseHandle(m_hMapping);
+
+		m_pLayout = NULL;
+		m_hMapping = NULL;
+	}
+
+	// Publish the track. pRecord is the encoded event (NULL = The segment has no record until the next event).
+	void Publish(const CTrackEvent& objEvent, const WCHAR* szText, const CEventRecord* pRecord)
+	{
+		if (m_pLayout == NULL) return;
+
+		CNowPlayingSnapshot& objData = m_pLayout->objData;
+		FILETIME ftNow;
+		::GetSystemTimeAsFileTime(&ftNow);
+
+		m_objWriteCS.Enter();
+		LONG lSequence = BeginWrite();
+
+		objData.dwStatus     = (objEvent.IsStopped() ? NOWPLAYING_STATUS_STOPPED : NOWPLAYING_STATUS_PLAYING);
+		objData.dwEventCount = ++m_dwEventCount;
+		objData.ullEventTime = ((ULONGLONG) ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime;
+		objData.dwDurationMS = objEvent.m_dwDurationMS;
+		objData.wYear        = objEvent.m_wYear;
+		objData.wTrackNumber = objEvent.m_wTrackNumber;
+
+		wcsncpy_s(objData.szTitle,  objEvent.m_szTitle,  _TRUNCATE);
+		wcsncpy_s(objData.szArtist, objEvent.m_szArtist, _TRUNCATE);
+		wcsncpy_s(objData.szAlbum,  objEvent.m_szAlbum,  _TRUNCATE);
+		wcsncpy_s(objData.szGenre,  objEvent.m_szGenre,  _TRUNCATE);
+		wcsncpy_s(objData.szText,   szText,              _TRUNCATE);
+
+		m_pLayout->dwRecordSize = (pRecord != NULL ? pRecord->GetSize() : 0);
+		if (pRecord != NULL) memcpy(m_pLayout->arrRecord, pRecord->GetData(), pRecord->GetSize());
+
+		EndWrite(lSequence);
+		m_objWriteCS.Leave();
+	}
+
+	// Mark the current track stopped (watchdog timeout, app exit). Track texts are left as they were.
+	void SetStopped()
+	{
+		if (m_pLayout == NULL) return;
+
+		m_objWriteCS.Enter();
+		if (m_pLayout->objData.dwStatus != NOWPLAYING_STATUS_STOPPED)
+		{
+			LONG lSequence = BeginWrite();
+			m_pLayout->objData.dwStatus = NOWPLAYING_STATUS_STOPPED;
+			m_pLayout->objData.dwEventCount = ++m_dwEventCount;
+			m_pLayout->objData.szText[0] = L'\0';
+
+			// Record of the track is left as it was, but flagged stopped
+			if (m_pLayout->dwRecordSize >= sizeof(CEventRecordHeader))
+				((CEventRecordHeader*) m_pLayout->arrRecord)->wFlags |= EVENTRECORD_FLAG_STOPPED;
+
+			EndWrite(lSequence);
+		}
+		m_objWriteCS.Leave();
+	}
+
+  protected:
+	// Make the sequence number odd (readers retry until EndWrite). Interlocked calls are full memory barriers.
+	LONG BeginWrite()
+	{
+		LONG lSequence = m_pLayout->lSequence | 1;
+		::InterlockedExchange(&m_pLayout->lSequence, lSequence);
+		return lSequence;
+	}
+
+	void EndWrite(LONG lSequence)
+	{
+		::InterlockedExchange(&m_pLayout->lSequence, lSequence + 1);
+	}
+};
+
+#endif //__CNOWPLAYINGSEGMENT_H__
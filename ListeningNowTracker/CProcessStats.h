@@ -0,0 +1,107 @@
+#ifndef __CPROCESSSTATS_H__
+#define __CPROCESSSTATS_H__
+
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+/*
+ * Snapshot of the resource usage of this process (working set, private bytes, handles).
+ * Used to report the footprint of the app in "/trace" mode and to check it against the
+ * budget of the minimal build profile (see BuildProfile.h). "/soak" mode samples also the
+ * heaps (see SampleHeaps) to find leaks which are too small to show up in private bytes.
+*/
+
+class CProcessStats
+{
+  public:
+	SIZE_T m_iWorkingSetKB;
+	SIZE_T m_iPeakWorkingSetKB;
+	SIZE_T m_iPrivateBytesKB;
+	DWORD  m_dwHandleCount;
+	DWORD  m_dwGdiObjectCount;
+	DWORD  m_dwUserObjectCount;
+
+	// SampleHeaps only
+	SIZE_T m_iHeapUsedKB;
+	DWORD  m_dwHeapBlockCount;
+
+  public:
+	CProcessStats()
+	{
+		m_iWorkingSetKB = m_iPeakWorkingSetKB = m_iPrivateBytesKB = m_iHeapUsedKB = 0;
+		m_dwHandleCount = m_dwGdiObjectCount = m_dwUserObjectCount = m_dwHeapBlockCount = 0;
+	}
+
+	// Take a new snapshot of the current process. Returns false if the counters are not available.
+	bool Sample()
+	{
+		PROCESS_MEMORY_COUNTERS_EX objCounters;
+		ZeroMemory(&objCounters, sizeof(objCounters));
+		objCounters.cb = sizeof(objCounters);
+
+		if (!::GetProcessMemoryInfo(::GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*) &objCounters, sizeof(objCounters)))
+			return false;
+
+		m_iWorkingSetKB     = objCounters.WorkingSetSize / 1024;
+		m_iPeakWorkingSetKB = objCounters.PeakWorkingSetSize / 1024;
+		m_iPrivateBytesKB   = objCounters.PrivateUsage / 1024;
+
+		if (!::GetProcessHandleCount(::GetCurrentProcess(), &m_dwHandleCount)) m_dwHandleCount = 0;
+
+		// Tray icon updates leak icons and menus as GDI/USER objects, not as kernel handles
+		m_dwGdiObjectCount  = ::GetGuiResources(::GetCurrentProcess(), GR_GDIOBJECTS);
+		m_dwUserObjectCount = ::GetGuiResources(::GetCurrentProcess(), GR_USEROBJECTS);
+
+		return true;
+	}
+
+	// Walk all heaps of the process and count the allocated blocks. Takes a few milliseconds and locks
+	// the heaps meanwhile, so this is not done in normal operation.
+	void SampleHeaps()
+	{
+		HANDLE arrHeaps[64];
+		DWORD dwHeapCount = ::GetProcessHeaps(64, arrHeaps);
+		SIZE_T iUsedBytes = 0;
+
+		m_dwHeapBlockCount = 0;
+		if (dwHeapCount > 64) dwHeapCount = 64;
+
+		for (DWORD idx = 0; idx < dwHeapCount; idx++)
+		{
+			PROCESS_HEAP_ENTRY objEntry;
+			objEntry.lpData = NULL;
+
+			if (!::HeapLock(arrHeaps[idx])) continue;
+			while (::HeapWalk(arrHeaps[idx], &objEntry))
+			{
+				if ((objEntry.wFlags & PROCESS_HEAP_ENTRY_BUSY) == 0) continue;
+				iUsedBytes += objEntry.cbData;
+				m_dwHeapBlockCount++;
+			}
+			::HeapUnlock(arrHeaps[idx]);
+		}
+
+		m_iHeapUsedKB = iUsedBytes / 1024;
+	}
+
+	// Budget values of zero are not checked
+	bool IsWithinBudget(SIZE_T iWorkingSetBudgetKB, SIZE_T iPrivateBytesBudgetKB) const
+	{
+		if (iWorkingSetBudgetKB   > 0 && m_iPeakWorkingSetKB > iWorkingSetBudgetKB) return false;
+		if (iPrivateBytesBudgetKB > 0 && m_iPrivateBytesKB > iPrivateBytesBudgetKB) return false;
+		return true;
+	}
+
+	std::wstring Format() const
+	{
+		WCHAR szText[160];
+		_snwprintf_s(szText, (sizeof(szText) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+			L"WorkingSet=%uKB PeakWorkingSet=%uKB PrivateBytes=%uKB Handles=%u GdiObjects=%u UserObjects=%u",
+			(unsigned) m_iWorkingSetKB, (unsigned) m_iPeakWorkingSetKB, (unsigned) m_iPrivateBytesKB, (unsigned) m_dwHandleCount,
+			(unsigned) m_dwGdiObjectCount, (unsigned) m_dwUserObjectCount);
+		return std::wstring(szText);
+	}
+};
+
+#endif //__CPROCESSSTATS_H__
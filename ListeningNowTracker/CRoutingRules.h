@@ -0,0 +1,582 @@
+#ifndef __CROUTINGRULES_H__
+#define __CROUTINGRULES_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "CTrackEvent.h"
+
+/*
+ * Routing rules decide per sink whether a track is published now, after a delay or not at all.
+ * Rules are defined in INI file [ROUTING] section
+ *
+ *   Rule=skype delay 20									Publish to Skype only after 20 secs of play
+ *   Rule=all drop if artist in ("Some Podcast", "Another Show")	Never publish these artists
+ *   Rule=all drop if source = "wmplayer.exe"					Ignore Windows Media Player
+ *   Rule=skype,tray publish if genre = "Jazz"					Exception to the rules below
+ *
+ *   Rule=<sinks> <action> [if <condition> [and <condition> ...]]
+ *     sinks     all | tray | skype | shm | broadcast (comma separated list)
+ *     action    publish | drop | delay <secs>
+ *     condition <field> = "text" | <field> != "text" | <field> [not] in ("text", "text", ...)
+ *     field     title | artist | album | genre | format | source (exe name of the sender process)
+ *
+ * The first matching rule of the sink decides. If no rule matches then the track is published.
+ * Text comparisons are case-insensitive.
+ *
+ * Rules are compiled to a flat instruction list per sink. All texts of the rules are interned
+ * (each distinct text gets an atom number), so the event fields are looked up from the atom table
+ * once per event and the rules compare atom numbers only. "in" lists are sorted atom sets. Parsing
+ * has no side effects: the texts are interned only when the whole rule is valid, so an invalid rule
+ * leaves no atoms, sets or used fields behind.
+ *
+ * A run of consecutive rules which all start with "<field> = ..." or "<field> in (...)" of the same
+ * field (the typical "drop these artists" list) is compiled to a switch instruction: a sorted table
+ * of atom -> rule, so only the rules of the event's field value are evaluated. Evaluation cost stays
+ * flat as such lists grow.
+*/
+
+class CRoutingRules
+{
+  public:
+	enum { SINK_TRAY, SINK_SKYPE, SINK_SHARED_MEMORY, SINK_BROADCAST, SINK_COUNT };
+	enum { FIELD_TITLE, FIELD_ARTIST, FIELD_ALBUM, FIELD_GENRE, FIELD_FORMAT, FIELD_SOURCE, FIELD_COUNT };
+	enum EAction { ACTION_PUBLISH, ACTION_DROP, ACTION_DELAY };
+	enum { MAX_DELAY_SECS = 3600 };
+
+	struct CDecision
+	{
+		EAction eAction;
+		DWORD   dwDelaySecs;	// ACTION_DELAY
+	};
+
+	// Results of the latest Compile call (reported in "/trace" mode)
+	struct CCompileStats
+	{
+		DWORD dwRuleCount;
+		DWORD dwInvalidRuleCount;	// Syntax errors (these rules are ignored)
+		DWORD dwInstructionCount;	// All sinks
+		DWORD dwAtomCount;
+	};
+
+  protected:
+	enum { OP_EQUAL, OP_NOT_EQUAL, OP_IN, OP_NOT_IN, OP_DECIDE, OP_SWITCH };
+	enum { NO_ATOM = 0, MIN_SWITCH_RULES = 4 };
+
+	struct CInstruction
+	{
+		BYTE  bOpCode;
+		BYTE  bField;
+		WORD  wAction;			// OP_DECIDE
+		DWORD dwArg;			// Atom, set index, switch table index or delay secs (OP_DECIDE)
+		DWORD dwFailJump;		// Next instruction if the test fails (the first instruction of the next rule)
+	};
+
+	struct CCondition
+	{
+		BYTE  bOpCode;
+		BYTE  bField;
+		DWORD dwArg;						// Atom or set index (see InternRule)
+		std::vector<std::wstring> arrTexts;	// Texts of the condition as parsed
+	};
+
+	// Parsed rule (used only while compiling)
+	struct CRule
+	{
+		DWORD                   dwSinkMask;
+		std::vector<CCondition> arrConditions;
+		CInstruction            objDecide;
+	};
+
+	// Atom -> program position of the rule (without its first condition), sorted by atom and position
+	typedef std::vector<std::pair<DWORD, DWORD> > CSwitchTable;
+
+	// Interned texts (lowercase). Atom 0 is "a text which is not used in any rule".
+	std::vector<std::wstring> m_arrAtoms;
+	std::vector<DWORD>        m_arrAtomHashes;
+	std::vector<DWORD>        m_arrAtomSlots;		// Open addressing hash table of atoms (0 = empty slot)
+	std::map<std::wstring, DWORD> m_mapAtoms;		// Used only while compiling
+
+	std::vector<std::vector<DWORD> > m_arrSets;		// Sorted atom sets of "in" conditions
+	std::vector<CSwitchTable>        m_arrSwitchTables;
+	std::vector<CInstruction>        m_arrPrograms[SINK_COUNT];
+	DWORD                            m_dwUsedFields;	// Bit mask of fields used by the rules
+
+	CCompileStats m_objStats;
+
+  public:
+	CRoutingRules()
+	{
+		m_dwUsedFields = 0;
+		ZeroMemory(&m_objStats, sizeof(m_objStats));
+	}
+
+	const CCompileStats& GetStats() const { return m_objStats; }
+
+	bool UsesField(int iField) const { return (m_dwUsedFields & (1 << iField)) != 0; }
+
+	// Compile the rules (INI file "Rule" values). Invalid rules are ignored. Returns false if there were invalid rules.
+	bool Compile(const std::vector<std::wstring>& arrRuleTexts)
+	{
+		m_arrAtoms.assign(1, std::wstring());
+		m_arrAtomHashes.assign(1, 0);
+		m_mapAtoms.clear();
+		m_arrSets.clear();
+		m_arrSwitchTables.clear();
+		m_dwUsedFields = 0;
+		ZeroMemory(&m_objStats, sizeof(m_objStats));
+
+		std::vector<CRule> arrRules;
+		for (size_t idx = 0; idx < arrRuleTexts.size(); idx++)
+		{
+			CRule objRule;
+			if (ParseRule(arrRuleTexts[idx].c_str(), objRule))
+			{
+				InternRule(objRule);
+				arrRules.push_back(objRule);
+			}
+			else m_objStats.dwInvalidRuleCount++;
+		}
+		m_objStats.dwRuleCount = (DWORD) arrRules.size();
+
+		for (int iSink = 0; iSink < SINK_COUNT; iSink++) BuildProgram(iSink, arrRules);
+
+		BuildAtomSlots();
+		m_mapAtoms.clear();
+
+		for (int iSink = 0; iSink < SINK_COUNT; iSink++) m_objStats.dwInstructionCount += (DWORD) m_arrPrograms[iSink].size();
+		m_objStats.dwAtomCount = (DWORD) m_arrAtoms.size() - 1;
+
+		return (m_objStats.dwInvalidRuleCount == 0);
+	}
+
+	// Decide the action of each sink for the event
+	void Evaluate(const CTrackEvent& objEvent, CDecision arrDecisions[SINK_COUNT]) const
+	{
+		DWORD arrFieldAtoms[FIELD_COUNT];
+
+		// Each field is looked up once, the rules compare atom numbers only
+		for (int iField = 0; iField < FIELD_COUNT; iField++)
+			arrFieldAtoms[iField] = (UsesField(iField) ? FindAtom(GetField(objEvent, iField)) : (DWORD) NO_ATOM);
+
+		for (int iSink = 0; iSink < SINK_COUNT; iSink++)
+			RunProgram(m_arrPrograms[iSink], arrFieldAtoms, arrDecisions[iSink]);
+	}
+
+  protected:
+	static const WCHAR* GetField(const CTrackEvent& objEvent, int iField)
+	{
+		switch (iField)
+		{
+			case FIELD_TITLE:  return objEvent.m_szTitle;
+			case FIELD_ARTIST: return objEvent.m_szArtist;
+			case FIELD_ALBUM:  return objEvent.m_szAlbum;
+			case FIELD_GENRE:  return objEvent.m_szGenre;
+			case FIELD_FORMAT: return objEvent.m_szFormat;
+			default:           return objEvent.m_szSource;
+		}
+	}
+
+	void RunProgram(const std::vector<CInstruction>& arrProgram, const DWORD arrFieldAtoms[FIELD_COUNT], CDecision& objDecision) const
+	{
+		size_t iPos = 0;
+
+		while (iPos < arrProgram.size())
+		{
+			const CInstruction& objInstr = arrProgram[iPos];
+
+			if (objInstr.bOpCode != OP_SWITCH)
+			{
+				if (RunRule(arrProgram, iPos, arrFieldAtoms, objDecision)) return;
+				continue;
+			}
+
+			// Only the rules of the field value can match. Candidates are in rule order, so the first match wins as usual.
+			DWORD dwAtom = arrFieldAtoms[objInstr.bField];
+			if (dwAtom != NO_ATOM)
+			{
+				const CSwitchTable& arrTable = m_arrSwitchTables[objInstr.dwArg];
+				CSwitchTable::const_iterator it = std::lower_bound(arrTable.begin(), arrTable.end(), std::make_pair(dwAtom, (DWORD) 0));
+
+				for (; it != arrTable.end() && it->first == dwAtom; ++it)
+				{
+					size_t iRulePos = it->second;
+					if (RunRule(arrProgram, iRulePos, arrFieldAtoms, objDecision)) return;
+				}
+			}
+
+			iPos = objInstr.dwFailJump;
+		}
+
+		objDecision.eAction = ACTION_PUBLISH;
+		objDecision.dwDelaySecs = 0;
+	}
+
+	// Run the rule starting at iPos. Returns true if the rule matched, otherwise iPos is moved to the next rule.
+	bool RunRule(const std::vector<CInstruction>& arrProgram, size_t& iPos, const DWORD arrFieldAtoms[FIELD_COUNT], CDecision& objDecision) const
+	{
+		for (;;)
+		{
+			const CInstruction& objInstr = arrProgram[iPos];
+			bool bPassed;
+
+			switch (objInstr.bOpCode)
+			{
+				case OP_EQUAL:     bPassed = (arrFieldAtoms[objInstr.bField] == objInstr.dwArg); break;
+				case OP_NOT_EQUAL: bPassed = (arrFieldAtoms[objInstr.bField] != objInstr.dwArg); break;
+				case OP_IN:        bPassed = IsInSet(objInstr.dwArg, arrFieldAtoms[objInstr.bField]); break;
+				case OP_NOT_IN:    bPassed = !IsInSet(objInstr.dwArg, arrFieldAtoms[objInstr.bField]); break;
+
+				default:
+					objDecision.eAction = (EAction) objInstr.wAction;
+					objDecision.dwDelaySecs = objInstr.dwArg;
+					return true;
+			}
+
+			if (!bPassed)
+			{
+				iPos = objInstr.dwFailJump;
+				return false;
+			}
+			iPos++;
+		}
+	}
+
+	bool IsInSet(DWORD dwSet, DWORD dwAtom) const
+	{
+		if (dwAtom == NO_ATOM) return false;
+		return std::binary_search(m_arrSets[dwSet].begin(), m_arrSets[dwSet].end(), dwAtom);
+	}
+
+	static WCHAR FoldChar(WCHAR ch)
+	{
+		if (ch < 128) return (ch >= L'A' && ch <= L'Z' ? ch + (L'a' - L'A') : ch);
+		return (WCHAR) towlower(ch);
+	}
+
+	static DWORD HashFolded(const WCHAR* szText)
+	{
+		DWORD dwHash = 2166136261U;
+		for (; *szText != L'\0'; szText++) dwHash = (dwHash ^ FoldChar(*szText)) * 16777619U;
+		return dwHash;
+	}
+
+	// Atom of the text (NO_ATOM if the text is not used in any rule). Doesn't allocate memory.
+	DWORD FindAtom(const WCHAR* szText) const
+	{
+		if (m_arrAtomSlots.empty()) return NO_ATOM;
+
+		DWORD  dwHash = HashFolded(szText);
+		size_t iMask  = m_arrAtomSlots.size() - 1;
+
+		for (size_t iSlot = dwHash & iMask; m_arrAtomSlots[iSlot] != 0; iSlot = (iSlot + 1) & iMask)
+		{
+			DWORD dwAtom = m_arrAtomSlots[iSlot];
+			if (m_arrAtomHashes[dwAtom] != dwHash) continue;
+
+			const WCHAR* szAtom = m_arrAtoms[dwAtom].c_str();
+			const WCHAR* szPos  = szText;
+			while (*szAtom != L'\0' && *szAtom == FoldChar(*szPos)) { szAtom++; szPos++; }
+
+			if (*szAtom == L'\0' && *szPos == L'\0') return dwAtom;
+		}
+
+		return NO_ATOM;
+	}
+
+	DWORD Intern(const std::wstring& strText)
+	{
+		std::wstring strFolded(strText);
+		for (size_t idx = 0; idx < strFolded.size(); idx++) strFolded[idx] = FoldChar(strFolded[idx]);
+
+		std::map<std::wstring, DWORD>::const_iterator it = m_mapAtoms.find(strFolded);
+		if (it != m_mapAtoms.end()) return it->second;
+
+		DWORD dwAtom = (DWORD) m_arrAtoms.size();
+		m_arrAtoms.push_back(strFolded);
+		m_arrAtomHashes.push_back(HashFolded(strFolded.c_str()));
+		m_mapAtoms[strFolded] = dwAtom;
+		return dwAtom;
+	}
+
+	void BuildAtomSlots()
+	{
+		size_t iSize = 16;
+		while (iSize < m_arrAtoms.size() * 2) iSize *= 2;
+
+		m_arrAtomSlots.assign(iSize, 0);
+		for (DWORD dwAtom = 1; dwAtom < m_arrAtoms.size(); dwAtom++)
+		{
+			size_t iSlot = m_arrAtomHashes[dwAtom] & (iSize - 1);
+			while (m_arrAtomSlots[iSlot] != 0) iSlot = (iSlot + 1) & (iSize - 1);
+			m_arrAtomSlots[iSlot] = dwAtom;
+		}
+	}
+
+	//
+	// Tokenizer of the rule text. Tokens are words, quoted texts and "(", ")", ",", "=", "!=".
+	// Returns false at the end of the text.
+	//
+	static bool NextToken(const WCHAR*& szPos, std::wstring& strToken, bool& bQuoted)
+	{
+		while (*szPos == L' ' || *szPos == L'\t') szPos++;
+		if (*szPos == L'\0') return false;
+
+		bQuoted = false;
+		strToken.clear();
+
+		if (*szPos == L'"')
+		{
+			const WCHAR* szEnd = wcschr(szPos + 1, L'"');
+			if (szEnd == NULL) return false;
+
+			strToken.assign(szPos + 1, szEnd - szPos - 1);
+			szPos = szEnd + 1;
+			bQuoted = true;
+		}
+		else if (wcschr(L"(),=", *szPos) != NULL)
+		{
+			strToken = *szPos++;
+		}
+		else if (szPos[0] == L'!' && szPos[1] == L'=')
+		{
+			strToken = L"!=";
+			szPos += 2;
+		}
+		else
+		{
+			while (*szPos != L'\0' && wcschr(L" \t(),=!\"", *szPos) == NULL) strToken += FoldChar(*szPos++);
+		}
+
+		return true;
+	}
+
+	static int FindName(const std::wstring& strName, const WCHAR* const* arrNames, int iCount)
+	{
+		for (int idx = 0; idx < iCount; idx++)
+			if (strName == arrNames[idx]) return idx;
+		return -1;
+	}
+
+	static bool ParseRule(const WCHAR* szText, CRule& objRule)
+	{
+		static const WCHAR* const arrSinkNames[SINK_COUNT] = { L"tray", L"skype", L"shm", L"broadcast" };
+
+		std::wstring strToken;
+		bool  bQuoted;
+		DWORD& dwSinkMask = objRule.dwSinkMask;
+		CInstruction& objDecide = objRule.objDecide;
+		std::vector<CCondition>& arrConditions = objRule.arrConditions;
+
+		dwSinkMask = 0;
+
+		// Sinks
+		do
+		{
+			if (!NextToken(szText, strToken, bQuoted) || bQuoted) return false;
+
+			int iSink = FindName(strToken, arrSinkNames, SINK_COUNT);
+			if (strToken == L"all") dwSinkMask = (1 << SINK_COUNT) - 1;
+			else if (iSink >= 0) dwSinkMask |= (1 << iSink);
+			else return false;
+
+			if (!NextToken(szText, strToken, bQuoted)) return false;
+		} while (strToken == L"," && !bQuoted);
+
+		// Action
+		ZeroMemory(&objDecide, sizeof(objDecide));
+		objDecide.bOpCode = OP_DECIDE;
+
+		if (strToken == L"publish") objDecide.wAction = ACTION_PUBLISH;
+		else if (strToken == L"drop") objDecide.wAction = ACTION_DROP;
+		else if (strToken == L"delay")
+		{
+			if (!NextToken(szText, strToken, bQuoted) || bQuoted) return false;
+
+			int iDelaySecs = _wtoi(strToken.c_str());
+			if (iDelaySecs <= 0 || iDelaySecs > MAX_DELAY_SECS) return false;
+
+			objDecide.wAction = ACTION_DELAY;
+			objDecide.dwArg = (DWORD) iDelaySecs;
+		}
+		else return false;
+
+		// Conditions
+		if (NextToken(szText, strToken, bQuoted))
+		{
+			if (strToken != L"if" || bQuoted) return false;
+
+			bool bMoreTokens;
+			do
+			{
+				CCondition objCondition;
+				if (!ParseCondition(szText, objCondition)) return false;
+				arrConditions.push_back(objCondition);
+
+				bMoreTokens = NextToken(szText, strToken, bQuoted);
+			} while (bMoreTokens && strToken == L"and" && !bQuoted);
+
+			// Something else than "and" after a condition
+			if (bMoreTokens) return false;
+		}
+
+		return true;
+	}
+
+	// Rule can be a part of a switch block (the first condition is "field = text" or "field in (...)")
+	static bool IsSwitchable(const CRule& objRule)
+	{
+		return (!objRule.arrConditions.empty() && (objRule.arrConditions[0].bOpCode == OP_EQUAL || objRule.arrConditions[0].bOpCode == OP_IN));
+	}
+
+	void BuildProgram(int iSink, const std::vector<CRule>& arrAllRules)
+	{
+		std::vector<const CRule*> arrRules;
+		std::vector<CInstruction>& arrProgram = m_arrPrograms[iSink];
+
+		arrProgram.clear();
+		for (size_t idx = 0; idx < arrAllRules.size(); idx++)
+			if (arrAllRules[idx].dwSinkMask & (1 << iSink)) arrRules.push_back(&arrAllRules[idx]);
+
+		size_t iRule = 0;
+		while (iRule < arrRules.size())
+		{
+			// Run of rules starting with a "=" or "in" condition of the same field
+			size_t iBlockEnd = iRule;
+			while (iBlockEnd < arrRules.size() && IsSwitchable(*arrRules[iBlockEnd])
+				&& arrRules[iBlockEnd]->arrConditions[0].bField == arrRules[iRule]->arrConditions[0].bField) iBlockEnd++;
+
+			if (iBlockEnd - iRule < MIN_SWITCH_RULES)
+			{
+				EmitRule(arrProgram, *arrRules[iRule], 0);
+				iRule++;
+				continue;
+			}
+
+			CInstruction objSwitch;
+			objSwitch.bOpCode = OP_SWITCH;
+			objSwitch.bField  = arrRules[iRule]->arrConditions[0].bField;
+			objSwitch.wAction = 0;
+			objSwitch.dwArg   = (DWORD) m_arrSwitchTables.size();
+
+			size_t iSwitchPos = arrProgram.size();
+			arrProgram.push_back(objSwitch);
+			m_arrSwitchTables.push_back(CSwitchTable());
+
+			// The switch replaces the first condition of the rules
+			for (; iRule < iBlockEnd; iRule++)
+			{
+				const CCondition& objFirst = arrRules[iRule]->arrConditions[0];
+				DWORD dwRulePos = EmitRule(arrProgram, *arrRules[iRule], 1);
+				CSwitchTable& arrTable = m_arrSwitchTables.back();
+
+				if (objFirst.bOpCode == OP_EQUAL) arrTable.push_back(std::make_pair(objFirst.dwArg, dwRulePos));
+				else
+				{
+					for (size_t idx = 0; idx < m_arrSets[objFirst.dwArg].size(); idx++)
+						arrTable.push_back(std::make_pair(m_arrSets[objFirst.dwArg][idx], dwRulePos));
+				}
+			}
+
+			std::sort(m_arrSwitchTables.back().begin(), m_arrSwitchTables.back().end());
+			arrProgram[iSwitchPos].dwFailJump = (DWORD) arrProgram.size();
+		}
+	}
+
+	// Append the conditions (starting from iFirstCondition) and the decision of the rule. Returns the position of the rule.
+	static DWORD EmitRule(std::vector<CInstruction>& arrProgram, const CRule& objRule, size_t iFirstCondition)
+	{
+		DWORD dwRulePos  = (DWORD) arrProgram.size();
+		DWORD dwNextRule = (DWORD) (dwRulePos + objRule.arrConditions.size() - iFirstCondition + 1);
+
+		for (size_t idx = iFirstCondition; idx < objRule.arrConditions.size(); idx++)
+		{
+			CInstruction objInstr;
+			objInstr.bOpCode    = objRule.arrConditions[idx].bOpCode;
+			objInstr.bField     = objRule.arrConditions[idx].bField;
+			objInstr.wAction    = 0;
+			objInstr.dwArg      = objRule.arrConditions[idx].dwArg;
+			objInstr.dwFailJump = dwNextRule;
+			arrProgram.push_back(objInstr);
+		}
+
+		arrProgram.push_back(objRule.objDecide);
+		return dwRulePos;
+	}
+
+	static bool ParseCondition(const WCHAR*& szText, CCondition& objCondition)
+	{
+		static const WCHAR* const arrFieldNames[FIELD_COUNT] = { L"title", L"artist", L"album", L"genre", L"format", L"source" };
+
+		std::wstring strToken;
+		bool bQuoted;
+
+		if (!NextToken(szText, strToken, bQuoted) || bQuoted) return false;
+
+		int iField = FindName(strToken, arrFieldNames, FIELD_COUNT);
+		if (iField < 0) return false;
+
+		objCondition.bField = (BYTE) iField;
+		objCondition.dwArg = NO_ATOM;
+
+		if (!NextToken(szText, strToken, bQuoted) || bQuoted) return false;
+
+		if (strToken == L"=" || strToken == L"!=")
+		{
+			objCondition.bOpCode = (strToken == L"=" ? OP_EQUAL : OP_NOT_EQUAL);
+
+			if (!NextToken(szText, strToken, bQuoted) || !bQuoted) return false;
+			objCondition.arrTexts.push_back(strToken);
+			return true;
+		}
+
+		objCondition.bOpCode = OP_IN;
+		if (strToken == L"not")
+		{
+			objCondition.bOpCode = OP_NOT_IN;
+			if (!NextToken(szText, strToken, bQuoted) || bQuoted) return false;
+		}
+
+		if (strToken != L"in") return false;
+		if (!NextToken(szText, strToken, bQuoted) || bQuoted || strToken != L"(") return false;
+
+		do
+		{
+			if (!NextToken(szText, strToken, bQuoted) || !bQuoted) return false;
+			objCondition.arrTexts.push_back(strToken);
+
+			if (!NextToken(szText, strToken, bQuoted) || bQuoted) return false;
+		} while (strToken == L",");
+
+		return (strToken == L")");
+	}
+
+	// Rule was accepted. Intern the texts of its conditions and mark the fields used.
+	void InternRule(CRule& objRule)
+	{
+		for (size_t idx = 0; idx < objRule.arrConditions.size(); idx++)
+		{
+			CCondition& objCondition = objRule.arrConditions[idx];
+			m_dwUsedFields |= (1 << objCondition.bField);
+
+			if (objCondition.bOpCode == OP_EQUAL || objCondition.bOpCode == OP_NOT_EQUAL)
+			{
+				objCondition.dwArg = Intern(objCondition.arrTexts[0]);
+				continue;
+			}
+
+			std::vector<DWORD> arrSet;
+			for (size_t iText = 0; iText < objCondition.arrTexts.size(); iText++) arrSet.push_back(Intern(objCondition.arrTexts[iText]));
+
+			std::sort(arrSet.begin(), arrSet.end());
+			arrSet.erase(std::unique(arrSet.begin(), arrSet.end()), arrSet.end());
+
+			objCondition.dwArg = (DWORD) m_arrSets.size();
+			m_arrSets.push_back(arrSet);
+		}
+	}
+};
+
+#endif //__CROUTINGRULES_H__
@@ -0,0 +1,230 @@
+#ifndef __CSKYPESTUB_H__
+#define __CSKYPESTUB_H__
+
+#include <objbase.h>
+#include <oleauto.h>
+
+#include <string>
+
+/*
+ * Stand-in for the Skype4COM.Skype automation object in "/soak" mode. UpdateSkypeMoodText creates
+ * three COM objects per call (Skype, Client and CurrentUserProfile), so a missing release in that
+ * path leaks a little on every track. The soak test registers CSkypeStubFactory in the process and
+ * UpdateSkypeMoodText creates CLSID_SkypeStub instead of Skype4COM: the synthetic tracks go through
+ * VOLE and COM like real ones, but the mood text of the real Skype is not touched.
+ *
+ * Only the members used by the app are implemented (Client, IsRunning, CurrentUserProfile and
+ * MoodText). Like in Skype4COM, every get of Client and CurrentUserProfile returns a new object.
+ * Live objects are counted, so the soak test can check that all of them were released.
+*/
+
+// {5E1A7C52-6B0D-4F8E-9C3A-2D7B41E0A9F3}
+static const CLSID CLSID_SkypeStub = { 0x5e1a7c52, 0x6b0d, 0x4f8e, { 0x9c, 0x3a, 0x2d, 0x7b, 0x41, 0xe0, 0xa9, 0xf3 } };
+
+class CSkypeStub : public IDispatch
+{
+  public:
+	enum EKind { KIND_SKYPE, KIND_CLIENT, KIND_PROFILE };
+	enum { DISPID_CLIENT = 1, DISPID_ISRUNNING, DISPID_CURRENTUSERPROFILE, DISPID_MOODTEXT };
+
+  protected:
+	volatile LONG m_lRefCount;
+	EKind         m_eKind;
+
+	static volatile LONG& LiveObjects() { static volatile LONG s_lLiveObjects = 0; return s_lLiveObjects; }
+	static std::wstring&  MoodText()    { static std::wstring s_strMoodText; return s_strMoodText; }
+	static DWORD&         MoodChanges() { static DWORD s_dwMoodChanges = 0; return s_dwMoodChanges; }
+
+  public:
+	explicit CSkypeStub(EKind eKind)
+	{
+		m_lRefCount = 1;
+		m_eKind = eKind;
+		::InterlockedIncrement(&LiveObjects());
+	}
+
+	virtual ~CSkypeStub()
+	{
+		::InterlockedDecrement(&LiveObjects());
+	}
+
+	// Objects not yet released (all of them, the factory is not counted)
+	static LONG GetLiveObjectCount() { return LiveObjects(); }
+
+	// Mood text of the stub profile and the number of MoodText puts
+	static const std::wstring& GetMoodText()       { return MoodText(); }
+	static DWORD               GetMoodTextChanges() { return MoodChanges(); }
+
+	//
+	// IUnknown
+	//
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject)
+	{
+		if (ppvObject == NULL) return E_POINTER;
+
+		if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_IDispatch))
+		{
+			*ppvObject = static_cast<IDispatch*>(this);
+			AddRef();
+			return S_OK;
+		}
+
+		*ppvObject = NULL;
+		return E_NOINTERFACE;
+	}
+
+	STDMETHODIMP_(ULONG) AddRef(void)
+	{
+		return (ULONG) ::InterlockedIncrement(&m_lRefCount);
+	}
+
+	STDMETHODIMP_(ULONG) Release(void)
+	{
+		LONG lRefCount = ::InterlockedDecrement(&m_lRefCount);
+		if (lRefCount == 0) delete this;
+		return (ULONG) lRefCount;
+	}
+
+	//
+	// IDispatch (no type information, names are resolved by GetIDsOfNames)
+	//
+	STDMETHODIMP GetTypeInfoCount(UINT* pctinfo)
+	{
+		if (pctinfo == NULL) return E_POINTER;
+		*pctinfo = 0;
+		return S_OK;
+	}
+
+	STDMETHODIMP GetTypeInfo(UINT /*iTInfo*/, LCID /*lcid*/, ITypeInfo** ppTInfo)
+	{
+		if (ppTInfo != NULL) *ppTInfo = NULL;
+		return E_NOTIMPL;
+	}
+
+	STDMETHODIMP GetIDsOfNames(REFIID /*riid*/, LPOLESTR* rgszNames, UINT cNames, LCID /*lcid*/, DISPID* rgDispId)
+	{
+		static const WCHAR* arrNames[] = { L"Client", L"IsRunning", L"CurrentUserProfile", L"MoodText" };
+		HRESULT hr = S_OK;
+
+		for (UINT idx = 0; idx < cNames; idx++)
+		{
+			rgDispId[idx] = DISPID_UNKNOWN;
+			for (int iName = 0; iName < (int) (sizeof(arrNames) / sizeof(arrNames[0])); iName++)
+				if (idx == 0 && _wcsicmp(rgszNames[idx], arrNames[iName]) == 0) rgDispId[idx] = DISPID_CLIENT + iName;
+
+			if (rgDispId[idx] == DISPID_UNKNOWN) hr = DISP_E_UNKNOWNNAME;
+		}
+		return hr;
+	}
+
+	STDMETHODIMP Invoke(DISPID dispIdMember, REFIID /*riid*/, LCID /*lcid*/, WORD wFlags, DISPPARAMS* pDispParams,
+		VARIANT* pVarResult, EXCEPINFO* /*pExcepInfo*/, UINT* /*puArgErr*/)
+	{
+		if (dispIdMember == DISPID_MOODTEXT && m_eKind == KIND_PROFILE && (wFlags & DISPATCH_PROPERTYPUT))
+		{
+			if (pDispParams == NULL || pDispParams->cArgs != 1) return DISP_E_BADPARAMCOUNT;
+			if (pDispParams->rgvarg[0].vt != VT_BSTR) return DISP_E_TYPEMISMATCH;
+
+			MoodText().assign(pDispParams->rgvarg[0].bstrVal != NULL ? pDispParams->rgvarg[0].bstrVal : L"");
+			MoodChanges()++;
+			return S_OK;
+		}
+
+		if (!(wFlags & DISPATCH_PROPERTYGET)) return DISP_E_MEMBERNOTFOUND;
+		if (pVarResult == NULL) return E_POINTER;
+
+		::VariantInit(pVarResult);
+
+		if ((dispIdMember == DISPID_CLIENT || dispIdMember == DISPID_CURRENTUSERPROFILE) && m_eKind == KIND_SKYPE)
+		{
+			pVarResult->vt = VT_DISPATCH;
+			pVarResult->pdispVal = new CSkypeStub(dispIdMember == DISPID_CLIENT ? KIND_CLIENT : KIND_PROFILE);
+		}
+		else if (dispIdMember == DISPID_ISRUNNING && m_eKind == KIND_CLIENT)
+		{
+			pVarResult->vt = VT_BOOL;
+			pVarResult->boolVal = VARIANT_TRUE;
+		}
+		else if (dispIdMember == DISPID_MOODTEXT && m_eKind == KIND_PROFILE)
+		{
+			pVarResult->vt = VT_BSTR;
+			pVarResult->bstrVal = ::SysAllocString(MoodText().c_str());
+		}
+		else
+			return DISP_E_MEMBERNOTFOUND;
+
+		return S_OK;
+	}
+};
+
+
+//
+// Class object of CLSID_SkypeStub. One static instance registered in the apartment of the main
+// thread (the thread which updates the mood text) while "/soak" mode runs.
+//
+class CSkypeStubFactory : public IClassFactory
+{
+  protected:
+	DWORD m_dwRegister;		// Cookie of CoRegisterClassObject (0 = Not registered)
+
+  public:
+	CSkypeStubFactory()
+	{
+		m_dwRegister = 0;
+	}
+
+	bool Register()
+	{
+		if (m_dwRegister == 0 && FAILED(::CoRegisterClassObject(CLSID_SkypeStub, static_cast<IClassFactory*>(this), CLSCTX_INPROC_SERVER, REGCLS_MULTIPLEUSE, &m_dwRegister)))
+			m_dwRegister = 0;
+		return (m_dwRegister != 0);
+	}
+
+	void Revoke()
+	{
+		if (m_dwRegister != 0) ::CoRevokeClassObject(m_dwRegister);
+		m_dwRegister = 0;
+	}
+
+	//
+	// IUnknown (static lifetime, not reference counted)
+	//
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppvObject)
+	{
+		if (ppvObject == NULL) return E_POINTER;
+
+		if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_IClassFactory))
+		{
+			*ppvObject = static_cast<IClassFactory*>(this);
+			return S_OK;
+		}
+
+		*ppvObject = NULL;
+		return E_NOINTERFACE;
+	}
+
+	STDMETHODIMP_(ULONG) AddRef(void)  { return 2; }
+	STDMETHODIMP_(ULONG) Release(void) { return 1; }
+
+	//
+	// IClassFactory
+	//
+	STDMETHODIMP CreateInstance(IUnknown* pUnkOuter, REFIID riid, void** ppvObject)
+	{
+		if (ppvObject == NULL) return E_POINTER;
+		*ppvObject = NULL;
+		if (pUnkOuter != NULL) return CLASS_E_NOAGGREGATION;
+
+		CSkypeStub* pSkype = new CSkypeStub(CSkypeStub::KIND_SKYPE);
+		HRESULT hr = pSkype->QueryInterface(riid, ppvObject);
+		pSkype->Release();
+		return hr;
+	}
+
+	STDMETHODIMP LockServer(BOOL /*bLock*/)
+	{
+		return S_OK;
+	}
+};
+
+#endif //__CSKYPESTUB_H__
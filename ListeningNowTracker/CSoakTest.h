@@ -0,0 +1,391 @@
+#ifndef __CSOAKTEST_H__
+#define __CSOAKTEST_H__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "CProcessStats.h"
+
+/*
+ * Soak test ("/soak" command line option). The app runs for weeks between reboots, so the event path
+ * must not leak memory, handles or GDI objects, and an event must not get slower over time.
+ *
+ * The test generates a synthetic listening history (plays, skips, pauses and nightly stops) and the
+ * app feeds it through the normal WM_COPYDATA handler under a compressed clock: the time between two
+ * events passes at once. The default run simulates well over a year of listening (the tick count
+ * wraps around every 49.7 days) in a few minutes.
+ *
+ * The synthetic events reach the tray tooltip and the Skype sink, which talks to a stand-in of
+ * Skype4COM (CSkypeStub.h). The real Skype, the shared memory segment, broadcast clients and the
+ * state checkpoint are not touched (see g_arrSoakSinks in MainWnd.cpp). Tests/TestSoak.cpp runs the same history through the portable part of the event
+ * path on Linux, without the app.
+ *
+ * After every batch of events the footprint of the process and the median latency of the batch are
+ * sampled. At the end each series gets a least squares trend line (samples of the warmup are not
+ * used: pools, caches and the learned track lengths fill up first). The run fails if the trend grows
+ * more than the limit of the series during the measured part of the run. It fails also if the peak
+ * footprint of the whole run goes over the budget of the build profile (see SetFootprintBudget), or
+ * if COM objects of the event path are still alive at the end (see SetComObjects).
+*/
+
+class CSoakTest
+{
+  public:
+	enum { DEFAULT_EVENT_COUNT = 20000, MAX_EVENT_COUNT = 10000000, BATCH_EVENTS = 100, WARMUP_PERCENT = 20 };
+
+	enum { SERIES_WORKINGSET, SERIES_PRIVATEBYTES, SERIES_HEAPUSED, SERIES_HEAPBLOCKS, SERIES_HANDLES,
+	       SERIES_GDIOBJECTS, SERIES_USEROBJECTS, SERIES_LATENCY, SERIES_COUNT };
+
+  protected:
+	enum { TRACK_COUNT = 5000, ARTIST_COUNT = 400, MAX_EVENT_LEN = 512 };
+
+	struct CSample
+	{
+		DWORD  dwEventCount;
+		double arrValues[SERIES_COUNT];
+	};
+
+	// Allowed growth of the trend line during the measured part of the run. Latency limit is relative
+	// to the latency at the start of the measured part, but never less than the absolute limit (noise
+	// of the scheduler).
+	struct CSeriesInfo
+	{
+		const WCHAR* szName;
+		const WCHAR* szUnit;
+		double       dMaxGrowth;
+		double       dMaxRelativeGrowth;
+	};
+
+	std::vector<CSample> m_arrSamples;			// Reserved at start, so sampling doesn't allocate memory
+	double        m_arrBatchLatencyUS[BATCH_EVENTS];
+	DWORD         m_dwBatchEvents;
+	DWORD         m_dwEventCount;				// Events of the whole run
+	DWORD         m_dwEventsDone;
+	DWORD         m_dwRandom;					// Generator state (fixed seed, so every run is the same)
+	ULONGLONG     m_ullSimulatedMS;
+	DWORD         m_dwPendingGapMS;				// Pause after the track which is playing now (0 = Next track follows)
+	LARGE_INTEGER m_liFrequency;
+	CProcessStats m_objPeakStats;				// Peak working set and private bytes of the samples
+	SIZE_T        m_iWorkingSetBudgetKB;		// 0 = Not checked
+	SIZE_T        m_iPrivateBytesBudgetKB;
+	DWORD         m_dwComUpdates;				// Updates through the COM objects of the event path
+	LONG          m_lLiveObjects;				// COM objects alive at the end of the run (-1 = Not checked)
+	WCHAR         m_szEvent[MAX_EVENT_LEN];
+	std::wstring  m_strReport;
+	bool          m_bEnabled;
+	bool          m_bFailed;
+
+  public:
+	CSoakTest()
+	{
+		m_bEnabled = m_bFailed = false;
+		m_dwEventCount = m_dwEventsDone = m_dwBatchEvents = 0;
+		m_dwRandom = 1;
+		m_ullSimulatedMS = 0;
+		m_dwPendingGapMS = 0;
+		m_iWorkingSetBudgetKB = m_iPrivateBytesBudgetKB = 0;
+		m_dwComUpdates = 0;
+		m_lLiveObjects = -1;
+		::QueryPerformanceFrequency(&m_liFrequency);
+	}
+
+	//
+	// "/soak[:events]" cmdline option. The option must be a word of its own and the event count a
+	// number from 1 to MAX_EVENT_COUNT with nothing after it. Returns false if there is no "/soak"
+	// option. A malformed option ("/soak:0", "/soak:many") returns true with dwEventCount 0.
+	//
+	static bool ParseOption(const WCHAR* szCmdLine, DWORD& dwEventCount)
+	{
+		dwEventCount = 0;
+
+		for (const WCHAR* szOption = szCmdLine; szOption != NULL && (szOption = wcsstr(szOption, L"/soak")) != NULL; szOption += 5)
+		{
+			const WCHAR* szValue = szOption + 5;
+
+			// "x/soak" and "/soaked" are not this option
+			if (szOption != szCmdLine && !IsSeparator(szOption[-1])) continue;
+			if (*szValue != L':' && !IsSeparator(*szValue)) continue;
+
+			if (*szValue != L':')
+			{
+				dwEventCount = DEFAULT_EVENT_COUNT;
+				return true;
+			}
+
+			ULONGLONG ullCount = 0;
+			for (szValue++; *szValue >= L'0' && *szValue <= L'9' && ullCount <= MAX_EVENT_COUNT; szValue++)
+				ullCount = 10 * ullCount + (*szValue - L'0');
+
+			if (IsSeparator(*szValue) && szValue[-1] != L':' && ullCount > 0 && ullCount <= MAX_EVENT_COUNT)
+				dwEventCount = (DWORD) ullCount;
+			return true;
+		}
+		return false;
+	}
+
+	void Enable(DWORD dwEventCount)
+	{
+		m_bEnabled = (dwEventCount > 0);
+		m_dwEventCount = dwEventCount;
+		m_arrSamples.reserve(dwEventCount / BATCH_EVENTS + 2);
+	}
+
+	// Footprint budget of the build profile (LNT_WORKINGSET_BUDGET_KB and LNT_PRIVATEBYTES_BUDGET_KB)
+	void SetFootprintBudget(SIZE_T iWorkingSetBudgetKB, SIZE_T iPrivateBytesBudgetKB)
+	{
+		m_iWorkingSetBudgetKB = iWorkingSetBudgetKB;
+		m_iPrivateBytesBudgetKB = iPrivateBytesBudgetKB;
+	}
+
+	// COM objects of the event path at the end of the run: the number of updates done through them
+	// and the objects not yet released. Analyze fails the run if an object is still alive, or if there
+	// were no updates at all (the objects were never created, so nothing was tested).
+	void SetComObjects(DWORD dwUpdates, LONG lLiveObjects)
+	{
+		m_dwComUpdates = dwUpdates;
+		m_lLiveObjects = lLiveObjects;
+	}
+
+	bool IsEnabled() const   { return m_bEnabled; }
+	bool IsCompleted() const { return m_dwEventsDone >= m_dwEventCount; }
+	bool HasFailed() const   { return m_bFailed; }
+
+	//
+	// Next synthetic event in the WM_COPYDATA data format of the players (see CTrackEvent::Parse).
+	// dwGapMS receives the simulated time until the next event. The text stays valid until the next call.
+	//
+	const WCHAR* NextEvent(size_t& iDataLen, DWORD& dwGapMS)
+	{
+		m_dwEventsDone++;
+
+		// Player was paused or stopped after the previous track
+		if (m_dwPendingGapMS > 0)
+		{
+			dwGapMS = m_dwPendingGapMS;
+			m_dwPendingGapMS = 0;
+			m_ullSimulatedMS += dwGapMS;
+
+			wcscpy_s(m_szEvent, L"\\0Music\\00\\0{0} - {1}\\0\\0\\0\\0");
+			iDataLen = wcslen(m_szEvent);
+			return m_szEvent;
+		}
+
+		// Popular tracks are played more often (square of a uniform number)
+		DWORD dwRandom = NextRandom() % 1000;
+		DWORD dwTrack = (dwRandom * dwRandom / 1000) * TRACK_COUNT / 1000 + NextRandom() % 5;
+		DWORD dwArtist = dwTrack % ARTIST_COUNT;
+		DWORD dwLengthMS = 1000 * (90 + (dwTrack * 7919) % 360);
+
+		// Titles of real players: remaster and "feat." suffixes (normalizer rules) and non-ASCII texts
+		const WCHAR* szSuffix = L"";
+		if (dwTrack % 7 == 0) szSuffix = L" - 2009 Remaster";
+		else if (dwTrack % 11 == 0) szSuffix = L" (feat. Guest Artist)";
+
+		_snwprintf_s(m_szEvent, MAX_EVENT_LEN, _TRUNCATE, L"\\0Music\\01\\0{0} - {1}\\0Track %u%s\\0%s %u\\0Album %u\\0",
+			dwTrack, szSuffix, (dwArtist % 5 == 0 ? L"Art\x00EFst \x00C5str\x00F6m" : L"Artist"), dwArtist, dwTrack / 12);
+		iDataLen = wcslen(m_szEvent);
+
+		// Most tracks are played to the end, some are skipped. Now and then the player is paused
+		// for a while or stopped for the night (about two hours of listening a day).
+		DWORD dwAction = NextRandom() % 100;
+		if (dwAction < 15) dwGapMS = 1000 * (3 + NextRandom() % 40);
+		else dwGapMS = dwLengthMS + NextRandom() % 3000;
+
+		if (dwAction >= 92 && dwAction < 97) m_dwPendingGapMS = 60 * 1000 * (1 + NextRandom() % 30);
+		else if (dwAction >= 97) m_dwPendingGapMS = 60 * 60 * 1000 * (8 + NextRandom() % 8);
+
+		m_ullSimulatedMS += dwGapMS;
+		return m_szEvent;
+	}
+
+	// Handling time of one event (QueryPerformanceCounter ticks)
+	void AddLatency(LONGLONG llTicks)
+	{
+		if (m_dwBatchEvents < BATCH_EVENTS)
+			m_arrBatchLatencyUS[m_dwBatchEvents++] = 1000000.0 * (double) llTicks / (double) m_liFrequency.QuadPart;
+	}
+
+	// Sample of the process after a batch of events (median latency of the batch)
+	void AddSample(const CProcessStats& objStats)
+	{
+		CSample objSample;
+
+		objSample.dwEventCount = m_dwEventsDone;
+		objSample.arrValues[SERIES_WORKINGSET]   = (double) objStats.m_iWorkingSetKB;
+		objSample.arrValues[SERIES_PRIVATEBYTES] = (double) objStats.m_iPrivateBytesKB;
+		objSample.arrValues[SERIES_HEAPUSED]     = (double) objStats.m_iHeapUsedKB;
+		objSample.arrValues[SERIES_HEAPBLOCKS]   = (double) objStats.m_dwHeapBlockCount;
+		objSample.arrValues[SERIES_HANDLES]      = (double) objStats.m_dwHandleCount;
+		objSample.arrValues[SERIES_GDIOBJECTS]   = (double) objStats.m_dwGdiObjectCount;
+		objSample.arrValues[SERIES_USEROBJECTS]  = (double) objStats.m_dwUserObjectCount;
+		objSample.arrValues[SERIES_LATENCY]      = 0;
+
+		m_objPeakStats.m_iPeakWorkingSetKB = std::max(m_objPeakStats.m_iPeakWorkingSetKB, objStats.m_iPeakWorkingSetKB);
+		m_objPeakStats.m_iPrivateBytesKB   = std::max(m_objPeakStats.m_iPrivateBytesKB, objStats.m_iPrivateBytesKB);
+
+		if (m_dwBatchEvents > 0)
+		{
+			std::nth_element(m_arrBatchLatencyUS, m_arrBatchLatencyUS + m_dwBatchEvents / 2, m_arrBatchLatencyUS + m_dwBatchEvents);
+			objSample.arrValues[SERIES_LATENCY] = m_arrBatchLatencyUS[m_dwBatchEvents / 2];
+		}
+		m_dwBatchEvents = 0;
+
+		m_arrSamples.push_back(objSample);
+	}
+
+	//
+	// Trend of each series after the warmup. Returns false (and HasFailed returns true) if a series grew
+	// more than its limit. The report has one line per series and a sample table.
+	//
+	bool Analyze()
+	{
+		static const CSeriesInfo arrSeries[SERIES_COUNT] =
+		{
+			{ L"WorkingSet",   L"KB", 1024, 0   },
+			{ L"PrivateBytes", L"KB", 256,  0   },
+			{ L"HeapUsed",     L"KB", 32,   0   },
+			{ L"HeapBlocks",   L"",   64,   0   },
+			{ L"Handles",      L"",   16,   0   },
+			{ L"GdiObjects",   L"",   8,    0   },
+			{ L"UserObjects",  L"",   8,    0   },
+			{ L"Latency",      L"us", 10,   0.5 }
+		};
+
+		WCHAR szLine[256];
+		size_t iFirst = m_arrSamples.size() * WARMUP_PERCENT / 100;
+
+		m_bFailed = false;
+		m_strReport.assign(L"ListeningNowTracker soak test\n");
+
+		_snwprintf_s(szLine, (sizeof(szLine) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+			L"Events=%u SimulatedDays=%.1f TickCountWraps=%u Samples=%u Warmup=%u\n",
+			m_dwEventsDone, (double) m_ullSimulatedMS / (24.0 * 60 * 60 * 1000), (unsigned) (m_ullSimulatedMS >> 32),
+			(unsigned) m_arrSamples.size(), (unsigned) iFirst);
+		m_strReport.append(szLine);
+
+		if (m_arrSamples.size() - iFirst < 3)
+		{
+			m_strReport.append(L"FAILED: Too few samples (use more events)\n");
+			m_bFailed = true;
+			return false;
+		}
+
+		for (int iSeries = 0; iSeries < SERIES_COUNT; iSeries++)
+		{
+			const CSeriesInfo& objInfo = arrSeries[iSeries];
+			double dSlope, dStart, dMedian;
+			GetTrend(iSeries, iFirst, dSlope, dStart, dMedian);
+
+			double dGrowth = dSlope * (double) (m_arrSamples.back().dwEventCount - m_arrSamples[iFirst].dwEventCount);
+			double dLimit = std::max(objInfo.dMaxGrowth, objInfo.dMaxRelativeGrowth * dStart);
+			bool   bFailed = (dGrowth > dLimit);
+
+			_snwprintf_s(szLine, (sizeof(szLine) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"%-4s %-12s median=%.1f%s growth=%+.1f%s limit=%.1f%s\n",
+				(bFailed ? L"FAIL" : L"ok"), objInfo.szName, dMedian, objInfo.szUnit, dGrowth, objInfo.szUnit, dLimit, objInfo.szUnit);
+			m_strReport.append(szLine);
+
+			if (bFailed) m_bFailed = true;
+		}
+
+		if (m_iWorkingSetBudgetKB > 0 || m_iPrivateBytesBudgetKB > 0)
+		{
+			bool bFailed = !m_objPeakStats.IsWithinBudget(m_iWorkingSetBudgetKB, m_iPrivateBytesBudgetKB);
+
+			_snwprintf_s(szLine, (sizeof(szLine) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"%-4s %-12s peakWorkingSet=%uKB budget=%uKB peakPrivateBytes=%uKB budget=%uKB\n",
+				(bFailed ? L"FAIL" : L"ok"), L"Budget", (unsigned) m_objPeakStats.m_iPeakWorkingSetKB, (unsigned) m_iWorkingSetBudgetKB,
+				(unsigned) m_objPeakStats.m_iPrivateBytesKB, (unsigned) m_iPrivateBytesBudgetKB);
+			m_strReport.append(szLine);
+
+			if (bFailed) m_bFailed = true;
+		}
+
+		if (m_lLiveObjects >= 0)
+		{
+			bool bFailed = (m_lLiveObjects > 0 || m_dwComUpdates == 0);
+
+			_snwprintf_s(szLine, (sizeof(szLine) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"%-4s %-12s updates=%u live=%d\n", (bFailed ? L"FAIL" : L"ok"), L"ComObjects", m_dwComUpdates, (int) m_lLiveObjects);
+			m_strReport.append(szLine);
+
+			if (bFailed) m_bFailed = true;
+		}
+
+		m_strReport.append(m_bFailed ? L"Result: FAILED\n" : L"Result: PASSED\n");
+
+		m_strReport.append(L"\nEvents");
+		for (int iSeries = 0; iSeries < SERIES_COUNT; iSeries++) m_strReport.append(L"\t").append(arrSeries[iSeries].szName);
+		m_strReport.append(L"\n");
+
+		for (size_t idx = 0; idx < m_arrSamples.size(); idx++)
+		{
+			const CSample& objSample = m_arrSamples[idx];
+			_snwprintf_s(szLine, (sizeof(szLine) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"%u\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.1f\n", objSample.dwEventCount,
+				objSample.arrValues[0], objSample.arrValues[1], objSample.arrValues[2], objSample.arrValues[3],
+				objSample.arrValues[4], objSample.arrValues[5], objSample.arrValues[6], objSample.arrValues[7]);
+			m_strReport.append(szLine);
+		}
+
+		return !m_bFailed;
+	}
+
+	const std::wstring& GetReport() const { return m_strReport; }
+
+	// Write the report to a log file (overwrites the previous log)
+	void Save(const std::wstring& strFileName) const
+	{
+		FILE* pFile = NULL;
+		if (_wfopen_s(&pFile, strFileName.c_str(), L"wt") != 0 || pFile == NULL) return;
+
+		fputws(m_strReport.c_str(), pFile);
+		fclose(pFile);
+	}
+
+  protected:
+	static bool IsSeparator(WCHAR chValue)
+	{
+		return (chValue == L'\0' || chValue == L' ' || chValue == L'\t');
+	}
+
+	DWORD NextRandom()
+	{
+		m_dwRandom = m_dwRandom * 1103515245 + 12345;
+		return (m_dwRandom >> 8);
+	}
+
+	// Least squares trend line of the series from sample iFirst to the end: slope (per event) and the
+	// value of the line at the first sample. Median of the samples is reported as the typical value.
+	void GetTrend(int iSeries, size_t iFirst, double& dSlope, double& dStart, double& dMedian) const
+	{
+		size_t iCount = m_arrSamples.size() - iFirst;
+		double dMeanX = 0, dMeanY = 0, dSumXY = 0, dSumXX = 0;
+		std::vector<double> arrValues;
+
+		for (size_t idx = iFirst; idx < m_arrSamples.size(); idx++)
+		{
+			dMeanX += m_arrSamples[idx].dwEventCount;
+			dMeanY += m_arrSamples[idx].arrValues[iSeries];
+			arrValues.push_back(m_arrSamples[idx].arrValues[iSeries]);
+		}
+		dMeanX /= iCount;
+		dMeanY /= iCount;
+
+		for (size_t idx = iFirst; idx < m_arrSamples.size(); idx++)
+		{
+			double dX = m_arrSamples[idx].dwEventCount - dMeanX;
+			dSumXY += dX * (m_arrSamples[idx].arrValues[iSeries] - dMeanY);
+			dSumXX += dX * dX;
+		}
+
+		dSlope = (dSumXX > 0 ? dSumXY / dSumXX : 0);
+		dStart = dMeanY - dSlope * (dMeanX - m_arrSamples[iFirst].dwEventCount);
+
+		std::nth_element(arrValues.begin(), arrValues.begin() + iCount / 2, arrValues.end());
+		dMedian = arrValues[iCount / 2];
+	}
+};
+
+#endif //__CSOAKTEST_H__
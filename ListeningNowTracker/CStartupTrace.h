@@ -0,0 +1,140 @@
+#ifndef __CSTARTUPTRACE_H__
+#define __CSTARTUPTRACE_H__
+
+#include <string>
+
+/*
+ * Simple startup timeline tracer. Records a high resolution timestamp for each init phase
+ * and writes the timeline to the debugger output (see DebugView tool) and to a log file.
+ *
+ * Tracing is enabled with "/trace" command line option. When disabled the Mark calls cost
+ * next to nothing, so the trace points can stay in the startup code permanently.
+ *
+ * CheckBudget compares the time since the first mark with a time budget of a startup phase
+ * (for example LNT_LISTENING_BUDGET_MS of BuildProfile.h). Going over the budget is an error
+ * line in the timeline.
+*/
+
+class CStartupTrace
+{
+  protected:
+	enum { MAX_PHASES = 32 };
+
+	// One "phase completed" entry in the timeline
+	struct CPhase
+	{
+		const TCHAR*  szName;
+		LARGE_INTEGER liTimeStamp;
+		DWORD         dwThreadID;
+		volatile LONG iFilled;			// 1 = Entry is complete (set after the other fields)
+	};
+
+	CPhase        m_arrPhases[MAX_PHASES];
+	volatile LONG m_iPhaseCount;		// Reserved slots. Phases can be marked by the watchdog thread also, so slot index is Interlocked
+	LARGE_INTEGER m_liFrequency;
+	LARGE_INTEGER m_liStart;			// Timestamp of the first Mark call (ie. WinMain entry)
+	std::wstring  m_strNotes;			// Free-form lines written after the timeline (main thread only)
+	bool          m_bEnabled;
+
+  public:
+	CStartupTrace()
+	{
+		m_iPhaseCount = 0;
+		m_bEnabled = false;
+		m_liStart.QuadPart = 0;
+		::QueryPerformanceFrequency(&m_liFrequency);
+
+		for (int idx = 0; idx < MAX_PHASES; idx++) m_arrPhases[idx].iFilled = 0;
+	}
+
+	void Enable(bool bEnabled) { m_bEnabled = bEnabled; }
+	bool IsEnabled() const { return m_bEnabled; }
+
+	// Record the end of a startup phase. szName must be a string literal (pointer is stored as such)
+	void Mark(const TCHAR* szName)
+	{
+		if (!m_bEnabled) return;
+
+		LONG iSlot = ::InterlockedIncrement(&m_iPhaseCount) - 1;
+		if (iSlot >= MAX_PHASES) return;  // Timeline full. Ignore the rest of the marks
+
+		CPhase& objPhase = m_arrPhases[iSlot];
+		::QueryPerformanceCounter(&objPhase.liTimeStamp);
+		objPhase.dwThreadID = ::GetCurrentThreadId();
+		objPhase.szName = szName;
+
+		if (iSlot == 0) m_liStart = objPhase.liTimeStamp;
+
+		// Save of another thread may see the slot reserved but not yet filled. It skips the slot
+		// until the entry is published here.
+		::InterlockedExchange(&objPhase.iFilled, 1);
+
+		::OutputDebugString(FormatPhase(objPhase).c_str());
+	}
+
+	// Milliseconds since the first mark (0 when disabled or nothing is marked yet)
+	double GetElapsedMS() const
+	{
+		if (!m_bEnabled || m_iPhaseCount == 0) return 0.0;
+
+		LARGE_INTEGER liNow;
+		::QueryPerformanceCounter(&liNow);
+		return 1000.0 * (double)(liNow.QuadPart - m_liStart.QuadPart) / (double)m_liFrequency.QuadPart;
+	}
+
+	// Check the time since the first mark against the budget of szPhase. Returns false (and adds an
+	// error line to the trace) only when tracing is enabled and the budget is exceeded.
+	bool CheckBudget(const TCHAR* szPhase, DWORD dwBudgetMS)
+	{
+		double dElapsedMS = GetElapsedMS();
+		if (dElapsedMS <= (double) dwBudgetMS) return true;
+
+		WCHAR szText[160];
+		_snwprintf_s(szText, _TRUNCATE, L"ERROR: %s took %.3f ms, budget %u ms", szPhase, dElapsedMS, dwBudgetMS);
+		Note(szText);
+		return false;
+	}
+
+	// Add a free-form text line to the trace (for example footprint of the process after startup)
+	void Note(const std::wstring& strText)
+	{
+		if (!m_bEnabled) return;
+
+		std::wstring strLine = L"[startup] " + strText + L"\n";
+		m_strNotes.append(strLine);
+		::OutputDebugString(strLine.c_str());
+	}
+
+	// Write the whole timeline to a log file (overwrites the previous log)
+	void Save(const std::wstring& strFileName)
+	{
+		if (!m_bEnabled) return;
+
+		FILE* pFile = NULL;
+		if (_wfopen_s(&pFile, strFileName.c_str(), L"wt") != 0 || pFile == NULL) return;
+
+		fwprintf(pFile, L"ListeningNowTracker startup timeline (ms since WinMain)\n");
+
+		LONG iCount = (m_iPhaseCount < MAX_PHASES ? m_iPhaseCount : MAX_PHASES);
+		for (LONG idx = 0; idx < iCount; idx++)
+			if (m_arrPhases[idx].iFilled != 0) fputws(FormatPhase(m_arrPhases[idx]).c_str(), pFile);
+
+		fputws(m_strNotes.c_str(), pFile);
+
+		fclose(pFile);
+	}
+
+  protected:
+	std::wstring FormatPhase(const CPhase& objPhase) const
+	{
+		WCHAR szLine[160];
+		double dElapsedMS = 1000.0 * (double)(objPhase.liTimeStamp.QuadPart - m_liStart.QuadPart) / (double)m_liFrequency.QuadPart;
+
+		_snwprintf_s(szLine, (sizeof(szLine) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+			L"[startup] %10.3f ms  tid=%-6u %s\n", dElapsedMS, objPhase.dwThreadID, objPhase.szName);
+
+		return std::wstring(szLine);
+	}
+};
+
+#endif //__CSTARTUPTRACE_H__
@@ -0,0 +1,257 @@
+#ifndef __CSTATECHECKPOINT_H__
+#define __CSTATECHECKPOINT_H__
+
+#include <string>
+
+#include "CThread.h"
+
+/*
+ * Crash-consistent checkpoint of the "listening now" text each sink was last told (Skype mood text,
+ * shared memory segment and broadcast subscribers). If the app or the whole machine crashes then the
+ * next app instance reads the checkpoint at startup and clears the stale texts left behind: Skype
+ * profile, shared memory readers which kept the segment open, and reconnecting subscribers.
+ *
+ * The checkpoint is a small memory-mapped file with two slots. A new state is written to the older
+ * slot and the slot is committed by writing its sequence number last, so the other slot always has
+ * a complete copy of the previous state. A slot with a bad checksum (torn write) is ignored.
+ *
+ * Writes go to the OS file cache only (no FlushViewOfFile per event). Process crash doesn't lose
+ * anything because the dirty pages belong to the OS. Power loss may lose the latest state, but then
+ * the previous state in the file is still consistent and the reconciliation logic handles it.
+ *
+ * The main thread and the watchdog thread both update sinks, so the methods are serialized with a
+ * critical section of the checkpoint. Two Commits at the same time would write the same sequence
+ * number to both slots or a slot with the checksum of another state.
+*/
+
+class CStateCheckpoint
+{
+  public:
+	enum { MAX_SINKS = 4, MAX_TEXT_LEN = 256 };
+
+	// Sink slot numbers in the checkpoint file (do not re-use numbers, the file survives app upgrades)
+	enum { SINK_SKYPE = 0, SINK_SHARED_MEMORY = 1, SINK_BROADCAST = 2 };
+
+  protected:
+	enum { FILE_MAGIC = 0x4B43544C /* "LTCK" */, FILE_VERSION = 2 };
+
+	struct CSinkRecord
+	{
+		DWORD dwTextLen;
+		WCHAR szText[MAX_TEXT_LEN];
+	};
+
+	struct CSlot
+	{
+		volatile LONG lSequence;	// 0 = Slot is being written or was never written
+		DWORD         dwChecksum;	// Checksum of the sequence number and the rest of the slot
+		DWORD         dwProcessID;	// Process which wrote the slot (diagnostics)
+		DWORD         dwReserved;
+		CSinkRecord   arrSinks[MAX_SINKS];
+	};
+
+	struct CFileLayout
+	{
+		DWORD dwMagic;
+		DWORD dwVersion;
+		DWORD dwSlotSize;
+		DWORD dwReserved;
+		CSlot arrSlots[2];
+	};
+
+	HANDLE       m_hFile;
+	HANDLE       m_hMapping;
+	CFileLayout* m_pView;
+
+	CSlot        m_objState;	// The latest committed state (copy in process memory)
+	mutable CCriticalSection m_objLock;	// Guards m_objState and the view
+
+  public:
+	CStateCheckpoint()
+	{
+		m_hFile = m_hMapping = NULL;
+		m_pView = NULL;
+		ZeroMemory(&m_objState, sizeof(m_objState));
+	}
+
+	~CStateCheckpoint()
+	{
+		Close();
+	}
+
+	bool IsOpen() const { return m_pView != NULL; }
+
+	// Open or create the checkpoint file and load the latest valid state from it
+	bool Open(const std::wstring& strFileName)
+	{
+		Close();
+
+		m_objLock.Enter();
+		bool bOpened = OpenView(strFileName);
+		m_objLock.Leave();
+		return bOpened;
+	}
+
+	void Close()
+	{
+		m_objLock.Enter();
+		CloseView();
+		m_objLock.Leave();
+	}
+
+	// Text the sink was last told (empty string if nothing or the sink was cleared)
+	std::wstring GetSinkText(int iSink) const
+	{
+		if (iSink < 0 || iSink >= MAX_SINKS) return std::wstring();
+
+		m_objLock.Enter();
+		std::wstring strText(m_objState.arrSinks[iSink].szText, m_objState.arrSinks[iSink].dwTextLen);
+		m_objLock.Leave();
+		return strText;
+	}
+
+	// Record the new text of the sink and commit the state to the checkpoint file
+	void SetSinkText(int iSink, const WCHAR* szText)
+	{
+		if (iSink < 0 || iSink >= MAX_SINKS) return;
+
+		m_objLock.Enter();
+
+		CSinkRecord& objRecord = m_objState.arrSinks[iSink];
+		size_t iTextLen = wcsnlen(szText, MAX_TEXT_LEN - 1);
+
+		// Same text as before. No need to write anything
+		if (iTextLen != objRecord.dwTextLen || wmemcmp(szText, objRecord.szText, iTextLen) != 0)
+		{
+			wmemcpy(objRecord.szText, szText, iTextLen);
+			wmemset(objRecord.szText + iTextLen, L'\0', MAX_TEXT_LEN - iTextLen);
+			objRecord.dwTextLen = (DWORD) iTextLen;
+
+			Commit();
+		}
+
+		m_objLock.Leave();
+	}
+
+  protected:
+	bool OpenView(const std::wstring& strFileName)
+	{
+		m_hFile = ::CreateFile(strFileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+		{
+			m_hFile = NULL;
+			return false;
+		}
+
+		// File mapping extends the file to the full size if it is a new (or truncated) file
+		m_hMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READWRITE, 0, sizeof(CFileLayout), NULL);
+		if (m_hMapping != NULL) m_pView = (CFileLayout*) ::MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, sizeof(CFileLayout));
+
+		if (m_pView == NULL)
+		{
+			CloseView();
+			return false;
+		}
+
+		if (m_pView->dwMagic != FILE_MAGIC || m_pView->dwVersion != FILE_VERSION || m_pView->dwSlotSize != sizeof(CSlot))
+		{
+			// New file or unknown format. Start from an empty state.
+			ZeroMemory(m_pView, sizeof(CFileLayout));
+			m_pView->dwMagic    = FILE_MAGIC;
+			m_pView->dwVersion  = FILE_VERSION;
+			m_pView->dwSlotSize = sizeof(CSlot);
+		}
+
+		LoadLatestSlot();
+		return true;
+	}
+
+	void CloseView()
+	{
+		if (m_pView != NULL)
+		{
+			::FlushViewOfFile(m_pView, 0);
+			::UnmapViewOfFile(m_pView);
+		}
+		if (m_hMapping != NULL) ::CloseHandle(m_hMapping);
+		if (m_hFile != NULL) ::CloseHandle(m_hFile);
+
+		m_pView = NULL;
+		m_hMapping = m_hFile = NULL;
+	}
+
+	void Commit()
+	{
+		if (m_pView == NULL) return;
+
+		// Sequence numbers start from 1. Zero is reserved for "slot not valid"
+		LONG lSequence = m_objState.lSequence + 1;
+		if (lSequence <= 0) lSequence = 1;
+
+		m_objState.lSequence   = lSequence;
+		m_objState.dwProcessID = ::GetCurrentProcessId();
+		m_objState.dwChecksum  = CalcChecksum(m_objState);
+
+		// Invalidate the target slot first, then copy the data and finally commit the sequence number.
+		// The other slot holds the previous committed state during the write.
+		CSlot& objSlot = m_pView->arrSlots[lSequence & 1];
+		::InterlockedExchange(&objSlot.lSequence, 0);
+
+		objSlot.dwChecksum = m_objState.dwChecksum;
+		memcpy(&objSlot.dwProcessID, &m_objState.dwProcessID, sizeof(CSlot) - offsetof(CSlot, dwProcessID));
+
+		::InterlockedExchange(&objSlot.lSequence, lSequence);
+	}
+
+	void LoadLatestSlot()
+	{
+		const CSlot* pLatest = NULL;
+
+		for (int idx = 0; idx < 2; idx++)
+		{
+			const CSlot& objSlot = m_pView->arrSlots[idx];
+			if (objSlot.lSequence <= 0 || objSlot.dwChecksum != CalcChecksum(objSlot)) continue;
+			if (pLatest == NULL || objSlot.lSequence > pLatest->lSequence) pLatest = &objSlot;
+		}
+
+		if (pLatest != NULL) memcpy(&m_objState, pLatest, sizeof(m_objState));
+		else ZeroMemory(&m_objState, sizeof(m_objState));
+
+		// Sanity check. Do not trust the length values of the file
+		for (int idx = 0; idx < MAX_SINKS; idx++)
+		{
+			if (m_objState.arrSinks[idx].dwTextLen >= MAX_TEXT_LEN) m_objState.arrSinks[idx].dwTextLen = 0;
+		}
+	}
+
+	// FNV-1a hash of the sequence number, the process ID and the used part of the sink texts (the
+	// rest of a text buffer is never read, so hashing the whole slot would only cost time per commit)
+	static DWORD CalcChecksum(const CSlot& objSlot)
+	{
+		DWORD dwHash = 2166136261U;
+		LONG  lSequence = objSlot.lSequence;
+
+		dwHash = HashBytes(dwHash, &lSequence, sizeof(lSequence));
+		dwHash = HashBytes(dwHash, &objSlot.dwProcessID, sizeof(objSlot.dwProcessID));
+
+		for (int idx = 0; idx < MAX_SINKS; idx++)
+		{
+			const CSinkRecord& objRecord = objSlot.arrSinks[idx];
+			DWORD dwTextLen = (objRecord.dwTextLen < MAX_TEXT_LEN ? objRecord.dwTextLen : MAX_TEXT_LEN);
+
+			dwHash = HashBytes(dwHash, &objRecord.dwTextLen, sizeof(objRecord.dwTextLen));
+			dwHash = HashBytes(dwHash, objRecord.szText, dwTextLen * sizeof(WCHAR));
+		}
+
+		return dwHash;
+	}
+
+	static DWORD HashBytes(DWORD dwHash, const void* pData, size_t iLen)
+	{
+		const BYTE* pByte = (const BYTE*) pData;
+		for (size_t idx = 0; idx < iLen; idx++) dwHash = (dwHash ^ pByte[idx]) * 16777619U;
+		return dwHash;
+	}
+};
+
+#endif //__CSTATECHECKPOINT_H__
@@ -0,0 +1,649 @@
+#ifndef __CTAGREADER_H__
+#define __CTAGREADER_H__
+
+#include <string>
+
+/*
+ * Minimal music file tag reader (ID3v2 MP3, FLAC and MP4/M4A files). Reads only the fields needed
+ * to enrich "now playing" events: title, artist, album, genre, year, track number and duration.
+ *
+ * Files are read through memory-mapped views of the file header (and the "moov" atom of MP4 files,
+ * which may be at the end of the file). Only the touched pages are read from disk, so big embedded
+ * album art pictures are skipped without reading them.
+*/
+
+//------------------------------------------------------------------
+// Tag values of one music file
+//
+class CTrackTags
+{
+  public:
+	enum { MAX_TEXT_LEN = 128, MAX_GENRE_LEN = 48 };
+
+	WCHAR m_szTitle [MAX_TEXT_LEN];
+	WCHAR m_szArtist[MAX_TEXT_LEN];
+	WCHAR m_szAlbum [MAX_TEXT_LEN];
+	WCHAR m_szGenre [MAX_GENRE_LEN];
+	WORD  m_wYear;				// 0 = Unknown
+	WORD  m_wTrackNumber;		// 0 = Unknown
+	DWORD m_dwDurationMS;		// 0 = Unknown
+
+  public:
+	CTrackTags()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		m_szTitle[0] = m_szArtist[0] = m_szAlbum[0] = m_szGenre[0] = L'\0';
+		m_wYear = m_wTrackNumber = 0;
+		m_dwDurationMS = 0;
+	}
+};
+
+
+//------------------------------------------------------------------
+// Read-only memory-mapped view of a file. Only one view is mapped at a time.
+//
+class CMappedFileView
+{
+  protected:
+	enum { VIEW_GRANULARITY = 64 * 1024 };	// Windows allocation granularity (offset of a view must be aligned to this)
+
+	HANDLE      m_hFile;
+	HANDLE      m_hMapping;
+	ULONGLONG   m_ullFileSize;
+	const BYTE* m_pView;
+
+  public:
+	CMappedFileView()
+	{
+		m_hFile = m_hMapping = NULL;
+		m_pView = NULL;
+		m_ullFileSize = 0;
+	}
+
+	~CMappedFileView()
+	{
+		Close();
+	}
+
+	bool Open(const std::wstring& strFileName)
+	{
+		LARGE_INTEGER liFileSize;
+
+		m_hFile = ::CreateFile(strFileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE)
+		{
+			m_hFile = NULL;
+			return false;
+		}
+
+		if (!::GetFileSizeEx(m_hFile, &liFileSize) || liFileSize.QuadPart == 0) return false;
+		m_ullFileSize = (ULONGLONG) liFileSize.QuadPart;
+
+		m_hMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		return (m_hMapping != NULL);
+	}
+
+	void Close()
+	{
+		Unmap();
+		if (m_hMapping != NULL) ::CloseHandle(m_hMapping);
+		if (m_hFile != NULL) ::CloseHandle(m_hFile);
+		m_hMapping = m_hFile = NULL;
+	}
+
+	ULONGLONG GetFileSize() const { return m_ullFileSize; }
+
+	// Map a view of the file and return a pointer to the requested offset (NULL if failed).
+	// Length is truncated to the end of the file. The previous view becomes invalid.
+	const BYTE* Map(ULONGLONG ullOffset, DWORD& dwLength)
+	{
+		Unmap();
+
+		if (m_hMapping == NULL || ullOffset >= m_ullFileSize) return NULL;
+		if (dwLength > m_ullFileSize - ullOffset) dwLength = (DWORD) (m_ullFileSize - ullOffset);
+
+		ULONGLONG ullViewOffset = ullOffset & ~((ULONGLONG) VIEW_GRANULARITY - 1);
+		DWORD     dwDelta = (DWORD) (ullOffset - ullViewOffset);
+
+		m_pView = (const BYTE*) ::MapViewOfFile(m_hMapping, FILE_MAP_READ, (DWORD) (ullViewOffset >> 32), (DWORD) ullViewOffset, dwDelta + dwLength);
+		return (m_pView != NULL ? m_pView + dwDelta : NULL);
+	}
+
+	void Unmap()
+	{
+		if (m_pView != NULL) ::UnmapViewOfFile(m_pView);
+		m_pView = NULL;
+	}
+};
+
+
+//------------------------------------------------------------------
+// Tag reader itself (stateless, all functions are class functions)
+//
+class CTagReader
+{
+  protected:
+	enum { MAX_HEADER_VIEW = 16 * 1024 * 1024 };	// Max size of a mapped header view (tags, metadata blocks, moov atom)
+
+  public:
+	// Read tags of the file. Returns false if the file type is not supported or the file could not be read.
+	static bool ReadTags(const std::wstring& strFileName, CTrackTags& objTags)
+	{
+		CMappedFileView objFile;
+
+		objTags.Clear();
+		if (!objFile.Open(strFileName)) return false;
+
+		DWORD dwLength = MAX_HEADER_VIEW;
+		const BYTE* pData = objFile.Map(0, dwLength);
+		if (pData == NULL || dwLength < 12) return false;
+
+		return ReadMappedTags(objFile, pData, dwLength, objTags);
+	}
+
+	// Name of a standard ID3v1 genre number (also used by MP4 "gnre" atom). NULL if unknown number.
+	static const WCHAR* GetStandardGenreName(size_t iGenre)
+	{
+		static const WCHAR* arrGenres[] = {
+			L"Blues", L"Classic Rock", L"Country", L"Dance", L"Disco", L"Funk", L"Grunge", L"Hip-Hop", L"Jazz", L"Metal",
+			L"New Age", L"Oldies", L"Other", L"Pop", L"R&B", L"Rap", L"Reggae", L"Rock", L"Techno", L"Industrial",
+			L"Alternative", L"Ska", L"Death Metal", L"Pranks", L"Soundtrack", L"Euro-Techno", L"Ambient", L"Trip-Hop", L"Vocal", L"Jazz+Funk",
+			L"Fusion", L"Trance", L"Classical", L"Instrumental", L"Acid", L"House", L"Game", L"Sound Clip", L"Gospel", L"Noise",
+			L"AlternRock", L"Bass", L"Soul", L"Punk", L"Space", L"Meditative", L"Instrumental Pop", L"Instrumental Rock", L"Ethnic", L"Gothic",
+			L"Darkwave", L"Techno-Industrial", L"Electronic", L"Pop-Folk", L"Eurodance", L"Dream", L"Southern Rock", L"Comedy", L"Cult", L"Gangsta",
+			L"Top 40", L"Christian Rap", L"Pop/Funk", L"Jungle", L"Native American", L"Cabaret", L"New Wave", L"Psychadelic", L"Rave", L"Showtunes",
+			L"Trailer", L"Lo-Fi", L"Tribal", L"Acid Punk", L"Acid Jazz", L"Polka", L"Retro", L"Musical", L"Rock & Roll", L"Hard Rock"
+		};
+
+		return (iGenre < sizeof(arrGenres) / sizeof(arrGenres[0]) ? arrGenres[iGenre] : NULL);
+	}
+
+  protected:
+	// Parse the mapped file header. Memory-mapped file raises an exception if the file can't be read 
+	// (network drive disconnected, file truncated while reading etc). Note! Separate function because 
+	// __try block can't be used in a function with C++ objects needing destructors.
+	static bool ReadMappedTags(CMappedFileView& objFile, const BYTE* pData, DWORD dwLength, CTrackTags& objTags)
+	{
+		__try
+		{
+			if (memcmp(pData, "ID3", 3) == 0 || IsMpegFrameHeader(pData))
+				return ReadMP3(pData, dwLength, objFile.GetFileSize(), objTags);
+
+			if (memcmp(pData, "fLaC", 4) == 0)
+				return ReadFLAC(pData, dwLength, objTags);
+
+			if (memcmp(pData + 4, "ftyp", 4) == 0)
+				return ReadMP4(objFile, objTags);
+		}
+		__except(EXCEPTION_EXECUTE_HANDLER)
+		{
+			objTags.Clear();
+		}
+
+		return false;
+	}
+
+	//
+	// Byte order helpers
+	//
+	static DWORD ReadBE32(const BYTE* p) { return ((DWORD) p[0] << 24) | ((DWORD) p[1] << 16) | ((DWORD) p[2] << 8) | p[3]; }
+	static DWORD ReadBE24(const BYTE* p) { return ((DWORD) p[0] << 16) | ((DWORD) p[1] << 8) | p[2]; }
+	static WORD  ReadBE16(const BYTE* p) { return (WORD) ((p[0] << 8) | p[1]); }
+	static DWORD ReadLE32(const BYTE* p) { return ((DWORD) p[3] << 24) | ((DWORD) p[2] << 16) | ((DWORD) p[1] << 8) | p[0]; }
+	static DWORD ReadSyncSafe32(const BYTE* p) { return ((DWORD) (p[0] & 0x7F) << 21) | ((DWORD) (p[1] & 0x7F) << 14) | ((DWORD) (p[2] & 0x7F) << 7) | (p[3] & 0x7F); }
+
+	//
+	// Text helpers. Values are truncated to the size of the target buffer.
+	//
+	static void CopyLatin1(const BYTE* pText, size_t iLen, WCHAR* szTarget, size_t iTargetSize)
+	{
+		size_t idx;
+		for (idx = 0; idx < iLen && idx < iTargetSize - 1 && pText[idx] != 0; idx++) szTarget[idx] = (WCHAR) pText[idx];
+		szTarget[idx] = L'\0';
+	}
+
+	static void CopyUTF8(const BYTE* pText, size_t iLen, WCHAR* szTarget, size_t iTargetSize)
+	{
+		while (iLen > 0 && pText[iLen - 1] == 0) iLen--;
+		int iChars = (iLen > 0 ? ::MultiByteToWideChar(CP_UTF8, 0, (LPCSTR) pText, (int) iLen, szTarget, (int) iTargetSize - 1) : 0);
+
+		// Too long text fails the conversion. Truncate the text and try again (cut may split a UTF-8 sequence, doesn't matter)
+		if (iChars == 0 && iLen >= iTargetSize)
+			iChars = ::MultiByteToWideChar(CP_UTF8, 0, (LPCSTR) pText, (int) iTargetSize - 1, szTarget, (int) iTargetSize - 1);
+
+		szTarget[iChars > 0 ? iChars : 0] = L'\0';
+	}
+
+	static void CopyUTF16(const BYTE* pText, size_t iLen, bool bBigEndian, WCHAR* szTarget, size_t iTargetSize)
+	{
+		size_t idx;
+		for (idx = 0; (idx * 2) + 1 < iLen && idx < iTargetSize - 1; idx++)
+		{
+			WCHAR wch = (bBigEndian ? (WCHAR) ((pText[idx * 2] << 8) | pText[idx * 2 + 1]) : (WCHAR) ((pText[idx * 2 + 1] << 8) | pText[idx * 2]));
+			if (wch == 0) break;
+			szTarget[idx] = wch;
+		}
+		szTarget[idx] = L'\0';
+	}
+
+	// Leading number of the text ("3/12" track number, "2009-05-01" date etc)
+	static DWORD ParseNumber(const WCHAR* szText)
+	{
+		DWORD dwValue = 0;
+		while (*szText == L' ' || *szText == L'(') szText++;
+		for (; *szText >= L'0' && *szText <= L'9'; szText++) dwValue = (dwValue * 10) + (*szText - L'0');
+		return dwValue;
+	}
+
+	// Genre text may be a standard genre number like "(17)" or "17" (old ID3 style)
+	static void SetGenre(const WCHAR* szGenre, CTrackTags& objTags)
+	{
+		const WCHAR* szName = NULL;
+		const WCHAR* szEnd = NULL;
+
+		if (szGenre[0] == L'(' || (szGenre[0] >= L'0' && szGenre[0] <= L'9'))
+		{
+			DWORD dwGenre = ParseNumber(szGenre);
+			szEnd = wcschr(szGenre, L')');
+
+			// "(17)Rock" style has the refined name after the number
+			if (szEnd != NULL && szEnd[1] != L'\0') szName = szEnd + 1;
+			else if (szEnd != NULL || wcsspn(szGenre, L"0123456789") == wcslen(szGenre)) szName = GetStandardGenreName(dwGenre);
+		}
+
+		wcsncpy_s(objTags.m_szGenre, (szName != NULL ? szName : szGenre), _TRUNCATE);
+	}
+
+	//
+	// MP3 files. ID3v2 tag (versions 2.2, 2.3 and 2.4) and duration from TLEN frame or MPEG audio headers.
+	//
+	static bool ReadMP3(const BYTE* pData, DWORD dwLength, ULONGLONG ullFileSize, CTrackTags& objTags)
+	{
+		DWORD dwAudioStart = 0;
+
+		if (memcmp(pData, "ID3", 3) == 0 && dwLength >= 10)
+		{
+			BYTE  bMajorVersion = pData[3];
+			BYTE  bFlags = pData[5];
+			DWORD dwTagSize = ReadSyncSafe32(pData + 6);
+
+			dwAudioStart = 10 + dwTagSize + ((bFlags & 0x10) ? 10 : 0);
+
+			// Unsynchronised tags are rare and would need a copy of the data to parse. Duration is still read.
+			if ((bFlags & 0x80) == 0 && bMajorVersion >= 2 && bMajorVersion <= 4)
+				ReadID3v2Frames(pData, (dwAudioStart < dwLength ? dwAudioStart : dwLength), bMajorVersion, bFlags, objTags);
+		}
+
+		if (objTags.m_dwDurationMS == 0 && dwAudioStart < dwLength)
+			objTags.m_dwDurationMS = ReadMpegDuration(pData + dwAudioStart, dwLength - dwAudioStart, ullFileSize - dwAudioStart);
+
+		return true;
+	}
+
+	static void ReadID3v2Frames(const BYTE* pData, DWORD dwTagEnd, BYTE bMajorVersion, BYTE bFlags, CTrackTags& objTags)
+	{
+		WCHAR szValue[CTrackTags::MAX_TEXT_LEN];
+		DWORD dwPos = 10;
+
+		// ID3v2.2 has 3 char frame IDs and 3 byte sizes. Versions 2.3 and 2.4 have 4 char IDs, 4 byte sizes and flags
+		DWORD dwIDLen = (bMajorVersion == 2 ? 3 : 4);
+		DWORD dwHeaderLen = (bMajorVersion == 2 ? 6 : 10);
+
+		// Skip extended header (v2.3 size excludes the size field itself, v2.4 size is syncsafe and includes it)
+		if ((bFlags & 0x40) && bMajorVersion >= 3 && dwPos + 4 <= dwTagEnd)
+			dwPos += (bMajorVersion == 3 ? 4 + ReadBE32(pData + dwPos) : ReadSyncSafe32(pData + dwPos));
+
+		while (dwPos + dwHeaderLen <= dwTagEnd && pData[dwPos] != 0)
+		{
+			const BYTE* pFrame = pData + dwPos;
+			DWORD dwFrameSize;
+
+			if (bMajorVersion == 2) dwFrameSize = ReadBE24(pFrame + 3);
+			else if (bMajorVersion == 3) dwFrameSize = ReadBE32(pFrame + 4);
+			else dwFrameSize = ReadSyncSafe32(pFrame + 4);
+
+			if (dwFrameSize > dwTagEnd - dwPos - dwHeaderLen) break;	// Corrupted tag
+
+			// Only text frames are interesting ("T" prefix), and those are small. Compressed, encrypted, grouped
+			// and unsynchronised v2.3+ frames are skipped (those have extra data before the text)
+			bool bPlainFrame = (bMajorVersion == 2 || (pFrame[9] & (bMajorVersion == 3 ? 0xE0 : 0x4F)) == 0);
+			if (pFrame[0] == 'T' && dwFrameSize > 1 && bPlainFrame)
+			{
+				ReadID3v2Text(pFrame + dwHeaderLen, dwFrameSize, szValue, CTrackTags::MAX_TEXT_LEN);
+
+				if      (IsFrame(pFrame, dwIDLen, "TIT2", "TT2")) wcsncpy_s(objTags.m_szTitle,  szValue, _TRUNCATE);
+				else if (IsFrame(pFrame, dwIDLen, "TPE1", "TP1")) wcsncpy_s(objTags.m_szArtist, szValue, _TRUNCATE);
+				else if (IsFrame(pFrame, dwIDLen, "TALB", "TAL")) wcsncpy_s(objTags.m_szAlbum,  szValue, _TRUNCATE);
+				else if (IsFrame(pFrame, dwIDLen, "TCON", "TCO")) SetGenre(szValue, objTags);
+				else if (IsFrame(pFrame, dwIDLen, "TRCK", "TRK")) objTags.m_wTrackNumber = (WORD) ParseNumber(szValue);
+				else if (IsFrame(pFrame, dwIDLen, "TLEN", "TLE")) objTags.m_dwDurationMS = ParseNumber(szValue);
+				else if (IsFrame(pFrame, dwIDLen, "TYER", "TYE") || IsFrame(pFrame, dwIDLen, "TDRC", "TDR")) objTags.m_wYear = (WORD) ParseNumber(szValue);
+			}
+
+			dwPos += dwHeaderLen + dwFrameSize;
+		}
+	}
+
+	static bool IsFrame(const BYTE* pFrame, DWORD dwIDLen, const char* szID, const char* szID22)
+	{
+		return memcmp(pFrame, (dwIDLen == 4 ? szID : szID22), dwIDLen) == 0;
+	}
+
+	// ID3v2 text frame: encoding byte + text (0=ISO-8859-1, 1=UTF-16 with BOM, 2=UTF-16BE, 3=UTF-8)
+	static void ReadID3v2Text(const BYTE* pText, DWORD dwSize, WCHAR* szTarget, size_t iTargetSize)
+	{
+		BYTE bEncoding = pText[0];
+		pText++;
+		dwSize--;
+
+		if (bEncoding == 1 && dwSize >= 2)
+		{
+			bool bBigEndian = (pText[0] == 0xFE && pText[1] == 0xFF);
+			if ((pText[0] == 0xFE && pText[1] == 0xFF) || (pText[0] == 0xFF && pText[1] == 0xFE))
+			{
+				pText += 2;
+				dwSize -= 2;
+			}
+			CopyUTF16(pText, dwSize, bBigEndian, szTarget, iTargetSize);
+		}
+		else if (bEncoding == 2) CopyUTF16(pText, dwSize, true, szTarget, iTargetSize);
+		else if (bEncoding == 3) CopyUTF8(pText, dwSize, szTarget, iTargetSize);
+		else CopyLatin1(pText, dwSize, szTarget, iTargetSize);
+	}
+
+	// Is the data a valid MPEG audio frame header (sync bits, version, layer, bitrate and samplerate fields)?
+	static bool IsMpegFrameHeader(const BYTE* p)
+	{
+		return (p[0] == 0xFF && (p[1] & 0xE0) == 0xE0 && ((p[1] >> 3) & 0x03) != 1 && ((p[1] >> 1) & 0x03) != 0 &&
+		        (p[2] >> 4) != 0x0F && (p[2] >> 4) != 0 && ((p[2] >> 2) & 0x03) != 3);
+	}
+
+	//
+	// Duration of MPEG audio stream. Uses Xing/Info or VBRI frame count if the first frame has one,
+	// otherwise assumes constant bitrate and calculates the duration from the size of the audio data.
+	//
+	static DWORD ReadMpegDuration(const BYTE* pData, DWORD dwLength, ULONGLONG ullAudioSize)
+	{
+		static const WORD arrBitratesV1[3][15] = {
+			{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },	// Layer I
+			{ 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384 },	// Layer II
+			{ 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320 }	// Layer III
+		};
+		static const WORD arrBitratesV2[3][15] = {
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },		// Layer I
+			{ 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160 },		// Layer II
+			{ 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160 }		// Layer III
+		};
+		static const DWORD arrSampleRates[3] = { 44100, 48000, 32000 };
+
+		// Find the first frame header (there may be padding after the ID3 tag)
+		DWORD dwPos;
+		for (dwPos = 0; dwPos + 4 <= dwLength && dwPos < 8192; dwPos++)
+			if (IsMpegFrameHeader(pData + dwPos)) break;
+
+		if (dwPos + 4 > dwLength || dwPos >= 8192) return 0;
+
+		const BYTE* pFrame = pData + dwPos;
+		int   iVersion  = (pFrame[1] >> 3) & 0x03;			// 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+		int   iLayer    = 3 - ((pFrame[1] >> 1) & 0x03);	// 0 = Layer I, 1 = Layer II, 2 = Layer III
+		DWORD dwBitrate = (iVersion == 3 ? arrBitratesV1 : arrBitratesV2)[iLayer][pFrame[2] >> 4] * 1000;
+		DWORD dwSampleRate = arrSampleRates[(pFrame[2] >> 2) & 0x03] >> (iVersion == 3 ? 0 : (iVersion == 2 ? 1 : 2));
+		bool  bMono = ((pFrame[3] >> 6) == 3);
+
+		DWORD dwSamplesPerFrame = (iLayer == 0 ? 384 : ((iLayer == 2 && iVersion != 3) ? 576 : 1152));
+
+		// Xing/Info header is right after the side info of the first Layer III frame
+		DWORD dwSideInfoSize = (iVersion == 3 ? (bMono ? 17 : 32) : (bMono ? 9 : 17));
+		DWORD dwFrameCount = 0;
+
+		if (dwPos + 4 + dwSideInfoSize + 12 <= dwLength)
+		{
+			const BYTE* pXing = pFrame + 4 + dwSideInfoSize;
+			if ((memcmp(pXing, "Xing", 4) == 0 || memcmp(pXing, "Info", 4) == 0) && (ReadBE32(pXing + 4) & 0x01))
+				dwFrameCount = ReadBE32(pXing + 8);
+		}
+
+		if (dwFrameCount == 0 && dwPos + 4 + 32 + 18 <= dwLength && memcmp(pFrame + 4 + 32, "VBRI", 4) == 0)
+			dwFrameCount = ReadBE32(pFrame + 4 + 32 + 14);
+
+		if (dwFrameCount > 0 && dwSampleRate > 0)
+			return (DWORD) (((ULONGLONG) dwFrameCount * dwSamplesPerFrame * 1000) / dwSampleRate);
+
+		if (dwBitrate > 0)
+			return (DWORD) (((ullAudioSize - dwPos) * 8 * 1000) / dwBitrate);
+
+		return 0;
+	}
+
+	//
+	// FLAC files. Duration from STREAMINFO block and tags from VORBIS_COMMENT block.
+	//
+	static bool ReadFLAC(const BYTE* pData, DWORD dwLength, CTrackTags& objTags)
+	{
+		DWORD dwPos = 4;
+		bool  bLastBlock = false;
+
+		while (!bLastBlock && dwPos + 4 <= dwLength)
+		{
+			BYTE  bBlockType  = pData[dwPos] & 0x7F;
+			DWORD dwBlockSize = ReadBE24(pData + dwPos + 1);
+			bLastBlock = ((pData[dwPos] & 0x80) != 0);
+
+			dwPos += 4;
+			if (dwBlockSize > dwLength - dwPos) break;
+
+			const BYTE* pBlock = pData + dwPos;
+
+			if (bBlockType == 0 && dwBlockSize >= 18)
+			{
+				// STREAMINFO: 20 bit sample rate and 36 bit total sample count
+				DWORD dwSampleRate = ((DWORD) pBlock[10] << 12) | ((DWORD) pBlock[11] << 4) | (pBlock[12] >> 4);
+				ULONGLONG ullSamples = ((ULONGLONG) (pBlock[13] & 0x0F) << 32) | ReadBE32(pBlock + 14);
+
+				if (dwSampleRate > 0) objTags.m_dwDurationMS = (DWORD) ((ullSamples * 1000) / dwSampleRate);
+			}
+			else if (bBlockType == 4)
+			{
+				ReadVorbisComments(pBlock, dwBlockSize, objTags);
+			}
+
+			dwPos += dwBlockSize;
+		}
+
+		return true;
+	}
+
+	// VORBIS_COMMENT block: little-endian lengths, "KEY=value" UTF-8 entries
+	static void ReadVorbisComments(const BYTE* pBlock, DWORD dwBlockSize, CTrackTags& objTags)
+	{
+		WCHAR szValue[CTrackTags::MAX_TEXT_LEN];
+
+		if (dwBlockSize < 8) return;
+		DWORD dwPos = 4 + ReadLE32(pBlock);	// Skip vendor string
+		if (dwPos + 4 > dwBlockSize) return;
+
+		DWORD dwCount = ReadLE32(pBlock + dwPos);
+		dwPos += 4;
+
+		for (DWORD idx = 0; idx < dwCount && dwPos + 4 <= dwBlockSize; idx++)
+		{
+			DWORD dwEntryLen = ReadLE32(pBlock + dwPos);
+			dwPos += 4;
+			if (dwEntryLen > dwBlockSize - dwPos) break;
+
+			const char* pEntry = (const char*) pBlock + dwPos;
+			const char* pValue = (const char*) memchr(pEntry, '=', dwEntryLen);
+			dwPos += dwEntryLen;
+
+			if (pValue == NULL) continue;
+
+			size_t iKeyLen = pValue - pEntry;
+			pValue++;
+			CopyUTF8((const BYTE*) pValue, dwEntryLen - iKeyLen - 1, szValue, CTrackTags::MAX_TEXT_LEN);
+
+			if      (IsVorbisKey(pEntry, iKeyLen, "TITLE"))       wcsncpy_s(objTags.m_szTitle,  szValue, _TRUNCATE);
+			else if (IsVorbisKey(pEntry, iKeyLen, "ARTIST"))      wcsncpy_s(objTags.m_szArtist, szValue, _TRUNCATE);
+			else if (IsVorbisKey(pEntry, iKeyLen, "ALBUM"))       wcsncpy_s(objTags.m_szAlbum,  szValue, _TRUNCATE);
+			else if (IsVorbisKey(pEntry, iKeyLen, "GENRE"))       wcsncpy_s(objTags.m_szGenre,  szValue, _TRUNCATE);
+			else if (IsVorbisKey(pEntry, iKeyLen, "DATE"))        objTags.m_wYear = (WORD) ParseNumber(szValue);
+			else if (IsVorbisKey(pEntry, iKeyLen, "TRACKNUMBER")) objTags.m_wTrackNumber = (WORD) ParseNumber(szValue);
+		}
+	}
+
+	// Vorbis comment keys are case-insensitive ASCII
+	static bool IsVorbisKey(const char* pKey, size_t iKeyLen, const char* szName)
+	{
+		return (iKeyLen == strlen(szName) && _strnicmp(pKey, szName, iKeyLen) == 0);
+	}
+
+	//
+	// MP4/M4A files. Duration from "moov/mvhd" atom and tags from iTunes style "moov/udta/meta/ilst" atoms.
+	//
+	static bool ReadMP4(CMappedFileView& objFile, CTrackTags& objTags)
+	{
+		ULONGLONG ullPos = 0;
+		ULONGLONG ullFileSize = objFile.GetFileSize();
+
+		// Find the top level "moov" atom. Map only the atom headers while skipping "mdat" and other big atoms.
+		while (ullPos + 8 <= ullFileSize)
+		{
+			DWORD dwLength = 16;
+			const BYTE* pAtom = objFile.Map(ullPos, dwLength);
+			if (pAtom == NULL || dwLength < 8) return false;
+
+			ULONGLONG ullAtomSize = ReadBE32(pAtom);
+			DWORD     dwHeaderSize = 8;
+
+			if (ullAtomSize == 1 && dwLength >= 16)
+			{
+				ullAtomSize = ((ULONGLONG) ReadBE32(pAtom + 8) << 32) | ReadBE32(pAtom + 12);
+				dwHeaderSize = 16;
+			}
+			else if (ullAtomSize == 0) ullAtomSize = ullFileSize - ullPos;	// Atom extends to the end of the file
+
+			if (ullAtomSize < dwHeaderSize) return false;
+
+			if (memcmp(pAtom + 4, "moov", 4) == 0)
+			{
+				if (ullAtomSize > MAX_HEADER_VIEW) return false;
+
+				dwLength = (DWORD) ullAtomSize - dwHeaderSize;
+				const BYTE* pMoov = objFile.Map(ullPos + dwHeaderSize, dwLength);
+				if (pMoov == NULL) return false;
+
+				ReadMP4Moov(pMoov, dwLength, objTags);
+				return true;
+			}
+
+			ullPos += ullAtomSize;
+		}
+
+		return false;
+	}
+
+	// Find a child atom of the given type. Returns pointer to the atom payload and its size.
+	static const BYTE* FindMP4Atom(const BYTE* pData, DWORD dwLength, const char* szType, DWORD& dwAtomLength)
+	{
+		DWORD dwPos = 0;
+
+		while (dwPos + 8 <= dwLength)
+		{
+			DWORD dwAtomSize = ReadBE32(pData + dwPos);
+			if (dwAtomSize < 8 || dwAtomSize > dwLength - dwPos) break;
+
+			if (memcmp(pData + dwPos + 4, szType, 4) == 0)
+			{
+				dwAtomLength = dwAtomSize - 8;
+				return pData + dwPos + 8;
+			}
+
+			dwPos += dwAtomSize;
+		}
+
+		return NULL;
+	}
+
+	static void ReadMP4Moov(const BYTE* pMoov, DWORD dwMoovLength, CTrackTags& objTags)
+	{
+		DWORD dwLength;
+
+		// mvhd: version(1) flags(3) and then v0: created(4) modified(4) timescale(4) duration(4), v1: created(8) modified(8) timescale(4) duration(8)
+		const BYTE* pMvhd = FindMP4Atom(pMoov, dwMoovLength, "mvhd", dwLength);
+		if (pMvhd != NULL && dwLength >= 32)
+		{
+			DWORD dwTimeScale;
+			ULONGLONG ullDuration;
+
+			if (pMvhd[0] == 1)
+			{
+				dwTimeScale = ReadBE32(pMvhd + 20);
+				ullDuration = ((ULONGLONG) ReadBE32(pMvhd + 24) << 32) | ReadBE32(pMvhd + 28);
+			}
+			else
+			{
+				dwTimeScale = ReadBE32(pMvhd + 12);
+				ullDuration = ReadBE32(pMvhd + 16);
+			}
+
+			if (dwTimeScale > 0) objTags.m_dwDurationMS = (DWORD) ((ullDuration * 1000) / dwTimeScale);
+		}
+
+		const BYTE* pUdta = FindMP4Atom(pMoov, dwMoovLength, "udta", dwLength);
+		const BYTE* pMeta = (pUdta != NULL ? FindMP4Atom(pUdta, dwLength, "meta", dwLength) : NULL);
+		if (pMeta == NULL || dwLength < 4) return;
+
+		// "meta" is a full atom (version and flags before the child atoms)
+		const BYTE* pIlst = FindMP4Atom(pMeta + 4, dwLength - 4, "ilst", dwLength);
+		if (pIlst == NULL) return;
+
+		DWORD dwPos = 0;
+		while (dwPos + 8 <= dwLength)
+		{
+			DWORD dwItemSize = ReadBE32(pIlst + dwPos);
+			if (dwItemSize < 8 || dwItemSize > dwLength - dwPos) break;
+
+			const BYTE* pItemType = pIlst + dwPos + 4;
+			DWORD dwDataLength;
+			const BYTE* pData = FindMP4Atom(pIlst + dwPos + 8, dwItemSize - 8, "data", dwDataLength);
+
+			// "data" atom: type(4) locale(4) value
+			if (pData != NULL && dwDataLength >= 8) ReadMP4Item(pItemType, pData + 8, dwDataLength - 8, objTags);
+
+			dwPos += dwItemSize;
+		}
+	}
+
+	static void ReadMP4Item(const BYTE* pItemType, const BYTE* pValue, DWORD dwValueLength, CTrackTags& objTags)
+	{
+		WCHAR szValue[CTrackTags::MAX_TEXT_LEN];
+
+		// Text items have 0xA9 ("copyright" char) prefix
+		if (pItemType[0] == 0xA9)
+		{
+			CopyUTF8(pValue, dwValueLength, szValue, CTrackTags::MAX_TEXT_LEN);
+
+			if      (memcmp(pItemType + 1, "nam", 3) == 0) wcsncpy_s(objTags.m_szTitle,  szValue, _TRUNCATE);
+			else if (memcmp(pItemType + 1, "ART", 3) == 0) wcsncpy_s(objTags.m_szArtist, szValue, _TRUNCATE);
+			else if (memcmp(pItemType + 1, "alb", 3) == 0) wcsncpy_s(objTags.m_szAlbum,  szValue, _TRUNCATE);
+			else if (memcmp(pItemType + 1, "gen", 3) == 0) wcsncpy_s(objTags.m_szGenre,  szValue, _TRUNCATE);
+			else if (memcmp(pItemType + 1, "day", 3) == 0) objTags.m_wYear = (WORD) ParseNumber(szValue);
+		}
+		else if (memcmp(pItemType, "trkn", 4) == 0 && dwValueLength >= 4)
+		{
+			objTags.m_wTrackNumber = ReadBE16(pValue + 2);
+		}
+		else if (memcmp(pItemType, "gnre", 4) == 0 && dwValueLength >= 2 && objTags.m_szGenre[0] == L'\0')
+		{
+			// Standard ID3v1 genre number plus one
+			WORD wGenre = ReadBE16(pValue);
+			const WCHAR* szGenre = (wGenre > 0 ? GetStandardGenreName(wGenre - 1) : NULL);
+			if (szGenre != NULL) wcsncpy_s(objTags.m_szGenre, szGenre, _TRUNCATE);
+		}
+	}
+};
+
+#endif //__CTAGREADER_H__
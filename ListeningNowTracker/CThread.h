@@ -142,10 +142,12 @@ class CThread
 
 			m_ThreadCtx.m_pUserData = arg;
 
+			// Create a "stop thread" event handle (the main process can signal the thread to quit). Note! The event
+			// must exist before the thread starts, because the thread may wait on it before _beginthreadex returns.
+			if (m_ThreadCtx.m_hStopEvent == NULL) m_ThreadCtx.m_hStopEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+
 			// Begin a new thread and call handler function with threadCtx object pointer as parameter.
-			// If thread creation succeeded then create a "stop thread" event handle (themain process can signal the thread to quit)
 			m_ThreadCtx.m_hThread = (HANDLE) _beginthreadex(NULL, 0, m_pThreadFunc, &m_ThreadCtx, 0, &m_ThreadCtx.m_dwTID);
-			if (m_ThreadCtx.m_hThread != 0) m_ThreadCtx.m_hStopEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
 
 			m_ThreadCtx.m_dwExitCode = (DWORD)-1;
 
@@ -204,6 +206,14 @@ class CThread
 		}
 
 
+		/*
+		 *	Handle of the running thread (NULL if not started). Can be used to wait for the thread to exit.
+		 */
+		HANDLE GetHandle() const
+		{
+			return m_ThreadCtx.m_hThread;
+		}
+
 		/*
 		 *	Attaches a Thread handler function pointer to the thread object.
 		 *	Start method calls this handler function when thread is started.
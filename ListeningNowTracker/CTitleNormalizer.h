@@ -0,0 +1,526 @@
+#ifndef __CTITLENORMALIZER_H__
+#define __CTITLENORMALIZER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "CTrackEvent.h"
+
+/*
+ * Normalization of track titles. Players send titles like "Song - 2009 Remaster", "Song (feat. X)"
+ * or "Song - Live at Wembley", so the same song shows up with many different texts. Normalizer
+ * removes or rewrites these parts with rules defined in INI file [NORMALIZE] section
+ *
+ *   Rule=cut " - # Remaster"		Cut the text from the match to the end of the field
+ *   Rule=strip " [Explicit]"		Remove the matched text
+ *   Rule=rewrite " & " " and "		Replace the matched text
+ *   Rule=feat " (feat. "			Move the featured artists (up to ")" or "]") to the artist field
+ *
+ * Patterns are case-insensitive. "#" matches one or more digits, "?" any one char and "\" makes
+ * the next char a literal char. A "#" at the end of a pattern takes all the digits, so strip " - #"
+ * removes the whole year of "Song - 2009".
+ *
+ * All rules are compiled once into a single DFA over char classes (subset construction), so
+ * a field is normalized in one pass without backtracking and the cost per char doesn't depend on
+ * the number of rules. When the DFA reaches an accepting state the start of the match is found by
+ * walking the matched pattern backwards (only the matched chars, see FindMatchStart). After a match
+ * the DFA restarts, so matches do not overlap. If several rules end at the same char then the
+ * rule defined first wins.
+*/
+
+class CTitleNormalizer
+{
+  public:
+	enum { MAX_DFA_STATES = 16384, MAX_PATTERN_LEN = 64 };
+
+	enum EAction { ACTION_CUT, ACTION_STRIP, ACTION_REWRITE, ACTION_FEAT };
+
+	// Results of the latest Compile call (reported in "/trace" mode)
+	struct CCompileStats
+	{
+		DWORD dwRuleCount;
+		DWORD dwInvalidRuleCount;	// Syntax errors (these rules are ignored)
+		DWORD dwStateCount;
+		DWORD dwClassCount;
+		DWORD dwTableBytes;
+		bool  bTooManyStates;		// DFA grew over MAX_DFA_STATES (normalization is disabled)
+	};
+
+  protected:
+	enum { ELEM_LITERAL, ELEM_ANY, ELEM_DIGITS };
+	enum { CLASS_OTHER = 0, CLASS_DIGIT = 1, NO_RULE = 0xFFFF };
+
+	struct CElement
+	{
+		int   iType;
+		WCHAR chLiteral;			// Lowercase char (ELEM_LITERAL)
+		WORD  wClass;				// Char class of the literal char
+	};
+
+	struct CRule
+	{
+		EAction               eAction;
+		std::vector<CElement> arrElements;
+		std::wstring          strReplacement;
+		DWORD                 dwFirstState;		// NFA state id of "first element matched" (see Compile)
+	};
+
+	std::vector<CRule> m_arrRules;
+
+	// Char class tables. Chars which are not in any pattern share the same class.
+	WORD  m_arrAsciiClass[128];
+	std::vector<std::pair<WCHAR, WORD> > m_arrWideClass;	// Non-ASCII pattern chars (lowercase), sorted by char
+	std::vector<BYTE> m_arrDigitClass;						// 1 = Class matches "#"
+	WORD  m_wClassCount;
+
+	std::vector<WORD> m_arrTransitions;		// Next DFA state by [state * m_wClassCount + class]. State 0 = start state
+	std::vector<WORD> m_arrAcceptRule;		// Rule matched in the DFA state (NO_RULE = not an accepting state)
+
+	bool m_bCaseFold;
+	CCompileStats m_objStats;
+
+  public:
+	CTitleNormalizer()
+	{
+		m_bCaseFold = false;
+		m_wClassCount = 0;
+		ZeroMemory(&m_objStats, sizeof(m_objStats));
+	}
+
+	bool IsEnabled() const { return !m_arrTransitions.empty(); }
+
+	const CCompileStats& GetStats() const { return m_objStats; }
+
+	// Built-in rules used when INI file doesn't have any rules
+	static std::vector<std::wstring> GetDefaultRules()
+	{
+		static const WCHAR* arrDefaults[] = {
+			L"cut \" - # Remaster\"",
+			L"cut \" - Remaster\"",
+			L"cut \" (# Remaster\"",
+			L"cut \" (Remaster\"",
+			L"cut \" [Remaster\"",
+			L"cut \" - Live at \"",
+			L"cut \" - Live from \"",
+			L"cut \" (Live at \"",
+			L"cut \" (Deluxe\"",
+			L"cut \" [Deluxe\"",
+			L"feat \" (feat. \"",
+			L"feat \" [feat. \"",
+			L"feat \" (ft. \"",
+			L"feat \" feat. \"",
+			L"feat \" ft. \"",
+		};
+
+		return std::vector<std::wstring>(arrDefaults, arrDefaults + (sizeof(arrDefaults) / sizeof(arrDefaults[0])));
+	}
+
+	//
+	// Compile the rules (INI file "Rule" values) into the DFA. Invalid rules are ignored. Returns false
+	// if there are no valid rules or the DFA grows too big (normalization is disabled then).
+	//
+	bool Compile(const std::vector<std::wstring>& arrRuleTexts, bool bCaseFold)
+	{
+		m_arrRules.clear();
+		m_arrWideClass.clear();
+		m_arrTransitions.clear();
+		m_arrAcceptRule.clear();
+		ZeroMemory(&m_objStats, sizeof(m_objStats));
+		m_bCaseFold = bCaseFold;
+
+		for (size_t idx = 0; idx < arrRuleTexts.size() && m_arrRules.size() < NO_RULE; idx++)
+		{
+			CRule objRule;
+			if (ParseRule(arrRuleTexts[idx].c_str(), objRule)) m_arrRules.push_back(objRule);
+			else m_objStats.dwInvalidRuleCount++;
+		}
+
+		m_objStats.dwRuleCount = (DWORD) m_arrRules.size();
+		if (m_arrRules.empty()) return false;
+
+		BuildCharClasses();
+		if (!BuildDFA())
+		{
+			m_objStats.bTooManyStates = true;
+			m_arrTransitions.clear();
+			m_arrAcceptRule.clear();
+			return false;
+		}
+
+		m_objStats.dwStateCount = (DWORD) m_arrAcceptRule.size();
+		m_objStats.dwClassCount = m_wClassCount;
+		m_objStats.dwTableBytes = (DWORD) (m_arrTransitions.size() * sizeof(WORD));
+		return true;
+	}
+
+	//
+	// Normalize title, artist and album of the event. Featured artists of the title and artist
+	// fields are appended to the artist field.
+	//
+	void NormalizeEvent(CTrackEvent& objEvent) const
+	{
+		WCHAR szOutput[CTrackEvent::MAX_FIELD_LEN];
+		WCHAR szFeatured[CTrackEvent::MAX_FIELD_LEN];
+
+		if (!IsEnabled()) return;
+
+		szFeatured[0] = L'\0';
+
+		if (NormalizeField(objEvent.m_szTitle, szOutput, CTrackEvent::MAX_FIELD_LEN, szFeatured, CTrackEvent::MAX_FIELD_LEN))
+			wcsncpy_s(objEvent.m_szTitle, szOutput, _TRUNCATE);
+
+		if (NormalizeField(objEvent.m_szAlbum, szOutput, CTrackEvent::MAX_FIELD_LEN, NULL, 0))
+			wcsncpy_s(objEvent.m_szAlbum, szOutput, _TRUNCATE);
+
+		if (NormalizeField(objEvent.m_szArtist, szOutput, CTrackEvent::MAX_FIELD_LEN, szFeatured, CTrackEvent::MAX_FIELD_LEN))
+			wcsncpy_s(objEvent.m_szArtist, szOutput, _TRUNCATE);
+
+		if (szFeatured[0] != L'\0')
+		{
+			if (objEvent.m_szArtist[0] != L'\0') wcsncat_s(objEvent.m_szArtist, L", ", _TRUNCATE);
+			wcsncat_s(objEvent.m_szArtist, szFeatured, _TRUNCATE);
+		}
+	}
+
+	//
+	// Normalize one text field. Featured artists are appended to szFeatured (NULL = featured artists
+	// are removed). Returns false if nothing was changed (szOutput and szFeatured are not set then).
+	//
+	bool NormalizeField(const WCHAR* szText, WCHAR* szOutput, size_t iOutputSize, WCHAR* szFeatured, size_t iFeaturedSize) const
+	{
+		WCHAR szFieldFeatured[CTrackEvent::MAX_FIELD_LEN];
+
+		if (!IsEnabled() || iOutputSize == 0) return false;
+
+		szFieldFeatured[0] = L'\0';
+
+		size_t iLen     = wcslen(szText);
+		size_t iPos     = 0;
+		size_t iRestart = 0;	// Position where the DFA was (re)started
+		size_t iOutLen  = 0;	// Logical output length. Chars beyond the buffer are dropped, but counted
+		WORD   wState   = 0;
+		bool   bModified = m_bCaseFold;
+
+		while (iPos < iLen)
+		{
+			WCHAR ch = szText[iPos++];
+
+			wState = m_arrTransitions[(size_t) wState * m_wClassCount + ClassOf(ch)];
+			AppendChar(szOutput, iOutputSize, iOutLen, m_bCaseFold ? FoldChar(ch) : ch);
+
+			WORD wRule = m_arrAcceptRule[wState];
+			if (wRule == NO_RULE) continue;
+
+			// Matched chars were copied to the output as such, so the match is removed by "rewinding" the output
+			const CRule& objRule = m_arrRules[wRule];
+
+			// Trailing "#" is greedy. The DFA accepts at the first digit, the rest of the number is part of the match.
+			if (objRule.arrElements.back().iType == ELEM_DIGITS)
+				while (iPos < iLen && IsDigit(szText[iPos])) AppendChar(szOutput, iOutputSize, iOutLen, szText[iPos++]);
+
+			iOutLen -= iPos - FindMatchStart(objRule, szText, iPos, iRestart);
+			bModified = true;
+
+			switch (objRule.eAction)
+			{
+				case ACTION_CUT:
+					iPos = iLen;
+					break;
+
+				case ACTION_STRIP:
+					break;
+
+				case ACTION_REWRITE:
+					for (size_t idx = 0; idx < objRule.strReplacement.size(); idx++)
+						AppendChar(szOutput, iOutputSize, iOutLen, objRule.strReplacement[idx]);
+					break;
+
+				case ACTION_FEAT:
+				{
+					size_t iEnd = iPos;
+					while (iEnd < iLen && szText[iEnd] != L')' && szText[iEnd] != L']') iEnd++;
+
+					if (szFeatured != NULL) AppendFeatured(szFieldFeatured, CTrackEvent::MAX_FIELD_LEN, szText + iPos, iEnd - iPos);
+					iPos = (iEnd < iLen ? iEnd + 1 : iLen);
+					break;
+				}
+			}
+
+			wState = 0;
+			iRestart = iPos;
+		}
+
+		if (!bModified) return false;
+
+		if (iOutLen > iOutputSize - 1) iOutLen = iOutputSize - 1;
+		while (iOutLen > 0 && szOutput[iOutLen - 1] == L' ') iOutLen--;
+		szOutput[iOutLen] = L'\0';
+
+		// Never normalize a field to an empty text (the whole title matched a rule). The featured
+		// artists are kept in the field then, so they are not added to the artist field either.
+		if (iOutLen == 0) return false;
+
+		if (szFieldFeatured[0] != L'\0') AppendFeatured(szFeatured, iFeaturedSize, szFieldFeatured, wcslen(szFieldFeatured));
+		return true;
+	}
+
+  protected:
+	static WCHAR FoldChar(WCHAR ch)
+	{
+		if (ch < 128) return (ch >= L'A' && ch <= L'Z' ? ch + (L'a' - L'A') : ch);
+		return (WCHAR) towlower(ch);
+	}
+
+	static bool IsDigit(WCHAR ch)
+	{
+		return (ch >= L'0' && ch <= L'9');
+	}
+
+	WORD ClassOf(WCHAR ch) const
+	{
+		if (ch < 128) return m_arrAsciiClass[ch];
+
+		WCHAR chFolded = (WCHAR) towlower(ch);
+		std::vector<std::pair<WCHAR, WORD> >::const_iterator it = std::lower_bound(m_arrWideClass.begin(), m_arrWideClass.end(), std::make_pair(chFolded, (WORD) 0));
+		return (it != m_arrWideClass.end() && it->first == chFolded ? it->second : (WORD) CLASS_OTHER);
+	}
+
+	static void AppendChar(WCHAR* szOutput, size_t iOutputSize, size_t& iOutLen, WCHAR ch)
+	{
+		if (iOutLen < iOutputSize - 1) szOutput[iOutLen] = ch;
+		iOutLen++;
+	}
+
+	static void AppendFeatured(WCHAR* szFeatured, size_t iFeaturedSize, const WCHAR* szText, size_t iLen)
+	{
+		while (iLen > 0 && szText[0] == L' ') { szText++; iLen--; }
+		while (iLen > 0 && szText[iLen - 1] == L' ') iLen--;
+		if (iLen == 0) return;
+
+		if (szFeatured[0] != L'\0') wcsncat_s(szFeatured, iFeaturedSize, L", ", _TRUNCATE);
+		wcsncat_s(szFeatured, iFeaturedSize, szText, (iLen < iFeaturedSize ? iLen : _TRUNCATE));
+	}
+
+	//
+	// Start of the match which ends at iEnd. Walks the pattern backwards. "#" takes all the digits,
+	// which is unambiguous because ParseRule doesn't allow a digit or "?" next to "#".
+	//
+	static size_t FindMatchStart(const CRule& objRule, const WCHAR* szText, size_t iEnd, size_t iMin)
+	{
+		size_t iPos = iEnd;
+
+		for (size_t idx = objRule.arrElements.size(); idx > 0 && iPos > iMin; idx--)
+		{
+			if (objRule.arrElements[idx - 1].iType == ELEM_DIGITS)
+			{
+				while (iPos > iMin && IsDigit(szText[iPos - 1])) iPos--;
+			}
+			else iPos--;
+		}
+
+		return iPos;
+	}
+
+	// Parse <action> "<pattern>" ["<replacement>"]
+	bool ParseRule(const WCHAR* szText, CRule& objRule) const
+	{
+		std::wstring strAction, strPattern;
+
+		while (*szText == L' ' || *szText == L'\t') szText++;
+		while (iswalpha(*szText)) strAction += (WCHAR) towlower(*szText++);
+
+		if      (strAction == L"cut")     objRule.eAction = ACTION_CUT;
+		else if (strAction == L"strip")   objRule.eAction = ACTION_STRIP;
+		else if (strAction == L"rewrite") objRule.eAction = ACTION_REWRITE;
+		else if (strAction == L"feat")    objRule.eAction = ACTION_FEAT;
+		else return false;
+
+		if (!ReadQuoted(szText, strPattern) || strPattern.empty()) return false;
+		if (objRule.eAction == ACTION_REWRITE && !ReadQuoted(szText, objRule.strReplacement)) return false;
+
+		objRule.dwFirstState = 0;
+		objRule.arrElements.clear();
+
+		for (size_t idx = 0; idx < strPattern.size(); idx++)
+		{
+			CElement objElement;
+			objElement.chLiteral = 0;
+			objElement.wClass = CLASS_OTHER;
+
+			if (strPattern[idx] == L'#') objElement.iType = ELEM_DIGITS;
+			else if (strPattern[idx] == L'?') objElement.iType = ELEM_ANY;
+			else
+			{
+				if (strPattern[idx] == L'\\' && idx + 1 < strPattern.size()) idx++;
+				objElement.iType = ELEM_LITERAL;
+				objElement.chLiteral = FoldChar(strPattern[idx]);
+			}
+
+			// "#" next to something which may be a digit would make the match start ambiguous
+			if (!objRule.arrElements.empty())
+			{
+				const CElement& objPrev = objRule.arrElements.back();
+				bool bPrevDigit = (objPrev.iType != ELEM_LITERAL || IsDigit(objPrev.chLiteral));
+				bool bThisDigit = (objElement.iType != ELEM_LITERAL || IsDigit(objElement.chLiteral));
+				if ((objPrev.iType == ELEM_DIGITS && bThisDigit) || (objElement.iType == ELEM_DIGITS && bPrevDigit)) return false;
+			}
+
+			objRule.arrElements.push_back(objElement);
+		}
+
+		return (objRule.arrElements.size() <= MAX_PATTERN_LEN);
+	}
+
+	static bool ReadQuoted(const WCHAR*& szText, std::wstring& strValue)
+	{
+		while (*szText == L' ' || *szText == L'\t') szText++;
+		if (*szText++ != L'"') return false;
+
+		const WCHAR* szEnd = wcschr(szText, L'"');
+		if (szEnd == NULL) return false;
+
+		strValue.assign(szText, szEnd - szText);
+		szText = szEnd + 1;
+		return true;
+	}
+
+	// Every literal pattern char gets its own class (upper- and lowercase share the class)
+	void BuildCharClasses()
+	{
+		m_wClassCount = 2;
+		m_arrDigitClass.assign(2, 0);
+		m_arrDigitClass[CLASS_DIGIT] = 1;
+
+		for (int ch = 0; ch < 128; ch++) m_arrAsciiClass[ch] = (IsDigit((WCHAR) ch) ? CLASS_DIGIT : CLASS_OTHER);
+
+		for (size_t iRule = 0; iRule < m_arrRules.size(); iRule++)
+		{
+			std::vector<CElement>& arrElements = m_arrRules[iRule].arrElements;
+
+			for (size_t idx = 0; idx < arrElements.size(); idx++)
+			{
+				if (arrElements[idx].iType != ELEM_LITERAL) continue;
+
+				WCHAR chLiteral = arrElements[idx].chLiteral;
+				WORD  wClass = ClassOf(chLiteral);
+
+				if (wClass == CLASS_OTHER || wClass == CLASS_DIGIT)
+				{
+					wClass = m_wClassCount++;
+					m_arrDigitClass.push_back(IsDigit(chLiteral) ? 1 : 0);
+
+					if (chLiteral < 128)
+					{
+						for (int ch = 0; ch < 128; ch++)
+							if (FoldChar((WCHAR) ch) == chLiteral) m_arrAsciiClass[ch] = wClass;
+					}
+					else
+					{
+						m_arrWideClass.insert(std::lower_bound(m_arrWideClass.begin(), m_arrWideClass.end(), std::make_pair(chLiteral, (WORD) 0)), std::make_pair(chLiteral, wClass));
+					}
+				}
+
+				arrElements[idx].wClass = wClass;
+			}
+		}
+	}
+
+	bool ElementMatches(const CElement& objElement, WORD wClass) const
+	{
+		switch (objElement.iType)
+		{
+			case ELEM_LITERAL: return (objElement.wClass == wClass);
+			case ELEM_DIGITS:  return (m_arrDigitClass[wClass] != 0);
+			default:           return true;
+		}
+	}
+
+	//
+	// Subset construction. NFA state "rule R has matched N elements" has id R.dwFirstState + N - 1.
+	// The "nothing matched yet" states of all rules are part of every DFA state (unanchored search),
+	// so those are not stored in the state sets.
+	//
+	bool BuildDFA()
+	{
+		typedef std::vector<DWORD> CStateSet;
+
+		std::vector<DWORD> arrNFARule;		// Rule of each NFA state
+		std::vector<DWORD> arrNFAMatched;	// Number of matched elements of each NFA state
+
+		for (size_t iRule = 0; iRule < m_arrRules.size(); iRule++)
+		{
+			m_arrRules[iRule].dwFirstState = (DWORD) arrNFARule.size();
+			for (size_t idx = 1; idx <= m_arrRules[iRule].arrElements.size(); idx++)
+			{
+				arrNFARule.push_back((DWORD) iRule);
+				arrNFAMatched.push_back((DWORD) idx);
+			}
+		}
+
+		// Transitions of the implicit start states by class (same for every DFA state)
+		std::vector<CStateSet> arrStartMoves(m_wClassCount);
+		for (WORD wClass = 0; wClass < m_wClassCount; wClass++)
+		{
+			for (size_t iRule = 0; iRule < m_arrRules.size(); iRule++)
+				if (ElementMatches(m_arrRules[iRule].arrElements[0], wClass)) arrStartMoves[wClass].push_back(m_arrRules[iRule].dwFirstState);
+		}
+
+		std::map<CStateSet, WORD> mapStates;
+		std::vector<CStateSet> arrStates;
+
+		arrStates.push_back(CStateSet());
+		mapStates[arrStates[0]] = 0;
+
+		for (size_t iState = 0; iState < arrStates.size(); iState++)
+		{
+			// Accepting state if any rule has matched all its elements (the first rule wins)
+			WORD wAcceptRule = NO_RULE;
+			for (size_t idx = 0; idx < arrStates[iState].size(); idx++)
+			{
+				DWORD dwNFAState = arrStates[iState][idx];
+				if (arrNFAMatched[dwNFAState] == m_arrRules[arrNFARule[dwNFAState]].arrElements.size() && arrNFARule[dwNFAState] < wAcceptRule)
+					wAcceptRule = (WORD) arrNFARule[dwNFAState];
+			}
+			m_arrAcceptRule.push_back(wAcceptRule);
+
+			for (WORD wClass = 0; wClass < m_wClassCount; wClass++)
+			{
+				CStateSet arrNext(arrStartMoves[wClass]);
+
+				for (size_t idx = 0; idx < arrStates[iState].size(); idx++)
+				{
+					DWORD dwNFAState = arrStates[iState][idx];
+					const std::vector<CElement>& arrElements = m_arrRules[arrNFARule[dwNFAState]].arrElements;
+					size_t iMatched = arrNFAMatched[dwNFAState];
+
+					// "#" repeats (stay in the same NFA state) and the next element moves forward
+					if (arrElements[iMatched - 1].iType == ELEM_DIGITS && m_arrDigitClass[wClass] != 0) arrNext.push_back(dwNFAState);
+					if (iMatched < arrElements.size() && ElementMatches(arrElements[iMatched], wClass)) arrNext.push_back(dwNFAState + 1);
+				}
+
+				std::sort(arrNext.begin(), arrNext.end());
+				arrNext.erase(std::unique(arrNext.begin(), arrNext.end()), arrNext.end());
+
+				std::map<CStateSet, WORD>::const_iterator it = mapStates.find(arrNext);
+				WORD wNext;
+				if (it != mapStates.end()) wNext = it->second;
+				else
+				{
+					if (arrStates.size() >= MAX_DFA_STATES) return false;
+
+					wNext = (WORD) arrStates.size();
+					mapStates[arrNext] = wNext;
+					arrStates.push_back(arrNext);
+				}
+
+				m_arrTransitions.push_back(wNext);
+			}
+		}
+
+		return true;
+	}
+};
+
+#endif //__CTITLENORMALIZER_H__
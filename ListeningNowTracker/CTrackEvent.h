@@ -0,0 +1,116 @@
+#ifndef __CTRACKEVENT_H__
+#define __CTRACKEVENT_H__
+
+/*
+ * "Now playing" event parsed from the data block of MSN WM_COPYDATA message.
+ *
+ * Uses fixed size buffers, so parsing an event doesn't allocate memory at all (the event path
+ * runs for weeks and every track change would otherwise allocate and release a bunch of strings).
+ * Too long field values are truncated.
+*/
+
+class CTrackEvent
+{
+  public:
+	enum { MAX_STATUS_LEN = 8, MAX_FORMAT_LEN = 64, MAX_FIELD_LEN = 256, MAX_GENRE_LEN = 48, MAX_SOURCE_LEN = 64 };
+
+	WCHAR m_szStatus[MAX_STATUS_LEN];	// 1 = Playing, 0 = Stopped or Paused
+	WCHAR m_szFormat[MAX_FORMAT_LEN];	// ? (no idea what this is in Spotify's case)
+	WCHAR m_szTitle [MAX_FIELD_LEN];	// Title of the song
+	WCHAR m_szArtist[MAX_FIELD_LEN];	// Name of the artist
+	WCHAR m_szAlbum [MAX_FIELD_LEN];	// Name of the album
+
+	// Optional metadata from the local music library index (not part of the event data, see CMusicLibraryIndex)
+	WCHAR m_szGenre [MAX_GENRE_LEN];
+	WORD  m_wYear;						// 0 = Unknown
+	WORD  m_wTrackNumber;				// 0 = Unknown
+	DWORD m_dwDurationMS;				// 0 = Unknown
+
+	// Exe name of the process which sent the event (empty if not known, see ProcessWMCopyDataEvent)
+	WCHAR m_szSource[MAX_SOURCE_LEN];
+
+  public:
+	CTrackEvent()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		m_szStatus[0] = m_szFormat[0] = m_szTitle[0] = m_szArtist[0] = m_szAlbum[0] = m_szGenre[0] = m_szSource[0] = L'\0';
+		m_wYear = m_wTrackNumber = 0;
+		m_dwDurationMS = 0;
+	}
+
+	// Song is stopped/paused or artist-title text is empty (ie. "listening now" text should be cleared)
+	bool IsStopped() const
+	{
+		return (wcscmp(m_szStatus, L"0") == 0 || (m_szTitle[0] == L'\0' && m_szArtist[0] == L'\0'));
+	}
+
+	//
+	// Normalized hash of artist and title (case, spaces and punctuation are ignored). Never 0. Same
+	// key in the music library index and in the learned track lengths (see CTrackExpiry).
+	//
+	static ULONGLONG MakeTrackKey(const WCHAR* szArtist, const WCHAR* szTitle)
+	{
+		ULONGLONG ullHash = HashNormalized(14695981039346656037ULL, szArtist);
+		ullHash = HashNormalized((ullHash ^ 0x1F) * 1099511628211ULL, szTitle);
+		return (ullHash != 0 ? ullHash : 1);
+	}
+
+	// FNV-1a hash of the letters and digits of the text (lower case), continuing from ullHash
+	static ULONGLONG HashNormalized(ULONGLONG ullHash, const WCHAR* szText)
+	{
+		for (; *szText != L'\0'; szText++)
+		{
+			if (!iswalnum(*szText)) continue;
+			ullHash = (ullHash ^ (WCHAR) towlower(*szText)) * 1099511628211ULL;
+		}
+		return ullHash;
+	}
+
+	//
+	// Parse "\0Music\0<status>\0<format>\0<song>\0<artist>\0<album>\0" data. Note! The "\0" delimiter is
+	// a two char "backslash zero" text and not a null char. Returns false if the data is not a music event.
+	//
+	bool Parse(const WCHAR* pData, size_t iDataLen)
+	{
+		static const WCHAR szTagMusic[] = L"\\0Music\\0";
+		const size_t iTagLen = (sizeof(szTagMusic) / sizeof(WCHAR)) - 1;
+
+		Clear();
+
+		// The first tag must be "\0Music\0", otherwise this msg is something we don't know about
+		if (pData == NULL || iDataLen < iTagLen || wcsncmp(pData, szTagMusic, iTagLen) != 0) return false;
+
+		const WCHAR* pPos = pData + iTagLen;
+		const WCHAR* pEnd = pData + iDataLen;
+
+		pPos = ReadField(pPos, pEnd, m_szStatus, MAX_STATUS_LEN);
+		pPos = ReadField(pPos, pEnd, m_szFormat, MAX_FORMAT_LEN);
+		pPos = ReadField(pPos, pEnd, m_szTitle,  MAX_FIELD_LEN);
+		pPos = ReadField(pPos, pEnd, m_szArtist, MAX_FIELD_LEN);
+		pPos = ReadField(pPos, pEnd, m_szAlbum,  MAX_FIELD_LEN);
+
+		return true;
+	}
+
+  protected:
+	// Copy text up to the next "\0" delimiter (or end of data) and return the position after the delimiter
+	static const WCHAR* ReadField(const WCHAR* pPos, const WCHAR* pEnd, WCHAR* szField, size_t iFieldSize)
+	{
+		size_t iLen = 0;
+
+		while (pPos < pEnd && !(pPos[0] == L'\\' && pPos + 1 < pEnd && pPos[1] == L'0'))
+		{
+			if (iLen < iFieldSize - 1) szField[iLen++] = *pPos;
+			pPos++;
+		}
+		szField[iLen] = L'\0';
+
+		return (pPos < pEnd ? pPos + 2 : pEnd);
+	}
+};
+
+#endif //__CTRACKEVENT_H__
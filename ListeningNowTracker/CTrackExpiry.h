@@ -0,0 +1,399 @@
+#ifndef __CTRACKEXPIRY_H__
+#define __CTRACKEXPIRY_H__
+
+#include <string>
+#include <vector>
+
+#include "CThread.h"
+#include "CTrackEvent.h"
+
+/*
+ * Expiry model of the "listening now" text. Players send an event when a track starts, but nothing
+ * if the player crashes, so the text must be cleared when the track should have ended already.
+ *
+ * Each track gets a deadline of predicted length + margin. The length is predicted from
+ *
+ *   1. duration of the event (music library index)
+ *   2. running distribution of the play lengths of all tracks (90th percentile), or the fixed
+ *      timeout ("WatchDogTimerInMins") until the distribution has enough samples
+ *   3. learned play length of the same track (longest play seen so far) if it is longer than 2.
+ *      Tracks longer than usual are not cleared while they are still playing, once a play of them
+ *      has ended before its deadline (for example a play with a duration from the library).
+ *
+ * The play length of a track is the time from its event to the next event. Learned lengths and the
+ * distribution are saved at exit, so the model is not starting from scratch every time.
+ *
+ * Events are processed in the main thread and the watchdog waits for the deadline. Setting a new
+ * deadline signals the wake event, so the watchdog re-arms its wait with the new deadline.
+*/
+
+class CTrackExpiry
+{
+  public:
+	enum ESource { SOURCE_NONE, SOURCE_DURATION, SOURCE_LEARNED, SOURCE_DISTRIBUTION, SOURCE_FIXED, SOURCE_COUNT };
+
+	enum
+	{
+		TRACK_SLOT_COUNT   = 2048,			// Learned lengths (direct mapped cache, a colliding track replaces the old one)
+		BUCKET_MS          = 10 * 1000,		// Distribution of play lengths in 10 sec buckets up to 60 mins
+		BUCKET_COUNT       = 360,
+		MIN_SAMPLE_COUNT   = 20,			// Distribution is not used before this many complete plays
+		MAX_SAMPLE_COUNT   = 10000,			// Counts are halved at this point, so the distribution follows the recent listening
+		PERCENTILE         = 90,
+		MIN_PLAY_MS        = 30 * 1000,		// Shorter plays are skips (not a track length)
+		MAX_PREDICTED_MS   = 4 * 60 * 60 * 1000,
+		MARGIN_PERCENT     = 15,
+		MIN_MARGIN_MS      = 30 * 1000
+	};
+
+	// Counters since startup (reported in "/trace" mode)
+	struct CStats
+	{
+		DWORD dwLearnedTracks;				// Tracks in the learned length cache
+		DWORD dwSampleCount;				// Plays in the distribution
+		DWORD arrPredictions[SOURCE_COUNT];	// Deadlines by the source of the prediction
+		DWORD dwExpiredCount;				// Deadlines which expired (text cleared by the watchdog)
+	};
+
+  protected:
+	enum { FILE_MAGIC = 0x4E4C544C /* "LTLN" */, FILE_VERSION = 1 };
+
+	struct CLearnedTrack
+	{
+		ULONGLONG ullTrackKey;		// 0 = Empty slot
+		DWORD     dwPlayMS;
+		DWORD     dwReserved;
+	};
+
+	std::vector<CLearnedTrack> m_arrTracks;
+	std::vector<DWORD>         m_arrBuckets;
+	DWORD                      m_dwSampleCount;
+	bool                       m_bAdaptive;
+	bool                       m_bModified;
+	DWORD                      m_dwFixedTimeoutMS;
+
+	// Current track (main thread only)
+	ULONGLONG                  m_ullCurrentKey;
+	DWORD                      m_dwCurrentStartMS;
+	DWORD                      m_dwCurrentDelayMS;
+
+	// Deadline is shared with the watchdog
+	CCriticalSection           m_objCS;
+	DWORD                      m_dwDeadlineMS;		// Tick count (0 = No active track)
+	bool                       m_bExpired;			// Deadline of the current track expired
+	HANDLE                     m_hWakeEvent;
+
+	CStats                     m_objStats;
+
+  public:
+	CTrackExpiry()
+	{
+		m_arrTracks.resize(TRACK_SLOT_COUNT);
+		m_arrBuckets.resize(BUCKET_COUNT);
+		ZeroMemory(&m_arrTracks[0], m_arrTracks.size() * sizeof(CLearnedTrack));
+		ZeroMemory(&m_objStats, sizeof(m_objStats));
+
+		m_dwSampleCount = 0;
+		m_bAdaptive = true;
+		m_bModified = false;
+		m_dwFixedTimeoutMS = 10 * 60 * 1000;
+
+		m_ullCurrentKey = 0;
+		m_dwCurrentStartMS = m_dwCurrentDelayMS = 0;
+
+		m_dwDeadlineMS = 0;
+		m_bExpired = false;
+		m_hWakeEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	~CTrackExpiry()
+	{
+		if (m_hWakeEvent != NULL) ::CloseHandle(m_hWakeEvent);
+	}
+
+	// Auto-reset event signaled when the deadline changes
+	HANDLE GetWakeEvent() const { return m_hWakeEvent; }
+
+	// bAdaptive=false is the old policy: every track expires after the fixed timeout
+	void SetPolicy(bool bAdaptive, DWORD dwFixedTimeoutMS)
+	{
+		m_bAdaptive = bAdaptive;
+		m_dwFixedTimeoutMS = (dwFixedTimeoutMS > 0 ? dwFixedTimeoutMS : 1000);
+	}
+
+	const CStats& GetStats()
+	{
+		m_objStats.dwSampleCount = m_dwSampleCount;
+		m_objStats.dwLearnedTracks = 0;
+		for (size_t idx = 0; idx < m_arrTracks.size(); idx++)
+			if (m_arrTracks[idx].ullTrackKey != 0) m_objStats.dwLearnedTracks++;
+
+		return m_objStats;
+	}
+
+	//
+	// New "now playing" event (main thread). Learns the play length of the previous track and sets
+	// the deadline of the new track. Returns the source of the prediction (SOURCE_NONE = stopped).
+	//
+	ESource OnEvent(const CTrackEvent& objEvent, DWORD dwNowMS)
+	{
+		bool bStopped = objEvent.IsStopped();
+		ULONGLONG ullTrackKey = (bStopped ? 0 : CTrackEvent::MakeTrackKey(objEvent.m_szArtist, objEvent.m_szTitle));
+
+		m_objCS.Enter();
+		bool bExpired = m_bExpired;
+		m_objCS.Leave();
+
+		if (m_ullCurrentKey != 0) LearnPlay(dwNowMS - m_dwCurrentStartMS, bExpired, !bStopped && ullTrackKey != m_ullCurrentKey);
+
+		ESource eSource = SOURCE_NONE;
+		DWORD dwDelayMS = 0;
+
+		if (!bStopped) eSource = Predict(objEvent, ullTrackKey, dwDelayMS);
+
+		m_ullCurrentKey    = ullTrackKey;
+		m_dwCurrentStartMS = dwNowMS;
+		m_dwCurrentDelayMS = dwDelayMS;
+		m_objStats.arrPredictions[eSource]++;
+
+		m_objCS.Enter();
+		m_dwDeadlineMS = (bStopped ? 0 : ((dwNowMS + dwDelayMS) != 0 ? dwNowMS + dwDelayMS : 1));
+		m_bExpired = false;
+		m_objCS.Leave();
+
+		::SetEvent(m_hWakeEvent);
+		return eSource;
+	}
+
+	// Time until the deadline. dwIdleWaitMS if there is no active track.
+	DWORD GetWaitMS(DWORD dwNowMS, DWORD dwIdleWaitMS)
+	{
+		DWORD dwWaitMS = dwIdleWaitMS;
+
+		m_objCS.Enter();
+		if (m_dwDeadlineMS != 0)
+		{
+			// Tick count wraps around after 49 days, so compare the differences only
+			LONG lRemainingMS = (LONG) (m_dwDeadlineMS - dwNowMS);
+			dwWaitMS = (lRemainingMS > 0 ? (DWORD) lRemainingMS : 0);
+		}
+		m_objCS.Leave();
+
+		return dwWaitMS;
+	}
+
+	// Returns true (once) if the deadline of the current track has passed. Called by the watchdog.
+	bool CheckExpired(DWORD dwNowMS)
+	{
+		bool bExpired = false;
+
+		m_objCS.Enter();
+		if (m_dwDeadlineMS != 0 && (LONG) (m_dwDeadlineMS - dwNowMS) <= 0)
+		{
+			m_dwDeadlineMS = 0;
+			m_bExpired = bExpired = true;
+			m_objStats.dwExpiredCount++;
+		}
+		m_objCS.Leave();
+
+		return bExpired;
+	}
+
+	// Deadline of the current track has expired and no new event has arrived since then
+	bool IsExpired()
+	{
+		m_objCS.Enter();
+		bool bExpired = m_bExpired;
+		m_objCS.Leave();
+
+		return bExpired;
+	}
+
+	//
+	// Load learned lengths and the distribution saved by the previous instance. The sample count of
+	// the header must match the buckets, otherwise the file is a partial or damaged write.
+	//
+	bool Load(const std::wstring& strFileName)
+	{
+		HANDLE hFile = ::CreateFile(strFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) return false;
+
+		DWORD arrHeader[5];
+		DWORD dwRead = 0;
+		bool  bSucceeded = false;
+
+		if (::ReadFile(hFile, arrHeader, sizeof(arrHeader), &dwRead, NULL) && dwRead == sizeof(arrHeader)
+			&& arrHeader[0] == FILE_MAGIC && arrHeader[1] == FILE_VERSION && arrHeader[2] == TRACK_SLOT_COUNT && arrHeader[3] == BUCKET_COUNT)
+		{
+			std::vector<CLearnedTrack> arrTracks(TRACK_SLOT_COUNT);
+			std::vector<DWORD> arrBuckets(BUCKET_COUNT);
+			DWORD dwTracksRead = 0, dwBucketsRead = 0;
+
+			ULONGLONG ullSampleCount = 0;
+
+			if (::ReadFile(hFile, &arrTracks[0], TRACK_SLOT_COUNT * sizeof(CLearnedTrack), &dwTracksRead, NULL) && dwTracksRead == TRACK_SLOT_COUNT * sizeof(CLearnedTrack)
+				&& ::ReadFile(hFile, &arrBuckets[0], BUCKET_COUNT * sizeof(DWORD), &dwBucketsRead, NULL) && dwBucketsRead == BUCKET_COUNT * sizeof(DWORD))
+			{
+				for (size_t idx = 0; idx < arrBuckets.size(); idx++) ullSampleCount += arrBuckets[idx];
+			}
+
+			if (dwBucketsRead == BUCKET_COUNT * sizeof(DWORD) && ullSampleCount == arrHeader[4] && ullSampleCount < MAX_SAMPLE_COUNT)
+			{
+				m_arrTracks.swap(arrTracks);
+				m_arrBuckets.swap(arrBuckets);
+				m_dwSampleCount = arrHeader[4];
+				bSucceeded = true;
+			}
+		}
+
+		::CloseHandle(hFile);
+		return bSucceeded;
+	}
+
+	// Save learned lengths and the distribution (if something was learned since Load)
+	bool Save(const std::wstring& strFileName)
+	{
+		if (!m_bModified) return true;
+
+		DWORD arrHeader[5] = { FILE_MAGIC, FILE_VERSION, TRACK_SLOT_COUNT, BUCKET_COUNT, m_dwSampleCount };
+
+		std::wstring strTempFileName = strFileName + L".tmp";
+		HANDLE hFile = ::CreateFile(strTempFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE) return false;
+
+		DWORD dwWritten[3] = { 0, 0, 0 };
+		BOOL  bSucceeded = ::WriteFile(hFile, arrHeader, sizeof(arrHeader), &dwWritten[0], NULL)
+			&& ::WriteFile(hFile, &m_arrTracks[0], TRACK_SLOT_COUNT * sizeof(CLearnedTrack), &dwWritten[1], NULL)
+			&& ::WriteFile(hFile, &m_arrBuckets[0], BUCKET_COUNT * sizeof(DWORD), &dwWritten[2], NULL);
+		::CloseHandle(hFile);
+
+		if (!bSucceeded || dwWritten[0] + dwWritten[1] + dwWritten[2] != sizeof(arrHeader) + TRACK_SLOT_COUNT * sizeof(CLearnedTrack) + BUCKET_COUNT * sizeof(DWORD)
+			|| !::MoveFileEx(strTempFileName.c_str(), strFileName.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			::DeleteFile(strTempFileName.c_str());
+			return false;
+		}
+
+		m_bModified = false;
+		return true;
+	}
+
+  protected:
+	CLearnedTrack& SlotOf(ULONGLONG ullTrackKey)
+	{
+		return m_arrTracks[(size_t) ((ullTrackKey ^ (ullTrackKey >> 32)) & (TRACK_SLOT_COUNT - 1))];
+	}
+
+	ESource Predict(const CTrackEvent& objEvent, ULONGLONG ullTrackKey, DWORD& dwDelayMS)
+	{
+		if (!m_bAdaptive)
+		{
+			dwDelayMS = m_dwFixedTimeoutMS;
+			return SOURCE_FIXED;
+		}
+
+		// Duration of the track is the best prediction
+		if (objEvent.m_dwDurationMS > 0)
+		{
+			dwDelayMS = AddMargin(objEvent.m_dwDurationMS);
+			return SOURCE_DURATION;
+		}
+
+		ESource eSource = SOURCE_FIXED;
+		dwDelayMS = m_dwFixedTimeoutMS;
+
+		if (m_dwSampleCount >= MIN_SAMPLE_COUNT)
+		{
+			dwDelayMS = AddMargin(GetPercentileMS(PERCENTILE));
+			eSource = SOURCE_DISTRIBUTION;
+		}
+
+		// Learned length may be a skipped or stopped play, so it only extends the deadline (long tracks)
+		const CLearnedTrack& objLearned = SlotOf(ullTrackKey);
+		if (objLearned.ullTrackKey == ullTrackKey && AddMargin(objLearned.dwPlayMS) > dwDelayMS)
+		{
+			dwDelayMS = AddMargin(objLearned.dwPlayMS);
+			eSource = SOURCE_LEARNED;
+		}
+
+		return eSource;
+	}
+
+	static DWORD AddMargin(DWORD dwLengthMS)
+	{
+		if (dwLengthMS > MAX_PREDICTED_MS) dwLengthMS = MAX_PREDICTED_MS;
+
+		DWORD dwMarginMS = dwLengthMS / 100 * MARGIN_PERCENT;
+		return dwLengthMS + (dwMarginMS > MIN_MARGIN_MS ? dwMarginMS : MIN_MARGIN_MS);
+	}
+
+	//
+	// Learn the play length of the current track. bCompleted=true means that the next track started
+	// (not a stop), so the play counts in the distribution.
+	//
+	// bExpired=true means that the text was cleared before this event: either the prediction was too
+	// short or the player crashed. The time since the event can't tell the two apart, and a crash gap
+	// learned as a play length would keep the next stale text up longer than the fixed timeout. So the
+	// track learns nothing, and the distribution gets the missed deadline only (the play was at least
+	// that long), so the percentile doesn't creep down.
+	//
+	void LearnPlay(DWORD dwPlayMS, bool bExpired, bool bCompleted)
+	{
+		if (bExpired)
+		{
+			if (bCompleted) AddSample(m_dwCurrentDelayMS);
+			return;
+		}
+
+		if (dwPlayMS < MIN_PLAY_MS || dwPlayMS > MAX_PREDICTED_MS) return;
+
+		CLearnedTrack& objLearned = SlotOf(m_ullCurrentKey);
+		if (objLearned.ullTrackKey != m_ullCurrentKey)
+		{
+			objLearned.ullTrackKey = m_ullCurrentKey;
+			objLearned.dwPlayMS = 0;
+		}
+
+		// Skips and stops are shorter than the track, so the longest play is the best guess of the length
+		if (dwPlayMS > objLearned.dwPlayMS) objLearned.dwPlayMS = dwPlayMS;
+
+		if (bCompleted) AddSample(dwPlayMS);
+		m_bModified = true;
+	}
+
+	// Add a play length to the distribution
+	void AddSample(DWORD dwSampleMS)
+	{
+		DWORD dwBucket = dwSampleMS / BUCKET_MS;
+		m_arrBuckets[dwBucket < BUCKET_COUNT ? dwBucket : BUCKET_COUNT - 1]++;
+
+		if (++m_dwSampleCount >= MAX_SAMPLE_COUNT)
+		{
+			m_dwSampleCount = 0;
+			for (size_t idx = 0; idx < m_arrBuckets.size(); idx++)
+			{
+				m_arrBuckets[idx] /= 2;
+				m_dwSampleCount += m_arrBuckets[idx];
+			}
+		}
+
+		m_bModified = true;
+	}
+
+	// Upper edge of the bucket where iPercent of the plays are shorter
+	DWORD GetPercentileMS(int iPercent) const
+	{
+		DWORD dwTarget = (DWORD) (((ULONGLONG) m_dwSampleCount * iPercent + 99) / 100);
+		DWORD dwCount = 0;
+
+		for (DWORD idx = 0; idx < BUCKET_COUNT; idx++)
+		{
+			dwCount += m_arrBuckets[idx];
+			if (dwCount >= dwTarget) return (idx + 1) * BUCKET_MS;
+		}
+
+		return BUCKET_COUNT * BUCKET_MS;
+	}
+};
+
+#endif //__CTRACKEXPIRY_H__
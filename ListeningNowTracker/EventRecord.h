@@ -0,0 +1,177 @@
+#ifndef __EVENTRECORD_H__
+#define __EVENTRECORD_H__
+
+#include <windows.h>
+#include <string.h>
+
+/*
+ * Binary "now playing" event record. ListeningNowTracker encodes each event once into this layout
+ * and the same bytes are used by the pending event queue, the shared memory segment (see
+ * NowPlayingReader.h) and the binary WebSocket feed of the broadcast server ("/records").
+ *
+ * This header depends only on windows.h, so copy it to your project as such. A record is read
+ * in place: CEventRecordView validates the offsets once and then returns pointers to the UTF-8
+ * texts inside the record (no copies, no allocations).
+ *
+ *   +--------------------+  CEventRecordHeader (wHeaderSize bytes)
+ *   | header             |
+ *   +--------------------+  wFieldCount x CEventRecordField (offset and length of each text)
+ *   | field table        |
+ *   +--------------------+  UTF-8 texts, each followed by a null byte (not counted in the length)
+ *   | texts              |
+ *   +--------------------+  dwRecordSize
+ *
+ * Schema evolution: new header fields are added to the end of the header and new texts to the end
+ * of the field table. Readers use wHeaderSize and wFieldCount, so an older reader skips what it
+ * doesn't know and a newer reader sees missing texts as empty. EVENTRECORD_VERSION changes only
+ * if the meaning of an existing field changes (readers reject other versions).
+ *
+ *   CEventRecordView objView;
+ *   if (objView.Attach(pData, iDataLen) && !objView.IsStopped())
+ *      printf("%s by %s\n", objView.GetText(EVENTRECORD_TEXT_TITLE), objView.GetText(EVENTRECORD_TEXT_ARTIST));
+*/
+
+#define EVENTRECORD_MAGIC			0x5245544C	/* "LTER" */
+#define EVENTRECORD_VERSION			1
+#define EVENTRECORD_MAX_SIZE		4096		// Texts are truncated to keep the record within this size
+#define EVENTRECORD_MIN_HEADER_SIZE	40			// Header of version 1 (fields added later: check wHeaderSize before use)
+
+#define EVENTRECORD_FLAG_STOPPED	0x0001		// Player stopped or paused (texts are empty or the last track)
+
+// Texts of the record (field table order)
+#define EVENTRECORD_TEXT_TITLE		0
+#define EVENTRECORD_TEXT_ARTIST		1
+#define EVENTRECORD_TEXT_ALBUM		2
+#define EVENTRECORD_TEXT_GENRE		3
+#define EVENTRECORD_TEXT_FORMAT		4
+#define EVENTRECORD_TEXT_SOURCE		5			// Exe name of the player process (empty if not known)
+#define EVENTRECORD_TEXT_LISTENING	6			// "Listening now" text as formatted by the tracker
+#define EVENTRECORD_TEXT_COUNT		7
+
+struct CEventRecordHeader
+{
+	DWORD     dwMagic;
+	WORD      wVersion;
+	WORD      wHeaderSize;		// Size of the header written by the tracker (>= sizeof of older versions)
+	DWORD     dwRecordSize;		// Header, field table and texts
+	WORD      wFieldCount;		// Entries in the field table
+	WORD      wFlags;			// EVENTRECORD_FLAG_xxx
+	ULONGLONG ullEventTime;		// Time of the event (FILETIME, UTC)
+	DWORD     dwSequence;		// Incremented for each record of the tracker process
+	DWORD     dwDurationMS;		// 0 = Unknown
+	WORD      wYear;			// 0 = Unknown
+	WORD      wTrackNumber;		// 0 = Unknown
+	DWORD     dwReserved;
+};
+
+struct CEventRecordField
+{
+	WORD wOffset;				// From the start of the record
+	WORD wLength;				// Bytes (without the null byte)
+};
+
+
+class CEventRecordView
+{
+  protected:
+	const BYTE*               m_pData;
+	const CEventRecordHeader* m_pHeader;
+	const CEventRecordField*  m_pFields;
+
+  public:
+	CEventRecordView()
+	{
+		m_pData = NULL;
+		m_pHeader = NULL;
+		m_pFields = NULL;
+	}
+
+	//
+	// Validate the record. The data must stay valid (and unchanged) while the view is used. Returns false
+	// if the record is truncated, corrupted or has an unknown version. Offsets are not trusted blindly:
+	// every text must be inside the record and null-terminated.
+	//
+	bool Attach(const void* pData, size_t iDataLen)
+	{
+		const CEventRecordHeader* pHeader = (const CEventRecordHeader*) pData;
+
+		m_pData = NULL;
+		m_pHeader = NULL;
+		m_pFields = NULL;
+
+		if (pData == NULL || iDataLen < EVENTRECORD_MIN_HEADER_SIZE) return false;
+		if (pHeader->dwMagic != EVENTRECORD_MAGIC || pHeader->wVersion != EVENTRECORD_VERSION) return false;
+		if (pHeader->wHeaderSize < EVENTRECORD_MIN_HEADER_SIZE || (pHeader->wHeaderSize & 3) != 0) return false;
+		if (pHeader->dwRecordSize > iDataLen || pHeader->dwRecordSize < pHeader->wHeaderSize + (DWORD) pHeader->wFieldCount * sizeof(CEventRecordField)) return false;
+
+		const BYTE* pBytes = (const BYTE*) pData;
+		const CEventRecordField* pFields = (const CEventRecordField*) (pBytes + pHeader->wHeaderSize);
+
+		for (WORD idx = 0; idx < pHeader->wFieldCount; idx++)
+		{
+			if ((DWORD) pFields[idx].wOffset + pFields[idx].wLength >= pHeader->dwRecordSize) return false;
+			if (pBytes[pFields[idx].wOffset + pFields[idx].wLength] != 0) return false;
+		}
+
+		m_pData = pBytes;
+		m_pHeader = pHeader;
+		m_pFields = pFields;
+		return true;
+	}
+
+	bool IsValid() const { return m_pHeader != NULL; }
+
+	const CEventRecordHeader& GetHeader() const { return *m_pHeader; }
+	const void* GetData() const { return m_pData; }
+
+	bool  IsStopped() const      { return (m_pHeader->wFlags & EVENTRECORD_FLAG_STOPPED) != 0; }
+	DWORD GetRecordSize() const  { return m_pHeader->dwRecordSize; }
+
+	// UTF-8 text (null-terminated). Texts unknown to the writer are empty.
+	const char* GetText(int iText, size_t* piLength = NULL) const
+	{
+		if (iText < 0 || iText >= m_pHeader->wFieldCount)
+		{
+			if (piLength != NULL) *piLength = 0;
+			return "";
+		}
+
+		if (piLength != NULL) *piLength = m_pFields[iText].wLength;
+		return (const char*) m_pData + m_pFields[iText].wOffset;
+	}
+
+	//
+	// Text as UTF-16, truncated to the buffer size at a char boundary (a surrogate pair is never cut).
+	// Returns the number of UTF-16 chars.
+	//
+	int GetTextW(int iText, WCHAR* szBuffer, int iBufferSize) const
+	{
+		size_t iLength;
+		const char* szText = GetText(iText, &iLength);
+
+		int iChars = (iLength > 0 ? ::MultiByteToWideChar(CP_UTF8, 0, szText, (int) iLength, NULL, 0) : 0);
+		if (iChars > iBufferSize - 1)
+		{
+			// Keep the UTF-8 chars which fit. 4 byte chars take two UTF-16 chars.
+			size_t iFitLength = 0;
+			iChars = 0;
+
+			while (iFitLength < iLength)
+			{
+				int iUnits = ((BYTE) szText[iFitLength] >= 0xF0 ? 2 : 1);
+				if (iChars + iUnits > iBufferSize - 1) break;
+
+				iChars += iUnits;
+				for (iFitLength++; iFitLength < iLength && ((BYTE) szText[iFitLength] & 0xC0) == 0x80; iFitLength++);
+			}
+
+			iLength = iFitLength;
+		}
+
+		iChars = (iLength > 0 ? ::MultiByteToWideChar(CP_UTF8, 0, szText, (int) iLength, szBuffer, iBufferSize - 1) : 0);
+		szBuffer[iChars] = L'\0';
+		return iChars;
+	}
+};
+
+#endif //__EVENTRECORD_H__
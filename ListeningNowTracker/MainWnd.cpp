@@ -62,13 +62,36 @@
 
 #include "stdafx.h"						// VC++ trick to speed up the process of using common header files
 
+#include "BuildProfile.h"				// Compile-time feature switches (full vs minimal build)
+
+#if LNT_SINK_SKYPE
 #include <vole/vole.hpp>				// VOLE+STLSoft OLE libraries. Absolutely fantastic libraries to 
 #include <comstl/util/initialisers.hpp> // to utilize OLE objects from pure C++ apps. Used to communicate with Skype OLE objects.
+#include "CSkypeStub.h"					// Stand-in of the Skype4COM object ("/soak" mode)
+#endif
 
 #include "resource.h"					// Windows API resource definitions (tray icon etc)
 
 #include "CThread.h"					// Thread wrapper
 #include "CIniFile.h"				    // INI file handler
+#include "CStartupTrace.h"				// Startup timeline tracing ("/trace" cmdline option)
+#include "CProcessStats.h"				// Process footprint (working set, private bytes)
+#include "CSoakTest.h"					// Long run leak and latency drift test ("/soak" cmdline option)
+#include "CTrackEvent.h"				// Parsed "now playing" event (fixed size buffers)
+#include "CEventRecord.h"				// Binary event record shared by the sinks (UTF-8, pooled buffers)
+#include "CStateCheckpoint.h"			// Crash-consistent checkpoint of the published texts
+#if LNT_SINK_SHARED_MEMORY
+#include "CNowPlayingSegment.h"			// Current track in shared memory for local pollers (see NowPlayingReader.h)
+#endif
+#include "CTitleNormalizer.h"			// Rule based cleanup of titles ("- 2009 Remaster", "(feat. X)" etc)
+#include "CRoutingRules.h"				// Per sink publish/drop/delay rules
+#include "CTrackExpiry.h"				// Predicted end of the current track (watchdog deadline)
+#if LNT_FEATURE_BROADCAST
+#include "CBroadcastServer.h"			// Localhost now playing server (line protocol, SSE, WebSocket)
+#endif
+#if LNT_FEATURE_LIBRARY_INDEX
+#include "CMusicLibraryIndex.h"			// Tag index of local music folders (genre, year, duration of tracks)
+#endif
 
 
 const LPTSTR g_szAppName = _T("ListeningNowTracker"); 
@@ -78,6 +101,36 @@ const LPTSTR g_szAppName = _T("ListeningNowTracker");
 const LPTSTR g_szMsn_WindowClassName   = _T("MsnMsgrUIManager"); 
 const ULONG  g_iMsn_NowPlayingEventNum = 0x547; 
 
+// Private message posted to the main window to run the deferred part of the app initialization
+// once the message loop is up and running (see InitApplicationDeferred)
+const UINT   WM_APP_DEFERRED_INIT = WM_APP + 10;
+
+// Private message posted to the main window to clear a stale Skype mood text left behind by
+// a crashed instance of this app (see ReconcileStaleSkypeMoodText)
+const UINT   WM_APP_RECONCILE_STATE = WM_APP + 11;
+
+// Socket notifications of the broadcast server (WSAAsyncSelect, see CBroadcastServer)
+const UINT   WM_APP_BROADCAST_SOCKET = WM_APP + 12;
+
+// Private message posted to the main window to run the next batch of soak test events (see RunSoakTestBatch)
+const UINT   WM_APP_SOAK_BATCH = WM_APP + 13;
+
+// Private message posted by the watchdog thread when the deadline of the current track has expired
+// (see ClearExpiredTrack). Tray icon and broadcast sockets are used in the main thread only.
+const UINT   WM_APP_TRACK_EXPIRED = WM_APP + 14;
+
+// Timer IDs of the main window. Watchdog timer is used instead of a watchdog thread in minimal builds
+const UINT_PTR IDT_WATCHDOG        = 1;
+const UINT_PTR IDT_TRIMWORKINGSET  = 2;
+const UINT_PTR IDT_ROUTING_HOLD    = 3;
+
+// Max number of "now playing" events buffered while the app is still initializing. Only the latest
+// events matter, so a small preallocated buffer is enough.
+const size_t g_iMaxPendingEvents = 8;
+
+// Event records are encoded only if a sink of the build uses them (see g_arrBuildSinks)
+#define LNT_RECORD_SINKS (LNT_SINK_SHARED_MEMORY || LNT_FEATURE_BROADCAST)
+
 
 //
 // Global variables
@@ -87,18 +140,74 @@ HINSTANCE g_hMainAppInstance;	// Main app instance handle
 HWND      g_hMainWnd;			// Main wnd handle
 
 std::wstring g_strListeningNowText; // Format mask for "Listening now" text shown in Skype profile (INI file parameter)
+std::wstring g_strStaleSkypeMoodText; // Mood text set by the previous (crashed) app instance and not yet cleared
+DWORD        g_dwSongTitleResetPeriodInMins; // WatchDog timeout if the track length is not known (INI file parameter)
+DWORD        g_dwTrimWorkingSetAfterIdleSecs; // Trim working set after X secs without events, 0=Never (INI file parameter)
+
+CStartupTrace g_objStartupTrace;	// Startup timeline (active only with "/trace" cmdline option)
+CSoakTest     g_objSoakTest;		// Synthetic long run (active only with "/soak" cmdline option)
+#if LNT_SINK_SKYPE
+CSkypeStubFactory g_objSkypeStubFactory; // Skype4COM stand-in of "/soak" mode (registered in the main thread)
+#endif
+bool          g_bBudgetExceeded = false; // "/trace" found the footprint or the startup time over the budget (exit code 2)
+CTitleNormalizer g_objTitleNormalizer; // Compiled [NORMALIZE] rules of INI file (used in the main thread only)
+CRoutingRules    g_objRoutingRules;    // Compiled [ROUTING] rules of INI file (used in the main thread only)
+CEventRecordPool g_objEventRecordPool; // Event records of the sinks and the pending events (used in the main thread only)
+
+// Track held back by "delay" routing rules. Due time per sink, 0 = Not held for the sink (used in the main thread only)
+CTrackEvent      g_objHeldEvent;
+std::wstring     g_strHeldText;
+CEventRecord*    g_pHeldRecord = NULL;
+DWORD            g_arrHeldDueTickMS[CRoutingRules::SINK_COUNT];
+#if LNT_FEATURE_BROADCAST
+CBroadcastServer g_objBroadcastServer; // Now playing events to local subscribers (used in the main thread only)
+#endif
 
 
 // 
 // Global "shared resources" for the process (all threads share these values)
 //
+#if LNT_FEATURE_WATCHDOG_THREAD
 CThread          g_objThreadWatchDog;  // WatchDog thread to clear Skype MoodText in case MusicPlayer has crashed
+#endif
+
+#if LNT_FEATURE_LIBRARY_INDEX
+CThread            g_objThreadLibraryScan;	// Music library scan thread (quits when the scan is completed)
+CMusicLibraryIndex g_objMusicLibrary;		// Tag index of local music folders
+std::vector<std::wstring> g_arrLibraryFolders; // Music folders to scan (INI file parameter)
+int                g_iLibraryScanThreads;	// Number of parallel scan workers (INI file parameter, 0 = number of CPUs)
+#endif
+
 CCriticalSection g_objProcessCS;	   // CriticalSection object to control the usage of shared resources
+CTrackExpiry     g_objTrackExpiry;	   // Deadline of the current track (main thread sets it, watchdog waits for it)
 
 NOTIFYICONDATA   g_ToolbarTrayIcon;			    // Toolbar tray icon object
+CStateCheckpoint g_objStateCheckpoint;		    // Checkpoint of the text each sink was last told (survives crashes)
+#if LNT_SINK_SHARED_MEMORY
+CNowPlayingSegment g_objNowPlayingSegment;	    // Shared memory copy of the current track
+#endif
 
 BOOL			 g_bProcessRunning;	             // TRUE=Process is valid, FALSE=Process is closing. Do nothing in child threads except closing immediately
 DWORD			 g_dwLastTrackChangeTimeStampMS; // The timestamp of the last received "track changed" event
+volatile DWORD	 g_dwClockOffsetMS = 0;			 // Offset of the app clock from the tick count (compressed clock of "/soak" mode)
+
+BOOL			 g_bAppInitialized;				 // TRUE=Deferred init completed and events are processed immediately
+BOOL			 g_bMainThreadCOMInitialized;	 // TRUE=OLE APIs initialized in the main thread (done lazily on first Skype update)
+DWORD			 g_dwMainThreadID;				 // Thread ID of the main (message loop) thread
+
+CEventRecord*	 g_arrPendingEvents[g_iMaxPendingEvents]; // "Now playing" events received before the app was fully initialized (ring buffer)
+size_t			 g_iPendingEventFirst;			 // Index of the oldest pending event
+size_t			 g_iPendingEventCount;			 // Number of pending events
+
+
+//--------------------------------------------------------
+// Tick count of the event path (track deadlines, routing delays). Same as GetTickCount except in
+// "/soak" mode, where the simulated time between the synthetic events passes at once.
+//
+DWORD GetAppTickCount(void)
+{
+	return ::GetTickCount() + g_dwClockOffsetMS;
+}
 
 
 //--------------------------------------------------------
@@ -144,8 +253,8 @@ void InitTray(HWND hWnd, const std::wstring& strTrayIconText)
 		g_ToolbarTrayIcon.uFlags = NIF_TIP;
 	}
 
-	// Substr text to make sure the tooltip text doesn't overflow the max size of szTip array
-	wcscpy_s(g_ToolbarTrayIcon.szTip, strTrayIconText.substr(0,iMaxTipTextSize).c_str()); 
+	// Truncate text to make sure the tooltip text doesn't overflow the max size of szTip array
+	wcsncpy_s(g_ToolbarTrayIcon.szTip, strTrayIconText.c_str(), iMaxTipTextSize); 
 
 	if(hWnd != NULL) Shell_NotifyIcon(NIM_ADD, &g_ToolbarTrayIcon); 
 	else if (g_ToolbarTrayIcon.uID != 0) Shell_NotifyIcon(NIM_MODIFY, &g_ToolbarTrayIcon);
@@ -157,12 +266,101 @@ void UpdateTrayText(const std::wstring& strTrayIconText)
 }
 
 
+//--------------------------------------------------------
+// Working set trimming. The app sleeps most of the time (waiting for the next track event),
+// so there is no point to keep startup and event processing pages in the working set.
+// Timer is restarted on every event, so trimming happens only after X secs of idle time.
+//
+void ScheduleWorkingSetTrim(void)
+{
+	if (g_dwTrimWorkingSetAfterIdleSecs > 0 && g_hMainWnd != NULL)
+		::SetTimer(g_hMainWnd, IDT_TRIMWORKINGSET, 1000 * g_dwTrimWorkingSetAfterIdleSecs, NULL);
+}
+
+void TrimWorkingSet(void)
+{
+	::KillTimer(g_hMainWnd, IDT_TRIMWORKINGSET);
+	::SetProcessWorkingSetSize(::GetCurrentProcess(), (SIZE_T) -1, (SIZE_T) -1);
+}
+
+
+//--------------------------------------------------------
+// Footprint of the process to the "/trace" log. Going over the budget of the build profile
+// (BuildProfile.h) is an error, not a warning: the "/trace" run exits with code 2 (see WinMain),
+// so a test script of the minimal build fails on it.
+//
+void TraceFootprint(const std::wstring& strPrefix)
+{
+	CProcessStats objStats;
+	if (!g_objStartupTrace.IsEnabled() || !objStats.Sample()) return;
+
+	g_objStartupTrace.Note(strPrefix + objStats.Format());
+	if (!objStats.IsWithinBudget(LNT_WORKINGSET_BUDGET_KB, LNT_PRIVATEBYTES_BUDGET_KB))
+	{
+		g_objStartupTrace.Note(L"ERROR: Footprint budget exceeded");
+		g_bBudgetExceeded = true;
+	}
+}
+
+
+#if !LNT_FEATURE_WATCHDOG_THREAD
+//--------------------------------------------------------
+// Watchdog timer fires at the deadline of the current track (or after WatchDogTimerInMins if no
+// track is playing). Minimal build only, normal builds have a watchdog thread.
+//
+void ScheduleWatchDog(void)
+{
+	DWORD dwWaitMS = g_objTrackExpiry.GetWaitMS(GetAppTickCount(), 1000 * 60 * g_dwSongTitleResetPeriodInMins);
+	::SetTimer(g_hMainWnd, IDT_WATCHDOG, (dwWaitMS > 0 ? dwWaitMS : 1), NULL);
+}
+#endif
+
+
+//--------------------------------------------------------
+// Initialize OLE APIs in the main thread when the first OLE call is about to happen. 
+// OLE init is not needed to receive events, so there is no reason to do it at startup.
+// The watchdog thread has its own OLE initialization.
+//
+void EnsureMainThreadCOMInitialized(void)
+{
+#if LNT_SINK_SKYPE
+	if (g_bMainThreadCOMInitialized || ::GetCurrentThreadId() != g_dwMainThreadID) return;
+
+	if (SUCCEEDED(::CoInitialize(NULL)))
+	{
+		g_bMainThreadCOMInitialized = TRUE;
+		g_objStartupTrace.Mark(_T("OLE initialized in main thread"));
+
+		// Mood text updates of "/soak" mode go to the stand-in (see CreateSkypeObject)
+		if (g_objSoakTest.IsEnabled()) g_objSkypeStubFactory.Register();
+	}
+#endif
+}
+
+
+#if LNT_SINK_SKYPE
+//--------------------------------------------------------
+// Skype4COM object of a mood text update. "/soak" mode creates the stand-in registered by
+// EnsureMainThreadCOMInitialized, so the synthetic tracks never reach the real Skype.
+//
+vole::object CreateSkypeObject(void)
+{
+	if (g_objSoakTest.IsEnabled()) return vole::object::create(CLSID_SkypeStub, CLSCTX_INPROC_SERVER);
+	return vole::object::create(L"Skype4COM.Skype");
+}
+#endif
+
+
 //--------------------------------------------------------
 // Update Skype mood text using Skype4OLE interface (comes with Skype Windows client).
 //
 void UpdateSkypeMoodText(const std::wstring& strMoodText)
 {
+#if LNT_SINK_SKYPE
 	using vole::object;
+#endif
+
+	EnsureMainThreadCOMInitialized();
 
 	g_objProcessCS.Enter();
 
@@ -180,9 +378,10 @@ void UpdateSkypeMoodText(const std::wstring& strMoodText)
 		// there is no "active song title" in the Skype MoodText property.
 		//
 		if (strMoodText.empty()) g_dwLastTrackChangeTimeStampMS = 0;
-		else g_dwLastTrackChangeTimeStampMS = GetTickCount();
-		  
-		object objSkype = object::create(L"Skype4COM.Skype");
+		else g_dwLastTrackChangeTimeStampMS = GetAppTickCount();
+
+#if LNT_SINK_SKYPE
+		object objSkype = CreateSkypeObject();
 		object objClient = objSkype.get_property<object>(L"Client");
 
 		// TODO: Should we start Skype automatically if it's not running?
@@ -199,9 +398,14 @@ void UpdateSkypeMoodText(const std::wstring& strMoodText)
 			object objProfile = objSkype.get_property<object>(L"CurrentUserProfile");
 			//std::wstring strMood = objProfile.get_property<std::wstring>(L"MoodText");
 			objProfile.put_property(L"MoodText", strMoodText.c_str());
+
+			// New text replaces whatever the crashed instance left behind
+			g_objStateCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, strMoodText.c_str());
+			g_strStaleSkypeMoodText.clear();
 		}
 		else
 			UpdateTrayText(std::wstring(L"WARNING: Skype is not running. Cannot update profile text"));
+#endif
 	}
 
   } catch (/*...*/ std::exception &x ) { 
@@ -212,6 +416,48 @@ void UpdateSkypeMoodText(const std::wstring& strMoodText)
 }
 
 
+//--------------------------------------------------------
+// Previous instance of this app crashed (or the machine crashed) while Skype was showing
+// a "listening now" text. Clear the text unless the user has changed the mood text since then.
+// If Skype is not running then try again later (watchdog check calls this also).
+//
+void ReconcileStaleSkypeMoodText(void)
+{
+#if LNT_SINK_SKYPE
+	using vole::object;
+
+	EnsureMainThreadCOMInitialized();
+
+	g_objProcessCS.Enter();
+
+  try
+  {
+	if (!g_strStaleSkypeMoodText.empty() && g_bProcessRunning)
+	{
+		object objSkype = CreateSkypeObject();
+		object objClient = objSkype.get_property<object>(L"Client");
+
+		if ( objClient.get_property<bool>(L"IsRunning") )
+		{
+			object objProfile = objSkype.get_property<object>(L"CurrentUserProfile");
+			std::wstring strMood = objProfile.get_property<std::wstring>(L"MoodText");
+
+			if (strMood == g_strStaleSkypeMoodText)
+				objProfile.put_property(L"MoodText", L"");
+
+			g_objStateCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, L"");
+			g_strStaleSkypeMoodText.clear();
+		}
+	}
+  } catch (/*...*/ std::exception &x ) { 
+	UpdateTrayText( std::wstring(L"ERROR: ").append( str2wstr(x.what()) ) );
+  }
+
+	g_objProcessCS.Leave();
+#endif
+}
+
+
 //---------------------------------------------------------
 // Application is closing. Cleanup everything.
 //
@@ -230,21 +476,54 @@ void CleanupApplication(void)
 		// Flag this application for closing. Nothing can be done anymore with shared resources
 		g_bProcessRunning = FALSE;
 
+#if LNT_FEATURE_WATCHDOG_THREAD
 		//
 		// Signal thread to stop. Note! Doesn't use forceKill because the thread probably stops
 		// by the time this process is ready to close. Anyway, there is "Stop(TRUE) forceKill"
 		// command at the end of this process just-in-case.
 		//
 		g_objThreadWatchDog.Stop();
+#else
+		::KillTimer(g_hMainWnd, IDT_WATCHDOG);
+#endif
+
+#if LNT_FEATURE_LIBRARY_INDEX
+		g_objThreadLibraryScan.Stop();
+#endif
+
+		// Tracks held back by routing rules are not published anymore
+		::KillTimer(g_hMainWnd, IDT_ROUTING_HOLD);
+
+#if LNT_FEATURE_BROADCAST
+		// Subscribers see the connection closing
+		g_objBroadcastServer.Stop();
+		g_objStateCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, L"");
+#endif
+
+#if LNT_SINK_SHARED_MEMORY
+		// Shared memory readers may keep the segment open after this process has quit
+		g_objNowPlayingSegment.SetStopped();
+		g_objNowPlayingSegment.Close();
+		g_objStateCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, L"");
+#endif
 
 		// Set empty "Skype mood text" because this app no longer monitors
-		// the Spotify "Playing" events (otherwise Skype would show the last text permanently)
+		// the Spotify "Playing" events (otherwise Skype would show the last text permanently).
+		// In "/soak" mode the text is cleared in the Skype stand-in.
 		if (g_ToolbarTrayIcon.uID != 0)	
 		{
 			UpdateSkypeMoodText(std::wstring());
 			Shell_NotifyIcon(NIM_DELETE, &g_ToolbarTrayIcon); 
 		}
 		g_ToolbarTrayIcon.uID = 0;
+
+		// Clean shutdown is the only time the checkpoint is flushed to disk explicitly
+		g_objStateCheckpoint.Close();
+
+		// Learned track lengths are saved only at exit (losing a few plays in a crash doesn't matter).
+		// Synthetic tracks of the soak test are not saved.
+		if (!g_objSoakTest.IsEnabled())
+			g_objTrackExpiry.Save(CIniFile::GetUserDataPath().append(L"\\ListeningNowTracker.lengths"));
 	}
   }
   catch (...)
@@ -286,72 +565,372 @@ void NotifyMsnMessenger(PCOPYDATASTRUCT data)
 
 
 //-------------------------------------------------- 
-// Process "Listening song" WM_COPYDATA event. 
-// Data is expected to be in "\0Music\0<status>\0<format>\0<song>\0<artist>\0<album>\0" format
+// Publish the track to one sink. bClear=true clears the sink instead (routing rules dropped the
+// track or hold it back for a while). Only the sinks of the build are compiled.
 //
-// Update Skype mood text based on the song title and artist texts.
+#if LNT_SINK_TRAY
+void PublishToTray(const CTrackEvent& /*objEvent*/, const std::wstring& strListeningText, const CEventRecord* /*pRecord*/, bool bClear)
+{
+	UpdateTrayText(bClear ? std::wstring(g_szAppName) : strListeningText);
+}
+#endif
+
+#if LNT_SINK_SKYPE
+void PublishToSkype(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* /*pRecord*/, bool bClear)
+{
+	// Update Skype mood text or clear it if song is stopped/paused/arist-title text is empty
+	if (bClear || objEvent.IsStopped()) 
+		UpdateSkypeMoodText(std::wstring());
+	else	
+		UpdateSkypeMoodText(strListeningText);
+}
+#endif
+
+#if LNT_SINK_SHARED_MEMORY
+void PublishToSharedMemory(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, bool bClear)
+{
+	if (bClear) g_objNowPlayingSegment.SetStopped();
+	else g_objNowPlayingSegment.Publish(objEvent, objEvent.IsStopped() ? L"" : strListeningText.c_str(), pRecord);
+
+	g_objStateCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, (bClear || objEvent.IsStopped() ? L"" : strListeningText.c_str()));
+}
+#endif
+
+#if LNT_FEATURE_BROADCAST
+void PublishToBroadcast(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, bool bClear)
+{
+	if (bClear)
+	{
+		// Empty event is a "stopped" event for the subscribers
+		static const CTrackEvent objEmptyEvent;
+		CEventRecord* pEmptyRecord = g_objEventRecordPool.Encode(objEmptyEvent, L"");
+		g_objBroadcastServer.Publish(pEmptyRecord->GetView());
+		pEmptyRecord->Release();
+	}
+	else
+		g_objBroadcastServer.Publish(pRecord->GetView());
+
+	g_objStateCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, (bClear || objEvent.IsStopped() ? L"" : strListeningText.c_str()));
+}
+#endif
+
+// Sinks compiled into this build (see BuildProfile.h). The event path loops over this table, so
+// a sink left out of the build costs neither code nor a check per event. The table ends with a
+// NULL function.
+typedef void (*PUBLISHTOSINKPROC)(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, bool bClear);
+
+struct CBuildSink
+{
+	int               iSink;		// CRoutingRules::SINK_xxx
+	PUBLISHTOSINKPROC pfnPublish;
+};
+
+const CBuildSink g_arrBuildSinks[] =
+{
+#if LNT_SINK_TRAY
+	{ CRoutingRules::SINK_TRAY,          PublishToTray },
+#endif
+#if LNT_SINK_SKYPE
+	{ CRoutingRules::SINK_SKYPE,         PublishToSkype },
+#endif
+#if LNT_SINK_SHARED_MEMORY
+	{ CRoutingRules::SINK_SHARED_MEMORY, PublishToSharedMemory },
+#endif
+#if LNT_FEATURE_BROADCAST
+	{ CRoutingRules::SINK_BROADCAST,     PublishToBroadcast },
+#endif
+	{ CRoutingRules::SINK_COUNT,         NULL }
+};
+
+// "/soak" mode publishes the synthetic events to the tray and to the Skype stand-in (CSkypeStub.h).
+// The real Skype, shared memory readers and broadcast clients never see them.
+const CBuildSink g_arrSoakSinks[] =
+{
+#if LNT_SINK_TRAY
+	{ CRoutingRules::SINK_TRAY,          PublishToTray },
+#endif
+#if LNT_SINK_SKYPE
+	{ CRoutingRules::SINK_SKYPE,         PublishToSkype },
+#endif
+	{ CRoutingRules::SINK_COUNT,         NULL }
+};
+
+const CBuildSink* g_pPublishSinks = g_arrBuildSinks;	// Sinks of the events (g_arrSoakSinks in "/soak" mode)
+
+
+//--------------------------------------------------------
+// Previous instance crashed while the shared memory segment and the broadcast subscribers were
+// told that a track is playing. Readers which kept the segment open would see the track playing
+// forever and reconnecting subscribers would get no "stopped" event, so both sinks are cleared
+// as soon as they are up again. Unlike the Skype mood text, nobody else changes these texts.
 //
-// Parsing of lpData data derived from http://code.google.com/p/scrobblify/ application (with modifications).
+void ReconcileStaleSinkState(void)
+{
+#if LNT_SINK_SHARED_MEMORY
+	if (!g_objStateCheckpoint.GetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY).empty())
+		PublishToSharedMemory(CTrackEvent(), std::wstring(), NULL, true);
+#endif
+
+#if LNT_FEATURE_BROADCAST
+	if (!g_objStateCheckpoint.GetSinkText(CStateCheckpoint::SINK_BROADCAST).empty())
+		PublishToBroadcast(CTrackEvent(), std::wstring(), NULL, true);
+#endif
+}
+
+
+//-------------------------------------------------- 
+// Track held back by "delay" routing rules. The track is published to the sink when the delay
+// has elapsed, unless another event arrives before that (track was skipped).
 //
-LRESULT CALLBACK ProcessWMCopyDataEvent(HWND /*hWnd*/, WPARAM /*wParam*/, LPARAM lParam) 
-{ 
-	// Max text of "Listening" text is 200 chars in this app. Feel free to increase if necessary
-	WCHAR szBuffer[200];
-	size_t iPos;
+void ScheduleHeldEvent(void)
+{
+	DWORD dwNowMS = GetAppTickCount();
+	DWORD dwWaitMS = 0;
+	bool  bHeld = false;
 
-	PCOPYDATASTRUCT cds = (PCOPYDATASTRUCT) lParam; 
-	std::wstring data   = (TCHAR *) cds->lpData;
+	for (int iSink = 0; iSink < CRoutingRules::SINK_COUNT; iSink++)
+	{
+		if (g_arrHeldDueTickMS[iSink] == 0) continue;
 
-	// TODO: uncomment when this works 
-	// NotifyMsnMessenger(cds); 
+		// Tick count wraps around after 49 days, so compare the differences only
+		DWORD dwSinkWaitMS = ((LONG) (g_arrHeldDueTickMS[iSink] - dwNowMS) > 0 ? g_arrHeldDueTickMS[iSink] - dwNowMS : 0);
+		if (!bHeld || dwSinkWaitMS < dwWaitMS) dwWaitMS = dwSinkWaitMS;
+		bHeld = true;
+	}
+
+	if (bHeld) ::SetTimer(g_hMainWnd, IDT_ROUTING_HOLD, (dwWaitMS > 0 ? dwWaitMS : 1), NULL);
+	else ::KillTimer(g_hMainWnd, IDT_ROUTING_HOLD);
+}
 
-	// Field delimiter
-	std::wstring delimiter = _T("\\0");			
-	size_t delimiter_size  = delimiter.size(); 
+void ReleaseHeldRecord(void)
+{
+	if (g_pHeldRecord != NULL) g_pHeldRecord->Release();
+	g_pHeldRecord = NULL;
+}
 
-	// The first tag must be "\0Music\0", otherwise this msg is something we don't know about
-	std::wstring sTagMusic = delimiter + _T("Music") + delimiter; 
+void HoldEvent(int iSink, const CTrackEvent& objEvent, const std::wstring& strListeningText, CEventRecord* pRecord, DWORD dwDelaySecs)
+{
+	// All sinks hold the same event (the latest one)
+	g_objHeldEvent = objEvent;
+	g_strHeldText.assign(strListeningText);
 
-	iPos = sTagMusic.size(); 
-	if (data.compare(0, iPos, sTagMusic) != 0) 
+	if (g_pHeldRecord != pRecord)
 	{
-		return 0;  // Hmmm.. Unknown prefix in the data. Do nothing.
+		ReleaseHeldRecord();
+		if (pRecord != NULL) pRecord->AddRef();
+		g_pHeldRecord = pRecord;
 	}
 
-	// Status: 1=Playing, 0=Stopped or Paused
-	std::wstring status = data.substr(iPos, data.find(delimiter, iPos) - iPos);  
-	iPos += status.size() + delimiter_size; 
+	g_arrHeldDueTickMS[iSink] = GetAppTickCount() + 1000 * dwDelaySecs;
+	if (g_arrHeldDueTickMS[iSink] == 0) g_arrHeldDueTickMS[iSink] = 1;
 
-	// Format: ???
-	std::wstring format = data.substr(iPos, data.find(delimiter, iPos) - iPos);  
-	iPos += format.size() + delimiter_size; 
+	ScheduleHeldEvent();
+}
 
-	// Title of the song
-	std::wstring title = data.substr(iPos, data.find(delimiter, iPos) - iPos); 
-	iPos += title.size() + delimiter_size; 
+void CancelHeldEvent(void)
+{
+	bool bHeld = false;
+	for (int iSink = 0; iSink < CRoutingRules::SINK_COUNT; iSink++)
+	{
+		if (g_arrHeldDueTickMS[iSink] != 0) bHeld = true;
+		g_arrHeldDueTickMS[iSink] = 0;
+	}
+
+	if (bHeld) ::KillTimer(g_hMainWnd, IDT_ROUTING_HOLD);
+	ReleaseHeldRecord();
+}
+
+// IDT_ROUTING_HOLD timer. Publish the held track to the sinks whose delay has elapsed.
+void PublishHeldEvent(void)
+{
+	DWORD dwNowMS = GetAppTickCount();
+	bool  bHeld = false;
+
+	for (const CBuildSink* pSink = g_pPublishSinks; pSink->pfnPublish != NULL; pSink++)
+	{
+		if (g_arrHeldDueTickMS[pSink->iSink] == 0) continue;
+		if ((LONG) (g_arrHeldDueTickMS[pSink->iSink] - dwNowMS) > 0)
+		{
+			bHeld = true;
+			continue;
+		}
+
+		g_arrHeldDueTickMS[pSink->iSink] = 0;
+		pSink->pfnPublish(g_objHeldEvent, g_strHeldText, g_pHeldRecord, false);
+	}
+
+	if (!bHeld) ReleaseHeldRecord();
+	ScheduleHeldEvent();
+}
+
+
+//-------------------------------------------------- 
+// Process "Listening song" event (see CTrackEvent for the data format).
+//
+// Update Skype mood text based on the song title and artist texts.
+//
+// Parsing of lpData data derived from http://code.google.com/p/scrobblify/ application (with modifications).
+//
+void ProcessNowPlayingEvent(CTrackEvent& objEvent)
+{
+	// Max text of "Listening" text is 200 chars in this app. Feel free to increase if necessary
+	WCHAR szBuffer[200];
+	WCHAR szYear[8];
 
-	// Artist of the song
-	std::wstring artist = data.substr(iPos, data.find(delimiter, iPos) - iPos); 
-	iPos += artist.size(); 
+	// The text object is re-used between events, so assigning a new text doesn't allocate memory
+	static std::wstring strListeningText;
+	if (strListeningText.capacity() < 200) strListeningText.reserve(200);
+
+#if LNT_FEATURE_LIBRARY_INDEX
+	// Add genre, year and duration of the track if it is found in local music folders. The index
+	// is keyed by the raw tags of the files, so the lookup uses the fields as the player sent them.
+	if (!objEvent.IsStopped()) g_objMusicLibrary.Enrich(objEvent);
+#endif
+
+	// Remove "- 2009 Remaster" etc parts of the title and move featured artists to the artist field
+	if (!objEvent.IsStopped()) g_objTitleNormalizer.NormalizeEvent(objEvent);
+
+	// Deadline of the watchdog is the predicted end of this track
+	g_objTrackExpiry.OnEvent(objEvent, GetAppTickCount());
+#if !LNT_FEATURE_WATCHDOG_THREAD
+	ScheduleWatchDog();
+#endif
+
+	// Year is formatted as a text, so all optional fields of the format mask are strings (empty if unknown)
+	if (objEvent.m_wYear > 0) _snwprintf_s(szYear, sizeof(szYear) / sizeof(WCHAR), _TRUNCATE, L"%u", (unsigned) objEvent.m_wYear);
+	else szYear[0] = L'\0';
 
 	// Format "Listening" text string (too bad std:wstring doesn't have built-in printf 
 	// formatter, so we have to do it through old-fashioned temp buffer.
 	_snwprintf_s(szBuffer, (sizeof(szBuffer) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE, 
 		g_strListeningNowText.c_str(),
-		title.c_str(), 
-		artist.c_str()
+		objEvent.m_szTitle, 
+		objEvent.m_szArtist,
+		objEvent.m_szAlbum,
+		objEvent.m_szGenre,
+		szYear
 	);
-	std::wstring strListeningText = szBuffer;
+	strListeningText.assign(szBuffer);
 
-	// Update tray tooltip
-	UpdateTrayText(strListeningText);
-	
-	// Update Skype mood text or clear it if song is stopped/paused/arist-title text is empty
-	if ( status.compare(_T("0")) == 0 || ( title.empty() && artist.empty() ) ) 
-		UpdateSkypeMoodText(std::wstring());
-	else	
-		UpdateSkypeMoodText(strListeningText);
+	// New event supersedes the track held back by delay rules
+	CancelHeldEvent();
+
+	// Texts are converted to UTF-8 once and the sinks share the record
+	CEventRecord* pRecord = NULL;
+#if LNT_RECORD_SINKS
+	pRecord = g_objEventRecordPool.Encode(objEvent, objEvent.IsStopped() ? L"" : strListeningText.c_str());
+#endif
+
+	// Stopped event always goes through, so no sink keeps showing a track which is not playing anymore
+	CRoutingRules::CDecision arrDecisions[CRoutingRules::SINK_COUNT];
+	if (!objEvent.IsStopped()) g_objRoutingRules.Evaluate(objEvent, arrDecisions);
+
+	for (const CBuildSink* pSink = g_pPublishSinks; pSink->pfnPublish != NULL; pSink++)
+	{
+		const CRoutingRules::CDecision& objDecision = arrDecisions[pSink->iSink];
+
+		if (objEvent.IsStopped() || objDecision.eAction == CRoutingRules::ACTION_PUBLISH)
+		{
+			pSink->pfnPublish(objEvent, strListeningText, pRecord, false);
+			continue;
+		}
+
+		// Sink must not keep showing the previous track while this one is dropped or held back
+		pSink->pfnPublish(objEvent, strListeningText, pRecord, true);
+		if (objDecision.eAction == CRoutingRules::ACTION_DELAY) HoldEvent(pSink->iSink, objEvent, strListeningText, pRecord, objDecision.dwDelaySecs);
+	}
+
+	if (pRecord != NULL) pRecord->Release();
+
+	ScheduleWorkingSetTrim();
+}
+
+
+//-------------------------------------------------- 
+// Exe name of the process which owns the sender window of WM_COPYDATA message (wParam). Players send
+// events from the same process for hours, so the name of the latest process is cached.
+//
+void GetEventSourceName(HWND hSenderWnd, WCHAR* szSource, size_t iSourceSize)
+{
+	static DWORD dwCachedProcessID = 0;
+	static WCHAR szCachedName[CTrackEvent::MAX_SOURCE_LEN] = L"";
+
+	DWORD dwProcessID = 0;
+	szSource[0] = L'\0';
+
+	if (hSenderWnd == NULL || ::GetWindowThreadProcessId(hSenderWnd, &dwProcessID) == 0 || dwProcessID == 0) return;
+
+	if (dwProcessID != dwCachedProcessID)
+	{
+		HANDLE hProcess = ::OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, dwProcessID);
+		if (hProcess == NULL) return;
+
+		if (::GetModuleBaseName(hProcess, NULL, szCachedName, sizeof(szCachedName) / sizeof(WCHAR)) == 0) szCachedName[0] = L'\0';
+		::CloseHandle(hProcess);
 
+		dwCachedProcessID = dwProcessID;
+	}
+
+	wcsncpy_s(szSource, iSourceSize, szCachedName, _TRUNCATE);
+}
+
+
+//-------------------------------------------------- 
+// Process "Listening song" WM_COPYDATA event. 
+//
+// lpData is valid only during WM_COPYDATA message handling, so events arriving before the app is
+// fully initialized are copied to a pending list and replayed by InitApplicationDeferred.
+//
+LRESULT CALLBACK ProcessWMCopyDataEvent(HWND /*hWnd*/, WPARAM wParam, LPARAM lParam) 
+{ 
+	static bool bFirstEvent = true;
+	static CTrackEvent objEvent;	// Preallocated. Events are processed one at a time in the main thread
+
+	PCOPYDATASTRUCT cds = (PCOPYDATASTRUCT) lParam; 
+	if (cds->lpData == NULL || cds->cbData < sizeof(TCHAR)) return 0;
+
+	// Do not trust the sender to null-terminate the data block
+	const WCHAR* pData = (const WCHAR*) cds->lpData;
+	size_t iDataLen = wcsnlen(pData, cds->cbData / sizeof(WCHAR));
+
+	// TODO: uncomment when this works 
+	// NotifyMsnMessenger(cds); 
+
+	if (bFirstEvent)
+	{
+		bFirstEvent = false;
+		g_objStartupTrace.Mark(_T("First now playing event received"));
+	}
+
+	if (!g_bAppInitialized)
+	{
+		if (!objEvent.Parse(pData, iDataLen)) return 0;
+
+		// Routing rules are not loaded yet, so the source may be needed later
+		GetEventSourceName((HWND) wParam, objEvent.m_szSource, CTrackEvent::MAX_SOURCE_LEN);
+
+		// Only the latest events matter, so when the buffer is full the oldest event is superseded
+		if (g_iPendingEventCount == g_iMaxPendingEvents)
+		{
+			g_arrPendingEvents[g_iPendingEventFirst]->Release();
+			g_iPendingEventFirst = (g_iPendingEventFirst + 1) % g_iMaxPendingEvents;
+			g_iPendingEventCount--;
+		}
+
+		// Queued as a record, which is allocated to the size of its texts (usually 256 bytes, a CTrackEvent is about 1.9 KB)
+		g_arrPendingEvents[(g_iPendingEventFirst + g_iPendingEventCount) % g_iMaxPendingEvents] = g_objEventRecordPool.Encode(objEvent, L"");
+		g_iPendingEventCount++;
+		return 0;
+	}
+
+	// Hmmm.. Unknown prefix in the data. Do nothing.
+	if (!objEvent.Parse(pData, iDataLen)) return 0;
+
+	// Opening the sender process is not free, so do it only if some rule needs the source
+	if (g_objRoutingRules.UsesField(CRoutingRules::FIELD_SOURCE))
+		GetEventSourceName((HWND) wParam, objEvent.m_szSource, CTrackEvent::MAX_SOURCE_LEN);
+
+	ProcessNowPlayingEvent(objEvent);
 	return 0; 
 } 
 
@@ -377,6 +956,11 @@ void ShowContextMenu(HWND hWnd)
 	} 
 } 
 
+void InitApplicationDeferred(HWND hWnd);
+void CheckWatchDogTimeout(void);
+void ClearExpiredTrack(void);
+void RunSoakTestBatch(HWND hWnd);
+
 //---------------------------------------------------------
 // Message handler of the main window
 //
@@ -387,14 +971,43 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 	switch (message) 
 	{ 
-		case WM_CREATE: 
-			// Create a new tray icon (default tooltip is the application name)
-			InitTray(hWnd, std::wstring(g_szAppName)); 
+		case WM_APP_DEFERRED_INIT: 
+			InitApplicationDeferred(hWnd);
+			break; 
+
+		case WM_APP_RECONCILE_STATE: 
+			ReconcileStaleSkypeMoodText();
+			break; 
+
+		case WM_APP_SOAK_BATCH: 
+			RunSoakTestBatch(hWnd);
+			break; 
+
+		case WM_APP_TRACK_EXPIRED: 
+			ClearExpiredTrack();
+			break; 
+
+#if LNT_FEATURE_BROADCAST
+		case WM_APP_BROADCAST_SOCKET: 
+			g_objBroadcastServer.OnSocketMessage(wParam, lParam);
+			break; 
+#endif
+
+		case WM_TIMER: 
+			if (wParam == IDT_TRIMWORKINGSET) TrimWorkingSet();
+			else if (wParam == IDT_ROUTING_HOLD) PublishHeldEvent();
+#if !LNT_FEATURE_WATCHDOG_THREAD
+			else if (wParam == IDT_WATCHDOG)
+			{
+				CheckWatchDogTimeout();
+				ScheduleWatchDog();
+			}
+#endif
 			break; 
 
 		case WM_DESTROY: 
 			CleanupApplication();
-			PostQuitMessage(0); 
+			PostQuitMessage(g_objSoakTest.HasFailed() ? 1 : 0); 
 			break; 
 
 		case WM_USER: 
@@ -500,15 +1113,119 @@ bool InitInstance(HINSTANCE hInstance, int nCmdShow)
 
 
 //----------------------------------------------------
-// WatchDog handler thread to reset Skype mood text back to empty string if
-// the same song title has been as "ListeningNow" text more than X minutes
-// (maybe MusicPlayer crashed and doesn't send anymore change events?)
+// Clear the "listening now" texts of all sinks if the current track should have ended
+// already, but no new event has arrived (maybe MusicPlayer crashed and doesn't 
+// send anymore change events?). See CTrackExpiry for the deadline of the track.
+//
+// Called by the watchdog thread or by the watchdog timer of the main window (minimal
+// build without the watchdog thread) at the deadline and every X minutes when idle.
+// The watchdog thread leaves the clearing to the main thread (WM_APP_TRACK_EXPIRED).
+//
+void CheckWatchDogTimeout(void)
+{
+	g_objProcessCS.Enter();
+   try
+   {
+	// Skype was not running when the app started. Try again to clear the text left behind by the crashed instance.
+	if (!g_strStaleSkypeMoodText.empty()) ReconcileStaleSkypeMoodText();
+
+	if (g_bProcessRunning && g_objTrackExpiry.CheckExpired(GetAppTickCount())) 
+	{
+#if LNT_FEATURE_WATCHDOG_THREAD
+		::PostMessage(g_hMainWnd, WM_APP_TRACK_EXPIRED, 0, 0);
+#else
+		ClearExpiredTrack();
+#endif
+	}
+   }
+   catch(...)
+   {
+   }
+	g_objProcessCS.Leave();
+}
+
+
+//--------------------------------------------------
+// Deadline of the current track has expired. Every sink of the build is cleared like a sink whose
+// routing rule drops the track, so the tray, Skype, shared memory readers and broadcast clients
+// all stop showing it. Main thread only.
+//
+void ClearExpiredTrack(void)
+{
+	static const CTrackEvent objEmptyEvent;
+
+	// New track arrived after the watchdog posted the message (the new track has a new deadline)
+	if (!g_bProcessRunning || !g_objTrackExpiry.IsExpired()) return;
+
+	CancelHeldEvent();
+
+	for (const CBuildSink* pSink = g_pPublishSinks; pSink->pfnPublish != NULL; pSink++)
+		pSink->pfnPublish(objEmptyEvent, std::wstring(), NULL, true);
+}
+
+
+//--------------------------------------------------
+// "/soak" mode. Feeds a batch of synthetic events through the WM_COPYDATA handler (parsing, rules, the
+// tray and Skype stand-in sinks, see g_arrSoakSinks) and samples the process after the batch. Batches are posted messages, so timers and socket
+// messages are handled between them as usual. The app quits when the run has been analyzed.
+//
+void RunSoakTestBatch(HWND hWnd)
+{
+	for (int idx = 0; idx < CSoakTest::BATCH_EVENTS && !g_objSoakTest.IsCompleted(); idx++)
+	{
+		COPYDATASTRUCT cds;
+		LARGE_INTEGER  liStart, liEnd;
+		size_t         iDataLen;
+		DWORD          dwGapMS;
+
+		cds.dwData = g_iMsn_NowPlayingEventNum;
+		cds.lpData = (PVOID) g_objSoakTest.NextEvent(iDataLen, dwGapMS);
+		cds.cbData = (DWORD) (iDataLen * sizeof(WCHAR));
+
+		::QueryPerformanceCounter(&liStart);
+		ProcessWMCopyDataEvent(hWnd, (WPARAM) hWnd, (LPARAM) &cds);
+		::QueryPerformanceCounter(&liEnd);
+		g_objSoakTest.AddLatency(liEnd.QuadPart - liStart.QuadPart);
+
+		// Compressed clock: the time until the next event passes at once, so held tracks and the
+		// watchdog deadline are checked here instead of waiting for their timers
+		g_dwClockOffsetMS += dwGapMS;
+		PublishHeldEvent();
+		CheckWatchDogTimeout();
+	}
+
+	CProcessStats objStats;
+	objStats.Sample();
+	objStats.SampleHeaps();
+	g_objSoakTest.AddSample(objStats);
+
+	if (!g_objSoakTest.IsCompleted())
+	{
+		::PostMessage(hWnd, WM_APP_SOAK_BATCH, 0, 0);
+		return;
+	}
+
+#if LNT_SINK_SKYPE
+	// Every Skype, Client and CurrentUserProfile object of the mood text updates is released by now
+	g_objSoakTest.SetComObjects(CSkypeStub::GetMoodTextChanges(), CSkypeStub::GetLiveObjectCount());
+#endif
+	g_objSoakTest.Analyze();
+	g_objSoakTest.Save(CIniFile::GetApplicationPath().append(L"\\ListeningNowTracker_soak.log"));
+	::OutputDebugString(g_objSoakTest.GetReport().substr(0, g_objSoakTest.GetReport().find(L"\n\n")).c_str());
+
+	::DestroyWindow(hWnd);
+}
+
+
+#if LNT_FEATURE_WATCHDOG_THREAD
+//----------------------------------------------------
+// WatchDog handler thread. Sleeps until the deadline of the current track (or X minutes
+// if no track is playing). A new track wakes the thread up to wait for the new deadline.
 //
 // Note! This function is executed in a separate thread (see CThread)
 //
 unsigned __stdcall ThreadWatchDogHandler(void *pArg)
 {
-	DWORD dwCurrentTimeStampMS;
 	DWORD dwResetPeriodInMS;
 
 	CThreadContext *objThreadCtx = (CThreadContext*) pArg;	
@@ -518,58 +1235,293 @@ unsigned __stdcall ThreadWatchDogHandler(void *pArg)
 	dwResetPeriodInMS = *((DWORD*)objThreadCtx->m_pUserData);
 	dwResetPeriodInMS = 1000 * 60 * dwResetPeriodInMS;
 
+#if LNT_SINK_SKYPE
 	// Thread needs to do its own OLE initialization or it fails to use Skype OLE object
 	comstl::com_initialiser coinit;
+	g_objStartupTrace.Mark(_T("OLE initialized in watchdog thread"));
+
+	// Pre-load Skype4COM library while the main thread is free to receive events. The main thread
+	// creates its own Skype object on the first update, but then the DLL is already loaded and registered.
+	try
+	{
+		vole::object objSkype = vole::object::create(L"Skype4COM.Skype");
+		(void) objSkype;
+		g_objStartupTrace.Mark(_T("Skype4COM coclass preloaded"));
+	}
+	catch(...)
+	{
+		// Do nothing. UpdateSkypeMoodText reports the error if Skype4COM is really missing
+	}
+#endif
+
+	HANDLE arrWaitHandles[2] = { objThreadCtx->m_hStopEvent, g_objTrackExpiry.GetWakeEvent() };
 
 	while (g_bProcessRunning) 
 	{ 
-		// Sleep X minutes and check whether the song title is still the same or
-		// until the thread is signaled to stop (ie. hStopEvent is something else than TIMEOUT signaled)
-		if (::WaitForSingleObject(objThreadCtx->m_hStopEvent, dwResetPeriodInMS) != WAIT_TIMEOUT) break;
+		// Sleep until the deadline, a new deadline or until the thread is signaled to stop
+		DWORD dwWaitResult = ::WaitForMultipleObjects(2, arrWaitHandles, FALSE, g_objTrackExpiry.GetWaitMS(GetAppTickCount(), dwResetPeriodInMS));
+		if (dwWaitResult == WAIT_OBJECT_0 + 1) continue;
+		if (dwWaitResult != WAIT_TIMEOUT) break;
 		if (g_bProcessRunning == FALSE) break;
 
-		g_objProcessCS.Enter();
-	   try
-	   {
-	    // Do nothing if Skype MoodText is not set (ie. empty text because no song playing)
-		if (g_dwLastTrackChangeTimeStampMS != 0) 
-		{
-			dwCurrentTimeStampMS = ::GetTickCount();
-			if (dwCurrentTimeStampMS < g_dwLastTrackChangeTimeStampMS)
-			{
-				// GetTickCount wraps around back to zero if Windows is not rebooted within 49 days.
-				// In that case do not reset the Skype mood text, just wait for the next timeout and 
-				// this watchdog is back in normal cycle
-				g_dwLastTrackChangeTimeStampMS = dwCurrentTimeStampMS;
-			}
-			else if ( (dwCurrentTimeStampMS - g_dwLastTrackChangeTimeStampMS) >= dwResetPeriodInMS)
-			{
-				// It's been more than 10 minutes since the song title was changed. Reset Skype mood text to empty string.
-				UpdateSkypeMoodText(std::wstring(L""));				
-			}
-		}
-	   }
-	   catch(...)
-	   {
-	   }
-		g_objProcessCS.Leave();
+		CheckWatchDogTimeout();
 	}
 
 	// CRT _beginthreadex requires _endthreadex within the thread to signal and cleanup the thread
 	_endthreadex(0);
 	return 0;
 }
+#endif //LNT_FEATURE_WATCHDOG_THREAD
+
+
+#if LNT_FEATURE_LIBRARY_INDEX
+//----------------------------------------------------
+// Music library scan thread. Loads the index of the previous scan (lookups work immediately),
+// updates the index incrementally from the music folders and quits.
+//
+// Note! This function is executed in a separate thread (see CThread)
+//
+unsigned __stdcall ThreadLibraryScanHandler(void *pArg)
+{
+	CThreadContext *objThreadCtx = (CThreadContext*) pArg;	
+	CMusicLibraryIndex::CScanStats objStats;
+	WCHAR szText[200];
+
+	std::wstring strIndexFileName = CIniFile::GetUserDataPath().append(L"\\ListeningNowTracker.tagindex");
+
+	if (g_objMusicLibrary.Load(strIndexFileName))
+		g_objStartupTrace.Mark(_T("Music library index loaded"));
+
+	// Default is one worker per CPU. Tag reading is mostly waiting for the disk, so more doesn't hurt much either.
+	int iThreadCount = g_iLibraryScanThreads;
+	if (iThreadCount <= 0)
+	{
+		SYSTEM_INFO objSysInfo;
+		::GetSystemInfo(&objSysInfo);
+		iThreadCount = (int) objSysInfo.dwNumberOfProcessors;
+	}
+
+	if (g_bProcessRunning && g_objMusicLibrary.Rebuild(g_arrLibraryFolders, iThreadCount, strIndexFileName, objThreadCtx->m_hStopEvent, objStats))
+	{
+		_snwprintf_s(szText, (sizeof(szText) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+			L"ListeningNowTracker: Music library scanned. %u files (%u read) in %u ms, %u files/sec, index %u bytes\n",
+			objStats.dwFileCount, objStats.dwParsedCount, objStats.dwElapsedMS,
+			(objStats.dwElapsedMS > 0 ? (DWORD) (((ULONGLONG) objStats.dwFileCount * 1000) / objStats.dwElapsedMS) : objStats.dwFileCount),
+			objStats.dwIndexBytes);
+		::OutputDebugString(szText);
+	}
+
+	// CRT _beginthreadex requires _endthreadex within the thread to signal and cleanup the thread
+	_endthreadex(0);
+	return 0;
+}
+#endif //LNT_FEATURE_LIBRARY_INDEX
+
+
+//----------------------------------------------------
+// Deferred part of the application initialization. The main window is already receiving
+// events at this point, so nothing here delays the processing of "now playing" messages.
+// Events received before this function has completed are buffered and replayed at the end.
+//
+void InitApplicationDeferred(HWND hWnd)
+{
+	if (g_bAppInitialized || g_bProcessRunning == FALSE) return;
+
+	// Create a new tray icon (default tooltip is the application name). Shell may be slow to respond at login time.
+	InitTray(hWnd, std::wstring(g_szAppName)); 
+	g_objStartupTrace.Mark(_T("Tray icon created"));
+
+	CIniFile objAppINIFile(CIniFile::GetApplicationPath().append(L"\\ListeningNowTracker.ini").c_str());
+
+	g_strListeningNowText          = objAppINIFile.ReadString (L"CONFIG", L"ListeningNowText", L"Listening '%1s' by %2s");
+	g_dwSongTitleResetPeriodInMins = objAppINIFile.ReadInteger(L"CONFIG", L"WatchDogTimerInMins", 10);
+	g_objTrackExpiry.SetPolicy(objAppINIFile.ReadInteger(L"CONFIG", L"AdaptiveWatchDog", 1) != 0, 1000 * 60 * g_dwSongTitleResetPeriodInMins);
+	g_dwTrimWorkingSetAfterIdleSecs = objAppINIFile.ReadInteger(L"CONFIG", L"TrimWorkingSetAfterIdleSecs", LNT_DEFAULT_TRIM_IDLE_SECS);
+#if LNT_FEATURE_BROADCAST
+	WORD wBroadcastPort = (WORD) objAppINIFile.ReadInteger(L"BROADCAST", L"Port", 0);
+#endif
+#if LNT_FEATURE_LIBRARY_INDEX
+	g_arrLibraryFolders   = objAppINIFile.ReadStringList(L"LIBRARY", L"Folders");
+	g_iLibraryScanThreads = objAppINIFile.ReadInteger(L"LIBRARY", L"ScanThreads", 0);
+#endif
+	g_objStartupTrace.Mark(_T("INI file read"));
+
+	// Title normalization rules (built-in rules if INI file doesn't have any)
+	if (objAppINIFile.ReadInteger(L"NORMALIZE", L"Enabled", 1) != 0)
+	{
+		std::vector<std::wstring> arrRules = objAppINIFile.ReadSectionValues(L"NORMALIZE", L"Rule");
+		if (arrRules.empty()) arrRules = CTitleNormalizer::GetDefaultRules();
+
+		g_objTitleNormalizer.Compile(arrRules, objAppINIFile.ReadInteger(L"NORMALIZE", L"CaseFold", 0) != 0);
+		g_objStartupTrace.Mark(_T("Title normalization rules compiled"));
+
+		if (g_objTitleNormalizer.GetStats().bTooManyStates)
+		{
+			g_objStartupTrace.Note(L"ERROR: Too many [NORMALIZE] rules. Title normalization is disabled");
+			UpdateTrayText(L"ERROR: Too many [NORMALIZE] rules. Title normalization is disabled");
+		}
+
+		if (g_objStartupTrace.IsEnabled())
+		{
+			const CTitleNormalizer::CCompileStats& objStats = g_objTitleNormalizer.GetStats();
+			WCHAR szText[160];
+
+			_snwprintf_s(szText, (sizeof(szText) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"Title normalizer: %u rules (%u invalid), %u DFA states, %u char classes, %u bytes%s",
+				objStats.dwRuleCount, objStats.dwInvalidRuleCount, objStats.dwStateCount, objStats.dwClassCount, objStats.dwTableBytes,
+				(g_objTitleNormalizer.IsEnabled() ? L"" : L" - DISABLED"));
+			g_objStartupTrace.Note(szText);
+		}
+	}
+
+	// Routing rules (no rules = every track is published to every sink)
+	{
+		std::vector<std::wstring> arrRules = objAppINIFile.ReadSectionValues(L"ROUTING", L"Rule");
+		g_objRoutingRules.Compile(arrRules);
+		g_objStartupTrace.Mark(_T("Routing rules compiled"));
+
+		if (g_objStartupTrace.IsEnabled())
+		{
+			const CRoutingRules::CCompileStats& objStats = g_objRoutingRules.GetStats();
+			WCHAR szText[160];
+
+			_snwprintf_s(szText, (sizeof(szText) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"Routing rules: %u rules (%u invalid), %u instructions, %u atoms",
+				objStats.dwRuleCount, objStats.dwInvalidRuleCount, objStats.dwInstructionCount, objStats.dwAtomCount);
+			g_objStartupTrace.Note(szText);
+		}
+	}
+
+	// Non-empty text in the checkpoint means that the previous instance didn't exit cleanly.
+	// Reconciliation talks to Skype, so it is posted to run after the buffered events. The soak
+	// test leaves the checkpoint of the real sinks alone (texts are then kept in memory only).
+	if (!g_objSoakTest.IsEnabled() && g_objStateCheckpoint.Open(CIniFile::GetUserDataPath().append(L"\\ListeningNowTracker.state")))
+	{
+		g_strStaleSkypeMoodText = g_objStateCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE);
+		if (!g_strStaleSkypeMoodText.empty()) ::PostMessage(hWnd, WM_APP_RECONCILE_STATE, 0, 0);
+	}
+	g_objStartupTrace.Mark(_T("State checkpoint loaded"));
+
+#if LNT_SINK_SHARED_MEMORY
+	if (!g_objSoakTest.IsEnabled() && g_objNowPlayingSegment.Open())
+		g_objStartupTrace.Mark(_T("Shared memory segment created"));
+	else if (g_objNowPlayingSegment.IsIncompatible())
+	{
+		// Reader of another version keeps the old segment alive. The segment is not used until the next start.
+		g_objStartupTrace.Note(L"ERROR: Shared memory segment of another version is still open by a reader");
+		UpdateTrayText(L"ERROR: Shared memory segment of another version is still open by a reader. Restart the reader");
+	}
+#endif
+
+	if (!g_objSoakTest.IsEnabled() && g_objTrackExpiry.Load(CIniFile::GetUserDataPath().append(L"\\ListeningNowTracker.lengths")))
+	{
+		g_objStartupTrace.Mark(_T("Learned track lengths loaded"));
+
+		if (g_objStartupTrace.IsEnabled())
+		{
+			const CTrackExpiry::CStats& objStats = g_objTrackExpiry.GetStats();
+			WCHAR szText[160];
+
+			_snwprintf_s(szText, (sizeof(szText) / sizeof(WCHAR)) - sizeof(WCHAR), _TRUNCATE,
+				L"Track expiry: %u learned track lengths, %u plays in the length distribution", objStats.dwLearnedTracks, objStats.dwSampleCount);
+			g_objStartupTrace.Note(szText);
+		}
+	}
+
+	// Start a watchdog (resets Skype MoodText back to empty string if song 
+	// title haven't changed in X minutes. It is assumed that MusicPlayer has crashed or quit)
+#if LNT_FEATURE_WATCHDOG_THREAD
+	g_objThreadWatchDog.Attach(ThreadWatchDogHandler);
+	g_objThreadWatchDog.Start(&g_dwSongTitleResetPeriodInMins);
+	g_objStartupTrace.Mark(_T("WatchDog thread started"));
+#else
+	::SetTimer(hWnd, IDT_WATCHDOG, 1000 * 60 * g_dwSongTitleResetPeriodInMins, NULL);
+	g_objStartupTrace.Mark(_T("WatchDog timer started"));
+#endif
+
+#if LNT_FEATURE_BROADCAST
+	// Broadcast server is disabled by default (port 0)
+	if (wBroadcastPort != 0 && !g_objSoakTest.IsEnabled())
+	{
+		if (g_objBroadcastServer.Start(hWnd, WM_APP_BROADCAST_SOCKET, wBroadcastPort))
+			g_objStartupTrace.Mark(_T("Broadcast server started"));
+		else
+			UpdateTrayText(L"ERROR: Could not start the broadcast server. Port is in use?");
+	}
+#endif
+
+	// Stale shared memory and broadcast state of a crashed instance (sinks are up, events not yet replayed)
+	ReconcileStaleSinkState();
+
+#if LNT_FEATURE_LIBRARY_INDEX
+	// Music library scan runs in the background. Events are enriched as soon as the old index is loaded.
+	if (!g_arrLibraryFolders.empty())
+	{
+		g_objThreadLibraryScan.Attach(ThreadLibraryScanHandler);
+		g_objThreadLibraryScan.Start();
+		g_objStartupTrace.Mark(_T("Music library scan thread started"));
+	}
+#endif
+
+	g_bAppInitialized = TRUE;
+
+	// Replay events received during the initialization (in the original order)
+	for (size_t idx = 0; idx < g_iPendingEventCount; idx++)
+	{
+		CEventRecord* pPendingRecord = g_arrPendingEvents[(g_iPendingEventFirst + idx) % g_iMaxPendingEvents];
+		CTrackEvent objPendingEvent;
+
+		CEventRecord::Decode(pPendingRecord->GetView(), objPendingEvent);
+		pPendingRecord->Release();
+		ProcessNowPlayingEvent(objPendingEvent);
+	}
+
+	if (g_iPendingEventCount > 0)
+		g_objStartupTrace.Mark(_T("Buffered events replayed"));
+
+	g_iPendingEventFirst = g_iPendingEventCount = 0;
+
+	g_objStartupTrace.Mark(_T("Deferred initialization completed"));
+
+	// Startup pages are not needed anymore
+	if (g_dwTrimWorkingSetAfterIdleSecs > 0) TrimWorkingSet();
+
+	TraceFootprint(L"");
+	g_objStartupTrace.Save(CIniFile::GetApplicationPath().append(L"\\ListeningNowTracker_startup.log"));
+
+	if (g_objSoakTest.IsEnabled()) ::PostMessage(hWnd, WM_APP_SOAK_BATCH, 0, 0);
+}
 
 
 //----------------------------------------------------
 // MAIN procedure. Everything starts from here
 //
-int APIENTRY _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR /*lpCmdLine*/, int nCmdShow) 
+// Startup is split in two parts. WinMain does only the minimum to get the message window
+// listening for events and the rest is done by InitApplicationDeferred when the message loop runs.
+//
+int APIENTRY _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lpCmdLine, int nCmdShow) 
 { 
 	MSG	  msg; 
-	DWORD dwSongTitleResetPeriodInMins;
 
-	CIniFile objAppINIFile(CIniFile::GetApplicationPath().append(L"\\ListeningNowTracker.ini").c_str());
+	// "/trace" cmdline option writes the timeline of the startup phases to the debugger output and to a log file
+	g_objStartupTrace.Enable(lpCmdLine != NULL && _tcsstr(lpCmdLine, _T("/trace")) != NULL);
+	g_objStartupTrace.Mark(_T("WinMain entered"));
+
+	// "/soak[:events]" cmdline option runs the soak test and quits (exit code 1 = leak or latency drift found).
+	// A malformed option is reported and ignored, the app starts as usual.
+	DWORD dwSoakEventCount;
+	if (CSoakTest::ParseOption(lpCmdLine, dwSoakEventCount))
+	{
+		g_objSoakTest.Enable(dwSoakEventCount);
+		if (g_objSoakTest.IsEnabled())
+		{
+			g_objSoakTest.SetFootprintBudget(LNT_WORKINGSET_BUDGET_KB, LNT_PRIVATEBYTES_BUDGET_KB);
+			g_pPublishSinks = g_arrSoakSinks;
+		}
+		else
+			::OutputDebugString(L"ListeningNowTracker: Invalid /soak option (use /soak or /soak:<events>), soak test not run\n");
+	}
+
 	CMutex   objProcessMutex(std::wstring(L"mutex_").append(g_szAppName).c_str());
 
 	// ::MessageBox(NULL, L"test", L"title", MB_ICONWARNING | MB_TOPMOST | MB_OK); 
@@ -577,33 +1529,33 @@ int APIENTRY _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR
 	// Initialize shared resources
 	ZeroMemory(&g_ToolbarTrayIcon, sizeof(g_ToolbarTrayIcon)); 
 	g_bProcessRunning = TRUE;
+	g_bAppInitialized = FALSE;
+	g_bMainThreadCOMInitialized = FALSE;
+	g_dwMainThreadID = ::GetCurrentThreadId();
 	g_dwLastTrackChangeTimeStampMS = 0;
+	g_iPendingEventFirst = g_iPendingEventCount = 0;
 
 	// Proceed to initialize the application
 
 	// Makes sure this is the only instance of this application. Quit if app is already running
 	if (objProcessMutex.GetShareCount() != 1)
 		return AbnormalAppClosing();
+	g_objStartupTrace.Mark(_T("Single instance mutex created"));
 
 	// Register window class using the class name used by Spotify to notify MSN about "listening" events
 	if (!RegisterAppWndClass(hInstance))
 		return AbnormalAppClosing();
+	g_objStartupTrace.Mark(_T("Window class registered"));
 
 	// Initialize the application
 	if (!InitInstance(hInstance, nCmdShow)) 
 		return AbnormalAppClosing();
+	g_objStartupTrace.Mark(_T("Message window listening"));
+	if (!g_objStartupTrace.CheckBudget(_T("Message window listening"), LNT_LISTENING_BUDGET_MS))
+		g_bBudgetExceeded = true;
 
-	// Initialize OLE APIs (used to communicate with Skype API)
-	comstl::com_initialiser coinit;
-
-	// Start a watchdog thread (resets Skype MoodText back to empty string if song 
-	// title haven't changed in X minutes. It is assumed that MusicPlayer has crashed or quit)
-
-	g_strListeningNowText        = objAppINIFile.ReadString (L"CONFIG", L"ListeningNowText", L"Listening '%1s' by %2s");
-	dwSongTitleResetPeriodInMins = objAppINIFile.ReadInteger(L"CONFIG", L"WatchDogTimerInMins", 10);
-
-	g_objThreadWatchDog.Attach(ThreadWatchDogHandler);
-	g_objThreadWatchDog.Start(&dwSongTitleResetPeriodInMins);
+	// The rest of the initialization (tray icon, INI file, watchdog thread) runs from the message loop
+	::PostMessage(g_hMainWnd, WM_APP_DEFERRED_INIT, 0, 0);
  
 	// Start the main message loop
 	while(GetMessage(&msg, NULL, 0, 0)) 
@@ -614,9 +1566,23 @@ int APIENTRY _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR
 
 	// Terminate the watchdog thread brutally just in case it is not yet terminated.
 	// Also, call CleanupApplication just in case (should have been called already as WM_DESTROY message handling)
+#if LNT_FEATURE_WATCHDOG_THREAD
 	g_objThreadWatchDog.Stop(TRUE);
+#endif
+#if LNT_FEATURE_LIBRARY_INDEX
+	g_objThreadLibraryScan.Stop(TRUE);
+#endif
 	CleanupApplication();
 
-	return ((int) msg.wParam); 
-} 
+#if LNT_SINK_SKYPE
+	g_objSkypeStubFactory.Revoke();
+#endif
+	if (g_bMainThreadCOMInitialized) ::CoUninitialize();
 
+	// Peak footprint of the whole session
+	TraceFootprint(L"At exit: ");
+
+	g_objStartupTrace.Save(CIniFile::GetApplicationPath().append(L"\\ListeningNowTracker_startup.log"));
+
+	return (g_bBudgetExceeded ? 2 : (int) msg.wParam);
+} 
@@ -0,0 +1,206 @@
+#ifndef __NOWPLAYINGREADER_H__
+#define __NOWPLAYINGREADER_H__
+
+#include <windows.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "EventRecord.h"
+
+/*
+ * Reader of the "now playing" shared memory segment published by ListeningNowTracker.
+ *
+ * This header is meant for other applications (overlays, widgets) which poll the current track
+ * frequently. It depends only on windows.h and EventRecord.h, so copy both to your project. Opening the
+ * segment costs a couple of system calls, but reading a snapshot doesn't make any system calls
+ * or take any locks.
+ *
+ * The segment is protected by a sequence lock: the writer makes the sequence number odd before it
+ * modifies the data and even again when the data is complete. Reader copies the data and retries
+ * if the sequence number was odd or changed during the copy.
+ *
+ *   CNowPlayingReader objReader;
+ *   CNowPlayingSnapshot objSnapshot;
+ *
+ *   if (objReader.Open() && objReader.Read(objSnapshot) && objSnapshot.dwStatus == NOWPLAYING_STATUS_PLAYING)
+ *      wprintf(L"%s by %s\n", objSnapshot.szTitle, objSnapshot.szArtist);
+ *
+ * Call HasChanged(dwLastSequence) first if you poll very often and the track usually stays the same.
+ *
+ * The segment has also the binary event record of the track (UTF-8 texts, see EventRecord.h).
+ * ReadRecord copies it out with the same sequence lock. Segments of older tracker versions don't
+ * have the record (ReadRecord returns false).
+*/
+
+#define NOWPLAYING_SEGMENT_NAME		L"Local\\ListeningNowTracker_NowPlaying"
+#define NOWPLAYING_MAGIC			0x504E544C	/* "LTNP" */
+#define NOWPLAYING_VERSION			1			// Incremented only if existing fields change. New fields are added to the end.
+
+#define NOWPLAYING_STATUS_STOPPED	0
+#define NOWPLAYING_STATUS_PLAYING	1
+
+// Track data of the segment (copied out by the reader)
+struct CNowPlayingSnapshot
+{
+	DWORD     dwStatus;			// NOWPLAYING_STATUS_xxx
+	DWORD     dwEventCount;		// Number of events published by the current writer process
+	ULONGLONG ullEventTime;		// Time of the event (FILETIME, UTC)
+	DWORD     dwDurationMS;		// 0 = Unknown
+	WORD      wYear;			// 0 = Unknown
+	WORD      wTrackNumber;		// 0 = Unknown
+	WCHAR     szTitle [256];
+	WCHAR     szArtist[256];
+	WCHAR     szAlbum [256];
+	WCHAR     szGenre [48];
+	WCHAR     szText  [200];	// "Listening now" text as formatted by the tracker
+};
+
+// Fixed layout of the shared memory segment
+struct CNowPlayingLayout
+{
+	DWORD         dwMagic;
+	DWORD         dwVersion;
+	DWORD         dwSize;				// Size of the layout written by the tracker (>= sizeof of older versions)
+	DWORD         dwWriterProcessID;	// Process ID of the tracker (readers may check that it is still alive)
+	volatile LONG lSequence;			// Sequence lock. Odd = Write in progress
+	DWORD         dwReserved;
+	CNowPlayingSnapshot objData;
+
+	// Added to the end of the version 1 layout (check dwSize before use)
+	DWORD         dwRecordSize;			// 0 = No record
+	DWORD         dwReserved2;
+	BYTE          arrRecord[EVENTRECORD_MAX_SIZE];
+};
+
+// Size of the layout before the event record was added
+#define NOWPLAYING_MIN_LAYOUT_SIZE	offsetof(CNowPlayingLayout, dwRecordSize)
+
+
+class CNowPlayingReader
+{
+  protected:
+	HANDLE                         m_hMapping;
+	const volatile CNowPlayingLayout* m_pLayout;
+
+  public:
+	CNowPlayingReader()
+	{
+		m_hMapping = NULL;
+		m_pLayout = NULL;
+	}
+
+	~CNowPlayingReader()
+	{
+		Close();
+	}
+
+	// Open the segment. Fails if the tracker is not running (or runs in another logon session).
+	bool Open(const WCHAR* szName = NOWPLAYING_SEGMENT_NAME)
+	{
+		Close();
+
+		m_hMapping = ::OpenFileMappingW(FILE_MAP_READ, FALSE, szName);
+		if (m_hMapping == NULL) return false;
+
+		// Whole segment is mapped, because the segment of an older tracker is smaller than CNowPlayingLayout
+		m_pLayout = (const volatile CNowPlayingLayout*) ::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+
+		if (m_pLayout == NULL || m_pLayout->dwMagic != NOWPLAYING_MAGIC || m_pLayout->dwVersion != NOWPLAYING_VERSION || m_pLayout->dwSize < NOWPLAYING_MIN_LAYOUT_SIZE)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_pLayout != NULL) ::UnmapViewOfFile((LPCVOID) m_pLayout);
+		if (m_hMapping != NULL) ::CloseHandle(m_hMapping);
+
+		m_pLayout = NULL;
+		m_hMapping = NULL;
+	}
+
+	bool IsOpen() const { return m_pLayout != NULL; }
+
+	DWORD GetWriterProcessID() const { return (m_pLayout != NULL ? m_pLayout->dwWriterProcessID : 0); }
+
+	// Cheap change check (one memory read). Pass the sequence number returned by the previous Read call.
+	bool HasChanged(LONG lLastSequence) const
+	{
+		return (m_pLayout != NULL && m_pLayout->lSequence != lLastSequence);
+	}
+
+	//
+	// Copy a consistent snapshot of the segment. Returns false if the segment is not open or the writer
+	// didn't complete a write within iMaxRetries attempts (for example the tracker crashed in the middle
+	// of a write). plSequence receives the sequence number of the snapshot (see HasChanged).
+	//
+	bool Read(CNowPlayingSnapshot& objSnapshot, LONG* plSequence = NULL, int iMaxRetries = 1000) const
+	{
+		if (m_pLayout == NULL) return false;
+
+		for (int iRetry = 0; iRetry < iMaxRetries; iRetry++)
+		{
+			LONG lSequence = m_pLayout->lSequence;
+			if (lSequence & 1)
+			{
+				YieldProcessor();
+				continue;
+			}
+
+			MemoryBarrier();
+			memcpy(&objSnapshot, (const void*) &m_pLayout->objData, sizeof(objSnapshot));
+			MemoryBarrier();
+
+			if (m_pLayout->lSequence == lSequence)
+			{
+				// Writer truncates the texts, but a reader must not trust anything in shared memory
+				objSnapshot.szTitle [255] = objSnapshot.szArtist[255] = objSnapshot.szAlbum[255] = L'\0';
+				objSnapshot.szGenre [47]  = objSnapshot.szText[199] = L'\0';
+
+				if (plSequence != NULL) *plSequence = lSequence;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//
+	// Copy the event record of the current track to pBuffer (EVENTRECORD_MAX_SIZE bytes) and attach
+	// objView to it. Returns false if the segment has no record or a consistent copy was not possible.
+	//
+	bool ReadRecord(BYTE* pBuffer, CEventRecordView& objView, LONG* plSequence = NULL, int iMaxRetries = 1000) const
+	{
+		if (m_pLayout == NULL || m_pLayout->dwSize < sizeof(CNowPlayingLayout)) return false;
+
+		for (int iRetry = 0; iRetry < iMaxRetries; iRetry++)
+		{
+			LONG lSequence = m_pLayout->lSequence;
+			if (lSequence & 1)
+			{
+				YieldProcessor();
+				continue;
+			}
+
+			MemoryBarrier();
+			DWORD dwRecordSize = m_pLayout->dwRecordSize;
+			if (dwRecordSize > EVENTRECORD_MAX_SIZE) dwRecordSize = 0;
+			memcpy(pBuffer, (const void*) m_pLayout->arrRecord, dwRecordSize);
+			MemoryBarrier();
+
+			if (m_pLayout->lSequence == lSequence)
+			{
+				if (plSequence != NULL) *plSequence = lSequence;
+				return objView.Attach(pBuffer, dwRecordSize);
+			}
+		}
+
+		return false;
+	}
+};
+
+#endif //__NOWPLAYINGREADER_H__
\ No newline at end of file
@@ -0,0 +1,1836 @@
+/*
+	File: Win32Compat.cpp
+
+	Win32 API subset of Compat/windows.h on top of POSIX. Only the behaviour the app relies on is
+	implemented, but that part follows Win32 closely (recursive critical sections, auto-reset events,
+	conversion functions failing on a too small buffer, views bigger than the file mapping failing etc),
+	so the tests see the same results as the app on Windows.
+*/
+
+#include <windows.h>
+#include <process.h>
+#include <winsock2.h>
+#include <wincrypt.h>
+#include <psapi.h>
+#include <objbase.h>
+#include <oleauto.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <locale.h>
+#include <malloc.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+
+
+//--------------------------------------------------------
+// Kernel objects behind the HANDLE values
+//
+class CCompatObject
+{
+  public:
+	enum { TYPE_EVENT, TYPE_THREAD, TYPE_MUTEX, TYPE_FILE, TYPE_MAPPING, TYPE_FIND };
+
+	int           m_iType;
+	volatile LONG m_lRefCount;
+
+	CCompatObject(int iType) : m_iType(iType), m_lRefCount(1) {}
+	virtual ~CCompatObject() {}
+
+	void AddRef()  { ::InterlockedIncrement(&m_lRefCount); }
+	void Release() { if (::InterlockedDecrement(&m_lRefCount) == 0) delete this; }
+};
+
+// Events and threads share one lock and condition, so a wait for several objects is simple
+static pthread_mutex_t g_objWaitMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_objWaitCond;
+
+class CEventObject : public CCompatObject
+{
+  public:
+	bool m_bManualReset;
+	bool m_bSignaled;
+
+	CEventObject(bool bManualReset, bool bSignaled) : CCompatObject(TYPE_EVENT), m_bManualReset(bManualReset), m_bSignaled(bSignaled) {}
+};
+
+class CThreadObject : public CCompatObject
+{
+  public:
+	unsigned (__stdcall *m_pStartAddress)(void*);
+	void*    m_pArg;
+	DWORD    m_dwExitCode;
+	bool     m_bSignaled;
+
+	CThreadObject() : CCompatObject(TYPE_THREAD), m_pStartAddress(NULL), m_pArg(NULL), m_dwExitCode(STILL_ACTIVE), m_bSignaled(false) {}
+};
+
+class CMutexObject : public CCompatObject
+{
+  public:
+	std::wstring m_strName;
+
+	CMutexObject(const std::wstring& strName) : CCompatObject(TYPE_MUTEX), m_strName(strName) {}
+	~CMutexObject();
+};
+
+class CFileObject : public CCompatObject
+{
+  public:
+	int m_iFD;
+
+	CFileObject(int iFD) : CCompatObject(TYPE_FILE), m_iFD(iFD) {}
+	~CFileObject() { ::close(m_iFD); }
+};
+
+// Named mappings are POSIX shared memory objects. The creator removes the name when it closes the
+// handle (Win32 keeps the name while any handle is open, but the tests don't depend on that).
+class CMappingObject : public CCompatObject
+{
+  public:
+	int         m_iFD;
+	ULONGLONG   m_ullSize;
+	bool        m_bWritable;
+	std::string m_strShmName;
+
+	CMappingObject(int iFD, ULONGLONG ullSize, bool bWritable, const std::string& strShmName)
+		: CCompatObject(TYPE_MAPPING), m_iFD(iFD), m_ullSize(ullSize), m_bWritable(bWritable), m_strShmName(strShmName) {}
+
+	~CMappingObject()
+	{
+		::close(m_iFD);
+		if (!m_strShmName.empty()) ::shm_unlink(m_strShmName.c_str());
+	}
+};
+
+class CFindObject : public CCompatObject
+{
+  public:
+	DIR*        m_pDir;
+	std::string m_strFolder;
+
+	CFindObject(DIR* pDir, const std::string& strFolder) : CCompatObject(TYPE_FIND), m_pDir(pDir), m_strFolder(strFolder) {}
+	~CFindObject() { ::closedir(m_pDir); }
+};
+
+static __thread DWORD          t_dwLastError;
+static __thread CThreadObject* t_pCurrentThread;
+
+static CCompatObject* GetObject(HANDLE hHandle, int iType)
+{
+	if (hHandle == NULL || hHandle == INVALID_HANDLE_VALUE) return NULL;
+
+	CCompatObject* pObject = (CCompatObject*) hHandle;
+	return (iType < 0 || pObject->m_iType == iType ? pObject : NULL);
+}
+
+static DWORD ErrorFromErrno(int iErrno)
+{
+	switch (iErrno)
+	{
+		case ENOENT: return ERROR_FILE_NOT_FOUND;
+		case ENOTDIR: return ERROR_PATH_NOT_FOUND;
+		case EACCES:
+		case EPERM: return ERROR_ACCESS_DENIED;
+		case EEXIST: return ERROR_FILE_EXISTS;
+		case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
+		case EBADF: return ERROR_INVALID_HANDLE;
+		default: return ERROR_INVALID_PARAMETER;
+	}
+}
+
+// File name in UTF-8 with '/' separators
+static std::string ToNativePath(LPCWSTR szPath)
+{
+	std::string strPath;
+	int iBytes = ::WideCharToMultiByte(CP_UTF8, 0, szPath, -1, NULL, 0, NULL, NULL);
+
+	if (iBytes > 1)
+	{
+		strPath.resize(iBytes);
+		::WideCharToMultiByte(CP_UTF8, 0, szPath, -1, &strPath[0], iBytes, NULL, NULL);
+		strPath.resize(iBytes - 1);
+	}
+
+	for (size_t idx = 0; idx < strPath.size(); idx++)
+		if (strPath[idx] == '\\') strPath[idx] = '/';
+
+	return strPath;
+}
+
+static void ToFileTime(const struct timespec& objTime, FILETIME* pFileTime)
+{
+	ULONGLONG ullTime = (ULONGLONG) objTime.tv_sec * 10000000ULL + objTime.tv_nsec / 100 + 116444736000000000ULL;
+	pFileTime->dwLowDateTime  = (DWORD) ullTime;
+	pFileTime->dwHighDateTime = (DWORD) (ullTime >> 32);
+}
+
+// Text files of the tests (logs) are written in UTF-8
+static struct CCompatInit
+{
+	CCompatInit()
+	{
+		pthread_condattr_t objAttr;
+		pthread_condattr_init(&objAttr);
+		pthread_condattr_setclock(&objAttr, CLOCK_MONOTONIC);
+		pthread_cond_init(&g_objWaitCond, &objAttr);
+		pthread_condattr_destroy(&objAttr);
+
+		setlocale(LC_CTYPE, "C.UTF-8");
+	}
+} g_objCompatInit;
+
+
+//--------------------------------------------------------
+// Errors and handles
+//
+DWORD GetLastError(void)
+{
+	return t_dwLastError;
+}
+
+void SetLastError(DWORD dwError)
+{
+	t_dwLastError = dwError;
+}
+
+BOOL CloseHandle(HANDLE hObject)
+{
+	CCompatObject* pObject = GetObject(hObject, -1);
+	if (pObject == NULL)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pObject->Release();
+	return TRUE;
+}
+
+
+//--------------------------------------------------------
+// Synchronization
+//
+void InitializeCriticalSection(CRITICAL_SECTION* pCS)
+{
+	pthread_mutexattr_t objAttr;
+	pthread_mutexattr_init(&objAttr);
+	pthread_mutexattr_settype(&objAttr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&pCS->objMutex, &objAttr);
+	pthread_mutexattr_destroy(&objAttr);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION* pCS)
+{
+	pthread_mutex_destroy(&pCS->objMutex);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION* pCS)
+{
+	pthread_mutex_lock(&pCS->objMutex);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION* pCS)
+{
+	pthread_mutex_unlock(&pCS->objMutex);
+}
+
+HANDLE CreateEventW(LPVOID /*pAttributes*/, BOOL bManualReset, BOOL bInitialState, LPCWSTR /*szName*/)
+{
+	::SetLastError(ERROR_SUCCESS);
+	return (HANDLE) new CEventObject(bManualReset != FALSE, bInitialState != FALSE);
+}
+
+static BOOL SetEventState(HANDLE hEvent, bool bSignaled)
+{
+	CEventObject* pEvent = (CEventObject*) GetObject(hEvent, CCompatObject::TYPE_EVENT);
+	if (pEvent == NULL)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pthread_mutex_lock(&g_objWaitMutex);
+	pEvent->m_bSignaled = bSignaled;
+	if (bSignaled) pthread_cond_broadcast(&g_objWaitCond);
+	pthread_mutex_unlock(&g_objWaitMutex);
+	return TRUE;
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+	return SetEventState(hEvent, true);
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+	return SetEventState(hEvent, false);
+}
+
+// Named mutexes are known within this process only (single instance check of the app)
+static pthread_mutex_t g_objMutexNamesLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::wstring, int> g_mapMutexNames;
+
+CMutexObject::~CMutexObject()
+{
+	if (m_strName.empty()) return;
+
+	pthread_mutex_lock(&g_objMutexNamesLock);
+	if (--g_mapMutexNames[m_strName] == 0) g_mapMutexNames.erase(m_strName);
+	pthread_mutex_unlock(&g_objMutexNamesLock);
+}
+
+HANDLE CreateMutexW(LPVOID /*pAttributes*/, BOOL /*bInitialOwner*/, LPCWSTR szName)
+{
+	std::wstring strName(szName != NULL ? szName : L"");
+	DWORD dwError = ERROR_SUCCESS;
+
+	if (!strName.empty())
+	{
+		pthread_mutex_lock(&g_objMutexNamesLock);
+		if (g_mapMutexNames[strName]++ > 0) dwError = ERROR_ALREADY_EXISTS;
+		pthread_mutex_unlock(&g_objMutexNamesLock);
+	}
+
+	::SetLastError(dwError);
+	return (HANDLE) new CMutexObject(strName);
+}
+
+// Called with g_objWaitMutex locked
+static bool IsSignaled(CCompatObject* pObject)
+{
+	if (pObject->m_iType == CCompatObject::TYPE_EVENT) return ((CEventObject*) pObject)->m_bSignaled;
+	return ((CThreadObject*) pObject)->m_bSignaled;
+}
+
+static void ConsumeSignal(CCompatObject* pObject)
+{
+	if (pObject->m_iType == CCompatObject::TYPE_EVENT && !((CEventObject*) pObject)->m_bManualReset)
+		((CEventObject*) pObject)->m_bSignaled = false;
+}
+
+DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE* pHandles, BOOL bWaitAll, DWORD dwMilliseconds)
+{
+	std::vector<CCompatObject*> arrObjects;
+
+	for (DWORD idx = 0; idx < nCount; idx++)
+	{
+		CCompatObject* pObject = GetObject(pHandles[idx], -1);
+		if (pObject == NULL || (pObject->m_iType != CCompatObject::TYPE_EVENT && pObject->m_iType != CCompatObject::TYPE_THREAD))
+		{
+			::SetLastError(ERROR_INVALID_HANDLE);
+			return WAIT_FAILED;
+		}
+		arrObjects.push_back(pObject);
+	}
+
+	if (arrObjects.empty())
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	struct timespec objDeadline;
+	clock_gettime(CLOCK_MONOTONIC, &objDeadline);
+	objDeadline.tv_sec  += dwMilliseconds / 1000;
+	objDeadline.tv_nsec += (long) (dwMilliseconds % 1000) * 1000000;
+	if (objDeadline.tv_nsec >= 1000000000)
+	{
+		objDeadline.tv_sec++;
+		objDeadline.tv_nsec -= 1000000000;
+	}
+
+	DWORD dwResult = WAIT_TIMEOUT;
+	pthread_mutex_lock(&g_objWaitMutex);
+
+	for (;;)
+	{
+		size_t iSignaled = 0;
+		size_t iFirst = arrObjects.size();
+
+		for (size_t idx = 0; idx < arrObjects.size(); idx++)
+		{
+			if (!IsSignaled(arrObjects[idx])) continue;
+			if (iFirst == arrObjects.size()) iFirst = idx;
+			iSignaled++;
+		}
+
+		if (bWaitAll && iSignaled == arrObjects.size())
+		{
+			for (size_t idx = 0; idx < arrObjects.size(); idx++) ConsumeSignal(arrObjects[idx]);
+			dwResult = WAIT_OBJECT_0;
+			break;
+		}
+
+		if (!bWaitAll && iSignaled > 0)
+		{
+			ConsumeSignal(arrObjects[iFirst]);
+			dwResult = WAIT_OBJECT_0 + (DWORD) iFirst;
+			break;
+		}
+
+		if (dwMilliseconds == 0) break;
+
+		if (dwMilliseconds == INFINITE) pthread_cond_wait(&g_objWaitCond, &g_objWaitMutex);
+		else if (pthread_cond_timedwait(&g_objWaitCond, &g_objWaitMutex, &objDeadline) == ETIMEDOUT) dwMilliseconds = 0;
+	}
+
+	pthread_mutex_unlock(&g_objWaitMutex);
+	return dwResult;
+}
+
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
+{
+	return ::WaitForMultipleObjects(1, &hHandle, FALSE, dwMilliseconds);
+}
+
+
+//--------------------------------------------------------
+// Threads
+//
+static void FinishThread(CThreadObject* pThread, unsigned iExitCode)
+{
+	pthread_mutex_lock(&g_objWaitMutex);
+	pThread->m_dwExitCode = iExitCode;
+	pThread->m_bSignaled = true;
+	pthread_cond_broadcast(&g_objWaitCond);
+	pthread_mutex_unlock(&g_objWaitMutex);
+
+	// Reference of the running thread
+	pThread->Release();
+}
+
+static void* ThreadStartRoutine(void* pArg)
+{
+	CThreadObject* pThread = (CThreadObject*) pArg;
+	t_pCurrentThread = pThread;
+
+	unsigned iExitCode = pThread->m_pStartAddress(pThread->m_pArg);
+
+	t_pCurrentThread = NULL;
+	FinishThread(pThread, iExitCode);
+	return NULL;
+}
+
+UINT_PTR _beginthreadex(void* /*pSecurity*/, unsigned /*iStackSize*/, unsigned (__stdcall *pStartAddress)(void*), void* pArg, unsigned /*iInitFlag*/, unsigned* piThreadID)
+{
+	CThreadObject* pThread = new CThreadObject();
+	pThread->m_pStartAddress = pStartAddress;
+	pThread->m_pArg = pArg;
+	pThread->AddRef();
+
+	pthread_t objThread;
+	pthread_attr_t objAttr;
+	pthread_attr_init(&objAttr);
+	pthread_attr_setdetachstate(&objAttr, PTHREAD_CREATE_DETACHED);
+
+	int iError = pthread_create(&objThread, &objAttr, ThreadStartRoutine, pThread);
+	pthread_attr_destroy(&objAttr);
+
+	if (iError != 0)
+	{
+		delete pThread;
+		::SetLastError(ErrorFromErrno(iError));
+		return 0;
+	}
+
+	if (piThreadID != NULL) *piThreadID = (unsigned) (ULONG_PTR) pThread;
+	::SetLastError(ERROR_SUCCESS);
+	return (UINT_PTR) pThread;
+}
+
+void _endthreadex(unsigned iExitCode)
+{
+	CThreadObject* pThread = t_pCurrentThread;
+	t_pCurrentThread = NULL;
+
+	if (pThread != NULL) FinishThread(pThread, iExitCode);
+	pthread_exit(NULL);
+}
+
+BOOL GetExitCodeThread(HANDLE hThread, LPDWORD pdwExitCode)
+{
+	CThreadObject* pThread = (CThreadObject*) GetObject(hThread, CCompatObject::TYPE_THREAD);
+	if (pThread == NULL)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pthread_mutex_lock(&g_objWaitMutex);
+	*pdwExitCode = pThread->m_dwExitCode;
+	pthread_mutex_unlock(&g_objWaitMutex);
+	return TRUE;
+}
+
+// POSIX threads can't be killed safely. The tests never leave a thread running.
+BOOL TerminateThread(HANDLE /*hThread*/, DWORD /*dwExitCode*/)
+{
+	::SetLastError(ERROR_ACCESS_DENIED);
+	return FALSE;
+}
+
+DWORD GetCurrentThreadId(void)
+{
+	return (DWORD) syscall(SYS_gettid);
+}
+
+DWORD GetCurrentProcessId(void)
+{
+	return (DWORD) getpid();
+}
+
+HANDLE GetCurrentProcess(void)
+{
+	return (HANDLE) (LONG_PTR) -1;
+}
+
+void Sleep(DWORD dwMilliseconds)
+{
+	struct timespec objTime;
+	objTime.tv_sec  = dwMilliseconds / 1000;
+	objTime.tv_nsec = (long) (dwMilliseconds % 1000) * 1000000;
+	while (nanosleep(&objTime, &objTime) != 0 && errno == EINTR) {}
+}
+
+BOOL SwitchToThread(void)
+{
+	return sched_yield() == 0;
+}
+
+void GetSystemInfo(SYSTEM_INFO* pSystemInfo)
+{
+	ZeroMemory(pSystemInfo, sizeof(*pSystemInfo));
+	pSystemInfo->dwPageSize              = (DWORD) sysconf(_SC_PAGESIZE);
+	pSystemInfo->dwNumberOfProcessors    = (DWORD) sysconf(_SC_NPROCESSORS_ONLN);
+	pSystemInfo->dwAllocationGranularity = 64 * 1024;
+}
+
+
+//--------------------------------------------------------
+// Time
+//
+DWORD GetTickCount(void)
+{
+	struct timespec objTime;
+	clock_gettime(CLOCK_MONOTONIC, &objTime);
+	return (DWORD) ((ULONGLONG) objTime.tv_sec * 1000 + objTime.tv_nsec / 1000000);
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER* pCount)
+{
+	struct timespec objTime;
+	clock_gettime(CLOCK_MONOTONIC, &objTime);
+	pCount->QuadPart = (LONGLONG) objTime.tv_sec * 1000000000 + objTime.tv_nsec;
+	return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* pFrequency)
+{
+	pFrequency->QuadPart = 1000000000;
+	return TRUE;
+}
+
+void GetSystemTimeAsFileTime(FILETIME* pFileTime)
+{
+	struct timespec objTime;
+	clock_gettime(CLOCK_REALTIME, &objTime);
+	ToFileTime(objTime, pFileTime);
+}
+
+
+//--------------------------------------------------------
+// Files
+//
+HANDLE CreateFileW(LPCWSTR szFileName, DWORD dwAccess, DWORD /*dwShareMode*/, LPVOID /*pAttributes*/, DWORD dwDisposition, DWORD /*dwFlags*/, HANDLE /*hTemplate*/)
+{
+	std::string strPath = ToNativePath(szFileName);
+	int iFlags = O_CLOEXEC;
+
+	if ((dwAccess & GENERIC_READ) && (dwAccess & GENERIC_WRITE)) iFlags |= O_RDWR;
+	else if (dwAccess & GENERIC_WRITE) iFlags |= O_WRONLY;
+	else iFlags |= O_RDONLY;
+
+	switch (dwDisposition)
+	{
+		case CREATE_NEW:        iFlags |= O_CREAT | O_EXCL; break;
+		case CREATE_ALWAYS:     iFlags |= O_CREAT | O_TRUNC; break;
+		case OPEN_ALWAYS:       iFlags |= O_CREAT; break;
+		case TRUNCATE_EXISTING: iFlags |= O_TRUNC; break;
+	}
+
+	bool bExisted = (dwDisposition == OPEN_ALWAYS || dwDisposition == CREATE_ALWAYS) && ::access(strPath.c_str(), F_OK) == 0;
+
+	int iFD = ::open(strPath.c_str(), iFlags, 0644);
+	if (iFD < 0)
+	{
+		::SetLastError(ErrorFromErrno(errno));
+		return INVALID_HANDLE_VALUE;
+	}
+
+	::SetLastError(bExisted ? ERROR_ALREADY_EXISTS : ERROR_SUCCESS);
+	return (HANDLE) new CFileObject(iFD);
+}
+
+BOOL ReadFile(HANDLE hFile, LPVOID pBuffer, DWORD dwBytes, LPDWORD pdwRead, LPVOID /*pOverlapped*/)
+{
+	CFileObject* pFile = (CFileObject*) GetObject(hFile, CCompatObject::TYPE_FILE);
+	DWORD dwDone = 0;
+
+	if (pdwRead != NULL) *pdwRead = 0;
+	if (pFile == NULL)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	while (dwDone < dwBytes)
+	{
+		ssize_t iRead = ::read(pFile->m_iFD, (BYTE*) pBuffer + dwDone, dwBytes - dwDone);
+		if (iRead < 0 && errno == EINTR) continue;
+		if (iRead < 0)
+		{
+			::SetLastError(ErrorFromErrno(errno));
+			return FALSE;
+		}
+		if (iRead == 0) break;
+		dwDone += (DWORD) iRead;
+	}
+
+	if (pdwRead != NULL) *pdwRead = dwDone;
+	return TRUE;
+}
+
+BOOL WriteFile(HANDLE hFile, LPCVOID pBuffer, DWORD dwBytes, LPDWORD pdwWritten, LPVOID /*pOverlapped*/)
+{
+	CFileObject* pFile = (CFileObject*) GetObject(hFile, CCompatObject::TYPE_FILE);
+	DWORD dwDone = 0;
+
+	if (pdwWritten != NULL) *pdwWritten = 0;
+	if (pFile == NULL)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	while (dwDone < dwBytes)
+	{
+		ssize_t iWritten = ::write(pFile->m_iFD, (const BYTE*) pBuffer + dwDone, dwBytes - dwDone);
+		if (iWritten < 0 && errno == EINTR) continue;
+		if (iWritten <= 0)
+		{
+			::SetLastError(ErrorFromErrno(errno));
+			return FALSE;
+		}
+		dwDone += (DWORD) iWritten;
+	}
+
+	if (pdwWritten != NULL) *pdwWritten = dwDone;
+	return TRUE;
+}
+
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER* pSize)
+{
+	CFileObject* pFile = (CFileObject*) GetObject(hFile, CCompatObject::TYPE_FILE);
+	struct stat objStat;
+
+	if (pFile == NULL || ::fstat(pFile->m_iFD, &objStat) != 0)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pSize->QuadPart = objStat.st_size;
+	return TRUE;
+}
+
+DWORD GetFileSize(HANDLE hFile, LPDWORD pdwSizeHigh)
+{
+	LARGE_INTEGER liSize;
+	if (!::GetFileSizeEx(hFile, &liSize)) return INVALID_FILE_SIZE;
+
+	if (pdwSizeHigh != NULL) *pdwSizeHigh = (DWORD) liSize.HighPart;
+	::SetLastError(ERROR_SUCCESS);
+	return liSize.LowPart;
+}
+
+BOOL FlushFileBuffers(HANDLE hFile)
+{
+	CFileObject* pFile = (CFileObject*) GetObject(hFile, CCompatObject::TYPE_FILE);
+	return (pFile != NULL && ::fsync(pFile->m_iFD) == 0);
+}
+
+BOOL DeleteFileW(LPCWSTR szFileName)
+{
+	if (::unlink(ToNativePath(szFileName).c_str()) == 0) return TRUE;
+
+	::SetLastError(ErrorFromErrno(errno));
+	return FALSE;
+}
+
+BOOL MoveFileExW(LPCWSTR szExisting, LPCWSTR szNew, DWORD dwFlags)
+{
+	std::string strNew = ToNativePath(szNew);
+
+	if ((dwFlags & MOVEFILE_REPLACE_EXISTING) == 0 && ::access(strNew.c_str(), F_OK) == 0)
+	{
+		::SetLastError(ERROR_ALREADY_EXISTS);
+		return FALSE;
+	}
+
+	if (::rename(ToNativePath(szExisting).c_str(), strNew.c_str()) == 0) return TRUE;
+
+	::SetLastError(ErrorFromErrno(errno));
+	return FALSE;
+}
+
+BOOL CreateDirectoryW(LPCWSTR szPath, LPVOID /*pAttributes*/)
+{
+	if (::mkdir(ToNativePath(szPath).c_str(), 0755) == 0) return TRUE;
+
+	::SetLastError(errno == EEXIST ? ERROR_ALREADY_EXISTS : ErrorFromErrno(errno));
+	return FALSE;
+}
+
+DWORD GetTempPathW(DWORD dwBufferLen, LPWSTR szBuffer)
+{
+	const char* szTemp = getenv("TMPDIR");
+	std::wstring strTemp;
+
+	for (const char* pChar = (szTemp != NULL && szTemp[0] != '\0' ? szTemp : "/tmp"); *pChar != '\0'; pChar++) strTemp += (WCHAR) (BYTE) *pChar;
+	if (strTemp[strTemp.size() - 1] != L'/') strTemp += L'/';
+
+	if (strTemp.size() + 1 > dwBufferLen) return (DWORD) strTemp.size() + 1;
+
+	wcscpy(szBuffer, strTemp.c_str());
+	return (DWORD) strTemp.size();
+}
+
+// Fill the find data of the next directory entry. Returns false at the end of the directory.
+static bool ReadNextEntry(CFindObject* pFind, WIN32_FIND_DATAW* pFindData)
+{
+	struct dirent* pEntry = ::readdir(pFind->m_pDir);
+	if (pEntry == NULL) return false;
+
+	struct stat objStat;
+	std::string strPath = pFind->m_strFolder + "/" + pEntry->d_name;
+
+	ZeroMemory(pFindData, sizeof(*pFindData));
+	if (::stat(strPath.c_str(), &objStat) == 0)
+	{
+		pFindData->dwFileAttributes = (S_ISDIR(objStat.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL);
+		pFindData->nFileSizeHigh    = (DWORD) ((ULONGLONG) objStat.st_size >> 32);
+		pFindData->nFileSizeLow     = (DWORD) objStat.st_size;
+		ToFileTime(objStat.st_mtim, &pFindData->ftLastWriteTime);
+		ToFileTime(objStat.st_atim, &pFindData->ftLastAccessTime);
+		ToFileTime(objStat.st_ctim, &pFindData->ftCreationTime);
+	}
+	else
+		pFindData->dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+
+	::MultiByteToWideChar(CP_UTF8, 0, pEntry->d_name, -1, pFindData->cFileName, MAX_PATH);
+	return true;
+}
+
+// Only "<folder>\*" patterns are supported
+HANDLE FindFirstFileW(LPCWSTR szPattern, WIN32_FIND_DATAW* pFindData)
+{
+	std::string strFolder = ToNativePath(szPattern);
+	if (strFolder.size() >= 2 && strFolder.compare(strFolder.size() - 2, 2, "/*") == 0) strFolder.resize(strFolder.size() - 2);
+
+	DIR* pDir = ::opendir(strFolder.c_str());
+	if (pDir == NULL)
+	{
+		::SetLastError(ErrorFromErrno(errno));
+		return INVALID_HANDLE_VALUE;
+	}
+
+	CFindObject* pFind = new CFindObject(pDir, strFolder);
+	if (!ReadNextEntry(pFind, pFindData))
+	{
+		pFind->Release();
+		::SetLastError(ERROR_FILE_NOT_FOUND);
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return (HANDLE) pFind;
+}
+
+BOOL FindNextFileW(HANDLE hFind, WIN32_FIND_DATAW* pFindData)
+{
+	CFindObject* pFind = (CFindObject*) GetObject(hFind, CCompatObject::TYPE_FIND);
+	if (pFind != NULL && ReadNextEntry(pFind, pFindData)) return TRUE;
+
+	::SetLastError(pFind != NULL ? ERROR_NO_MORE_FILES : ERROR_INVALID_HANDLE);
+	return FALSE;
+}
+
+BOOL FindClose(HANDLE hFind)
+{
+	return ::CloseHandle(hFind);
+}
+
+
+//--------------------------------------------------------
+// File mappings
+//
+static pthread_mutex_t g_objViewsLock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<const BYTE*, SIZE_T> g_mapViews;		// Mapped views (address -> size)
+
+static std::string ToShmName(LPCWSTR szName)
+{
+	std::string strName = "/" + ToNativePath(szName);
+	for (size_t idx = 1; idx < strName.size(); idx++)
+		if (strName[idx] == '/') strName[idx] = '_';
+	return strName;
+}
+
+HANDLE CreateFileMappingW(HANDLE hFile, LPVOID /*pAttributes*/, DWORD dwProtect, DWORD dwSizeHigh, DWORD dwSizeLow, LPCWSTR szName)
+{
+	ULONGLONG ullSize = ((ULONGLONG) dwSizeHigh << 32) | dwSizeLow;
+	bool      bWritable = (dwProtect == PAGE_READWRITE);
+	struct stat objStat;
+
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		// Paging file backed section. An existing section of the same name is opened as such (old size).
+		std::string strShmName = (szName != NULL ? ToShmName(szName) : std::string());
+		char szUniqueName[64];
+
+		if (strShmName.empty())
+		{
+			static volatile LONG lAnonymousCount = 0;
+			snprintf(szUniqueName, sizeof(szUniqueName), "/lnt-compat-%d-%d", (int) getpid(), (int) ::InterlockedIncrement(&lAnonymousCount));
+		}
+
+		const char* szShmName = (strShmName.empty() ? szUniqueName : strShmName.c_str());
+		int iFD = ::shm_open(szShmName, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+		if (iFD >= 0)
+		{
+			if (::ftruncate(iFD, (off_t) ullSize) != 0)
+			{
+				::close(iFD);
+				::shm_unlink(szShmName);
+				::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+				return NULL;
+			}
+
+			// Unnamed section is gone when its handle is closed
+			if (strShmName.empty()) ::shm_unlink(szShmName);
+
+			::SetLastError(ERROR_SUCCESS);
+			return (HANDLE) new CMappingObject(iFD, ullSize, true, strShmName);
+		}
+
+		if (errno != EEXIST || strShmName.empty() || (iFD = ::shm_open(szShmName, O_RDWR, 0600)) < 0 || ::fstat(iFD, &objStat) != 0)
+		{
+			if (iFD >= 0) ::close(iFD);
+			::SetLastError(ErrorFromErrno(errno));
+			return NULL;
+		}
+
+		::SetLastError(ERROR_ALREADY_EXISTS);
+		return (HANDLE) new CMappingObject(iFD, (ULONGLONG) objStat.st_size, true, std::string());
+	}
+
+	CFileObject* pFile = (CFileObject*) GetObject(hFile, CCompatObject::TYPE_FILE);
+	if (pFile == NULL || ::fstat(pFile->m_iFD, &objStat) != 0)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	// Size 0 = The whole file. A writable mapping extends the file to the size of the mapping.
+	if (ullSize == 0) ullSize = (ULONGLONG) objStat.st_size;
+	if (ullSize == 0 || (ullSize > (ULONGLONG) objStat.st_size && !bWritable))
+	{
+		::SetLastError(ERROR_ACCESS_DENIED);
+		return NULL;
+	}
+
+	if (ullSize > (ULONGLONG) objStat.st_size && ::ftruncate(pFile->m_iFD, (off_t) ullSize) != 0)
+	{
+		::SetLastError(ERROR_ACCESS_DENIED);
+		return NULL;
+	}
+
+	::SetLastError(ERROR_SUCCESS);
+	return (HANDLE) new CMappingObject(::dup(pFile->m_iFD), ullSize, bWritable, std::string());
+}
+
+HANDLE OpenFileMappingW(DWORD dwAccess, BOOL /*bInheritHandle*/, LPCWSTR szName)
+{
+	bool bWritable = (dwAccess & FILE_MAP_WRITE) != 0;
+	struct stat objStat;
+
+	int iFD = ::shm_open(ToShmName(szName).c_str(), (bWritable ? O_RDWR : O_RDONLY), 0);
+	if (iFD < 0 || ::fstat(iFD, &objStat) != 0)
+	{
+		if (iFD >= 0) ::close(iFD);
+		::SetLastError(ERROR_FILE_NOT_FOUND);
+		return NULL;
+	}
+
+	::SetLastError(ERROR_SUCCESS);
+	return (HANDLE) new CMappingObject(iFD, (ULONGLONG) objStat.st_size, bWritable, std::string());
+}
+
+LPVOID MapViewOfFile(HANDLE hMapping, DWORD dwAccess, DWORD dwOffsetHigh, DWORD dwOffsetLow, SIZE_T iBytes)
+{
+	CMappingObject* pMapping = (CMappingObject*) GetObject(hMapping, CCompatObject::TYPE_MAPPING);
+	ULONGLONG ullOffset = ((ULONGLONG) dwOffsetHigh << 32) | dwOffsetLow;
+	bool      bWrite = (dwAccess & FILE_MAP_WRITE) != 0;
+
+	if (pMapping == NULL)
+	{
+		::SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	// View must fit in the section (Win32 fails the same way, it doesn't grow the section)
+	if (iBytes == 0 && ullOffset < pMapping->m_ullSize) iBytes = (SIZE_T) (pMapping->m_ullSize - ullOffset);
+	if (iBytes == 0 || ullOffset + iBytes > pMapping->m_ullSize || (bWrite && !pMapping->m_bWritable) || (ullOffset % (64 * 1024)) != 0)
+	{
+		::SetLastError(ERROR_ACCESS_DENIED);
+		return NULL;
+	}
+
+	void* pView = ::mmap(NULL, iBytes, PROT_READ | (bWrite ? PROT_WRITE : 0), MAP_SHARED, pMapping->m_iFD, (off_t) ullOffset);
+	if (pView == MAP_FAILED)
+	{
+		::SetLastError(ErrorFromErrno(errno));
+		return NULL;
+	}
+
+	pthread_mutex_lock(&g_objViewsLock);
+	g_mapViews[(const BYTE*) pView] = iBytes;
+	pthread_mutex_unlock(&g_objViewsLock);
+
+	return pView;
+}
+
+BOOL UnmapViewOfFile(LPCVOID pView)
+{
+	SIZE_T iBytes = 0;
+
+	pthread_mutex_lock(&g_objViewsLock);
+	std::map<const BYTE*, SIZE_T>::iterator it = g_mapViews.find((const BYTE*) pView);
+	if (it != g_mapViews.end())
+	{
+		iBytes = it->second;
+		g_mapViews.erase(it);
+	}
+	pthread_mutex_unlock(&g_objViewsLock);
+
+	if (iBytes == 0)
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	return ::munmap((void*) pView, iBytes) == 0;
+}
+
+BOOL FlushViewOfFile(LPCVOID pView, SIZE_T iBytes)
+{
+	SIZE_T iPageSize = (SIZE_T) sysconf(_SC_PAGESIZE);
+	ULONG_PTR uStart = (ULONG_PTR) pView & ~(iPageSize - 1);
+
+	pthread_mutex_lock(&g_objViewsLock);
+	std::map<const BYTE*, SIZE_T>::iterator it = g_mapViews.upper_bound((const BYTE*) pView);
+	bool bFound = (it != g_mapViews.begin() && (--it, (const BYTE*) pView < it->first + it->second));
+	if (bFound && iBytes == 0) iBytes = (SIZE_T) (it->first + it->second - (const BYTE*) pView);
+	pthread_mutex_unlock(&g_objViewsLock);
+
+	if (!bFound)
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	return ::msync((void*) uStart, (ULONG_PTR) pView + iBytes - uStart, MS_SYNC) == 0;
+}
+
+// Mapped views only (region = the rest of the view, rounded up to whole pages)
+SIZE_T VirtualQuery(LPCVOID pAddress, MEMORY_BASIC_INFORMATION* pInfo, SIZE_T iLength)
+{
+	SIZE_T iPageSize = (SIZE_T) sysconf(_SC_PAGESIZE);
+	SIZE_T iResult = 0;
+
+	if (iLength < sizeof(MEMORY_BASIC_INFORMATION)) return 0;
+
+	pthread_mutex_lock(&g_objViewsLock);
+	std::map<const BYTE*, SIZE_T>::iterator it = g_mapViews.upper_bound((const BYTE*) pAddress);
+	if (it != g_mapViews.begin() && (--it, (const BYTE*) pAddress < it->first + it->second))
+	{
+		ULONG_PTR uPage = (ULONG_PTR) pAddress & ~(iPageSize - 1);
+		ULONG_PTR uEnd  = ((ULONG_PTR) it->first + it->second + iPageSize - 1) & ~(iPageSize - 1);
+
+		ZeroMemory(pInfo, sizeof(*pInfo));
+		pInfo->BaseAddress    = (PVOID) uPage;
+		pInfo->AllocationBase = (PVOID) it->first;
+		pInfo->RegionSize     = uEnd - uPage;
+		pInfo->State          = MEM_COMMIT;
+		pInfo->Type           = MEM_MAPPED;
+		iResult = sizeof(*pInfo);
+	}
+	pthread_mutex_unlock(&g_objViewsLock);
+
+	if (iResult == 0) ::SetLastError(ERROR_INVALID_PARAMETER);
+	return iResult;
+}
+
+
+//--------------------------------------------------------
+// Process footprint. glibc has one heap and no block list, so the heap walk reports the bytes
+// in use (mallinfo2) as a single block.
+//
+DWORD GetProcessHeaps(DWORD dwCount, HANDLE* pHeaps)
+{
+	if (dwCount > 0) pHeaps[0] = (HANDLE) &g_objCompatInit;
+	return 1;
+}
+
+BOOL HeapLock(HANDLE /*hHeap*/)
+{
+	return TRUE;
+}
+
+BOOL HeapUnlock(HANDLE /*hHeap*/)
+{
+	return TRUE;
+}
+
+BOOL HeapWalk(HANDLE hHeap, PROCESS_HEAP_ENTRY* pEntry)
+{
+	if (pEntry->lpData != NULL)
+	{
+		::SetLastError(ERROR_NO_MORE_FILES);
+		return FALSE;
+	}
+
+	struct mallinfo2 objInfo = mallinfo2();
+
+	ZeroMemory(pEntry, sizeof(*pEntry));
+	pEntry->lpData = hHeap;
+	pEntry->cbData = (DWORD) objInfo.uordblks;
+	pEntry->wFlags = PROCESS_HEAP_ENTRY_BUSY;
+	return TRUE;
+}
+
+BOOL GetProcessHandleCount(HANDLE /*hProcess*/, LPDWORD pdwHandleCount)
+{
+	DIR* pDir = ::opendir("/proc/self/fd");
+	DWORD dwCount = 0;
+
+	if (pDir == NULL) return FALSE;
+
+	// Entries "." and ".." and the descriptor of the directory itself are not counted
+	while (::readdir(pDir) != NULL) dwCount++;
+	::closedir(pDir);
+
+	*pdwHandleCount = (dwCount > 3 ? dwCount - 3 : 0);
+	return TRUE;
+}
+
+DWORD GetGuiResources(HANDLE /*hProcess*/, DWORD /*dwFlags*/)
+{
+	return 0;
+}
+
+BOOL SetProcessWorkingSetSize(HANDLE /*hProcess*/, SIZE_T /*iMinimum*/, SIZE_T /*iMaximum*/)
+{
+	return TRUE;
+}
+
+BOOL GetProcessMemoryInfo(HANDLE /*hProcess*/, PROCESS_MEMORY_COUNTERS* pCounters, DWORD cb)
+{
+	FILE* pFile = fopen("/proc/self/status", "r");
+	char  szLine[256];
+
+	if (pFile == NULL || cb < sizeof(PROCESS_MEMORY_COUNTERS))
+	{
+		if (pFile != NULL) fclose(pFile);
+		return FALSE;
+	}
+
+	ZeroMemory(pCounters, cb);
+	pCounters->cb = cb;
+
+	while (fgets(szLine, sizeof(szLine), pFile) != NULL)
+	{
+		unsigned long ulKB = 0;
+		if (sscanf(szLine, "VmRSS: %lu", &ulKB) == 1) pCounters->WorkingSetSize = ulKB * 1024;
+		else if (sscanf(szLine, "VmHWM: %lu", &ulKB) == 1) pCounters->PeakWorkingSetSize = ulKB * 1024;
+		else if (sscanf(szLine, "VmData: %lu", &ulKB) == 1) pCounters->PrivateUsage = pCounters->PagefileUsage = ulKB * 1024;
+	}
+
+	fclose(pFile);
+	return TRUE;
+}
+
+
+//--------------------------------------------------------
+// Text conversions (UTF-8 and UTF-16, other code pages are treated as Latin-1)
+//
+static bool DecodeUTF8(const BYTE*& pText, const BYTE* pEnd, DWORD& dwChar)
+{
+	static const DWORD arrMinValues[4] = { 0, 0x80, 0x800, 0x10000 };
+	BYTE bLead = *pText++;
+	int  iTrail;
+
+	if (bLead < 0x80) { dwChar = bLead; return true; }
+	else if ((bLead & 0xE0) == 0xC0) { dwChar = bLead & 0x1F; iTrail = 1; }
+	else if ((bLead & 0xF0) == 0xE0) { dwChar = bLead & 0x0F; iTrail = 2; }
+	else if ((bLead & 0xF8) == 0xF0) { dwChar = bLead & 0x07; iTrail = 3; }
+	else return false;
+
+	for (int idx = 0; idx < iTrail; idx++)
+	{
+		if (pText >= pEnd || (*pText & 0xC0) != 0x80) return false;
+		dwChar = (dwChar << 6) | (*pText++ & 0x3F);
+	}
+
+	// Overlong forms, surrogates and values above the Unicode range are invalid
+	return (dwChar >= arrMinValues[iTrail] && dwChar <= 0x10FFFF && (dwChar < 0xD800 || dwChar > 0xDFFF));
+}
+
+int MultiByteToWideChar(UINT uCodePage, DWORD dwFlags, LPCSTR szText, int iBytes, LPWSTR szWide, int iWideChars)
+{
+	if (szText == NULL || iBytes == 0 || iWideChars < 0)
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+
+	if (iBytes < 0) iBytes = (int) strlen(szText) + 1;
+
+	const BYTE* pText = (const BYTE*) szText;
+	const BYTE* pEnd  = pText + iBytes;
+	int iCount = 0;
+
+	while (pText < pEnd)
+	{
+		DWORD dwChar = *pText;
+
+		if (uCodePage != CP_UTF8) pText++;
+		else if (!DecodeUTF8(pText, pEnd, dwChar))
+		{
+			if (dwFlags & MB_ERR_INVALID_CHARS)
+			{
+				::SetLastError(ERROR_NO_UNICODE_TRANSLATION);
+				return 0;
+			}
+			dwChar = 0xFFFD;
+		}
+
+		int iUnits = (dwChar >= 0x10000 ? 2 : 1);
+		if (iWideChars > 0)
+		{
+			if (iCount + iUnits > iWideChars)
+			{
+				::SetLastError(ERROR_INSUFFICIENT_BUFFER);
+				return 0;
+			}
+
+			if (iUnits == 2)
+			{
+				szWide[iCount]     = (WCHAR) (0xD800 + ((dwChar - 0x10000) >> 10));
+				szWide[iCount + 1] = (WCHAR) (0xDC00 + ((dwChar - 0x10000) & 0x3FF));
+			}
+			else
+				szWide[iCount] = (WCHAR) dwChar;
+		}
+		iCount += iUnits;
+	}
+
+	return iCount;
+}
+
+int WideCharToMultiByte(UINT uCodePage, DWORD /*dwFlags*/, LPCWSTR szWide, int iWideChars, LPSTR szText, int iBytes, LPCSTR /*szDefaultChar*/, LPBOOL pbUsedDefaultChar)
+{
+	if (szWide == NULL || iWideChars == 0 || iBytes < 0)
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+
+	if (iWideChars < 0) iWideChars = (int) wcslen(szWide) + 1;
+	if (pbUsedDefaultChar != NULL) *pbUsedDefaultChar = FALSE;
+
+	int iCount = 0;
+	for (int idx = 0; idx < iWideChars; idx++)
+	{
+		DWORD dwChar = (DWORD) szWide[idx];
+		BYTE  arrBytes[4];
+		int   iLen;
+
+		if (dwChar >= 0xD800 && dwChar <= 0xDBFF && idx + 1 < iWideChars && (DWORD) szWide[idx + 1] >= 0xDC00 && (DWORD) szWide[idx + 1] <= 0xDFFF)
+			dwChar = 0x10000 + ((dwChar - 0xD800) << 10) + ((DWORD) szWide[++idx] - 0xDC00);
+		else if ((dwChar >= 0xD800 && dwChar <= 0xDFFF) || dwChar > 0x10FFFF)
+			dwChar = 0xFFFD;
+
+		if (uCodePage != CP_UTF8)
+		{
+			arrBytes[0] = (BYTE) (dwChar <= 0xFF ? dwChar : '?');
+			if (dwChar > 0xFF && pbUsedDefaultChar != NULL) *pbUsedDefaultChar = TRUE;
+			iLen = 1;
+		}
+		else if (dwChar < 0x80) { arrBytes[0] = (BYTE) dwChar; iLen = 1; }
+		else if (dwChar < 0x800) { arrBytes[0] = (BYTE) (0xC0 | (dwChar >> 6)); arrBytes[1] = (BYTE) (0x80 | (dwChar & 0x3F)); iLen = 2; }
+		else if (dwChar < 0x10000) { arrBytes[0] = (BYTE) (0xE0 | (dwChar >> 12)); arrBytes[1] = (BYTE) (0x80 | ((dwChar >> 6) & 0x3F)); arrBytes[2] = (BYTE) (0x80 | (dwChar & 0x3F)); iLen = 3; }
+		else { arrBytes[0] = (BYTE) (0xF0 | (dwChar >> 18)); arrBytes[1] = (BYTE) (0x80 | ((dwChar >> 12) & 0x3F)); arrBytes[2] = (BYTE) (0x80 | ((dwChar >> 6) & 0x3F)); arrBytes[3] = (BYTE) (0x80 | (dwChar & 0x3F)); iLen = 4; }
+
+		if (iBytes > 0)
+		{
+			if (iCount + iLen > iBytes)
+			{
+				::SetLastError(ERROR_INSUFFICIENT_BUFFER);
+				return 0;
+			}
+			memcpy(szText + iCount, arrBytes, iLen);
+		}
+		iCount += iLen;
+	}
+
+	return iCount;
+}
+
+void OutputDebugStringW(LPCWSTR szText)
+{
+	// DebugView of the tests is stderr (LNT_DEBUG_OUTPUT=1)
+	if (getenv("LNT_DEBUG_OUTPUT") != NULL) fputs(ToNativePath(szText).c_str(), stderr);
+}
+
+
+//--------------------------------------------------------
+// Secure CRT
+//
+#define STRUNCATE	80
+
+int wcscpy_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource)
+{
+	size_t iLen = wcslen(szSource);
+	if (iDestSize == 0) return EINVAL;
+	if (iLen >= iDestSize)
+	{
+		szDest[0] = L'\0';
+		return ERANGE;
+	}
+
+	wmemcpy(szDest, szSource, iLen + 1);
+	return 0;
+}
+
+int wcsncpy_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource, size_t iCount)
+{
+	size_t iLen = 0;
+	if (iDestSize == 0) return EINVAL;
+
+	while (iLen < iCount && szSource[iLen] != L'\0') iLen++;
+
+	if (iLen >= iDestSize)
+	{
+		if (iCount != _TRUNCATE)
+		{
+			szDest[0] = L'\0';
+			return ERANGE;
+		}
+
+		wmemcpy(szDest, szSource, iDestSize - 1);
+		szDest[iDestSize - 1] = L'\0';
+		return STRUNCATE;
+	}
+
+	wmemcpy(szDest, szSource, iLen);
+	szDest[iLen] = L'\0';
+	return 0;
+}
+
+int wcscat_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource)
+{
+	size_t iLen = wcsnlen(szDest, iDestSize);
+	if (iLen >= iDestSize) return EINVAL;
+	return wcscpy_s(szDest + iLen, iDestSize - iLen, szSource);
+}
+
+int wcsncat_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource, size_t iCount)
+{
+	size_t iLen = wcsnlen(szDest, iDestSize);
+	if (iLen >= iDestSize) return EINVAL;
+	return wcsncpy_s(szDest + iLen, iDestSize - iLen, szSource, iCount);
+}
+
+int strncpy_s(char* szDest, size_t iDestSize, const char* szSource, size_t iCount)
+{
+	size_t iLen = 0;
+	if (iDestSize == 0) return EINVAL;
+
+	while (iLen < iCount && szSource[iLen] != '\0') iLen++;
+	if (iLen >= iDestSize)
+	{
+		if (iCount != _TRUNCATE)
+		{
+			szDest[0] = '\0';
+			return ERANGE;
+		}
+		iLen = iDestSize - 1;
+	}
+
+	memcpy(szDest, szSource, iLen);
+	szDest[iLen] = '\0';
+	return (iLen < iCount && szSource[iLen] != '\0' ? STRUNCATE : 0);
+}
+
+int memcpy_s(void* pDest, size_t iDestSize, const void* pSource, size_t iCount)
+{
+	if (iCount > iDestSize)
+	{
+		memset(pDest, 0, iDestSize);
+		return ERANGE;
+	}
+
+	memcpy(pDest, pSource, iCount);
+	return 0;
+}
+
+// Format string of VC++ printf functions in glibc terms (see windows.h). bWide = wide printf function.
+template <class TChar>
+static std::basic_string<TChar> ConvertFormat(const TChar* szFormat, bool bWide)
+{
+	std::basic_string<TChar> strFormat;
+
+	for (const TChar* pChar = szFormat; *pChar != 0; pChar++)
+	{
+		strFormat += *pChar;
+		if (*pChar != '%') continue;
+
+		pChar++;
+		if (*pChar == 0) break;
+		if (*pChar == '%')
+		{
+			strFormat += *pChar;
+			continue;
+		}
+
+		while (*pChar != 0 && strchr("-+ #0123456789.*", (char) *pChar) != NULL) strFormat += *pChar++;
+
+		// Size prefix
+		char chSize = 0;
+		if (pChar[0] == 'I' && pChar[1] == '6' && pChar[2] == '4') { strFormat += 'l'; strFormat += 'l'; pChar += 3; }
+		else if (pChar[0] == 'I' && pChar[1] == '3' && pChar[2] == '2') pChar += 3;
+		else if (*pChar == 'h' || *pChar == 'l' || *pChar == 'w' || *pChar == 'L') chSize = (char) *pChar++;
+
+		if (*pChar == 0) break;
+
+		char chType = (char) *pChar;
+		bool bWideArg;
+
+		if (chType == 's' || chType == 'c') bWideArg = (chSize == 'l' || chSize == 'w' || (chSize == 0 && bWide));
+		else if (chType == 'S' || chType == 'C') bWideArg = (chSize == 'l' || chSize == 'w' || (chSize == 0 && !bWide));
+		else
+		{
+			if (chSize == 'h' || chSize == 'l' || chSize == 'L') strFormat += chSize;
+			strFormat += *pChar;
+			continue;
+		}
+
+		if (bWideArg) strFormat += 'l';
+		strFormat += (TChar) (chType == 'S' ? 's' : (chType == 'C' ? 'c' : chType));
+	}
+
+	return strFormat;
+}
+
+int _vsnwprintf_s(WCHAR* szBuffer, size_t iBufferSize, size_t iCount, const WCHAR* szFormat, va_list args)
+{
+	std::wstring strFormat = ConvertFormat(szFormat, true);
+	std::vector<WCHAR> arrText(256);
+	int iLen;
+
+	if (iBufferSize == 0) return -1;
+
+	// vswprintf doesn't tell the length of a truncated result, so the buffer grows until the text fits
+	for (;;)
+	{
+		va_list argsCopy;
+		__va_copy(argsCopy, args);
+		iLen = vswprintf(&arrText[0], arrText.size(), strFormat.c_str(), argsCopy);
+		va_end(argsCopy);
+
+		if (iLen >= 0 || arrText.size() >= 1024 * 1024) break;
+		arrText.resize(arrText.size() * 4);
+	}
+
+	if (iLen < 0)
+	{
+		szBuffer[0] = L'\0';
+		return -1;
+	}
+
+	size_t iLimit = (iCount < iBufferSize - 1 ? iCount : iBufferSize - 1);
+	if ((size_t) iLen <= iLimit)
+	{
+		wmemcpy(szBuffer, &arrText[0], iLen + 1);
+		return iLen;
+	}
+
+	wmemcpy(szBuffer, &arrText[0], iLimit);
+	szBuffer[iLimit] = L'\0';
+	return -1;
+}
+
+int _snwprintf_s(WCHAR* szBuffer, size_t iBufferSize, size_t iCount, const WCHAR* szFormat, ...)
+{
+	va_list args;
+	va_start(args, szFormat);
+	int iResult = _vsnwprintf_s(szBuffer, iBufferSize, iCount, szFormat, args);
+	va_end(args);
+	return iResult;
+}
+
+int _snprintf_s(char* szBuffer, size_t iBufferSize, size_t iCount, const char* szFormat, ...)
+{
+	std::string strFormat = ConvertFormat(szFormat, false);
+	va_list args;
+
+	if (iBufferSize == 0) return -1;
+
+	size_t iLimit = (iCount < iBufferSize - 1 ? iCount : iBufferSize - 1);
+	std::vector<char> arrText(iLimit + 1);
+
+	va_start(args, szFormat);
+	int iLen = vsnprintf(&arrText[0], arrText.size(), strFormat.c_str(), args);
+	va_end(args);
+
+	memcpy(szBuffer, &arrText[0], iLimit + 1);
+	return (iLen >= 0 && (size_t) iLen <= iLimit ? iLen : -1);
+}
+
+int _wcsicmp(const WCHAR* szText1, const WCHAR* szText2)
+{
+	return _wcsnicmp(szText1, szText2, (size_t) -1);
+}
+
+int _wcsnicmp(const WCHAR* szText1, const WCHAR* szText2, size_t iCount)
+{
+	for (size_t idx = 0; idx < iCount; idx++)
+	{
+		wint_t ch1 = towlower(szText1[idx]);
+		wint_t ch2 = towlower(szText2[idx]);
+
+		if (ch1 != ch2) return (ch1 < ch2 ? -1 : 1);
+		if (ch1 == 0) break;
+	}
+	return 0;
+}
+
+int _wtoi(const WCHAR* szText)
+{
+	return (int) wcstol(szText, NULL, 10);
+}
+
+ULONGLONG _wcstoui64(const WCHAR* szText, WCHAR** pszEnd, int iBase)
+{
+	return wcstoull(szText, pszEnd, iBase);
+}
+
+int _wfopen_s(FILE** ppFile, const WCHAR* szFileName, const WCHAR* szMode)
+{
+	std::string strMode;
+	for (const WCHAR* pChar = szMode; *pChar != L'\0' && *pChar != L','; pChar++)
+		if (*pChar != L't') strMode += (char) *pChar;
+
+	*ppFile = fopen(ToNativePath(szFileName).c_str(), strMode.c_str());
+	return (*ppFile != NULL ? 0 : errno);
+}
+
+
+//--------------------------------------------------------
+// Message queue and Winsock
+//
+struct CSelectedSocket
+{
+	HWND hWnd;
+	UINT uMsg;
+	long lEvents;
+	bool bWriteBlocked;
+	bool bCloseReported;
+};
+
+static pthread_mutex_t g_objQueueLock = PTHREAD_MUTEX_INITIALIZER;
+static std::deque<MSG> g_arrMessages;
+static std::map<SOCKET, CSelectedSocket> g_mapSelectedSockets;
+
+// Called with g_objQueueLock locked
+static void QueueMessage(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	MSG objMsg;
+	ZeroMemory(&objMsg, sizeof(objMsg));
+	objMsg.hwnd    = hWnd;
+	objMsg.message = uMsg;
+	objMsg.wParam  = wParam;
+	objMsg.lParam  = lParam;
+	objMsg.time    = ::GetTickCount();
+	g_arrMessages.push_back(objMsg);
+}
+
+// Poll the selected sockets and queue their notifications. Called with g_objQueueLock locked.
+static void PollSockets(DWORD dwMilliseconds)
+{
+	std::vector<struct pollfd> arrPoll;
+
+	for (std::map<SOCKET, CSelectedSocket>::iterator it = g_mapSelectedSockets.begin(); it != g_mapSelectedSockets.end(); ++it)
+	{
+		struct pollfd objPoll;
+		objPoll.fd      = it->first;
+		objPoll.events  = 0;
+		objPoll.revents = 0;
+
+		if (it->second.bCloseReported) continue;
+		if (it->second.lEvents & (FD_ACCEPT | FD_READ)) objPoll.events |= POLLIN;
+		if ((it->second.lEvents & FD_WRITE) && it->second.bWriteBlocked) objPoll.events |= POLLOUT;
+		arrPoll.push_back(objPoll);
+	}
+
+	// Socket events arrive while the lock is released (send and closesocket take the lock too)
+	pthread_mutex_unlock(&g_objQueueLock);
+	int iReady = ::poll(arrPoll.empty() ? NULL : &arrPoll[0], arrPoll.size(), (dwMilliseconds == INFINITE ? -1 : (int) dwMilliseconds));
+	pthread_mutex_lock(&g_objQueueLock);
+
+	for (size_t idx = 0; idx < arrPoll.size() && iReady > 0; idx++)
+	{
+		std::map<SOCKET, CSelectedSocket>::iterator it = g_mapSelectedSockets.find(arrPoll[idx].fd);
+		short iEvents = arrPoll[idx].revents;
+
+		if (it == g_mapSelectedSockets.end() || iEvents == 0) continue;
+		CSelectedSocket& objSocket = it->second;
+
+		if (iEvents & POLLIN)
+			QueueMessage(objSocket.hWnd, objSocket.uMsg, (WPARAM) it->first, WSAMAKESELECTREPLY((objSocket.lEvents & FD_ACCEPT) ? FD_ACCEPT : FD_READ, 0));
+
+		if (iEvents & POLLOUT)
+		{
+			objSocket.bWriteBlocked = false;
+			QueueMessage(objSocket.hWnd, objSocket.uMsg, (WPARAM) it->first, WSAMAKESELECTREPLY(FD_WRITE, 0));
+		}
+
+		if ((iEvents & (POLLHUP | POLLERR)) && (iEvents & POLLIN) == 0 && (objSocket.lEvents & FD_CLOSE))
+		{
+			objSocket.bCloseReported = true;
+			QueueMessage(objSocket.hWnd, objSocket.uMsg, (WPARAM) it->first, WSAMAKESELECTREPLY(FD_CLOSE, 0));
+		}
+	}
+}
+
+BOOL PostMessageW(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	pthread_mutex_lock(&g_objQueueLock);
+	QueueMessage(hWnd, uMsg, wParam, lParam);
+	pthread_mutex_unlock(&g_objQueueLock);
+	return TRUE;
+}
+
+// Window and message filters are not supported (the tests have one window)
+BOOL PeekMessageW(MSG* pMsg, HWND /*hWnd*/, UINT /*uMsgFilterMin*/, UINT /*uMsgFilterMax*/, UINT uRemoveMsg)
+{
+	BOOL bFound = FALSE;
+
+	pthread_mutex_lock(&g_objQueueLock);
+	if (g_arrMessages.empty()) PollSockets(0);
+
+	if (!g_arrMessages.empty())
+	{
+		*pMsg = g_arrMessages.front();
+		if (uRemoveMsg & PM_REMOVE) g_arrMessages.pop_front();
+		bFound = TRUE;
+	}
+	pthread_mutex_unlock(&g_objQueueLock);
+
+	return bFound;
+}
+
+// Waits for messages only (nCount = 0)
+DWORD MsgWaitForMultipleObjects(DWORD nCount, const HANDLE* /*pHandles*/, BOOL /*bWaitAll*/, DWORD dwMilliseconds, DWORD /*dwWakeMask*/)
+{
+	if (nCount != 0)
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	pthread_mutex_lock(&g_objQueueLock);
+	if (g_arrMessages.empty()) PollSockets(dwMilliseconds);
+	bool bFound = !g_arrMessages.empty();
+	pthread_mutex_unlock(&g_objQueueLock);
+
+	return (bFound ? WAIT_OBJECT_0 : WAIT_TIMEOUT);
+}
+
+int WSAStartup(WORD wVersionRequested, WSADATA* pData)
+{
+	ZeroMemory(pData, sizeof(*pData));
+	pData->wVersion = pData->wHighVersion = wVersionRequested;
+	return 0;
+}
+
+int WSACleanup(void)
+{
+	return 0;
+}
+
+int WSAGetLastError(void)
+{
+	if (errno == EAGAIN || errno == EWOULDBLOCK) return WSAEWOULDBLOCK;
+	if (errno == ECONNRESET || errno == EPIPE) return WSAECONNRESET;
+	return (errno != 0 ? WSABASEERR + errno : 0);
+}
+
+int WSAAsyncSelect(SOCKET hSocket, HWND hWnd, UINT uMsg, long lEvents)
+{
+	int iFlags = ::fcntl(hSocket, F_GETFL);
+	if (iFlags < 0 || ::fcntl(hSocket, F_SETFL, iFlags | O_NONBLOCK) != 0) return SOCKET_ERROR;
+
+	pthread_mutex_lock(&g_objQueueLock);
+	if (lEvents == 0) g_mapSelectedSockets.erase(hSocket);
+	else
+	{
+		CSelectedSocket& objSocket = g_mapSelectedSockets[hSocket];
+		objSocket.hWnd           = hWnd;
+		objSocket.uMsg           = uMsg;
+		objSocket.lEvents        = lEvents;
+		objSocket.bWriteBlocked  = false;
+		objSocket.bCloseReported = false;
+	}
+	pthread_mutex_unlock(&g_objQueueLock);
+
+	return 0;
+}
+
+int closesocket(SOCKET hSocket)
+{
+	pthread_mutex_lock(&g_objQueueLock);
+	g_mapSelectedSockets.erase(hSocket);
+	pthread_mutex_unlock(&g_objQueueLock);
+
+	return ::close(hSocket);
+}
+
+int ioctlsocket(SOCKET hSocket, long /*lCommand*/, unsigned long* pArg)
+{
+	// FIONBIO only
+	int iFlags = ::fcntl(hSocket, F_GETFL);
+	if (iFlags < 0) return SOCKET_ERROR;
+	return ::fcntl(hSocket, F_SETFL, (*pArg != 0 ? iFlags | O_NONBLOCK : iFlags & ~O_NONBLOCK));
+}
+
+int send(SOCKET hSocket, const char* pData, size_t iLen, int iFlags)
+{
+	ssize_t iSent = ::send(hSocket, (const void*) pData, iLen, iFlags | MSG_NOSIGNAL);
+
+	if (iSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		int iErrno = errno;
+
+		pthread_mutex_lock(&g_objQueueLock);
+		std::map<SOCKET, CSelectedSocket>::iterator it = g_mapSelectedSockets.find(hSocket);
+		if (it != g_mapSelectedSockets.end()) it->second.bWriteBlocked = true;
+		pthread_mutex_unlock(&g_objQueueLock);
+
+		errno = iErrno;
+	}
+
+	return (iSent < 0 ? SOCKET_ERROR : (int) iSent);
+}
+
+int recv(SOCKET hSocket, char* pBuffer, size_t iLen, int iFlags)
+{
+	ssize_t iRead = ::recv(hSocket, (void*) pBuffer, iLen, iFlags);
+	return (iRead < 0 ? SOCKET_ERROR : (int) iRead);
+}
+
+
+//--------------------------------------------------------
+// CryptoAPI (SHA-1 only)
+//
+struct CSha1Hash
+{
+	DWORD     arrState[5];
+	BYTE      arrBlock[64];
+	ULONGLONG ullLength;
+	BYTE      arrDigest[20];
+	bool      bFinished;
+};
+
+static DWORD RotateLeft(DWORD dwValue, int iBits)
+{
+	return (dwValue << iBits) | (dwValue >> (32 - iBits));
+}
+
+static void Sha1Transform(CSha1Hash* pHash, const BYTE* pBlock)
+{
+	DWORD arrWords[80];
+	DWORD a = pHash->arrState[0], b = pHash->arrState[1], c = pHash->arrState[2], d = pHash->arrState[3], e = pHash->arrState[4];
+
+	for (int idx = 0; idx < 16; idx++)
+		arrWords[idx] = ((DWORD) pBlock[4 * idx] << 24) | ((DWORD) pBlock[4 * idx + 1] << 16) | ((DWORD) pBlock[4 * idx + 2] << 8) | pBlock[4 * idx + 3];
+	for (int idx = 16; idx < 80; idx++)
+		arrWords[idx] = RotateLeft(arrWords[idx - 3] ^ arrWords[idx - 8] ^ arrWords[idx - 14] ^ arrWords[idx - 16], 1);
+
+	for (int idx = 0; idx < 80; idx++)
+	{
+		DWORD f, k;
+		if (idx < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+		else if (idx < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+		else if (idx < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+		else               { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+		DWORD dwTemp = RotateLeft(a, 5) + f + e + k + arrWords[idx];
+		e = d;
+		d = c;
+		c = RotateLeft(b, 30);
+		b = a;
+		a = dwTemp;
+	}
+
+	pHash->arrState[0] += a;
+	pHash->arrState[1] += b;
+	pHash->arrState[2] += c;
+	pHash->arrState[3] += d;
+	pHash->arrState[4] += e;
+}
+
+static void Sha1Update(CSha1Hash* pHash, const BYTE* pData, size_t iLen)
+{
+	for (size_t idx = 0; idx < iLen; idx++)
+	{
+		pHash->arrBlock[pHash->ullLength++ % 64] = pData[idx];
+		if (pHash->ullLength % 64 == 0) Sha1Transform(pHash, pHash->arrBlock);
+	}
+}
+
+BOOL CryptAcquireContextW(HCRYPTPROV* phProv, LPCWSTR /*szContainer*/, LPCWSTR /*szProvider*/, DWORD /*dwProvType*/, DWORD /*dwFlags*/)
+{
+	*phProv = 1;
+	return TRUE;
+}
+
+BOOL CryptReleaseContext(HCRYPTPROV /*hProv*/, DWORD /*dwFlags*/)
+{
+	return TRUE;
+}
+
+BOOL CryptCreateHash(HCRYPTPROV /*hProv*/, ALG_ID Algid, HCRYPTKEY /*hKey*/, DWORD /*dwFlags*/, HCRYPTHASH* phHash)
+{
+	if (Algid != CALG_SHA1)
+	{
+		::SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	static const DWORD arrInitialState[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	CSha1Hash* pHash = new CSha1Hash();
+	memcpy(pHash->arrState, arrInitialState, sizeof(arrInitialState));
+	pHash->ullLength = 0;
+	pHash->bFinished = false;
+
+	*phHash = (HCRYPTHASH) pHash;
+	return TRUE;
+}
+
+BOOL CryptHashData(HCRYPTHASH hHash, const BYTE* pData, DWORD dwDataLen, DWORD /*dwFlags*/)
+{
+	CSha1Hash* pHash = (CSha1Hash*) hHash;
+	if (pHash->bFinished) return FALSE;
+
+	Sha1Update(pHash, pData, dwDataLen);
+	return TRUE;
+}
+
+BOOL CryptGetHashParam(HCRYPTHASH hHash, DWORD dwParam, BYTE* pData, DWORD* pdwDataLen, DWORD /*dwFlags*/)
+{
+	CSha1Hash* pHash = (CSha1Hash*) hHash;
+
+	if (dwParam != HP_HASHVAL || *pdwDataLen < sizeof(pHash->arrDigest))
+	{
+		*pdwDataLen = sizeof(pHash->arrDigest);
+		::SetLastError(dwParam != HP_HASHVAL ? ERROR_INVALID_PARAMETER : ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+
+	if (!pHash->bFinished)
+	{
+		// Padding: 0x80, zeros, then the message length in bits (big-endian)
+		ULONGLONG ullBits = pHash->ullLength * 8;
+		BYTE arrLength[8];
+		BYTE bPad = 0x80;
+
+		for (int idx = 0; idx < 8; idx++) arrLength[idx] = (BYTE) (ullBits >> (56 - 8 * idx));
+
+		Sha1Update(pHash, &bPad, 1);
+		bPad = 0;
+		while (pHash->ullLength % 64 != 56) Sha1Update(pHash, &bPad, 1);
+		Sha1Update(pHash, arrLength, sizeof(arrLength));
+
+		for (int idx = 0; idx < 20; idx++) pHash->arrDigest[idx] = (BYTE) (pHash->arrState[idx / 4] >> (24 - 8 * (idx % 4)));
+		pHash->bFinished = true;
+	}
+
+	memcpy(pData, pHash->arrDigest, sizeof(pHash->arrDigest));
+	*pdwDataLen = sizeof(pHash->arrDigest);
+	return TRUE;
+}
+
+BOOL CryptDestroyHash(HCRYPTHASH hHash)
+{
+	delete (CSha1Hash*) hHash;
+	return TRUE;
+}
+
+
+//--------------------------------------------------------
+// COM and OLE automation (see objbase.h and oleauto.h)
+//
+const IID IID_NULL          = { 0x00000000, 0x0000, 0x0000, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } };
+const IID IID_IUnknown      = { 0x00000000, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+const IID IID_IClassFactory = { 0x00000001, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+const IID IID_IDispatch     = { 0x00020400, 0x0000, 0x0000, { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 } };
+
+BSTR SysAllocString(const OLECHAR* szText)
+{
+	if (szText == NULL) return NULL;
+
+	size_t iLen = wcslen(szText);
+	BSTR bstrText = (BSTR) malloc((iLen + 1) * sizeof(OLECHAR));
+	if (bstrText != NULL) memcpy(bstrText, szText, (iLen + 1) * sizeof(OLECHAR));
+	return bstrText;
+}
+
+void SysFreeString(BSTR bstrText)
+{
+	free(bstrText);
+}
+
+void VariantInit(VARIANTARG* pVariant)
+{
+	memset(pVariant, 0, sizeof(VARIANTARG));
+}
+
+HRESULT VariantClear(VARIANTARG* pVariant)
+{
+	if (pVariant->vt == VT_BSTR) SysFreeString(pVariant->bstrVal);
+	else if ((pVariant->vt == VT_DISPATCH || pVariant->vt == VT_UNKNOWN) && pVariant->punkVal != NULL) pVariant->punkVal->Release();
+
+	VariantInit(pVariant);
+	return S_OK;
+}
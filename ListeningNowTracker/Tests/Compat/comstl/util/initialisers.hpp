@@ -0,0 +1,15 @@
+#ifndef __COMPAT_COMSTL_INITIALISERS_HPP__
+#define __COMPAT_COMSTL_INITIALISERS_HPP__
+
+// COM initialiser of STLSoft. Declared only (MainWnd.cpp footprint build, see Makefile)
+
+namespace comstl
+{
+	struct com_initialiser
+	{
+		com_initialiser();
+		~com_initialiser();
+	};
+}
+
+#endif //__COMPAT_COMSTL_INITIALISERS_HPP__
@@ -0,0 +1,66 @@
+#ifndef __COMPAT_OBJBASE_H__
+#define __COMPAT_OBJBASE_H__
+
+// COM interfaces and GUIDs. Objects implemented in the app (CSkypeStub.h) work as on Windows; class
+// registration is declared only (MainWnd.cpp footprint build, see Makefile)
+
+#include <string.h>
+
+typedef struct _GUID
+{
+	DWORD Data1;
+	WORD  Data2;
+	WORD  Data3;
+	BYTE  Data4[8];
+} GUID;
+
+typedef GUID        IID;
+typedef GUID        CLSID;
+typedef const GUID& REFGUID;
+typedef const IID&  REFIID;
+typedef const CLSID& REFCLSID;
+
+inline bool operator==(REFGUID guid1, REFGUID guid2) { return memcmp(&guid1, &guid2, sizeof(GUID)) == 0; }
+inline bool operator!=(REFGUID guid1, REFGUID guid2) { return !(guid1 == guid2); }
+#define IsEqualGUID(guid1, guid2)	((guid1) == (guid2))
+#define IsEqualIID(iid1, iid2)		((iid1) == (iid2))
+
+#define STDMETHODCALLTYPE
+#define STDMETHODIMP				HRESULT STDMETHODCALLTYPE
+#define STDMETHODIMP_(type)			type STDMETHODCALLTYPE
+
+#define S_OK						((HRESULT) 0)
+#define S_FALSE						((HRESULT) 1)
+#define E_NOTIMPL					((HRESULT) 0x80004001)
+#define E_NOINTERFACE				((HRESULT) 0x80004002)
+#define E_POINTER					((HRESULT) 0x80004003)
+#define E_OUTOFMEMORY				((HRESULT) 0x8007000E)
+#define CLASS_E_NOAGGREGATION		((HRESULT) 0x80040110)
+
+#define CLSCTX_INPROC_SERVER		0x1
+#define REGCLS_MULTIPLEUSE			1
+
+struct IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) = 0;
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) = 0;
+	virtual ULONG STDMETHODCALLTYPE Release(void) = 0;
+};
+
+struct IClassFactory : public IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE CreateInstance(IUnknown* pUnkOuter, REFIID riid, void** ppvObject) = 0;
+	virtual HRESULT STDMETHODCALLTYPE LockServer(BOOL bLock) = 0;
+};
+
+extern const IID IID_NULL;
+extern const IID IID_IUnknown;
+extern const IID IID_IClassFactory;
+
+//
+// Declared only (MainWnd.cpp footprint build)
+//
+HRESULT CoRegisterClassObject(REFCLSID rclsid, IUnknown* pUnk, DWORD dwClsContext, DWORD dwFlags, LPDWORD pdwRegister);
+HRESULT CoRevokeClassObject(DWORD dwRegister);
+
+#endif //__COMPAT_OBJBASE_H__
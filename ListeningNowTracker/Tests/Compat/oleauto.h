@@ -0,0 +1,78 @@
+#ifndef __COMPAT_OLEAUTO_H__
+#define __COMPAT_OLEAUTO_H__
+
+// OLE automation: IDispatch, VARIANT and BSTR (BSTR functions are implemented in Win32Compat.cpp,
+// without the length prefix of the real BSTR)
+
+#include <objbase.h>
+
+typedef WCHAR          OLECHAR;
+typedef OLECHAR*       LPOLESTR;
+typedef const OLECHAR* LPCOLESTR;
+typedef OLECHAR*       BSTR;
+typedef LONG           DISPID;
+typedef DWORD          LCID;
+typedef short          VARIANT_BOOL;
+typedef unsigned short VARTYPE;
+
+#define VARIANT_TRUE				((VARIANT_BOOL) -1)
+#define VARIANT_FALSE				((VARIANT_BOOL) 0)
+
+enum VARENUM { VT_EMPTY = 0, VT_I4 = 3, VT_BSTR = 8, VT_DISPATCH = 9, VT_BOOL = 11, VT_UNKNOWN = 13 };
+
+#define DISPATCH_METHOD				0x1
+#define DISPATCH_PROPERTYGET		0x2
+#define DISPATCH_PROPERTYPUT		0x4
+#define DISPID_UNKNOWN				(-1)
+#define DISPID_PROPERTYPUT			(-3)
+
+#define DISP_E_MEMBERNOTFOUND		((HRESULT) 0x80020003)
+#define DISP_E_TYPEMISMATCH			((HRESULT) 0x80020005)
+#define DISP_E_UNKNOWNNAME			((HRESULT) 0x80020006)
+#define DISP_E_BADPARAMCOUNT		((HRESULT) 0x8002000E)
+
+struct IDispatch;
+struct ITypeInfo;
+struct EXCEPINFO;
+
+typedef struct tagVARIANT
+{
+	VARTYPE vt;
+	WORD    wReserved1;
+	WORD    wReserved2;
+	WORD    wReserved3;
+	union
+	{
+		LONG         lVal;
+		VARIANT_BOOL boolVal;
+		BSTR         bstrVal;
+		IUnknown*    punkVal;
+		IDispatch*   pdispVal;
+	};
+} VARIANT, VARIANTARG;
+
+typedef struct tagDISPPARAMS
+{
+	VARIANTARG* rgvarg;
+	DISPID*     rgdispidNamedArgs;
+	UINT        cArgs;
+	UINT        cNamedArgs;
+} DISPPARAMS;
+
+struct IDispatch : public IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT* pctinfo) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo** ppTInfo) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID riid, LPOLESTR* rgszNames, UINT cNames, LCID lcid, DISPID* rgDispId) = 0;
+	virtual HRESULT STDMETHODCALLTYPE Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS* pDispParams,
+		VARIANT* pVarResult, EXCEPINFO* pExcepInfo, UINT* puArgErr) = 0;
+};
+
+extern const IID IID_IDispatch;
+
+BSTR    SysAllocString(const OLECHAR* szText);
+void    SysFreeString(BSTR bstrText);
+void    VariantInit(VARIANTARG* pVariant);
+HRESULT VariantClear(VARIANTARG* pVariant);
+
+#endif //__COMPAT_OLEAUTO_H__
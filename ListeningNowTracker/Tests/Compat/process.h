@@ -0,0 +1,9 @@
+#ifndef __COMPAT_PROCESS_H__
+#define __COMPAT_PROCESS_H__
+
+// CRT threads of VC++ (implemented with POSIX threads in Win32Compat.cpp)
+
+UINT_PTR _beginthreadex(void* pSecurity, unsigned iStackSize, unsigned (__stdcall *pStartAddress)(void*), void* pArg, unsigned iInitFlag, unsigned* piThreadID);
+void     _endthreadex(unsigned iExitCode);
+
+#endif //__COMPAT_PROCESS_H__
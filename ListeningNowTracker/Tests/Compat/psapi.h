@@ -0,0 +1,26 @@
+#ifndef __COMPAT_PSAPI_H__
+#define __COMPAT_PSAPI_H__
+
+// Process memory counters. Win32Compat.cpp reads them from /proc/self/status: working set is the
+// resident set (VmRSS, peak VmHWM) and private bytes is the data segment (VmData).
+
+typedef struct _PROCESS_MEMORY_COUNTERS_EX
+{
+	DWORD  cb;
+	DWORD  PageFaultCount;
+	SIZE_T PeakWorkingSetSize;
+	SIZE_T WorkingSetSize;
+	SIZE_T QuotaPeakPagedPoolUsage;
+	SIZE_T QuotaPagedPoolUsage;
+	SIZE_T QuotaPeakNonPagedPoolUsage;
+	SIZE_T QuotaNonPagedPoolUsage;
+	SIZE_T PagefileUsage;
+	SIZE_T PeakPagefileUsage;
+	SIZE_T PrivateUsage;
+} PROCESS_MEMORY_COUNTERS_EX, PROCESS_MEMORY_COUNTERS;
+
+BOOL  GetProcessMemoryInfo(HANDLE hProcess, PROCESS_MEMORY_COUNTERS* pCounters, DWORD cb);
+DWORD GetModuleBaseNameW(HANDLE hProcess, HMODULE hModule, LPWSTR szBaseName, DWORD dwSize);
+#define GetModuleBaseName			GetModuleBaseNameW
+
+#endif //__COMPAT_PSAPI_H__
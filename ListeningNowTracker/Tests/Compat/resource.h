@@ -0,0 +1,2 @@
+// MainWnd.cpp includes "resource.h" (case-insensitive file names on Windows)
+#include "../../Resource.h"
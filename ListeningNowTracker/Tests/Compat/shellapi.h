@@ -0,0 +1,27 @@
+#ifndef __COMPAT_SHELLAPI_H__
+#define __COMPAT_SHELLAPI_H__
+
+// Tray icon (declared only, see windows.h)
+
+#define NIM_ADD						0x00000000
+#define NIM_MODIFY					0x00000001
+#define NIM_DELETE					0x00000002
+#define NIF_MESSAGE					0x00000001
+#define NIF_ICON					0x00000002
+#define NIF_TIP						0x00000004
+
+typedef struct _NOTIFYICONDATAW
+{
+	DWORD cbSize;
+	HWND  hWnd;
+	UINT  uID;
+	UINT  uFlags;
+	UINT  uCallbackMessage;
+	HICON hIcon;
+	WCHAR szTip[128];
+} NOTIFYICONDATA;
+
+BOOL Shell_NotifyIconW(DWORD dwMessage, NOTIFYICONDATA* pData);
+#define Shell_NotifyIcon			Shell_NotifyIconW
+
+#endif //__COMPAT_SHELLAPI_H__
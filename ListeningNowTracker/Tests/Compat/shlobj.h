@@ -0,0 +1,12 @@
+#ifndef __COMPAT_SHLOBJ_H__
+#define __COMPAT_SHLOBJ_H__
+
+// Known folders (declared only, see windows.h)
+
+#define CSIDL_LOCAL_APPDATA			0x001C
+#define CSIDL_FLAG_CREATE			0x8000
+
+HRESULT SHGetFolderPathW(HWND hWnd, int iFolder, HANDLE hToken, DWORD dwFlags, LPWSTR szPath);
+#define SHGetFolderPath				SHGetFolderPathW
+
+#endif //__COMPAT_SHLOBJ_H__
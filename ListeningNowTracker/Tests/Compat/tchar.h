@@ -0,0 +1,14 @@
+#ifndef __COMPAT_TCHAR_H__
+#define __COMPAT_TCHAR_H__
+
+// Generic text mappings of a UNICODE build (see windows.h)
+
+#define _T(x)						L##x
+#define _TEXT(x)					L##x
+#define _tWinMain					wWinMain
+#define _tcslen						wcslen
+#define _tcsstr						wcsstr
+#define _tcsnicmp					_wcsnicmp
+#define _ttoi						_wtoi
+
+#endif //__COMPAT_TCHAR_H__
@@ -0,0 +1,21 @@
+#ifndef __COMPAT_VOLE_HPP__
+#define __COMPAT_VOLE_HPP__
+
+// VOLE OLE automation wrapper. Declared only (MainWnd.cpp footprint build, see Makefile)
+
+#include <objbase.h>
+
+namespace vole
+{
+	class object
+	{
+	  public:
+		static object create(const wchar_t* szProgID);
+		static object create(REFCLSID clsid, DWORD dwClsCtx);
+
+		template <typename T> T get_property(const wchar_t* szName);
+		template <typename T> void put_property(const wchar_t* szName, T value);
+	};
+}
+
+#endif //__COMPAT_VOLE_HPP__
@@ -0,0 +1,24 @@
+#ifndef __COMPAT_WINCRYPT_H__
+#define __COMPAT_WINCRYPT_H__
+
+// CryptoAPI hashing. Only CALG_SHA1 is implemented (WebSocket handshake of CBroadcastServer).
+
+typedef ULONG_PTR HCRYPTPROV;
+typedef ULONG_PTR HCRYPTHASH;
+typedef ULONG_PTR HCRYPTKEY;
+typedef unsigned  ALG_ID;
+
+#define PROV_RSA_FULL				1
+#define CRYPT_VERIFYCONTEXT			0xF0000000
+#define CALG_SHA1					0x00008004
+#define HP_HASHVAL					0x0002
+
+BOOL CryptAcquireContextW(HCRYPTPROV* phProv, LPCWSTR szContainer, LPCWSTR szProvider, DWORD dwProvType, DWORD dwFlags);
+BOOL CryptReleaseContext(HCRYPTPROV hProv, DWORD dwFlags);
+BOOL CryptCreateHash(HCRYPTPROV hProv, ALG_ID Algid, HCRYPTKEY hKey, DWORD dwFlags, HCRYPTHASH* phHash);
+BOOL CryptHashData(HCRYPTHASH hHash, const BYTE* pData, DWORD dwDataLen, DWORD dwFlags);
+BOOL CryptGetHashParam(HCRYPTHASH hHash, DWORD dwParam, BYTE* pData, DWORD* pdwDataLen, DWORD dwFlags);
+BOOL CryptDestroyHash(HCRYPTHASH hHash);
+#define CryptAcquireContext			CryptAcquireContextW
+
+#endif //__COMPAT_WINCRYPT_H__
@@ -0,0 +1,491 @@
+#ifndef __COMPAT_WINDOWS_H__
+#define __COMPAT_WINDOWS_H__
+
+/*
+ * Win32 API subset for building the portable headers of the app on Linux (see Tests/Makefile).
+ *
+ * The functions used by the headers under test are implemented in Win32Compat.cpp on top of POSIX
+ * (threads, events, files, file mappings, sockets). Types have the Win32 (LLP64) sizes except WCHAR,
+ * which is the 32-bit wchar_t of Linux. The conversion functions still produce UTF-16 surrogate
+ * pairs, so text lengths are counted as on Windows.
+ *
+ * User interface, COM and process APIs are only declared. MainWnd.cpp compiles against them for
+ * the footprint report, but the test programs don't call them.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <pthread.h>
+
+//
+// Compiler extensions of VC++
+//
+#define WINAPI
+#define APIENTRY
+#define CALLBACK
+#define __stdcall
+#define __cdecl
+#define __try						try
+#define __except(filter)			catch(...)
+#define EXCEPTION_EXECUTE_HANDLER	1
+
+//
+// Basic types
+//
+typedef int                BOOL;
+typedef unsigned char      BYTE;
+typedef unsigned short     WORD;
+typedef unsigned int       DWORD;
+typedef int                LONG;
+typedef unsigned int       ULONG;
+typedef unsigned int       UINT;
+typedef long long          LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef wchar_t            WCHAR;
+typedef wchar_t            TCHAR;
+typedef char               CHAR;
+
+typedef long               INT_PTR;
+typedef unsigned long      UINT_PTR;
+typedef long               LONG_PTR;
+typedef unsigned long      ULONG_PTR;
+typedef ULONG_PTR          SIZE_T;
+typedef ULONG_PTR          DWORD_PTR;
+
+typedef void*              PVOID;
+typedef void*              LPVOID;
+typedef const void*        LPCVOID;
+typedef char*              LPSTR;
+typedef const char*        LPCSTR;
+typedef WCHAR*             LPWSTR;
+typedef const WCHAR*       LPCWSTR;
+typedef TCHAR*             LPTSTR;
+typedef const TCHAR*       LPCTSTR;
+typedef DWORD*             LPDWORD;
+typedef BOOL*              LPBOOL;
+typedef long               HRESULT;
+
+typedef void*              HANDLE;
+typedef struct HWND__*     HWND;
+typedef void*              HINSTANCE;
+typedef void*              HMODULE;
+typedef void*              HICON;
+typedef void*              HMENU;
+typedef void*              HBRUSH;
+typedef void*              HCURSOR;
+
+typedef UINT_PTR           WPARAM;
+typedef LONG_PTR           LPARAM;
+typedef LONG_PTR           LRESULT;
+
+typedef union _LARGE_INTEGER
+{
+	struct { DWORD LowPart; LONG HighPart; };
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER
+{
+	struct { DWORD LowPart; DWORD HighPart; };
+	ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+typedef struct _FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct tagPOINT
+{
+	LONG x;
+	LONG y;
+} POINT;
+
+// Win32 critical sections are recursive (the app enters g_objProcessCS again in nested calls)
+typedef struct _CRITICAL_SECTION
+{
+	pthread_mutex_t objMutex;
+} CRITICAL_SECTION;
+
+typedef struct _SYSTEM_INFO
+{
+	WORD      wProcessorArchitecture;
+	WORD      wReserved;
+	DWORD     dwPageSize;
+	LPVOID    lpMinimumApplicationAddress;
+	LPVOID    lpMaximumApplicationAddress;
+	DWORD_PTR dwActiveProcessorMask;
+	DWORD     dwNumberOfProcessors;
+	DWORD     dwProcessorType;
+	DWORD     dwAllocationGranularity;
+	WORD      wProcessorLevel;
+	WORD      wProcessorRevision;
+} SYSTEM_INFO;
+
+typedef struct _MEMORY_BASIC_INFORMATION
+{
+	PVOID  BaseAddress;
+	PVOID  AllocationBase;
+	DWORD  AllocationProtect;
+	SIZE_T RegionSize;
+	DWORD  State;
+	DWORD  Protect;
+	DWORD  Type;
+} MEMORY_BASIC_INFORMATION;
+
+typedef struct _WIN32_FIND_DATAW
+{
+	DWORD    dwFileAttributes;
+	FILETIME ftCreationTime;
+	FILETIME ftLastAccessTime;
+	FILETIME ftLastWriteTime;
+	DWORD    nFileSizeHigh;
+	DWORD    nFileSizeLow;
+	DWORD    dwReserved0;
+	DWORD    dwReserved1;
+	WCHAR    cFileName[260];
+	WCHAR    cAlternateFileName[14];
+} WIN32_FIND_DATA, WIN32_FIND_DATAW;
+
+typedef struct _PROCESS_HEAP_ENTRY
+{
+	PVOID lpData;
+	DWORD cbData;
+	BYTE  cbOverhead;
+	BYTE  iRegionIndex;
+	WORD  wFlags;
+	DWORD dwReserved[4];
+} PROCESS_HEAP_ENTRY;
+
+typedef struct tagCOPYDATASTRUCT
+{
+	ULONG_PTR dwData;
+	DWORD     cbData;
+	PVOID     lpData;
+} COPYDATASTRUCT, *PCOPYDATASTRUCT;
+
+typedef struct tagMSG
+{
+	HWND   hwnd;
+	UINT   message;
+	WPARAM wParam;
+	LPARAM lParam;
+	DWORD  time;
+	POINT  pt;
+} MSG;
+
+typedef LRESULT (CALLBACK *WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+
+typedef struct tagWNDCLASSEXW
+{
+	UINT      cbSize;
+	UINT      style;
+	WNDPROC   lpfnWndProc;
+	int       cbClsExtra;
+	int       cbWndExtra;
+	HINSTANCE hInstance;
+	HICON     hIcon;
+	HCURSOR   hCursor;
+	HBRUSH    hbrBackground;
+	LPCWSTR   lpszMenuName;
+	LPCWSTR   lpszClassName;
+	HICON     hIconSm;
+} WNDCLASSEX;
+
+//
+// Constants
+//
+#define TRUE						1
+#define FALSE						0
+#define MAX_PATH					260
+#define _MAX_PATH					260
+#define _TRUNCATE					((size_t) -1)
+#define INFINITE					0xFFFFFFFF
+
+#define WAIT_OBJECT_0				0
+#define WAIT_TIMEOUT				258
+#define WAIT_FAILED					0xFFFFFFFF
+#define STILL_ACTIVE				259
+
+#define ERROR_SUCCESS				0
+#define ERROR_FILE_NOT_FOUND		2
+#define ERROR_PATH_NOT_FOUND		3
+#define ERROR_ACCESS_DENIED			5
+#define ERROR_INVALID_HANDLE		6
+#define ERROR_NOT_ENOUGH_MEMORY		8
+#define ERROR_NO_MORE_FILES			18
+#define ERROR_HANDLE_EOF			38
+#define ERROR_FILE_EXISTS			80
+#define ERROR_INVALID_PARAMETER		87
+#define ERROR_INSUFFICIENT_BUFFER	122
+#define ERROR_ALREADY_EXISTS		183
+#define ERROR_NO_UNICODE_TRANSLATION 1113
+
+#define INVALID_HANDLE_VALUE		((HANDLE) (LONG_PTR) -1)
+#define INVALID_FILE_SIZE			0xFFFFFFFF
+
+#define GENERIC_READ				0x80000000
+#define GENERIC_WRITE				0x40000000
+#define FILE_SHARE_READ				0x00000001
+#define FILE_SHARE_WRITE			0x00000002
+#define FILE_SHARE_DELETE			0x00000004
+#define CREATE_NEW					1
+#define CREATE_ALWAYS				2
+#define OPEN_EXISTING				3
+#define OPEN_ALWAYS					4
+#define TRUNCATE_EXISTING			5
+#define FILE_ATTRIBUTE_DIRECTORY	0x00000010
+#define FILE_ATTRIBUTE_NORMAL		0x00000080
+#define FILE_FLAG_SEQUENTIAL_SCAN	0x08000000
+#define FILE_FLAG_RANDOM_ACCESS		0x10000000
+#define FILE_BEGIN					0
+#define FILE_CURRENT				1
+#define FILE_END					2
+#define MOVEFILE_REPLACE_EXISTING	0x00000001
+#define MOVEFILE_WRITE_THROUGH		0x00000008
+
+#define PAGE_READONLY				0x02
+#define PAGE_READWRITE				0x04
+#define FILE_MAP_WRITE				0x0002
+#define FILE_MAP_READ				0x0004
+#define FILE_MAP_ALL_ACCESS			0x000F001F
+#define MEM_COMMIT					0x1000
+#define MEM_MAPPED					0x40000
+
+#define PROCESS_HEAP_ENTRY_BUSY		0x0004
+#define PROCESS_QUERY_INFORMATION	0x0400
+#define PROCESS_VM_READ				0x0010
+#define GR_GDIOBJECTS				0
+#define GR_USEROBJECTS				1
+
+#define CP_ACP						0
+#define CP_UTF8						65001
+#define MB_ERR_INVALID_CHARS		0x00000008
+
+#define WM_CREATE					0x0001
+#define WM_DESTROY					0x0002
+#define WM_QUIT						0x0012
+#define WM_CONTEXTMENU				0x007B
+#define WM_COPYDATA					0x004A
+#define WM_COMMAND					0x0111
+#define WM_TIMER					0x0113
+#define WM_RBUTTONDOWN				0x0204
+#define WM_USER						0x0400
+#define WM_APP						0x8000
+#define PM_NOREMOVE					0x0000
+#define PM_REMOVE					0x0001
+#define QS_ALLINPUT					0x04FF
+
+#define MF_STRING					0x0000
+#define TPM_BOTTOMALIGN				0x0020
+#define WS_MINIMIZE					0x20000000
+#define CW_USEDEFAULT				((int) 0x80000000)
+#define HWND_MESSAGE				((HWND) -3)
+#define COLOR_WINDOW				5
+#define MB_OK						0x0000
+#define MB_ICONWARNING				0x0030
+#define MB_TOPMOST					0x00040000
+
+#define MAKEINTRESOURCE(i)			((LPCTSTR) (ULONG_PTR) (WORD) (i))
+#define IDC_ARROW					MAKEINTRESOURCE(32512)
+#define MAKEWORD(a, b)				((WORD) (((BYTE) (a)) | ((WORD) ((BYTE) (b))) << 8))
+#define LOWORD(l)					((WORD) ((DWORD_PTR) (l) & 0xFFFF))
+#define HIWORD(l)					((WORD) (((DWORD_PTR) (l) >> 16) & 0xFFFF))
+#define SUCCEEDED(hr)				(((HRESULT) (hr)) >= 0)
+#define FAILED(hr)					(((HRESULT) (hr)) < 0)
+
+#define ZeroMemory(p, n)			memset((p), 0, (n))
+#define CopyMemory(d, s, n)			memcpy((d), (s), (n))
+#define MemoryBarrier()				__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define YieldProcessor()			__asm__ __volatile__("" ::: "memory")
+
+#define CreateFile					CreateFileW
+#define CreateFileMapping			CreateFileMappingW
+#define OpenFileMapping				OpenFileMappingW
+#define CreateEvent					CreateEventW
+#define CreateMutex					CreateMutexW
+#define DeleteFile					DeleteFileW
+#define MoveFileEx					MoveFileExW
+#define CreateDirectory				CreateDirectoryW
+#define FindFirstFile				FindFirstFileW
+#define FindNextFile				FindNextFileW
+#define GetTempPath					GetTempPathW
+#define GetModuleFileName			GetModuleFileNameW
+#define OutputDebugString			OutputDebugStringW
+#define PostMessage					PostMessageW
+#define PeekMessage					PeekMessageW
+
+//
+// Interlocked functions are full memory barriers
+//
+inline LONG InterlockedIncrement(volatile LONG* plValue) { return __atomic_add_fetch(plValue, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedDecrement(volatile LONG* plValue) { return __atomic_sub_fetch(plValue, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchange(volatile LONG* plTarget, LONG lValue) { return __atomic_exchange_n(plTarget, lValue, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchangeAdd(volatile LONG* plTarget, LONG lValue) { return __atomic_fetch_add(plTarget, lValue, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedCompareExchange(volatile LONG* plTarget, LONG lExchange, LONG lComparand)
+{
+	__atomic_compare_exchange_n(plTarget, &lComparand, lExchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return lComparand;
+}
+inline PVOID InterlockedExchangePointer(PVOID volatile* ppTarget, PVOID pValue) { return __atomic_exchange_n(ppTarget, pValue, __ATOMIC_SEQ_CST); }
+
+//
+// Kernel (implemented in Win32Compat.cpp)
+//
+DWORD  GetLastError(void);
+void   SetLastError(DWORD dwError);
+BOOL   CloseHandle(HANDLE hObject);
+
+void   InitializeCriticalSection(CRITICAL_SECTION* pCS);
+void   DeleteCriticalSection(CRITICAL_SECTION* pCS);
+void   EnterCriticalSection(CRITICAL_SECTION* pCS);
+void   LeaveCriticalSection(CRITICAL_SECTION* pCS);
+
+HANDLE CreateEventW(LPVOID pAttributes, BOOL bManualReset, BOOL bInitialState, LPCWSTR szName);
+BOOL   SetEvent(HANDLE hEvent);
+BOOL   ResetEvent(HANDLE hEvent);
+HANDLE CreateMutexW(LPVOID pAttributes, BOOL bInitialOwner, LPCWSTR szName);
+DWORD  WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds);
+DWORD  WaitForMultipleObjects(DWORD nCount, const HANDLE* pHandles, BOOL bWaitAll, DWORD dwMilliseconds);
+
+BOOL   GetExitCodeThread(HANDLE hThread, LPDWORD pdwExitCode);
+BOOL   TerminateThread(HANDLE hThread, DWORD dwExitCode);
+DWORD  GetCurrentThreadId(void);
+DWORD  GetCurrentProcessId(void);
+HANDLE GetCurrentProcess(void);
+void   Sleep(DWORD dwMilliseconds);
+BOOL   SwitchToThread(void);
+void   GetSystemInfo(SYSTEM_INFO* pSystemInfo);
+
+DWORD  GetTickCount(void);
+BOOL   QueryPerformanceCounter(LARGE_INTEGER* pCount);
+BOOL   QueryPerformanceFrequency(LARGE_INTEGER* pFrequency);
+void   GetSystemTimeAsFileTime(FILETIME* pFileTime);
+
+HANDLE CreateFileW(LPCWSTR szFileName, DWORD dwAccess, DWORD dwShareMode, LPVOID pAttributes, DWORD dwDisposition, DWORD dwFlags, HANDLE hTemplate);
+BOOL   ReadFile(HANDLE hFile, LPVOID pBuffer, DWORD dwBytes, LPDWORD pdwRead, LPVOID pOverlapped);
+BOOL   WriteFile(HANDLE hFile, LPCVOID pBuffer, DWORD dwBytes, LPDWORD pdwWritten, LPVOID pOverlapped);
+DWORD  GetFileSize(HANDLE hFile, LPDWORD pdwSizeHigh);
+BOOL   GetFileSizeEx(HANDLE hFile, LARGE_INTEGER* pSize);
+BOOL   FlushFileBuffers(HANDLE hFile);
+BOOL   DeleteFileW(LPCWSTR szFileName);
+BOOL   MoveFileExW(LPCWSTR szExisting, LPCWSTR szNew, DWORD dwFlags);
+BOOL   CreateDirectoryW(LPCWSTR szPath, LPVOID pAttributes);
+DWORD  GetTempPathW(DWORD dwBufferLen, LPWSTR szBuffer);
+HANDLE FindFirstFileW(LPCWSTR szPattern, WIN32_FIND_DATAW* pFindData);
+BOOL   FindNextFileW(HANDLE hFind, WIN32_FIND_DATAW* pFindData);
+BOOL   FindClose(HANDLE hFind);
+
+HANDLE CreateFileMappingW(HANDLE hFile, LPVOID pAttributes, DWORD dwProtect, DWORD dwSizeHigh, DWORD dwSizeLow, LPCWSTR szName);
+HANDLE OpenFileMappingW(DWORD dwAccess, BOOL bInheritHandle, LPCWSTR szName);
+LPVOID MapViewOfFile(HANDLE hMapping, DWORD dwAccess, DWORD dwOffsetHigh, DWORD dwOffsetLow, SIZE_T iBytes);
+BOOL   UnmapViewOfFile(LPCVOID pView);
+BOOL   FlushViewOfFile(LPCVOID pView, SIZE_T iBytes);
+SIZE_T VirtualQuery(LPCVOID pAddress, MEMORY_BASIC_INFORMATION* pInfo, SIZE_T iLength);
+
+DWORD  GetProcessHeaps(DWORD dwCount, HANDLE* pHeaps);
+BOOL   HeapLock(HANDLE hHeap);
+BOOL   HeapUnlock(HANDLE hHeap);
+BOOL   HeapWalk(HANDLE hHeap, PROCESS_HEAP_ENTRY* pEntry);
+BOOL   GetProcessHandleCount(HANDLE hProcess, LPDWORD pdwHandleCount);
+DWORD  GetGuiResources(HANDLE hProcess, DWORD dwFlags);
+BOOL   SetProcessWorkingSetSize(HANDLE hProcess, SIZE_T iMinimum, SIZE_T iMaximum);
+
+int    MultiByteToWideChar(UINT uCodePage, DWORD dwFlags, LPCSTR szText, int iBytes, LPWSTR szWide, int iWideChars);
+int    WideCharToMultiByte(UINT uCodePage, DWORD dwFlags, LPCWSTR szWide, int iWideChars, LPSTR szText, int iBytes, LPCSTR szDefaultChar, LPBOOL pbUsedDefaultChar);
+
+void   OutputDebugStringW(LPCWSTR szText);
+
+// Message queue of the calling process. Sockets registered with WSAAsyncSelect are polled for
+// notifications when the queue is empty (see winsock2.h).
+BOOL   PostMessageW(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+BOOL   PeekMessageW(MSG* pMsg, HWND hWnd, UINT uMsgFilterMin, UINT uMsgFilterMax, UINT uRemoveMsg);
+DWORD  MsgWaitForMultipleObjects(DWORD nCount, const HANDLE* pHandles, BOOL bWaitAll, DWORD dwMilliseconds, DWORD dwWakeMask);
+
+//
+// Declared only (MainWnd.cpp footprint build)
+//
+HINSTANCE GetModuleHandleW(LPCWSTR szModuleName);
+DWORD  GetModuleFileNameW(HMODULE hModule, LPWSTR szFileName, DWORD dwSize);
+UINT   GetPrivateProfileIntW(LPCWSTR szSection, LPCWSTR szKey, int iDefault, LPCWSTR szFileName);
+DWORD  GetPrivateProfileStringW(LPCWSTR szSection, LPCWSTR szKey, LPCWSTR szDefault, LPWSTR szValue, DWORD dwSize, LPCWSTR szFileName);
+DWORD  GetPrivateProfileSectionW(LPCWSTR szSection, LPWSTR szValues, DWORD dwSize, LPCWSTR szFileName);
+#define GetPrivateProfileInt		GetPrivateProfileIntW
+#define GetPrivateProfileString		GetPrivateProfileStringW
+#define GetPrivateProfileSection	GetPrivateProfileSectionW
+HANDLE OpenProcess(DWORD dwAccess, BOOL bInheritHandle, DWORD dwProcessID);
+DWORD  GetWindowThreadProcessId(HWND hWnd, LPDWORD pdwProcessID);
+HRESULT CoInitialize(LPVOID pReserved);
+void   CoUninitialize(void);
+LRESULT DefWindowProcW(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+void   PostQuitMessage(int iExitCode);
+BOOL   GetMessageW(MSG* pMsg, HWND hWnd, UINT uMsgFilterMin, UINT uMsgFilterMax);
+BOOL   TranslateMessage(const MSG* pMsg);
+LRESULT DispatchMessageW(const MSG* pMsg);
+HWND   CreateWindowW(LPCWSTR szClassName, LPCWSTR szWindowName, DWORD dwStyle, int x, int y, int iWidth, int iHeight, HWND hParent, HMENU hMenu, HINSTANCE hInstance, LPVOID pParam);
+BOOL   DestroyWindow(HWND hWnd);
+BOOL   UpdateWindow(HWND hWnd);
+WORD   RegisterClassExW(const WNDCLASSEX* pWndClass);
+HICON  LoadIconW(HINSTANCE hInstance, LPCWSTR szIconName);
+HCURSOR LoadCursorW(HINSTANCE hInstance, LPCWSTR szCursorName);
+BOOL   GetCursorPos(POINT* pPoint);
+HMENU  CreatePopupMenu(void);
+BOOL   AppendMenuW(HMENU hMenu, UINT uFlags, UINT_PTR uIDNewItem, LPCWSTR szNewItem);
+BOOL   SetForegroundWindow(HWND hWnd);
+BOOL   TrackPopupMenu(HMENU hMenu, UINT uFlags, int x, int y, int iReserved, HWND hWnd, const void* pRect);
+BOOL   DestroyMenu(HMENU hMenu);
+int    MessageBoxW(HWND hWnd, LPCWSTR szText, LPCWSTR szCaption, UINT uType);
+UINT_PTR SetTimer(HWND hWnd, UINT_PTR uIDEvent, UINT uElapse, LPVOID pTimerFunc);
+BOOL   KillTimer(HWND hWnd, UINT_PTR uIDEvent);
+#define DefWindowProc				DefWindowProcW
+#define GetMessage					GetMessageW
+#define DispatchMessage				DispatchMessageW
+#define CreateWindow				CreateWindowW
+#define RegisterClassEx				RegisterClassExW
+#define LoadIcon					LoadIconW
+#define LoadCursor					LoadCursorW
+#define AppendMenu					AppendMenuW
+#define MessageBox					MessageBoxW
+
+//
+// Secure CRT of VC++ (implemented in Win32Compat.cpp). Wide printf functions use the VC++ meaning
+// of the format: %s and %c are wide, %S and %hs are narrow.
+//
+int    wcscpy_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource);
+int    wcsncpy_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource, size_t iCount);
+int    wcscat_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource);
+int    wcsncat_s(WCHAR* szDest, size_t iDestSize, const WCHAR* szSource, size_t iCount);
+int    strncpy_s(char* szDest, size_t iDestSize, const char* szSource, size_t iCount);
+int    memcpy_s(void* pDest, size_t iDestSize, const void* pSource, size_t iCount);
+int    _vsnwprintf_s(WCHAR* szBuffer, size_t iBufferSize, size_t iCount, const WCHAR* szFormat, va_list args);
+int    _snwprintf_s(WCHAR* szBuffer, size_t iBufferSize, size_t iCount, const WCHAR* szFormat, ...);
+int    _snprintf_s(char* szBuffer, size_t iBufferSize, size_t iCount, const char* szFormat, ...);
+int    _wcsicmp(const WCHAR* szText1, const WCHAR* szText2);
+int    _wcsnicmp(const WCHAR* szText1, const WCHAR* szText2, size_t iCount);
+int    _wtoi(const WCHAR* szText);
+ULONGLONG _wcstoui64(const WCHAR* szText, WCHAR** pszEnd, int iBase);
+int    _wfopen_s(FILE** ppFile, const WCHAR* szFileName, const WCHAR* szMode);
+#define _stricmp					strcasecmp
+#define _strnicmp					strncasecmp
+
+template <size_t N> inline int wcscpy_s(WCHAR (&szDest)[N], const WCHAR* szSource) { return wcscpy_s(szDest, N, szSource); }
+template <size_t N> inline int wcsncpy_s(WCHAR (&szDest)[N], const WCHAR* szSource, size_t iCount) { return wcsncpy_s(szDest, N, szSource, iCount); }
+template <size_t N> inline int wcscat_s(WCHAR (&szDest)[N], const WCHAR* szSource) { return wcscat_s(szDest, N, szSource); }
+template <size_t N> inline int wcsncat_s(WCHAR (&szDest)[N], const WCHAR* szSource, size_t iCount) { return wcsncat_s(szDest, N, szSource, iCount); }
+template <size_t N> inline int _snwprintf_s(WCHAR (&szBuffer)[N], size_t iCount, const WCHAR* szFormat, ...)
+{
+	va_list args;
+	va_start(args, szFormat);
+	int iResult = _vsnwprintf_s(szBuffer, N, iCount, szFormat, args);
+	va_end(args);
+	return iResult;
+}
+
+#endif //__COMPAT_WINDOWS_H__
@@ -0,0 +1,57 @@
+#ifndef __COMPAT_WINSOCK2_H__
+#define __COMPAT_WINSOCK2_H__
+
+/*
+ * Winsock on top of BSD sockets. WSAAsyncSelect is emulated with a registry of the selected sockets:
+ * PeekMessage and MsgWaitForMultipleObjects poll them and queue the notifications as messages of
+ * the given window (see windows.h). FD_WRITE is reported after a send has failed with WSAEWOULDBLOCK,
+ * so send and recv are overloaded with the Winsock signatures to track that. The length is size_t, so
+ * the overloads win over the BSD functions for both int and sizeof lengths.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+
+#define INVALID_SOCKET				(-1)
+#define SOCKET_ERROR				(-1)
+#define SD_RECEIVE					SHUT_RD
+#define SD_SEND						SHUT_WR
+#define SD_BOTH						SHUT_RDWR
+
+#define FD_READ						0x01
+#define FD_WRITE					0x02
+#define FD_ACCEPT					0x08
+#define FD_CLOSE					0x20
+
+#define WSABASEERR					10000
+#define WSAEWOULDBLOCK				10035
+#define WSAECONNRESET				10054
+
+#define WSAMAKESELECTREPLY(event, error)	((LPARAM) (DWORD) (((WORD) (event)) | ((DWORD) (WORD) (error) << 16)))
+#define WSAGETSELECTEVENT(lParam)	LOWORD(lParam)
+#define WSAGETSELECTERROR(lParam)	HIWORD(lParam)
+
+typedef struct WSAData
+{
+	WORD wVersion;
+	WORD wHighVersion;
+	char szDescription[257];
+	char szSystemStatus[129];
+} WSADATA;
+
+int WSAStartup(WORD wVersionRequested, WSADATA* pData);
+int WSACleanup(void);
+int WSAGetLastError(void);
+int WSAAsyncSelect(SOCKET hSocket, HWND hWnd, UINT uMsg, long lEvents);
+int closesocket(SOCKET hSocket);
+int ioctlsocket(SOCKET hSocket, long lCommand, unsigned long* pArg);
+int send(SOCKET hSocket, const char* pData, size_t iLen, int iFlags);
+int recv(SOCKET hSocket, char* pBuffer, size_t iLen, int iFlags);
+
+#endif //__COMPAT_WINSOCK2_H__
@@ -0,0 +1,502 @@
+//
+// Tests of CBroadcastServer: fan-out of events to many clients of every protocol, snapshot requests,
+// disconnects and drop-to-latest of a client which doesn't read. The load test fans events out to
+// 1,000 line protocol subscribers (fewer if the fd limit doesn't allow it) and measures the latency
+// from Publish to the arrival at each subscriber and the CPU time of Publish. "/bench" argument runs
+// a longer load test and reports the latency percentiles and CPU per event (make bench).
+//
+#include "stdafx.h"
+#include "CThread.h"
+#include "CBroadcastServer.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+static const UINT WM_APP_TEST_SOCKET = WM_APP + 1;
+
+struct CTestClient
+{
+	SOCKET      hSocket;
+	int         iFormat;		// CBroadcastPacket::FORMAT_xxx
+	std::string strReceived;
+	bool        bClosed;		// Server closed the connection
+};
+
+static CBroadcastServer g_objServer;
+static WORD g_wPort = 0;
+static DWORD g_dwSequence = 0;
+
+static bool StartServer()
+{
+	// Any free port (parallel test runs use different ports)
+	for (WORD wPort = (WORD) (42000 + ::GetCurrentProcessId() % 1000); wPort < 50000; wPort += 997)
+	{
+		if (!g_objServer.Start((HWND) 1, WM_APP_TEST_SOCKET, wPort)) continue;
+
+		g_wPort = wPort;
+		return true;
+	}
+	return false;
+}
+
+// Socket notifications of the server (the message loop of the main window in the app)
+static void PumpMessages()
+{
+	MSG objMsg;
+	while (::PeekMessage(&objMsg, NULL, 0, 0, PM_REMOVE))
+		if (objMsg.message == WM_APP_TEST_SOCKET) g_objServer.OnSocketMessage(objMsg.wParam, objMsg.lParam);
+}
+
+static CTestClient ConnectClient(int iFormat, const std::string& strRequest, int iReceiveBufferSize = 0)
+{
+	CTestClient objClient;
+	objClient.hSocket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	objClient.iFormat = iFormat;
+	objClient.bClosed = false;
+
+	if (iReceiveBufferSize > 0) ::setsockopt(objClient.hSocket, SOL_SOCKET, SO_RCVBUF, (const char*) &iReceiveBufferSize, sizeof(iReceiveBufferSize));
+
+	sockaddr_in objAddr;
+	ZeroMemory(&objAddr, sizeof(objAddr));
+	objAddr.sin_family      = AF_INET;
+	objAddr.sin_port        = htons(g_wPort);
+	objAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	CHECK(::connect(objClient.hSocket, (const sockaddr*) &objAddr, sizeof(objAddr)) == 0);
+	CHECK(::send(objClient.hSocket, strRequest.data(), (int) strRequest.size(), 0) == (int) strRequest.size());
+	::fcntl(objClient.hSocket, F_SETFL, ::fcntl(objClient.hSocket, F_GETFL) | O_NONBLOCK);
+	return objClient;
+}
+
+static void ReadClient(CTestClient& objClient)
+{
+	char szBuffer[8192];
+
+	while (!objClient.bClosed)
+	{
+		int iRead = ::recv(objClient.hSocket, szBuffer, sizeof(szBuffer), 0);
+		if (iRead > 0) objClient.strReceived.append(szBuffer, iRead);
+		else
+		{
+			if (iRead == 0) objClient.bClosed = true;
+			break;
+		}
+	}
+}
+
+// Sequence numbers of the events received by the client, in order
+static std::vector<DWORD> GetSequences(const CTestClient& objClient)
+{
+	std::vector<DWORD> arrSequences;
+	const std::string& strData = objClient.strReceived;
+
+	if (objClient.iFormat != CBroadcastPacket::FORMAT_RECORD)
+	{
+		for (size_t iPos = strData.find("\"seq\":"); iPos != std::string::npos; iPos = strData.find("\"seq\":", iPos + 1))
+			arrSequences.push_back((DWORD) strtoul(strData.c_str() + iPos + 6, NULL, 10));
+		return arrSequences;
+	}
+
+	// Binary WebSocket frames after the handshake response
+	size_t iPos = strData.find("\r\n\r\n");
+	if (iPos == std::string::npos) return arrSequences;
+
+	for (iPos += 4; iPos + 2 <= strData.size(); )
+	{
+		BYTE   bLen = (BYTE) strData[iPos + 1] & 0x7F;
+		size_t iHeaderLen = (bLen == 126 ? 4 : 2);
+		size_t iPayloadLen = (bLen == 126 && iPos + 4 <= strData.size() ? (((BYTE) strData[iPos + 2] << 8) | (BYTE) strData[iPos + 3]) : bLen);
+
+		if (iPos + iHeaderLen + iPayloadLen > strData.size()) break;
+
+		CEventRecordView objRecord;
+		CHECK((BYTE) strData[iPos] == 0x82);
+		CHECK(objRecord.Attach(strData.data() + iPos + iHeaderLen, iPayloadLen));
+		if (objRecord.IsValid()) arrSequences.push_back(objRecord.GetHeader().dwSequence);
+
+		iPos += iHeaderLen + iPayloadLen;
+	}
+
+	return arrSequences;
+}
+
+static DWORD GetLastSequence(const CTestClient& objClient)
+{
+	std::vector<DWORD> arrSequences = GetSequences(objClient);
+	return (arrSequences.empty() ? (DWORD) -1 : arrSequences.back());
+}
+
+static void PublishTrack(size_t iTextLen)
+{
+	CTrackEvent objEvent;
+	WCHAR szTitle[CTrackEvent::MAX_FIELD_LEN];
+	BYTE  arrRecord[EVENTRECORD_MAX_SIZE];
+
+	g_dwSequence++;
+	_snwprintf_s(szTitle, _TRUNCATE, L"Title %u %s", (unsigned) g_dwSequence, std::wstring(iTextLen, L'x').c_str());
+	wcsncpy_s(objEvent.m_szStatus, L"1", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szTitle, szTitle, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szArtist, L"Artist \"Quoted\"", _TRUNCATE);
+
+	CEventRecordView objRecord;
+	objRecord.Attach(arrRecord, CEventRecord::Encode(objEvent, szTitle, g_dwSequence, 0, arrRecord));
+	g_objServer.Publish(objRecord);
+}
+
+// Pump the server and read the clients until every open client has the latest event (or 10 secs)
+static bool WaitForLatest(std::vector<CTestClient>& arrClients)
+{
+	DWORD dwStartMS = ::GetTickCount();
+
+	while (::GetTickCount() - dwStartMS < 10000)
+	{
+		bool bAllReceived = true;
+
+		PumpMessages();
+		for (size_t idx = 0; idx < arrClients.size(); idx++)
+		{
+			if (arrClients[idx].hSocket == INVALID_SOCKET) continue;
+
+			ReadClient(arrClients[idx]);
+			if (GetLastSequence(arrClients[idx]) != g_dwSequence) bAllReceived = false;
+		}
+
+		if (bAllReceived) return true;
+		::MsgWaitForMultipleObjects(0, NULL, FALSE, 1, QS_ALLINPUT);
+	}
+
+	return false;
+}
+
+static void CloseClients(std::vector<CTestClient>& arrClients)
+{
+	for (size_t idx = 0; idx < arrClients.size(); idx++)
+		if (arrClients[idx].hSocket != INVALID_SOCKET) ::closesocket(arrClients[idx].hSocket);
+	arrClients.clear();
+}
+
+// Many subscribers of every protocol get every event in order (or skip to a newer one), never a stale one
+static void TestFanOut()
+{
+	const char* szWebSocketRequest = "GET %s HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+	char szRequest[512];
+	std::vector<CTestClient> arrClients;
+
+	for (int idx = 0; idx < 200; idx++) arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_LINE, "\n"));
+	for (int idx = 0; idx < 20; idx++) arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_SSE, "GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+
+	_snprintf_s(szRequest, sizeof(szRequest), _TRUNCATE, szWebSocketRequest, "/");
+	for (int idx = 0; idx < 20; idx++) arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_WEBSOCKET, szRequest));
+
+	_snprintf_s(szRequest, sizeof(szRequest), _TRUNCATE, szWebSocketRequest, "/records");
+	for (int idx = 0; idx < 20; idx++) arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_RECORD, szRequest));
+
+	// Every subscriber gets the current state ("stopped" before the first event) at once
+	CHECK(WaitForLatest(arrClients));
+	CHECK(g_objServer.GetStats().dwClientCount == arrClients.size());
+
+	for (int iEvent = 0; iEvent < 100; iEvent++)
+	{
+		PublishTrack(20);
+		if (iEvent % 10 == 0) PumpMessages();
+	}
+	CHECK(WaitForLatest(arrClients));
+
+	for (size_t idx = 0; idx < arrClients.size(); idx++)
+	{
+		std::vector<DWORD> arrSequences = GetSequences(arrClients[idx]);
+		CHECK(arrSequences.size() >= 2 && arrSequences[0] == 0);
+
+		for (size_t iSeq = 1; iSeq < arrSequences.size(); iSeq++) CHECK(arrSequences[iSeq] > arrSequences[iSeq - 1]);
+	}
+
+	const std::string& strLine = arrClients[0].strReceived;
+	CHECK(strLine.find("{\"status\":\"playing\",\"title\":\"Title 100 x") != std::string::npos);
+	CHECK(strLine.find("\"artist\":\"Artist \\\"Quoted\\\"\"") != std::string::npos);
+	CHECK(arrClients[200].strReceived.find("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream") == 0);
+	CHECK(arrClients[200].strReceived.find("\n\ndata: {\"status\":\"playing\"") != std::string::npos);
+	CHECK(arrClients[220].strReceived.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+
+	// Half of the line clients disconnect. The rest keep receiving.
+	for (size_t idx = 0; idx < 100; idx++)
+	{
+		::closesocket(arrClients[idx].hSocket);
+		arrClients[idx].hSocket = INVALID_SOCKET;
+	}
+
+	PublishTrack(20);
+	CHECK(WaitForLatest(arrClients));
+	CHECK(g_objServer.GetStats().dwClientCount == arrClients.size() - 100);
+
+	CloseClients(arrClients);
+}
+
+static void TestSnapshot()
+{
+	std::vector<CTestClient> arrClients;
+	arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_JSON, "GET /nowplaying HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+	arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_JSON, "GET /missing HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+
+	// Server closes both connections after the response
+	DWORD dwStartMS = ::GetTickCount();
+	while ((!arrClients[0].bClosed || !arrClients[1].bClosed) && ::GetTickCount() - dwStartMS < 10000)
+	{
+		PumpMessages();
+		ReadClient(arrClients[0]);
+		ReadClient(arrClients[1]);
+		::MsgWaitForMultipleObjects(0, NULL, FALSE, 1, QS_ALLINPUT);
+	}
+
+	CHECK(arrClients[0].bClosed && arrClients[1].bClosed);
+	CHECK(arrClients[0].strReceived.find("HTTP/1.1 200 OK\r\nContent-Type: application/json") == 0);
+	CHECK(GetLastSequence(arrClients[0]) == g_dwSequence);
+	CHECK(arrClients[1].strReceived.find("HTTP/1.1 404 Not Found\r\n") == 0);
+
+	CloseClients(arrClients);
+}
+
+// Client which doesn't read holds at most two packets, the server drops the rest. Other clients are not
+// slowed down, and the stalled client gets the latest event once it reads again.
+static void TestStalledClient()
+{
+	std::vector<CTestClient> arrClients;
+	arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_LINE, "\n", 4096));
+	arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_LINE, "\n"));
+	CHECK(WaitForLatest(arrClients));
+
+	CTestClient objStalled = arrClients[0];
+	arrClients[0].hSocket = INVALID_SOCKET;
+
+	DWORD dwDroppedCount = g_objServer.GetStats().dwDroppedCount;
+
+	for (int iEvent = 0; iEvent < 20000; iEvent++)
+	{
+		PublishTrack(200);
+		if (iEvent % 50 == 0)
+		{
+			PumpMessages();
+			ReadClient(arrClients[1]);
+		}
+	}
+	CHECK(WaitForLatest(arrClients));
+	CHECK(g_objServer.GetStats().dwDroppedCount > dwDroppedCount);
+
+	arrClients[0] = objStalled;
+	CHECK(WaitForLatest(arrClients));
+	CHECK(GetSequences(arrClients[0]).size() < GetSequences(arrClients[1]).size());
+
+	CloseClients(arrClients);
+}
+
+//
+// Load test. A reader thread plays the subscribers: it waits for data on all client sockets (epoll)
+// and records the arrival time of the awaited event at each client. The main thread publishes one
+// event at a time and waits until every subscriber has it.
+//
+struct CLoadState
+{
+	std::vector<CTestClient>* pClients;
+	std::vector<std::string>  arrLines;		// Incomplete line of each client
+	std::vector<double>       arrLatencyUS;	// Publish to arrival, one sample per client and event
+	volatile LONG             lTargetSequence;
+	volatile LONG             lArrivedCount;	// Clients which have the target event
+	LARGE_INTEGER             liPublished;		// Timestamp of the target event
+	double                    dTicksPerUS;
+};
+
+static CLoadState g_objLoad;
+
+static unsigned __stdcall LoadReaderThread(void* pArg)
+{
+	CThreadContext* pCtx = (CThreadContext*) pArg;
+	std::vector<CTestClient>& arrClients = *g_objLoad.pClients;
+	int hEpoll = epoll_create1(0);
+
+	for (size_t idx = 0; idx < arrClients.size(); idx++)
+	{
+		struct epoll_event objEvent;
+		objEvent.events = EPOLLIN;
+		objEvent.data.u64 = idx;
+		epoll_ctl(hEpoll, EPOLL_CTL_ADD, arrClients[idx].hSocket, &objEvent);
+	}
+
+	struct epoll_event arrEvents[256];
+	char szBuffer[4096];
+
+	while (::WaitForSingleObject(pCtx->m_hStopEvent, 0) != WAIT_OBJECT_0)
+	{
+		int iReady = epoll_wait(hEpoll, arrEvents, 256, 10);
+
+		for (int iEvent = 0; iEvent < iReady; iEvent++)
+		{
+			size_t idx = (size_t) arrEvents[iEvent].data.u64;
+			int iRead;
+
+			while ((iRead = ::recv(arrClients[idx].hSocket, szBuffer, sizeof(szBuffer), 0)) > 0)
+			{
+				LARGE_INTEGER liNow;
+				::QueryPerformanceCounter(&liNow);
+
+				std::string& strLine = g_objLoad.arrLines[idx];
+				strLine.append(szBuffer, iRead);
+
+				for (size_t iEnd = strLine.find('\n'); iEnd != std::string::npos; iEnd = strLine.find('\n'))
+				{
+					size_t iPos = strLine.find("\"seq\":");
+					if (iPos < iEnd && (LONG) strtoul(strLine.c_str() + iPos + 6, NULL, 10) == g_objLoad.lTargetSequence)
+					{
+						g_objLoad.arrLatencyUS.push_back((double) (liNow.QuadPart - g_objLoad.liPublished.QuadPart) / g_objLoad.dTicksPerUS);
+						::InterlockedIncrement(&g_objLoad.lArrivedCount);
+					}
+					strLine.erase(0, iEnd + 1);
+				}
+			}
+		}
+	}
+
+	close(hEpoll);
+	return 0;
+}
+
+// Two sockets per subscriber (client and server end). Raises the soft fd limit if needed.
+static int GetLoadSubscriberCount(int iWanted)
+{
+	struct rlimit objLimit;
+	rlim_t iNeeded = 2 * (rlim_t) iWanted + 64;
+
+	if (getrlimit(RLIMIT_NOFILE, &objLimit) != 0) return iWanted;
+	if (objLimit.rlim_cur < iNeeded)
+	{
+		objLimit.rlim_cur = std::min(iNeeded, objLimit.rlim_max);
+		setrlimit(RLIMIT_NOFILE, &objLimit);
+		getrlimit(RLIMIT_NOFILE, &objLimit);
+	}
+	if (objLimit.rlim_cur >= iNeeded) return iWanted;
+
+	int iCount = (int) ((objLimit.rlim_cur - 64) / 2);
+	printf("Note: fd limit %u allows %d subscribers instead of %d\n", (unsigned) objLimit.rlim_cur, iCount, iWanted);
+	return iCount;
+}
+
+static double GetThreadCPUTimeUS()
+{
+	struct timespec objTime;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &objTime);
+	return (double) objTime.tv_sec * 1000000.0 + (double) objTime.tv_nsec / 1000.0;
+}
+
+static double Percentile(std::vector<double>& arrValues, double dPercent)
+{
+	if (arrValues.empty()) return 0.0;
+	size_t idx = std::min(arrValues.size() - 1, (size_t) (dPercent / 100.0 * arrValues.size()));
+	std::nth_element(arrValues.begin(), arrValues.begin() + idx, arrValues.end());
+	return arrValues[idx];
+}
+
+static void TestLoad(int iWantedSubscribers, int iEventCount, bool bReport)
+{
+	int iSubscribers = GetLoadSubscriberCount(iWantedSubscribers);
+	std::vector<CTestClient> arrClients;
+
+	// The accept queue is short, so the server accepts while the clients connect
+	for (int idx = 0; idx < iSubscribers; idx++)
+	{
+		arrClients.push_back(ConnectClient(CBroadcastPacket::FORMAT_LINE, "\n"));
+		if (idx % 32 == 31) PumpMessages();
+	}
+	CHECK(WaitForLatest(arrClients));
+	CHECK(g_objServer.GetStats().dwClientCount == (DWORD) iSubscribers);
+	if (g_iTestFailures > 0) { CloseClients(arrClients); return; }
+
+	LARGE_INTEGER liFrequency;
+	::QueryPerformanceFrequency(&liFrequency);
+
+	g_objLoad.pClients = &arrClients;
+	g_objLoad.arrLines.assign(arrClients.size(), std::string());
+	g_objLoad.arrLatencyUS.clear();
+	g_objLoad.arrLatencyUS.reserve((size_t) iSubscribers * iEventCount);
+	g_objLoad.dTicksPerUS = (double) liFrequency.QuadPart / 1000000.0;
+	g_objLoad.lTargetSequence = -1;
+
+	CThread objReader(LoadReaderThread);
+	CHECK(objReader.Start() == 0);
+
+	std::vector<double> arrCompleteUS;
+	double dPublishCPUUS = 0.0;
+	int iCompleted = 0;
+
+	for (int iEvent = 0; iEvent < iEventCount; iEvent++)
+	{
+		g_objLoad.lArrivedCount = 0;
+		::InterlockedExchange(&g_objLoad.lTargetSequence, (LONG) g_dwSequence + 1);
+		::QueryPerformanceCounter(&g_objLoad.liPublished);
+
+		double dCPUStartUS = GetThreadCPUTimeUS();
+		PublishTrack(40);
+		dPublishCPUUS += GetThreadCPUTimeUS() - dCPUStartUS;
+
+		// Sockets which were full get the rest of the event from FD_WRITE notifications
+		CBenchTimer objWaitTimer;
+		while (g_objLoad.lArrivedCount < iSubscribers && objWaitTimer.GetElapsedMS() < 10000)
+		{
+			PumpMessages();
+			::MsgWaitForMultipleObjects(0, NULL, FALSE, 1, QS_ALLINPUT);
+		}
+
+		LARGE_INTEGER liNow;
+		::QueryPerformanceCounter(&liNow);
+		if (g_objLoad.lArrivedCount == iSubscribers) iCompleted++;
+		arrCompleteUS.push_back((double) (liNow.QuadPart - g_objLoad.liPublished.QuadPart) / g_objLoad.dTicksPerUS);
+	}
+
+	objReader.Stop(false);
+	::WaitForSingleObject(objReader.GetHandle(), INFINITE);
+	objReader.Stop(true);
+
+	// Every subscriber got every event
+	CHECK(iCompleted == iEventCount);
+	CHECK(g_objLoad.arrLatencyUS.size() == (size_t) iSubscribers * iEventCount);
+	CHECK(g_objServer.GetStats().dwDroppedCount == 0 || bReport);
+
+	if (bReport)
+	{
+		printf("Fan-out: %d subscribers (line protocol), %d events, one event at a time\n", iSubscribers, iEventCount);
+		printf("  Latency to a subscriber   p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", Percentile(g_objLoad.arrLatencyUS, 50),
+			Percentile(g_objLoad.arrLatencyUS, 99), Percentile(g_objLoad.arrLatencyUS, 100));
+		printf("  All subscribers reached   p50 %8.1f us  p99 %8.1f us\n", Percentile(arrCompleteUS, 50), Percentile(arrCompleteUS, 99));
+		printf("  CPU of Publish            %8.1f us per event, %6.3f us per subscriber\n", dPublishCPUUS / iEventCount,
+			dPublishCPUUS / iEventCount / iSubscribers);
+	}
+
+	CloseClients(arrClients);
+}
+
+int main(int argc, char* argv[])
+{
+	CHECK(StartServer());
+
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0)
+	{
+		if (g_objServer.IsRunning()) TestLoad(1000, 1000, true);
+		g_objServer.Stop();
+		return (g_iTestFailures == 0 ? 0 : 1);
+	}
+
+	if (g_objServer.IsRunning())
+	{
+		TestFanOut();
+		TestLoad(1000, 50, false);
+		TestSnapshot();
+		TestStalledClient();
+
+		g_objServer.Stop();
+		CHECK(g_objServer.GetStats().dwClientCount == 0);
+	}
+
+	return TestResult("TestBroadcastServer");
+}
@@ -0,0 +1,404 @@
+//
+// Tests of the binary event records (EventRecord.h, CEventRecord.h): round trip of the texts,
+// truncation of non-ASCII texts, records of older and newer writers, corrupted records and the
+// record pool. "/bench" argument compares the record path of an event with the text path it
+// replaced: the startup queue (encode + decode vs a CTrackEvent copy) and the broadcast JSON
+// (from the UTF-8 record vs from the UTF-16 event texts) (make bench).
+//
+#include "stdafx.h"
+#include "CEventRecord.h"
+#include "CBroadcastServer.h"
+#include "TestUtil.h"
+
+static CTrackEvent MakeEvent(const WCHAR* szArtist, const WCHAR* szTitle)
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, L"1", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szArtist, szArtist, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szTitle, szTitle, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szAlbum, L"\x00C1g\x00E6tis byrjun", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szGenre, L"Post-rock", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szSource, L"foobar2000.exe", _TRUNCATE);
+	objEvent.m_dwDurationMS = 215000;
+	objEvent.m_wYear = 1999;
+	objEvent.m_wTrackNumber = 7;
+	return objEvent;
+}
+
+static void TestRoundTrip()
+{
+	// Latin-1, CJK and a surrogate pair (U+1F3B5)
+	CTrackEvent objEvent = MakeEvent(L"Sigur R\x00F3s", L"Sv\x00ED" L"f \x97F3\x697D \xD83C\xDFB5");
+	BYTE arrBuffer[EVENTRECORD_MAX_SIZE];
+
+	DWORD dwSize = CEventRecord::Encode(objEvent, L"Listening: Sigur R\x00F3s", 42, 123, arrBuffer);
+	CEventRecordView objView;
+	CHECK(objView.Attach(arrBuffer, dwSize));
+	CHECK(objView.GetRecordSize() == dwSize && objView.GetHeader().dwSequence == 42 && !objView.IsStopped());
+
+	size_t iLength = 0;
+	CHECK(strcmp(objView.GetText(EVENTRECORD_TEXT_ARTIST, &iLength), "Sigur R\xC3\xB3s") == 0 && iLength == 10);
+	CHECK(strcmp(objView.GetText(EVENTRECORD_TEXT_TITLE), "Sv\xC3\xAD" "f \xE9\x9F\xB3\xE6\xA5\xBD \xF0\x9F\x8E\xB5") == 0);
+	CHECK(strcmp(objView.GetText(EVENTRECORD_TEXT_COUNT), "") == 0);
+
+	CTrackEvent objDecoded;
+	CEventRecord::Decode(objView, objDecoded);
+	CHECK_TEXT(objDecoded.m_szTitle, objEvent.m_szTitle);
+	CHECK_TEXT(objDecoded.m_szArtist, objEvent.m_szArtist);
+	CHECK_TEXT(objDecoded.m_szAlbum, objEvent.m_szAlbum);
+	CHECK_TEXT(objDecoded.m_szSource, objEvent.m_szSource);
+	CHECK(objDecoded.m_dwDurationMS == 215000 && objDecoded.m_wYear == 1999 && objDecoded.m_wTrackNumber == 7 && !objDecoded.IsStopped());
+
+	// Stopped event
+	CTrackEvent objStopped;
+	wcsncpy_s(objStopped.m_szStatus, L"0", _TRUNCATE);
+	CHECK(objView.Attach(arrBuffer, CEventRecord::Encode(objStopped, L"", 43, 124, arrBuffer)) && objView.IsStopped());
+	CEventRecord::Decode(objView, objDecoded);
+	CHECK(objDecoded.IsStopped() && objDecoded.m_szTitle[0] == L'\0');
+}
+
+// Texts are truncated by UTF-16 chars, not by UTF-8 bytes, and a surrogate pair is never cut
+static void TestTruncation()
+{
+	BYTE arrBuffer[EVENTRECORD_MAX_SIZE];
+	CEventRecordView objView;
+	CTrackEvent objDecoded;
+
+	// 200 CJK chars are 600 UTF-8 bytes, but they fit in a 256 char field
+	std::wstring strTitle(200, L'\x97F3');
+	CHECK(objView.Attach(arrBuffer, CEventRecord::Encode(MakeEvent(L"A", strTitle.c_str()), L"", 1, 0, arrBuffer)));
+	CEventRecord::Decode(objView, objDecoded);
+	CHECK_TEXT(objDecoded.m_szTitle, strTitle);
+
+	// Surrogate pair as the last chars of the field
+	strTitle = std::wstring(CTrackEvent::MAX_FIELD_LEN - 3, L'a') + L"\xD83C\xDFB5";
+	CHECK(objView.Attach(arrBuffer, CEventRecord::Encode(MakeEvent(L"A", strTitle.c_str()), L"", 1, 0, arrBuffer)));
+	CEventRecord::Decode(objView, objDecoded);
+	CHECK_TEXT(objDecoded.m_szTitle, strTitle);
+
+	// One char more: the whole pair is dropped
+	WCHAR szBuffer[CTrackEvent::MAX_FIELD_LEN];
+	strTitle = std::wstring(CTrackEvent::MAX_FIELD_LEN - 2, L'a') + L"\xD83C\xDFB5";
+	CTrackEvent objEvent = MakeEvent(L"A", L"");
+	CHECK(objView.Attach(arrBuffer, CEventRecord::Encode(objEvent, strTitle.c_str(), 1, 0, arrBuffer)));
+	CHECK(objView.GetTextW(EVENTRECORD_TEXT_LISTENING, szBuffer, CTrackEvent::MAX_FIELD_LEN) == CTrackEvent::MAX_FIELD_LEN - 2);
+	CHECK_TEXT(szBuffer, strTitle.substr(0, CTrackEvent::MAX_FIELD_LEN - 2));
+
+	// Small buffers
+	CHECK(objView.GetTextW(EVENTRECORD_TEXT_ALBUM, szBuffer, 3) == 2);
+	CHECK_TEXT(szBuffer, L"\x00C1g");
+	CHECK(objView.GetTextW(EVENTRECORD_TEXT_ALBUM, szBuffer, 1) == 0 && szBuffer[0] == L'\0');
+	CHECK(objView.GetTextW(EVENTRECORD_TEXT_TITLE, szBuffer, 10) == 0 && szBuffer[0] == L'\0');
+
+	// Too long texts are cut at a char boundary to keep the record within EVENTRECORD_MAX_SIZE
+	std::wstring strLong(3000, L'\x00E9');
+	DWORD dwSize = CEventRecord::Encode(objEvent, strLong.c_str(), 1, 0, arrBuffer);
+	CHECK(dwSize <= EVENTRECORD_MAX_SIZE && objView.Attach(arrBuffer, dwSize));
+
+	size_t iLength = 0;
+	objView.GetText(EVENTRECORD_TEXT_LISTENING, &iLength);
+	CHECK(iLength % 2 == 0 && iLength > 3000);
+}
+
+// Records of a newer writer (bigger header, more texts) and of an older writer (fewer texts)
+static void TestSchemaEvolution()
+{
+	BYTE arrBuffer[EVENTRECORD_MAX_SIZE];
+	DWORD dwSize = CEventRecord::Encode(MakeEvent(L"Artist", L"Bl\x00E5"), L"Listening", 5, 0, arrBuffer);
+	CEventRecordView objView;
+	CHECK(objView.Attach(arrBuffer, dwSize));
+
+	BYTE arrNewer[EVENTRECORD_MAX_SIZE];
+	ZeroMemory(arrNewer, sizeof(arrNewer));
+	memcpy(arrNewer, arrBuffer, EVENTRECORD_MIN_HEADER_SIZE);
+
+	CEventRecordHeader* pHeader = (CEventRecordHeader*) arrNewer;
+	pHeader->wHeaderSize = EVENTRECORD_MIN_HEADER_SIZE + 8;
+	pHeader->wFieldCount = EVENTRECORD_TEXT_COUNT + 2;
+
+	CEventRecordField* pFields = (CEventRecordField*) (arrNewer + pHeader->wHeaderSize);
+	DWORD dwPos = pHeader->wHeaderSize + pHeader->wFieldCount * sizeof(CEventRecordField);
+
+	for (int idx = 0; idx < pHeader->wFieldCount; idx++)
+	{
+		size_t iLength = 6;
+		const char* szText = (idx < EVENTRECORD_TEXT_COUNT ? objView.GetText(idx, &iLength) : "future");
+
+		pFields[idx].wOffset = (WORD) dwPos;
+		pFields[idx].wLength = (WORD) iLength;
+		memcpy(arrNewer + dwPos, szText, iLength + 1);
+		dwPos += (DWORD) iLength + 1;
+	}
+	pHeader->dwRecordSize = dwPos;
+
+	CEventRecordView objNewer;
+	CHECK(objNewer.Attach(arrNewer, dwPos));
+	CHECK(strcmp(objNewer.GetText(EVENTRECORD_TEXT_LISTENING), "Listening") == 0);
+	CHECK(strcmp(objNewer.GetText(EVENTRECORD_TEXT_COUNT + 1), "future") == 0);
+
+	CTrackEvent objDecoded;
+	CEventRecord::Decode(objNewer, objDecoded);
+	CHECK_TEXT(objDecoded.m_szTitle, L"Bl\x00E5");
+	CHECK(objDecoded.m_dwDurationMS == 215000);
+
+	// Older writer knew only title, artist and album
+	((CEventRecordHeader*) arrBuffer)->wFieldCount = 3;
+	CEventRecordView objOlder;
+	CHECK(objOlder.Attach(arrBuffer, dwSize));
+	CEventRecord::Decode(objOlder, objDecoded);
+	CHECK_TEXT(objDecoded.m_szArtist, L"Artist");
+	CHECK_TEXT(objDecoded.m_szAlbum, L"\x00C1g\x00E6tis byrjun");
+	CHECK(objDecoded.m_szGenre[0] == L'\0' && objDecoded.m_szSource[0] == L'\0');
+	CHECK(strcmp(objOlder.GetText(EVENTRECORD_TEXT_LISTENING), "") == 0);
+}
+
+static void TestCorruptRecords()
+{
+	BYTE arrRecord[EVENTRECORD_MAX_SIZE];
+	BYTE arrBuffer[EVENTRECORD_MAX_SIZE];
+	DWORD dwSize = CEventRecord::Encode(MakeEvent(L"Artist", L"Title"), L"Listening", 1, 0, arrRecord);
+	CEventRecordView objView;
+
+	CEventRecordHeader* pHeader = (CEventRecordHeader*) arrBuffer;
+	CEventRecordField*  pFields = (CEventRecordField*) (arrBuffer + EVENTRECORD_MIN_HEADER_SIZE);
+
+	memcpy(arrBuffer, arrRecord, dwSize); pFields[2].wOffset = (WORD) dwSize;   CHECK(!objView.Attach(arrBuffer, dwSize));
+	memcpy(arrBuffer, arrRecord, dwSize); pFields[2].wLength++;                 CHECK(!objView.Attach(arrBuffer, dwSize));
+	memcpy(arrBuffer, arrRecord, dwSize); pHeader->wFieldCount = 2000;          CHECK(!objView.Attach(arrBuffer, dwSize));
+	memcpy(arrBuffer, arrRecord, dwSize); pHeader->wVersion++;                  CHECK(!objView.Attach(arrBuffer, dwSize));
+	memcpy(arrBuffer, arrRecord, dwSize); pHeader->wHeaderSize = 0xFFFC;        CHECK(!objView.Attach(arrBuffer, dwSize));
+	memcpy(arrBuffer, arrRecord, dwSize); pHeader->wHeaderSize = 42;            CHECK(!objView.Attach(arrBuffer, dwSize));
+
+	CHECK(!objView.Attach(arrRecord, dwSize - 1) && !objView.IsValid());
+	CHECK(!objView.Attach(arrRecord, EVENTRECORD_MIN_HEADER_SIZE - 1));
+	CHECK(!objView.Attach(NULL, 0));
+	CHECK(objView.Attach(arrRecord, dwSize));
+
+	// Random damage of the header and the field table: a valid view has every text inside the record
+	DWORD dwRandom = 1;
+	for (int iRound = 0; iRound < 100000; iRound++)
+	{
+		memcpy(arrBuffer, arrRecord, dwSize);
+		for (int idx = 0; idx < 3; idx++)
+		{
+			dwRandom = dwRandom * 1103515245 + 12345;
+			arrBuffer[(dwRandom >> 8) % (EVENTRECORD_MIN_HEADER_SIZE + EVENTRECORD_TEXT_COUNT * sizeof(CEventRecordField))] ^= (BYTE) (1 + (dwRandom >> 20) % 255);
+		}
+
+		if (!objView.Attach(arrBuffer, dwSize)) continue;
+
+		for (int iText = 0; iText < objView.GetHeader().wFieldCount; iText++)
+		{
+			size_t iLength = 0;
+			const BYTE* pText = (const BYTE*) objView.GetText(iText, &iLength);
+			CHECK(pText >= arrBuffer && pText + iLength < arrBuffer + dwSize && pText[iLength] == 0);
+		}
+	}
+}
+
+static void TestPool()
+{
+	CEventRecordPool objPool;
+	CTrackEvent objEvent = MakeEvent(L"Artist", L"Title");
+
+	CEventRecord* pFirst = objPool.Encode(objEvent, L"Listening");
+	CEventRecord* pSecond = objPool.Encode(objEvent, L"Listening");
+	CHECK(pFirst->GetView().GetHeader().dwSequence + 1 == pSecond->GetView().GetHeader().dwSequence);
+	CHECK(pFirst->GetView().GetHeader().ullEventTime != 0);
+
+	// Released record is reused for the next event
+	pFirst->AddRef();
+	pFirst->Release();
+	pFirst->Release();
+	CEventRecord* pThird = objPool.Encode(objEvent, L"Other");
+	CHECK(pThird == pFirst && strcmp(pThird->GetView().GetText(EVENTRECORD_TEXT_LISTENING), "Other") == 0);
+
+	// Records are allocated to the size of the event, not to EVENTRECORD_MAX_SIZE
+	CHECK(pThird->GetCapacity() == CEventRecordPool::RECORD_SIZE_GRANULE && pThird->GetSize() <= pThird->GetCapacity());
+
+	// A free record too small for the event is skipped, the smallest one which fits is reused
+	std::wstring strLong(1000, L'x');
+	pThird->Release();
+	CEventRecord* pLong = objPool.Encode(objEvent, strLong.c_str());
+	CHECK(pLong != pThird && pLong->GetCapacity() >= pLong->GetSize() && pLong->GetSize() > 1000);
+	CHECK(pLong->GetCapacity() < pLong->GetSize() + CEventRecordPool::RECORD_SIZE_GRANULE);
+	CHECK(strlen(pLong->GetView().GetText(EVENTRECORD_TEXT_LISTENING)) == 1000);
+
+	pLong->Release();
+	pSecond->Release();
+	CEventRecord* pSmall = objPool.Encode(objEvent, L"Listening");
+	CEventRecord* pReused = objPool.Encode(objEvent, L"Listening");
+	CHECK(pSmall == pSecond && pReused == pThird);
+
+	CEventRecord* pBig = objPool.Encode(objEvent, strLong.c_str());
+	CHECK(pBig == pLong && pBig->GetView().IsValid());
+
+	pSmall->Release();
+	pReused->Release();
+	pBig->Release();
+}
+
+// Broadcast server with access to its JSON serializer
+class CJsonServer : public CBroadcastServer
+{
+  public:
+	using CBroadcastServer::MakeJson;
+};
+
+// JSON of the event as the broadcast server built it before the event records (UTF-16 texts of the event)
+static void AppendJsonString(std::string& strJson, const WCHAR* szText)
+{
+	strJson += '"';
+
+	for (; *szText != L'\0'; szText++)
+	{
+		DWORD ch = *szText;
+
+		if (ch >= 0xD800 && ch <= 0xDBFF && szText[1] >= 0xDC00 && szText[1] <= 0xDFFF)
+		{
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (szText[1] - 0xDC00);
+			szText++;
+		}
+		else if (ch >= 0xD800 && ch <= 0xDFFF) ch = 0xFFFD;
+
+		if (ch == '"' || ch == '\\')
+		{
+			strJson += '\\';
+			strJson += (char) ch;
+		}
+		else if (ch < 0x20)
+		{
+			char szEscape[8];
+			_snprintf_s(szEscape, sizeof(szEscape), _TRUNCATE, "\\u%04x", (unsigned) ch);
+			strJson += szEscape;
+		}
+		else if (ch < 0x80) strJson += (char) ch;
+		else if (ch < 0x800)
+		{
+			strJson += (char) (0xC0 | (ch >> 6));
+			strJson += (char) (0x80 | (ch & 0x3F));
+		}
+		else if (ch < 0x10000)
+		{
+			strJson += (char) (0xE0 | (ch >> 12));
+			strJson += (char) (0x80 | ((ch >> 6) & 0x3F));
+			strJson += (char) (0x80 | (ch & 0x3F));
+		}
+		else
+		{
+			strJson += (char) (0xF0 | (ch >> 18));
+			strJson += (char) (0x80 | ((ch >> 12) & 0x3F));
+			strJson += (char) (0x80 | ((ch >> 6) & 0x3F));
+			strJson += (char) (0x80 | (ch & 0x3F));
+		}
+	}
+
+	strJson += '"';
+}
+
+static std::string MakeTextJson(const CTrackEvent& objEvent, const WCHAR* szText, DWORD dwSequence)
+{
+	char szNumbers[120];
+	std::string strJson;
+
+	strJson.reserve(256);
+	strJson.append("{\"status\":").append(objEvent.IsStopped() ? "\"stopped\"" : "\"playing\"");
+	strJson.append(",\"title\":");  AppendJsonString(strJson, objEvent.m_szTitle);
+	strJson.append(",\"artist\":"); AppendJsonString(strJson, objEvent.m_szArtist);
+	strJson.append(",\"album\":");  AppendJsonString(strJson, objEvent.m_szAlbum);
+	strJson.append(",\"genre\":");  AppendJsonString(strJson, objEvent.m_szGenre);
+	strJson.append(",\"text\":");   AppendJsonString(strJson, szText);
+
+	_snprintf_s(szNumbers, sizeof(szNumbers), _TRUNCATE, ",\"year\":%u,\"track\":%u,\"durationMs\":%lu,\"seq\":%lu}",
+		(unsigned) objEvent.m_wYear, (unsigned) objEvent.m_wTrackNumber, (unsigned long) objEvent.m_dwDurationMS, (unsigned long) dwSequence);
+	strJson.append(szNumbers);
+
+	return strJson;
+}
+
+static void RunBenchmark()
+{
+	const unsigned iEventCount = 1000000;
+	const WCHAR* szText = L"Listening: Sigur R\x00F3s - Sv\x00EDef\x00E9 (\x00C1g\x00E6tis byrjun)";
+	CTrackEvent arrEvents[4] = { MakeEvent(L"Sigur R\x00F3s", L"Sv\x00EDef\x00E9"), MakeEvent(L"Artist", L"Title"),
+		MakeEvent(L"Some Artist Name", L"A Somewhat Longer Song Title (Live)"), MakeEvent(L"\x5742\x672C\x771F\x7DBE", L"\x30C8\x30EA\x30CB\x30C6\x30A3") };
+	CEventRecordPool objPool;
+	size_t iChecksum = 0;
+
+	// Startup queue: the event is queued and taken out once
+	CTrackEvent objQueued, objTaken;
+	CBenchTimer objCopyTimer;
+	for (unsigned idx = 0; idx < iEventCount; idx++)
+	{
+		objQueued = arrEvents[idx % 4];
+		objTaken = objQueued;
+		iChecksum += objTaken.m_szTitle[0];
+	}
+	double dCopyMS = objCopyTimer.GetElapsedMS();
+
+	DWORD dwRecordBytes = 0;
+	CBenchTimer objDecodeTimer;
+	for (unsigned idx = 0; idx < iEventCount; idx++)
+	{
+		CEventRecord* pRecord = objPool.Encode(arrEvents[idx % 4], L"");
+		CEventRecord::Decode(pRecord->GetView(), objTaken);
+		iChecksum += objTaken.m_szTitle[0];
+		if (idx < 4) dwRecordBytes += pRecord->GetCapacity();
+		pRecord->Release();
+	}
+	double dDecodeMS = objDecodeTimer.GetElapsedMS();
+
+	// Broadcast JSON: the record path includes the encoding, which the other sinks share
+	CBenchTimer objTextJsonTimer;
+	for (unsigned idx = 0; idx < iEventCount; idx++)
+		iChecksum += MakeTextJson(arrEvents[idx % 4], szText, idx).size();
+	double dTextJsonMS = objTextJsonTimer.GetElapsedMS();
+
+	CBenchTimer objEncodeTimer;
+	for (unsigned idx = 0; idx < iEventCount; idx++)
+	{
+		CEventRecord* pRecord = objPool.Encode(arrEvents[idx % 4], szText);
+		iChecksum += pRecord->GetSize();
+		pRecord->Release();
+	}
+	double dEncodeMS = objEncodeTimer.GetElapsedMS();
+
+	CBenchTimer objRecordJsonTimer;
+	for (unsigned idx = 0; idx < iEventCount; idx++)
+	{
+		CEventRecord* pRecord = objPool.Encode(arrEvents[idx % 4], szText);
+		iChecksum += CJsonServer::MakeJson(pRecord->GetView()).size();
+		pRecord->Release();
+	}
+	double dRecordJsonMS = objRecordJsonTimer.GetElapsedMS();
+
+	// Same JSON from both paths (apart from the sequence number)
+	CEventRecord* pRecord = objPool.Encode(arrEvents[0], szText);
+	CHECK(CJsonServer::MakeJson(pRecord->GetView()) == MakeTextJson(arrEvents[0], szText, pRecord->GetView().GetHeader().dwSequence));
+	pRecord->Release();
+	CHECK(iChecksum != 0);
+
+	printf("Startup queue, per event          ns    bytes queued\n");
+	printf("  CTrackEvent copy in and out  %6.0f  %6u\n", 1000000.0 * dCopyMS / iEventCount, (unsigned) sizeof(CTrackEvent));
+	printf("  Record encode and decode     %6.0f  %6u\n", 1000000.0 * dDecodeMS / iEventCount, (unsigned) (dwRecordBytes / 4));
+	printf("  (CTrackEvent texts are WCHAR, %u bytes here and 2 bytes on Windows)\n", (unsigned) sizeof(WCHAR));
+	printf("Broadcast JSON, per event         ns\n");
+	printf("  From the event texts         %6.0f\n", 1000000.0 * dTextJsonMS / iEventCount);
+	printf("  Record encode                %6.0f\n", 1000000.0 * dEncodeMS / iEventCount);
+	printf("  Record encode and JSON       %6.0f\n", 1000000.0 * dRecordJsonMS / iEventCount);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0) RunBenchmark();
+	else
+	{
+		TestRoundTrip();
+		TestTruncation();
+		TestSchemaEvolution();
+		TestCorruptRecords();
+		TestPool();
+	}
+
+	return TestResult("TestEventRecord");
+}
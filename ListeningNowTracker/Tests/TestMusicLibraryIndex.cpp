@@ -0,0 +1,260 @@
+//
+// Tests of CMusicLibraryIndex: scan, incremental rescan, lookups and index file validation.
+// "/bench" argument runs the 100k file scan and lookup benchmark instead (make bench).
+//
+#include "stdafx.h"
+#include "CMusicLibraryIndex.h"
+#include "TestUtil.h"
+
+#include <ftw.h>
+
+// ID3v2.3 text frame (UTF-8 text)
+static void AppendFrame(std::string& strTag, const char* szID, const std::string& strText)
+{
+	DWORD dwSize = (DWORD) strText.size() + 1;
+	BYTE arrHeader[10] = { (BYTE) szID[0], (BYTE) szID[1], (BYTE) szID[2], (BYTE) szID[3],
+		(BYTE) (dwSize >> 24), (BYTE) (dwSize >> 16), (BYTE) (dwSize >> 8), (BYTE) dwSize, 0, 0 };
+
+	strTag.append((const char*) arrHeader, sizeof(arrHeader));
+	strTag.append(1, '\x03').append(strText);
+}
+
+static std::string FormatText(const char* szFormat, unsigned iValue)
+{
+	char szText[64];
+	snprintf(szText, sizeof(szText), szFormat, iValue);
+	return std::string(szText);
+}
+
+// Tagged MP3 file of track number iTrack (tag only, no audio frames)
+static void WriteTrackFile(const std::wstring& strFileName, unsigned iTrack, const char* szTitleSuffix = "")
+{
+	static const char* arrGenres[] = { "Rock", "Jazz", "(17)", "Ambient" };
+	std::string strFrames;
+
+	AppendFrame(strFrames, "TIT2", FormatText("Title %u", iTrack) + szTitleSuffix);
+	AppendFrame(strFrames, "TPE1", FormatText("Artist %u", iTrack % 30));
+	AppendFrame(strFrames, "TCON", arrGenres[iTrack % 4]);
+	AppendFrame(strFrames, "TYER", FormatText("%u", 1990 + iTrack % 20));
+	AppendFrame(strFrames, "TRCK", FormatText("%u", iTrack % 12 + 1));
+	AppendFrame(strFrames, "TLEN", FormatText("%u", 1000 * (100 + iTrack % 300)));
+
+	DWORD dwSize = (DWORD) strFrames.size();
+	BYTE arrHeader[10] = { 'I', 'D', '3', 3, 0, 0, (BYTE) ((dwSize >> 21) & 0x7F), (BYTE) ((dwSize >> 14) & 0x7F), (BYTE) ((dwSize >> 7) & 0x7F), (BYTE) (dwSize & 0x7F) };
+
+	std::string strFile((const char*) arrHeader, sizeof(arrHeader));
+	strFile.append(strFrames);
+
+	HANDLE hFile = ::CreateFile(strFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD dwWritten = 0;
+	CHECK(hFile != INVALID_HANDLE_VALUE && ::WriteFile(hFile, strFile.data(), (DWORD) strFile.size(), &dwWritten, NULL));
+	::CloseHandle(hFile);
+}
+
+static std::wstring TrackFileName(const std::wstring& strFolder, unsigned iTrack, unsigned iTracksPerFolder)
+{
+	WCHAR szName[64];
+	_snwprintf_s(szName, _TRUNCATE, L"\\Album %u\\Track %u.mp3", iTrack / iTracksPerFolder, iTrack);
+	return strFolder + szName;
+}
+
+static void CreateLibrary(const std::wstring& strFolder, unsigned iTrackCount, unsigned iTracksPerFolder)
+{
+	::CreateDirectory(strFolder.c_str(), NULL);
+
+	for (unsigned iTrack = 0; iTrack < iTrackCount; iTrack++)
+	{
+		if (iTrack % iTracksPerFolder == 0)
+			::CreateDirectory(TrackFileName(strFolder, iTrack, iTracksPerFolder).substr(0, TrackFileName(strFolder, iTrack, iTracksPerFolder).rfind(L'\\')).c_str(), NULL);
+
+		WriteTrackFile(TrackFileName(strFolder, iTrack, iTracksPerFolder), iTrack);
+	}
+}
+
+static int RemoveEntry(const char* szPath, const struct stat*, int, struct FTW*)
+{
+	return remove(szPath);
+}
+
+static void RemoveLibrary(const std::wstring& strFolder)
+{
+	std::string strPath;
+	for (size_t idx = 0; idx < strFolder.size(); idx++) strPath += (char) strFolder[idx];
+	nftw(strPath.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static CTrackEvent MakeEvent(const WCHAR* szArtist, const WCHAR* szTitle)
+{
+	CTrackEvent objEvent;
+	wcscpy_s(objEvent.m_szArtist, szArtist);
+	wcscpy_s(objEvent.m_szTitle, szTitle);
+	return objEvent;
+}
+
+static void WriteIndexFile(const std::wstring& strFileName, const DWORD* pHeader, size_t iExtraBytes)
+{
+	std::string strFile((const char*) pHeader, 5 * sizeof(DWORD));
+	strFile.append(iExtraBytes, '\0');
+
+	HANDLE hFile = ::CreateFile(strFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD dwWritten = 0;
+	::WriteFile(hFile, strFile.data(), (DWORD) strFile.size(), &dwWritten, NULL);
+	::CloseHandle(hFile);
+}
+
+static void TestIndex()
+{
+	std::wstring strFolder = GetTestFileName(L"library");
+	std::wstring strIndexFile = GetTestFileName(L"library.index");
+	std::vector<std::wstring> arrFolders(1, strFolder);
+	CMusicLibraryIndex::CScanStats objStats;
+
+	CreateLibrary(strFolder, 300, 100);
+	WriteTrackFile(strFolder + L"\\cover.jpg", 1);
+
+	HANDLE hFile = ::CreateFile((strFolder + L"\\No tags.mp3").c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD dwWritten = 0;
+	::WriteFile(hFile, "not a tag", 9, &dwWritten, NULL);
+	::CloseHandle(hFile);
+
+	CMusicLibraryIndex objIndex;
+	CHECK(objIndex.Rebuild(arrFolders, 4, strIndexFile, NULL, objStats));
+	CHECK(objStats.dwFileCount == 301);
+	CHECK(objStats.dwParsedCount == 301);
+	CHECK(objStats.dwIndexBytes > 301 * sizeof(CMusicLibraryIndex::CRecord));
+
+	// Lookup ignores case, spaces and punctuation
+	CTrackEvent objEvent = MakeEvent(L"ARTIST 5", L"title-35!");
+	CHECK(objIndex.Enrich(objEvent));
+	CHECK(objEvent.m_dwDurationMS == 135000);
+	CHECK(objEvent.m_wYear == 2005);
+	CHECK(objEvent.m_wTrackNumber == 12);
+	CHECK_TEXT(objEvent.m_szGenre, L"Ambient");
+
+	// Old style genre number
+	objEvent = MakeEvent(L"Artist 8", L"Title 38");
+	CHECK(objIndex.Enrich(objEvent));
+	CHECK_TEXT(objEvent.m_szGenre, L"Rock");
+
+	objEvent = MakeEvent(L"Artist 6", L"Title 35");
+	CHECK(!objIndex.Enrich(objEvent));
+	CHECK(objEvent.m_dwDurationMS == 0);
+
+	objEvent = MakeEvent(L"Artist 5", L"");
+	CHECK(!objIndex.Enrich(objEvent));
+
+	// Incremental rescan reads only the modified file
+	CHECK(objIndex.Rebuild(arrFolders, 2, strIndexFile, NULL, objStats));
+	CHECK(objStats.dwParsedCount == 0);
+
+	::Sleep(10);
+	WriteTrackFile(TrackFileName(strFolder, 35, 100), 35, " (Remix)");
+	CHECK(objIndex.Rebuild(arrFolders, 2, strIndexFile, NULL, objStats));
+	CHECK(objStats.dwParsedCount == 1);
+
+	objEvent = MakeEvent(L"Artist 5", L"Title 35 (Remix)");
+	CHECK(objIndex.Enrich(objEvent));
+
+	// Saved index is loaded as such
+	CMusicLibraryIndex objLoaded;
+	CHECK(objLoaded.Load(strIndexFile));
+	objEvent = MakeEvent(L"Artist 20", L"Title 200");
+	CHECK(objLoaded.Enrich(objEvent) && objEvent.m_dwDurationMS == 300000);
+
+	// Cancelled scan keeps the current index
+	HANDLE hStopEvent = ::CreateEvent(NULL, TRUE, TRUE, NULL);
+	CHECK(!objLoaded.Rebuild(arrFolders, 2, strIndexFile, hStopEvent, objStats));
+	CHECK(objLoaded.Enrich(objEvent));
+	::CloseHandle(hStopEvent);
+
+	RemoveLibrary(strFolder);
+
+	// Record count of the header must match the file size. Huge counts must not overflow the size check.
+	DWORD arrHeader[5] = { 0x5849544C, 1, sizeof(CMusicLibraryIndex::CRecord), 2, 0 };
+	WriteIndexFile(strIndexFile, arrHeader, 2 * sizeof(CMusicLibraryIndex::CRecord));
+	CHECK(objLoaded.Load(strIndexFile));
+
+	WriteIndexFile(strIndexFile, arrHeader, 2 * sizeof(CMusicLibraryIndex::CRecord) - 1);
+	CHECK(!objLoaded.Load(strIndexFile));
+
+	for (DWORD dwCount = 0x80000000; dwCount != 0; dwCount = dwCount / 3 * 2)
+	{
+		arrHeader[3] = dwCount;
+		WriteIndexFile(strIndexFile, arrHeader, 2 * sizeof(CMusicLibraryIndex::CRecord));
+		if (dwCount != 2) CHECK(!objLoaded.Load(strIndexFile));
+	}
+
+	arrHeader[3] = 0xFFFFFFFF;
+	WriteIndexFile(strIndexFile, arrHeader, 0);
+	CHECK(!objLoaded.Load(strIndexFile));
+
+	arrHeader[3] = 0;
+	arrHeader[4] = 0xFFFFFFFF;
+	WriteIndexFile(strIndexFile, arrHeader, 64);
+	CHECK(!objLoaded.Load(strIndexFile));
+
+	::DeleteFile(strIndexFile.c_str());
+}
+
+// 100k files in 100 folders: cold scan, incremental rescan, index load and lookups
+static void RunBenchmark()
+{
+	const unsigned iTrackCount = 100000;
+	std::wstring strFolder = GetTestFileName(L"library-bench");
+	std::wstring strIndexFile = GetTestFileName(L"library-bench.index");
+	std::vector<std::wstring> arrFolders(1, strFolder);
+	CMusicLibraryIndex::CScanStats objStats;
+	SYSTEM_INFO objSystemInfo;
+
+	::GetSystemInfo(&objSystemInfo);
+	int iThreadCount = (int) objSystemInfo.dwNumberOfProcessors;
+
+	CreateLibrary(strFolder, iTrackCount, 1000);
+
+	CMusicLibraryIndex objIndex;
+	CBenchTimer objColdTimer;
+	CHECK(objIndex.Rebuild(arrFolders, iThreadCount, strIndexFile, NULL, objStats));
+	double dColdMS = objColdTimer.GetElapsedMS();
+	printf("Cold scan:        %6u files, %u threads, %8.1f ms, %9.0f files/sec\n", objStats.dwFileCount, iThreadCount, dColdMS, 1000.0 * objStats.dwFileCount / dColdMS);
+
+	CBenchTimer objRescanTimer;
+	CHECK(objIndex.Rebuild(arrFolders, iThreadCount, strIndexFile, NULL, objStats));
+	double dRescanMS = objRescanTimer.GetElapsedMS();
+	printf("Incremental scan: %6u files, %u parsed,  %8.1f ms, %9.0f files/sec\n", objStats.dwFileCount, objStats.dwParsedCount, dRescanMS, 1000.0 * objStats.dwFileCount / dRescanMS);
+
+	CMusicLibraryIndex objLoaded;
+	CBenchTimer objLoadTimer;
+	CHECK(objLoaded.Load(strIndexFile));
+	printf("Index load:       %6u KB (%u bytes per file), %8.1f ms\n", objStats.dwIndexBytes / 1024, objStats.dwIndexBytes / objStats.dwFileCount, objLoadTimer.GetElapsedMS());
+
+	// Lookups of found and missing tracks (each lookup hashes the texts and probes the table)
+	const unsigned iLookupCount = 1000000;
+	std::vector<CTrackEvent> arrEvents;
+	for (unsigned idx = 0; idx < 1000; idx++)
+	{
+		WCHAR szArtist[32], szTitle[32];
+		_snwprintf_s(szArtist, _TRUNCATE, L"Artist %u", (idx * 97) % 30);
+		_snwprintf_s(szTitle, _TRUNCATE, L"Title %u", (idx % 2 == 0 ? (idx * 97) : iTrackCount + idx));
+		arrEvents.push_back(MakeEvent(szArtist, szTitle));
+	}
+
+	unsigned iFound = 0;
+	CBenchTimer objLookupTimer;
+	for (unsigned idx = 0; idx < iLookupCount; idx++)
+		if (objLoaded.Enrich(arrEvents[idx % arrEvents.size()])) iFound++;
+	double dLookupMS = objLookupTimer.GetElapsedMS();
+
+	printf("Lookups:          %6u found of %u, %6.0f ns per lookup\n", iFound, iLookupCount, 1000000.0 * dLookupMS / iLookupCount);
+	CHECK(iFound == iLookupCount / 2);
+
+	RemoveLibrary(strFolder);
+	::DeleteFile(strIndexFile.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0) RunBenchmark();
+	else TestIndex();
+
+	return TestResult("TestMusicLibraryIndex");
+}
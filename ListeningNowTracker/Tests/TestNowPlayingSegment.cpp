@@ -0,0 +1,289 @@
+//
+// Tests of CNowPlayingSegment and CNowPlayingReader: existing sections of another size or version,
+// and a reader process which never sees a torn snapshot while another process publishes. "/bench"
+// argument reports the cost of a read and the retry rate with a writer process publishing at
+// different rates (make bench).
+//
+#include "stdafx.h"
+#include "CNowPlayingSegment.h"
+#include "TestUtil.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+static CTrackEvent MakeEvent(unsigned iTrack)
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, L"1", _TRUNCATE);
+	_snwprintf_s(objEvent.m_szTitle, _TRUNCATE, L"Title %u", iTrack);
+	_snwprintf_s(objEvent.m_szArtist, _TRUNCATE, L"Artist %u", iTrack);
+	_snwprintf_s(objEvent.m_szAlbum, _TRUNCATE, L"Album %u %s", iTrack, std::wstring(iTrack % 200, L'x').c_str());
+	objEvent.m_dwDurationMS = iTrack;
+	return objEvent;
+}
+
+static void Publish(CNowPlayingSegment& objSegment, unsigned iTrack)
+{
+	CTrackEvent objEvent = MakeEvent(iTrack);
+	WCHAR szText[64];
+	_snwprintf_s(szText, _TRUNCATE, L"Text %u", iTrack);
+
+	static CEventRecordPool objPool;
+	CEventRecord* pRecord = objPool.Encode(objEvent, szText);
+	objSegment.Publish(objEvent, szText, pRecord);
+	pRecord->Release();
+}
+
+static void TestPublish(const std::wstring& strName)
+{
+	CNowPlayingSegment objSegment;
+	CHECK(objSegment.Open(strName.c_str()));
+
+	CNowPlayingReader objReader;
+	CNowPlayingSnapshot objSnapshot;
+	LONG lSequence = 0;
+
+	CHECK(objReader.Open(strName.c_str()));
+	CHECK(objReader.GetWriterProcessID() == ::GetCurrentProcessId());
+	CHECK(objReader.Read(objSnapshot, &lSequence) && objSnapshot.dwStatus == NOWPLAYING_STATUS_STOPPED);
+	CHECK(!objReader.HasChanged(lSequence));
+
+	Publish(objSegment, 7);
+	CHECK(objReader.HasChanged(lSequence));
+	CHECK(objReader.Read(objSnapshot, &lSequence) && objSnapshot.dwStatus == NOWPLAYING_STATUS_PLAYING);
+	CHECK_TEXT(objSnapshot.szTitle, L"Title 7");
+	CHECK_TEXT(objSnapshot.szText, L"Text 7");
+
+	BYTE arrRecord[EVENTRECORD_MAX_SIZE];
+	CEventRecordView objRecord;
+	CHECK(objReader.ReadRecord(arrRecord, objRecord) && objRecord.GetHeader().dwDurationMS == 7 && !objRecord.IsStopped());
+
+	objSegment.SetStopped();
+	CHECK(objReader.Read(objSnapshot) && objSnapshot.dwStatus == NOWPLAYING_STATUS_STOPPED && objSnapshot.szText[0] == L'\0');
+	CHECK(objReader.ReadRecord(arrRecord, objRecord) && objRecord.IsStopped());
+}
+
+// Section of an older tracker (without the record) or of another layout version is still held by a reader
+static void TestIncompatibleSection(const std::wstring& strName)
+{
+	CNowPlayingSegment objSegment;
+
+	HANDLE hOldMapping = ::CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, NOWPLAYING_MIN_LAYOUT_SIZE, strName.c_str());
+	CHECK(hOldMapping != NULL);
+	CHECK(!objSegment.Open(strName.c_str()));
+	CHECK(objSegment.IsIncompatible() && !objSegment.IsOpen());
+	::CloseHandle(hOldMapping);
+
+	hOldMapping = ::CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(CNowPlayingLayout), strName.c_str());
+	CNowPlayingLayout* pOldLayout = (CNowPlayingLayout*) ::MapViewOfFile(hOldMapping, FILE_MAP_WRITE, 0, 0, 0);
+	CHECK(pOldLayout != NULL);
+	if (pOldLayout == NULL) return;
+
+	pOldLayout->dwMagic = NOWPLAYING_MAGIC;
+	pOldLayout->dwVersion = NOWPLAYING_VERSION + 1;
+	CHECK(!objSegment.Open(strName.c_str()));
+	CHECK(objSegment.IsIncompatible());
+	CHECK(pOldLayout->dwVersion == NOWPLAYING_VERSION + 1);
+
+	// Segment of the same version left behind by the previous instance is re-used
+	pOldLayout->dwVersion = NOWPLAYING_VERSION;
+	CHECK(objSegment.Open(strName.c_str()));
+	CHECK(!objSegment.IsIncompatible());
+	CHECK(pOldLayout->dwWriterProcessID == ::GetCurrentProcessId());
+	objSegment.Close();
+
+	::UnmapViewOfFile(pOldLayout);
+	::CloseHandle(hOldMapping);
+
+	// Nothing holds the section anymore, so a new one of the right size is created
+	CHECK(objSegment.Open(strName.c_str()));
+}
+
+//
+// Writer process publishes tracks as fast as it can (every field and the record carry the track number)
+// while this process reads snapshots. Every snapshot must be of one track, and the tracks never go back.
+//
+static void TestSeqlockStress(const std::wstring& strName)
+{
+	CNowPlayingSegment objOwner;
+	CHECK(objOwner.Open(strName.c_str()));
+
+	pid_t iChild = fork();
+	if (iChild == 0)
+	{
+		CNowPlayingSegment objSegment;
+		if (!objSegment.Open(strName.c_str())) _exit(1);
+
+		for (unsigned iTrack = 1; ; iTrack++)
+		{
+			Publish(objSegment, iTrack);
+			if (iTrack % 16 == 0) objSegment.SetStopped();
+		}
+	}
+	CHECK(iChild > 0);
+
+	CNowPlayingReader objReader;
+	CHECK(objReader.Open(strName.c_str()));
+
+	unsigned iSnapshots = 0, iRecords = 0, iChanges = 0, iLastTrack = 0;
+	BYTE arrRecord[EVENTRECORD_MAX_SIZE];
+	CBenchTimer objTimer;
+
+	while (objTimer.GetElapsedMS() < 1000 && g_iTestFailures == 0)
+	{
+		CNowPlayingSnapshot objSnapshot;
+		CEventRecordView objRecord;
+		unsigned iTrack = 0;
+		WCHAR szExpected[256];
+
+		if (objReader.Read(objSnapshot, NULL, 100000) && objSnapshot.dwDurationMS != 0)
+		{
+			iTrack = objSnapshot.dwDurationMS;
+			iSnapshots++;
+
+			_snwprintf_s(szExpected, _TRUNCATE, L"Title %u", iTrack);
+			CHECK_TEXT(objSnapshot.szTitle, szExpected);
+			_snwprintf_s(szExpected, _TRUNCATE, L"Artist %u", iTrack);
+			CHECK_TEXT(objSnapshot.szArtist, szExpected);
+			CHECK_TEXT(objSnapshot.szAlbum, MakeEvent(iTrack).m_szAlbum);
+
+			// Stopped state clears the text only
+			_snwprintf_s(szExpected, _TRUNCATE, L"Text %u", iTrack);
+			CHECK_TEXT(objSnapshot.szText, (objSnapshot.dwStatus == NOWPLAYING_STATUS_PLAYING ? szExpected : L""));
+
+			CHECK(iTrack >= iLastTrack);
+			if (iTrack != iLastTrack) iChanges++;
+			iLastTrack = iTrack;
+		}
+
+		if (objReader.ReadRecord(arrRecord, objRecord, NULL, 100000) && objRecord.GetHeader().dwDurationMS != 0)
+		{
+			iRecords++;
+			size_t iLength;
+			const char* szTitle = objRecord.GetText(EVENTRECORD_TEXT_TITLE, &iLength);
+			char szExpectedTitle[32];
+			_snprintf_s(szExpectedTitle, sizeof(szExpectedTitle), _TRUNCATE, "Title %u", (unsigned) objRecord.GetHeader().dwDurationMS);
+
+			CHECK(std::string(szTitle, iLength) == szExpectedTitle);
+		}
+	}
+
+	kill(iChild, SIGKILL);
+	int iStatus = 0;
+	waitpid(iChild, &iStatus, 0);
+	CHECK(WIFSIGNALED(iStatus));
+
+	// The writer was really running while the snapshots were taken
+	CHECK(iSnapshots > 1000 && iRecords > 1000 && iChanges > 100);
+}
+
+// Writer process for the benchmark: publishes a new track every dwIntervalUS microseconds (0 = as fast as it can)
+static pid_t StartWriter(const std::wstring& strName, DWORD dwIntervalUS)
+{
+	pid_t iChild = fork();
+	if (iChild != 0) return iChild;
+
+	CNowPlayingSegment objSegment;
+	if (!objSegment.Open(strName.c_str())) _exit(1);
+
+	for (unsigned iTrack = 1; ; iTrack++)
+	{
+		Publish(objSegment, iTrack);
+		if (dwIntervalUS > 0) usleep(dwIntervalUS);
+	}
+}
+
+// Reads for one second. Every attempt is a Read with one try, so a failed attempt is a retry of a
+// reader which uses the default retry count.
+static void MeasureReads(const CNowPlayingReader& objReader, const char* szLabel)
+{
+	CNowPlayingSnapshot objSnapshot;
+	BYTE arrRecord[EVENTRECORD_MAX_SIZE];
+	CEventRecordView objRecord;
+	LONG lStartSequence = 0, lEndSequence = 0, lSequence = 0;
+	unsigned iAttempts = 0, iReads = 0, iRecordAttempts = 0, iRecordReads = 0, iChecks = 0;
+
+	// A flat out writer can hold the lock longer than the default retries (preempted in the middle of a write)
+	while (!objReader.Read(objSnapshot, &lStartSequence)) ::Sleep(0);
+
+	CBenchTimer objReadTimer;
+	while (objReadTimer.GetElapsedMS() < 500)
+	{
+		for (int idx = 0; idx < 100; idx++, iAttempts++)
+			if (objReader.Read(objSnapshot, NULL, 1)) iReads++;
+	}
+	double dReadMS = objReadTimer.GetElapsedMS();
+
+	CBenchTimer objRecordTimer;
+	while (objRecordTimer.GetElapsedMS() < 500)
+	{
+		for (int idx = 0; idx < 100; idx++, iRecordAttempts++)
+			if (objReader.ReadRecord(arrRecord, objRecord, NULL, 1)) iRecordReads++;
+	}
+	double dRecordMS = objRecordTimer.GetElapsedMS();
+
+	CBenchTimer objCheckTimer;
+	for (; iChecks < 10000000; iChecks++)
+		if (objReader.HasChanged(lSequence)) lSequence++;
+	double dCheckMS = objCheckTimer.GetElapsedMS();
+
+	while (!objReader.Read(objSnapshot, &lEndSequence)) ::Sleep(0);
+	double dWritesPerSec = (double) ((lEndSequence - lStartSequence) / 2) * 1000.0 / (dReadMS + dRecordMS + dCheckMS);
+
+	CHECK(iReads > 0 && iRecordReads > 0);
+	printf("%-26s %9.0f  %8.1f ns  %7.3f%%  %8.1f ns  %7.3f%%  %6.2f ns\n", szLabel, dWritesPerSec,
+		1000000.0 * dReadMS / iReads, 100.0 * (iAttempts - iReads) / iAttempts,
+		1000000.0 * dRecordMS / iRecordReads, 100.0 * (iRecordAttempts - iRecordReads) / iRecordAttempts,
+		1000000.0 * dCheckMS / iChecks);
+}
+
+static void RunBenchmark(const std::wstring& strName)
+{
+	static const struct { const char* szLabel; DWORD dwIntervalUS; } arrWriters[] = {
+		{ "Writer every 1 ms", 1000 },
+		{ "Writer every 10 us", 10 },
+		{ "Writer flat out", 0 },
+	};
+
+	CNowPlayingSegment objOwner;
+	CNowPlayingReader  objReader;
+	CHECK(objOwner.Open(strName.c_str()));
+	CHECK(objReader.Open(strName.c_str()));
+	Publish(objOwner, 1);
+
+	printf("Reader cost (ns per consistent copy, incl. retries) and retry rate (%% of attempts)\n");
+	printf("%-26s %9s  %11s  %8s  %11s  %8s  %9s\n", "", "writes/s", "Read", "retries", "ReadRecord", "retries", "HasChanged");
+	MeasureReads(objReader, "No writes");
+
+	for (size_t idx = 0; idx < sizeof(arrWriters) / sizeof(arrWriters[0]); idx++)
+	{
+		pid_t iChild = StartWriter(strName, arrWriters[idx].dwIntervalUS);
+		CHECK(iChild > 0);
+		::Sleep(50);
+
+		MeasureReads(objReader, arrWriters[idx].szLabel);
+
+		kill(iChild, SIGKILL);
+		waitpid(iChild, NULL, 0);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// Segment of this test process only (not the segment of a running tracker)
+	WCHAR szName[64];
+	_snwprintf_s(szName, _TRUNCATE, L"Local\\lnt-test-%u-nowplaying", ::GetCurrentProcessId());
+	std::wstring strName(szName);
+
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0)
+	{
+		RunBenchmark(strName);
+		return (g_iTestFailures == 0 ? 0 : 1);
+	}
+
+	TestPublish(strName);
+	TestIncompatibleSection(strName);
+	TestSeqlockStress(strName);
+
+	return TestResult("TestNowPlayingSegment");
+}
@@ -0,0 +1,83 @@
+//
+// Tests of CProcessStats and the footprint budget check of the soak test
+//
+#include "stdafx.h"
+#include "CSoakTest.h"
+#include "TestUtil.h"
+
+static CProcessStats MakeStats(SIZE_T iPeakWorkingSetKB, SIZE_T iPrivateBytesKB)
+{
+	CProcessStats objStats;
+	objStats.m_iWorkingSetKB = objStats.m_iPeakWorkingSetKB = iPeakWorkingSetKB;
+	objStats.m_iPrivateBytesKB = iPrivateBytesKB;
+	return objStats;
+}
+
+static void TestBudget()
+{
+	CProcessStats objStats = MakeStats(3000, 1500);
+
+	CHECK(objStats.IsWithinBudget(0, 0));
+	CHECK(objStats.IsWithinBudget(3072, 1536));
+	CHECK(!objStats.IsWithinBudget(2048, 0));
+	CHECK(!objStats.IsWithinBudget(0, 1024));
+
+	// Peak working set counts, not the current one
+	objStats.m_iWorkingSetKB = 1000;
+	CHECK(!objStats.IsWithinBudget(2048, 0));
+}
+
+static void TestSample()
+{
+	CProcessStats objStats;
+	CHECK(objStats.Sample());
+	CHECK(objStats.m_iWorkingSetKB > 0);
+	CHECK(objStats.m_iPeakWorkingSetKB >= objStats.m_iWorkingSetKB);
+	CHECK(objStats.m_dwHandleCount > 0);
+
+	objStats.SampleHeaps();
+	CHECK(objStats.m_dwHeapBlockCount > 0);
+
+	CHECK(objStats.Format().find(L"WorkingSet=") == 0);
+}
+
+// Soak run with flat series: the result depends on the budget only
+static bool RunSoak(SIZE_T iWorkingSetBudgetKB, SIZE_T iPrivateBytesBudgetKB, SIZE_T iPeakWorkingSetKB)
+{
+	CSoakTest objSoak;
+	objSoak.Enable(10 * CSoakTest::BATCH_EVENTS);
+	objSoak.SetFootprintBudget(iWorkingSetBudgetKB, iPrivateBytesBudgetKB);
+
+	while (!objSoak.IsCompleted())
+	{
+		for (int idx = 0; idx < CSoakTest::BATCH_EVENTS && !objSoak.IsCompleted(); idx++)
+		{
+			size_t iDataLen;
+			DWORD  dwGapMS;
+			objSoak.NextEvent(iDataLen, dwGapMS);
+			objSoak.AddLatency(1000);
+		}
+		objSoak.AddSample(MakeStats(iPeakWorkingSetKB, 1000));
+	}
+
+	bool bPassed = objSoak.Analyze();
+	CHECK(bPassed == !objSoak.HasFailed());
+	CHECK(objSoak.GetReport().find(bPassed ? L"Result: PASSED" : L"Result: FAILED") != std::wstring::npos);
+	return bPassed;
+}
+
+static void TestSoakBudget()
+{
+	CHECK(RunSoak(0, 0, 5000));
+	CHECK(RunSoak(3072, 1536, 3000));
+	CHECK(!RunSoak(3072, 1536, 3100));
+	CHECK(!RunSoak(0, 512, 3000));
+}
+
+int main()
+{
+	TestBudget();
+	TestSample();
+	TestSoakBudget();
+	return TestResult("TestProcessStats");
+}
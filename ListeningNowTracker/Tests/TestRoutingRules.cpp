@@ -0,0 +1,245 @@
+//
+// Tests of CRoutingRules: rule semantics per sink, invalid rules, and the compiled instructions
+// (switch blocks, atoms and sets). "/bench" argument reports the evaluation cost of hundreds of
+// rules compiled to a plain instruction list and to switch instructions (make bench).
+//
+#include "stdafx.h"
+#include "CRoutingRules.h"
+#include "TestUtil.h"
+
+// Rules with access to the compiled program
+class CTestRoutingRules : public CRoutingRules
+{
+  public:
+	size_t GetProgramSize(int iSink) const { return m_arrPrograms[iSink].size(); }
+	int GetOpCode(int iSink, size_t iPos) const { return m_arrPrograms[iSink][iPos].bOpCode; }
+	size_t GetSetCount() const { return m_arrSets.size(); }
+	size_t GetSwitchTableSize(size_t iTable) const { return m_arrSwitchTables[iTable].size(); }
+	DWORD GetUsedFields() const { return m_dwUsedFields; }
+
+	static bool IsSwitch(int iOpCode) { return iOpCode == OP_SWITCH; }
+	static bool IsDecide(int iOpCode) { return iOpCode == OP_DECIDE; }
+};
+
+static CTrackEvent MakeEvent(const WCHAR* szArtist, const WCHAR* szTitle, const WCHAR* szGenre = L"", const WCHAR* szSource = L"spotify.exe")
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, L"1", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szArtist, szArtist, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szTitle, szTitle, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szGenre, szGenre, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szSource, szSource, _TRUNCATE);
+	return objEvent;
+}
+
+// Decisions of all sinks as a text, for example "PDP3P" (Publish, Drop, deLay 3 secs, Publish)
+static std::wstring Decide(const CRoutingRules& objRules, const CTrackEvent& objEvent)
+{
+	CRoutingRules::CDecision arrDecisions[CRoutingRules::SINK_COUNT];
+	std::wstring strResult;
+	WCHAR szDelay[16];
+
+	objRules.Evaluate(objEvent, arrDecisions);
+
+	for (int iSink = 0; iSink < CRoutingRules::SINK_COUNT; iSink++)
+	{
+		switch (arrDecisions[iSink].eAction)
+		{
+			case CRoutingRules::ACTION_PUBLISH: strResult += L'P'; break;
+			case CRoutingRules::ACTION_DROP:    strResult += L'D'; break;
+			case CRoutingRules::ACTION_DELAY:
+				_snwprintf_s(szDelay, _TRUNCATE, L"L%u", (unsigned) arrDecisions[iSink].dwDelaySecs);
+				strResult += szDelay;
+				break;
+		}
+	}
+
+	return strResult;
+}
+
+static void TestRules()
+{
+	std::vector<std::wstring> arrRules;
+	arrRules.push_back(L"skype,tray publish if genre = \"Jazz\"");
+	arrRules.push_back(L"skype delay 20");
+	arrRules.push_back(L"all drop if artist in (\"Some Podcast\", \"Another Show\")");
+	arrRules.push_back(L"all drop if source = \"wmplayer.exe\"");
+	arrRules.push_back(L"shm drop if genre != \"Rock\" and artist not in (\"Band\")");
+
+	CRoutingRules objRules;
+	CHECK(objRules.Compile(arrRules));
+	CHECK(objRules.GetStats().dwRuleCount == 5 && objRules.GetStats().dwInvalidRuleCount == 0);
+	CHECK(!objRules.UsesField(CRoutingRules::FIELD_TITLE) && objRules.UsesField(CRoutingRules::FIELD_SOURCE));
+
+	// Sink order: tray, skype, shm, broadcast
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Band", L"Song", L"Pop")), L"PL20PP");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Other", L"Song", L"Pop")), L"PL20DP");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Other", L"Song", L"ROCK")), L"PL20PP");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"SOME podcast", L"Episode 1")), L"DL20DD");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Some Podcast", L"Episode 1", L"jazz")), L"PPDD");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Band", L"Song", L"Rock", L"WMPlayer.exe")), L"DL20DD");
+
+	// No rules: everything is published
+	CHECK(objRules.Compile(std::vector<std::wstring>()));
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Band", L"Song")), L"PPPP");
+}
+
+// Invalid rules are ignored as a whole. Their texts and fields must not reach the compiled rules.
+static void TestInvalidRules()
+{
+	std::vector<std::wstring> arrRules;
+	arrRules.push_back(L"all drop if artist = \"Leaked\" and bogus = \"x\"");
+	arrRules.push_back(L"all drop if genre in (\"Jazz\", \"Blues\"");
+	arrRules.push_back(L"all drop if album not in (\"A\", \"B\") extra");
+	arrRules.push_back(L"all drop if title = \"Song\" and");
+	arrRules.push_back(L"radio drop");
+	arrRules.push_back(L"all delay 0");
+	arrRules.push_back(L"all drop if source = unquoted");
+
+	CTestRoutingRules objRules;
+	CHECK(!objRules.Compile(arrRules));
+	CHECK(objRules.GetStats().dwRuleCount == 0 && objRules.GetStats().dwInvalidRuleCount == arrRules.size());
+	CHECK(objRules.GetStats().dwAtomCount == 0 && objRules.GetStats().dwInstructionCount == 0);
+	CHECK(objRules.GetSetCount() == 0 && objRules.GetUsedFields() == 0);
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Leaked", L"Song", L"Jazz")), L"PPPP");
+
+	// One valid rule among the invalid ones has only its own atoms and set
+	arrRules.push_back(L"tray drop if genre in (\"Blues\", \"BLUES\", \"Soul\")");
+	CHECK(!objRules.Compile(arrRules));
+	CHECK(objRules.GetStats().dwRuleCount == 1);
+	CHECK(objRules.GetStats().dwAtomCount == 2 && objRules.GetSetCount() == 1);
+	CHECK(objRules.GetUsedFields() == (1 << CRoutingRules::FIELD_GENRE));
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Leaked", L"Song", L"blues")), L"DPPP");
+}
+
+// A run of "artist = ..." rules is compiled to one switch instruction per sink
+static void TestSwitchProgram()
+{
+	std::vector<std::wstring> arrRules;
+	WCHAR szRule[128];
+
+	for (int idx = 0; idx < 100; idx++)
+	{
+		_snwprintf_s(szRule, _TRUNCATE, (idx % 10 == 0 ? L"all drop if artist in (\"Artist %d\", \"Alias %d\")" : L"all drop if artist = \"Artist %d\""), idx, idx);
+		arrRules.push_back(szRule);
+	}
+	arrRules.push_back(L"all delay 5 if artist = \"Artist 7\" and title = \"Live\"");
+	arrRules.push_back(L"skype drop if genre = \"Jazz\"");
+
+	// Same artist again further down the block: the earlier rule wins
+	arrRules.insert(arrRules.begin() + 50, L"broadcast publish if artist = \"Artist 90\" and genre = \"Pop\"");
+
+	CTestRoutingRules objRules;
+	CHECK(objRules.Compile(arrRules));
+
+	// Switch, 100 decisions, the rule with a second condition (test + decision), then the last rule of skype only
+	CHECK(objRules.GetProgramSize(CRoutingRules::SINK_TRAY) == 1 + 100 + 2);
+	CHECK(CTestRoutingRules::IsSwitch(objRules.GetOpCode(CRoutingRules::SINK_TRAY, 0)));
+	CHECK(CTestRoutingRules::IsDecide(objRules.GetOpCode(CRoutingRules::SINK_TRAY, 1)));
+	CHECK(objRules.GetProgramSize(CRoutingRules::SINK_SKYPE) == 1 + 100 + 2 + 2);
+	CHECK(objRules.GetProgramSize(CRoutingRules::SINK_BROADCAST) == 1 + 100 + 2 + 2);
+	CHECK(objRules.GetSwitchTableSize(0) == 100 + 10 + 1);
+
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Artist 42", L"Song")), L"DDDD");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"alias 30", L"Song")), L"DDDD");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Artist 100", L"Song")), L"PPPP");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Artist 100", L"Song", L"Jazz")), L"PDPP");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Artist 90", L"Song", L"Pop")), L"DDDP");
+	CHECK_TEXT(Decide(objRules, MakeEvent(L"Nobody", L"Live")), L"PPPP");
+}
+
+// "Drop these artists" list of iRuleCount rules. With bPlain every other rule tests the album, so
+// no run of rules is long enough for a switch and the sinks get a plain instruction list.
+static std::vector<std::wstring> MakeRuleSet(unsigned iRuleCount, bool bPlain)
+{
+	std::vector<std::wstring> arrRules;
+	WCHAR szRule[128];
+
+	for (unsigned idx = 0; idx < iRuleCount; idx++)
+	{
+		if (bPlain && idx % 2 == 1) _snwprintf_s(szRule, _TRUNCATE, L"all drop if album = \"Album %u\"", idx);
+		else if (idx % 10 == 0) _snwprintf_s(szRule, _TRUNCATE, L"all drop if artist in (\"Artist %u\", \"Alias %u\")", idx, idx);
+		else _snwprintf_s(szRule, _TRUNCATE, L"all drop if artist = \"Artist %u\" and genre != \"Live\"", idx);
+		arrRules.push_back(szRule);
+	}
+	arrRules.push_back(L"skype delay 20");
+
+	return arrRules;
+}
+
+// Evaluate cost (all four sinks) of events which match one of the rules and of events which match none
+static void RunBenchmark()
+{
+	static const unsigned arrRuleCounts[] = { 10, 100, 300, 1000 };
+
+	printf("Rules  Program    Instructions  Switches  ns per event (hit)  ns per event (miss)\n");
+
+	for (unsigned iSet = 0; iSet < sizeof(arrRuleCounts) / sizeof(arrRuleCounts[0]); iSet++)
+	{
+		for (int iPlain = 1; iPlain >= 0; iPlain--)
+		{
+			const unsigned iRuleCount = arrRuleCounts[iSet];
+			const unsigned iEventCount = (iPlain ? 10000000 / (iRuleCount + 10) : 1000000);	// Plain list scans the rules
+			CTestRoutingRules objRules;
+			CHECK(objRules.Compile(MakeRuleSet(iRuleCount, iPlain != 0)));
+
+			// Hits are spread over the whole list (artist rules only, so the plain list has them too)
+			std::vector<CTrackEvent> arrHits, arrMisses;
+			WCHAR szArtist[64];
+			for (unsigned idx = 0; idx < 16; idx++)
+			{
+				_snwprintf_s(szArtist, _TRUNCATE, L"ARTIST %u", (idx * iRuleCount / 16) & ~1U);
+				arrHits.push_back(MakeEvent(szArtist, L"Song", L"Pop"));
+
+				_snwprintf_s(szArtist, _TRUNCATE, L"Unknown Artist %u", idx);
+				arrMisses.push_back(MakeEvent(szArtist, L"Song", L"Pop"));
+			}
+
+			CHECK_TEXT(Decide(objRules, arrHits[5]), L"DDDD");
+			CHECK_TEXT(Decide(objRules, arrMisses[5]), L"PL20PP");
+			CHECK(CTestRoutingRules::IsSwitch(objRules.GetOpCode(CRoutingRules::SINK_TRAY, 0)) == (iPlain == 0 && iRuleCount >= 4));
+
+			CRoutingRules::CDecision arrDecisions[CRoutingRules::SINK_COUNT];
+			DWORD dwDropped = 0;
+
+			CBenchTimer objHitTimer;
+			for (unsigned idx = 0; idx < iEventCount; idx++)
+			{
+				objRules.Evaluate(arrHits[idx % 16], arrDecisions);
+				dwDropped += (arrDecisions[CRoutingRules::SINK_TRAY].eAction == CRoutingRules::ACTION_DROP);
+			}
+			double dHitMS = objHitTimer.GetElapsedMS();
+
+			CBenchTimer objMissTimer;
+			for (unsigned idx = 0; idx < iEventCount; idx++)
+			{
+				objRules.Evaluate(arrMisses[idx % 16], arrDecisions);
+				dwDropped += (arrDecisions[CRoutingRules::SINK_TRAY].eAction == CRoutingRules::ACTION_DROP);
+			}
+			double dMissMS = objMissTimer.GetElapsedMS();
+
+			CHECK(dwDropped == iEventCount);
+
+			size_t iSwitchCount = 0;
+			for (size_t iPos = 0; iPos < objRules.GetProgramSize(CRoutingRules::SINK_TRAY); iPos++)
+				if (CTestRoutingRules::IsSwitch(objRules.GetOpCode(CRoutingRules::SINK_TRAY, iPos))) iSwitchCount++;
+
+			printf("%5u  %-9s  %12u  %8u  %18.1f  %19.1f\n", iRuleCount, (iPlain ? "plain" : "switch"),
+				(unsigned) objRules.GetStats().dwInstructionCount, (unsigned) iSwitchCount,
+				1000000.0 * dHitMS / iEventCount, 1000000.0 * dMissMS / iEventCount);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0) RunBenchmark();
+	else
+	{
+		TestRules();
+		TestInvalidRules();
+		TestSwitchProgram();
+	}
+
+	return TestResult("TestRoutingRules");
+}
@@ -0,0 +1,275 @@
+//
+// Model of the sink dispatch of ProcessNowPlayingEvent (MainWnd.cpp can't be linked into a test).
+// The sinks are stubs, so only the dispatch itself is measured:
+//
+//   mask + switch    previous event path: loop over all sinks, skip the sinks left out of the
+//                    build with the constant g_dwBuildSinks mask, switch on the sink
+//   table            current event path: loop over g_arrBuildSinks (function pointers)
+//   direct           calls to the sinks of the build written out one by one
+//
+// The test checks that all three deliver the same calls. "/bench" argument prints ns per event of
+// each dispatch for the full build and the Skype-only minimal build, next to the routing and record
+// encoding cost of the same event (make bench).
+//
+#include "stdafx.h"
+#include "CRoutingRules.h"
+#include "CEventRecord.h"
+#include "TestUtil.h"
+
+static DWORD g_arrPublished[CRoutingRules::SINK_COUNT];
+static DWORD g_arrCleared[CRoutingRules::SINK_COUNT];
+
+// Stub sinks: enough work that the call can't be dropped, nothing more
+void PublishToTray(const CTrackEvent& /*objEvent*/, const std::wstring& strListeningText, const CEventRecord* /*pRecord*/, bool bClear)
+{
+	if (bClear) g_arrCleared[CRoutingRules::SINK_TRAY]++;
+	else g_arrPublished[CRoutingRules::SINK_TRAY] += (DWORD) strListeningText.size();
+}
+
+void PublishToSkype(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* /*pRecord*/, bool bClear)
+{
+	if (bClear || objEvent.IsStopped()) g_arrCleared[CRoutingRules::SINK_SKYPE]++;
+	else g_arrPublished[CRoutingRules::SINK_SKYPE] += (DWORD) strListeningText.size();
+}
+
+void PublishToSharedMemory(const CTrackEvent& /*objEvent*/, const std::wstring& /*strListeningText*/, const CEventRecord* pRecord, bool bClear)
+{
+	if (bClear) g_arrCleared[CRoutingRules::SINK_SHARED_MEMORY]++;
+	else g_arrPublished[CRoutingRules::SINK_SHARED_MEMORY] += pRecord->GetSize();
+}
+
+void PublishToBroadcast(const CTrackEvent& /*objEvent*/, const std::wstring& /*strListeningText*/, const CEventRecord* pRecord, bool bClear)
+{
+	if (bClear) g_arrCleared[CRoutingRules::SINK_BROADCAST]++;
+	else g_arrPublished[CRoutingRules::SINK_BROADCAST] += pRecord->GetSize();
+}
+
+typedef void (*PUBLISHTOSINKPROC)(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, bool bClear);
+
+struct CBuildSink
+{
+	int               iSink;
+	PUBLISHTOSINKPROC pfnPublish;
+};
+
+const CBuildSink g_arrFullSinks[] =
+{
+	{ CRoutingRules::SINK_TRAY,          PublishToTray },
+	{ CRoutingRules::SINK_SKYPE,         PublishToSkype },
+	{ CRoutingRules::SINK_SHARED_MEMORY, PublishToSharedMemory },
+	{ CRoutingRules::SINK_BROADCAST,     PublishToBroadcast },
+	{ CRoutingRules::SINK_COUNT,         NULL }
+};
+
+const CBuildSink g_arrSkypeSinks[] =
+{
+	{ CRoutingRules::SINK_SKYPE,         PublishToSkype },
+	{ CRoutingRules::SINK_COUNT,         NULL }
+};
+
+const DWORD g_dwFullSinks  = (1 << CRoutingRules::SINK_COUNT) - 1;
+const DWORD g_dwSkypeSinks = 1 << CRoutingRules::SINK_SKYPE;
+
+// Previous PublishToSink
+void PublishToSink(int iSink, const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, bool bClear)
+{
+	switch (iSink)
+	{
+		case CRoutingRules::SINK_TRAY:          PublishToTray(objEvent, strListeningText, pRecord, bClear); break;
+		case CRoutingRules::SINK_SKYPE:         PublishToSkype(objEvent, strListeningText, pRecord, bClear); break;
+		case CRoutingRules::SINK_SHARED_MEMORY: PublishToSharedMemory(objEvent, strListeningText, pRecord, bClear); break;
+		case CRoutingRules::SINK_BROADCAST:     PublishToBroadcast(objEvent, strListeningText, pRecord, bClear); break;
+	}
+}
+
+// Decision of one sink as in ProcessNowPlayingEvent (held events are not modeled)
+#define DISPATCH_DECISION(iSink, PublishCall)											\
+	if (objEvent.IsStopped() || arrDecisions[iSink].eAction == CRoutingRules::ACTION_PUBLISH)	\
+		PublishCall(false);																\
+	else																				\
+		PublishCall(true);
+
+template <DWORD dwBuildSinks>
+void DispatchMaskSwitch(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, const CRoutingRules::CDecision* arrDecisions)
+{
+	for (int iSink = 0; iSink < CRoutingRules::SINK_COUNT; iSink++)
+	{
+		if ((dwBuildSinks & (1 << iSink)) == 0) continue;
+
+#define PUBLISH_CALL(bClear) PublishToSink(iSink, objEvent, strListeningText, pRecord, bClear)
+		DISPATCH_DECISION(iSink, PUBLISH_CALL)
+#undef PUBLISH_CALL
+	}
+}
+
+inline void DispatchTable(const CBuildSink* pSinks, const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, const CRoutingRules::CDecision* arrDecisions)
+{
+	for (const CBuildSink* pSink = pSinks; pSink->pfnPublish != NULL; pSink++)
+	{
+#define PUBLISH_CALL(bClear) pSink->pfnPublish(objEvent, strListeningText, pRecord, bClear)
+		DISPATCH_DECISION(pSink->iSink, PUBLISH_CALL)
+#undef PUBLISH_CALL
+	}
+}
+
+// The table of MainWnd.cpp is a global as well (a template argument can't be an internal linkage array in C++03)
+void DispatchFullTable(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, const CRoutingRules::CDecision* arrDecisions)
+{
+	DispatchTable(g_arrFullSinks, objEvent, strListeningText, pRecord, arrDecisions);
+}
+
+void DispatchSkypeTable(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, const CRoutingRules::CDecision* arrDecisions)
+{
+	DispatchTable(g_arrSkypeSinks, objEvent, strListeningText, pRecord, arrDecisions);
+}
+
+template <DWORD dwBuildSinks>
+void DispatchDirect(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, const CRoutingRules::CDecision* arrDecisions)
+{
+#define PUBLISH_CALL(bClear) PublishToTray(objEvent, strListeningText, pRecord, bClear)
+	if (dwBuildSinks & (1 << CRoutingRules::SINK_TRAY)) { DISPATCH_DECISION(CRoutingRules::SINK_TRAY, PUBLISH_CALL) }
+#undef PUBLISH_CALL
+#define PUBLISH_CALL(bClear) PublishToSkype(objEvent, strListeningText, pRecord, bClear)
+	if (dwBuildSinks & (1 << CRoutingRules::SINK_SKYPE)) { DISPATCH_DECISION(CRoutingRules::SINK_SKYPE, PUBLISH_CALL) }
+#undef PUBLISH_CALL
+#define PUBLISH_CALL(bClear) PublishToSharedMemory(objEvent, strListeningText, pRecord, bClear)
+	if (dwBuildSinks & (1 << CRoutingRules::SINK_SHARED_MEMORY)) { DISPATCH_DECISION(CRoutingRules::SINK_SHARED_MEMORY, PUBLISH_CALL) }
+#undef PUBLISH_CALL
+#define PUBLISH_CALL(bClear) PublishToBroadcast(objEvent, strListeningText, pRecord, bClear)
+	if (dwBuildSinks & (1 << CRoutingRules::SINK_BROADCAST)) { DISPATCH_DECISION(CRoutingRules::SINK_BROADCAST, PUBLISH_CALL) }
+#undef PUBLISH_CALL
+}
+
+typedef void (*DISPATCHPROC)(const CTrackEvent& objEvent, const std::wstring& strListeningText, const CEventRecord* pRecord, const CRoutingRules::CDecision* arrDecisions);
+
+// Called through a non-constant table, so the compiler can't specialize the benchmark loop for one dispatcher
+static DISPATCHPROC g_arrDispatchers[] =
+{
+	DispatchMaskSwitch<g_dwFullSinks>,  DispatchFullTable,  DispatchDirect<g_dwFullSinks>,
+	DispatchMaskSwitch<g_dwSkypeSinks>, DispatchSkypeTable, DispatchDirect<g_dwSkypeSinks>
+};
+static const char* g_arrDispatcherNames[] = { "mask + switch", "table", "direct" };
+
+static CTrackEvent MakeEvent(const WCHAR* szTitle, bool bStopped = false)
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, (bStopped ? L"0" : L"1"), _TRUNCATE);
+	wcsncpy_s(objEvent.m_szArtist, L"Artist", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szTitle, szTitle, _TRUNCATE);
+	return objEvent;
+}
+
+// Events of the test and the benchmark: every sink gets publishes and clears
+struct CDispatchInput
+{
+	CTrackEvent              arrEvents[4];
+	CRoutingRules::CDecision arrDecisions[4][CRoutingRules::SINK_COUNT];
+	CEventRecord*            arrRecords[4];
+	std::wstring             strText;
+	CEventRecordPool         objPool;
+
+	CDispatchInput()
+	{
+		CRoutingRules objRules;
+		std::vector<std::wstring> arrRules;
+		arrRules.push_back(L"skype drop if title = \"Podcast\"");
+		arrRules.push_back(L"broadcast delay 10 if title = \"Song 2\"");
+		CHECK(objRules.Compile(arrRules));
+
+		arrEvents[0] = MakeEvent(L"Song 1");
+		arrEvents[1] = MakeEvent(L"Podcast");
+		arrEvents[2] = MakeEvent(L"Song 2");
+		arrEvents[3] = MakeEvent(L"", true);
+		strText = L"Artist - Song";
+
+		for (int idx = 0; idx < 4; idx++)
+		{
+			objRules.Evaluate(arrEvents[idx], arrDecisions[idx]);
+			arrRecords[idx] = objPool.Encode(arrEvents[idx], strText.c_str());
+		}
+	}
+
+	~CDispatchInput()
+	{
+		for (int idx = 0; idx < 4; idx++) arrRecords[idx]->Release();
+	}
+};
+
+static void RunDispatcher(const CDispatchInput& objInput, DISPATCHPROC pfnDispatch, unsigned iEventCount)
+{
+	ZeroMemory(g_arrPublished, sizeof(g_arrPublished));
+	ZeroMemory(g_arrCleared, sizeof(g_arrCleared));
+
+	for (unsigned idx = 0; idx < iEventCount; idx++)
+		pfnDispatch(objInput.arrEvents[idx % 4], objInput.strText, objInput.arrRecords[idx % 4], objInput.arrDecisions[idx % 4]);
+}
+
+static void TestSameCalls()
+{
+	CDispatchInput objInput;
+
+	for (size_t iBuild = 0; iBuild < 2; iBuild++)
+	{
+		DWORD arrPublished[CRoutingRules::SINK_COUNT], arrCleared[CRoutingRules::SINK_COUNT];
+
+		RunDispatcher(objInput, g_arrDispatchers[3 * iBuild], 8);
+		memcpy(arrPublished, g_arrPublished, sizeof(arrPublished));
+		memcpy(arrCleared, g_arrCleared, sizeof(arrCleared));
+
+		// Skype drops the podcast and clears for the stop, broadcast clears for the held track
+		CHECK(arrCleared[CRoutingRules::SINK_SKYPE] == 4 && arrPublished[CRoutingRules::SINK_SKYPE] == 4 * objInput.strText.size());
+		CHECK(iBuild == 1 || arrCleared[CRoutingRules::SINK_BROADCAST] == 2);
+		CHECK(iBuild == 0 || arrPublished[CRoutingRules::SINK_TRAY] + arrCleared[CRoutingRules::SINK_BROADCAST] == 0);
+
+		for (size_t iDispatcher = 1; iDispatcher < 3; iDispatcher++)
+		{
+			RunDispatcher(objInput, g_arrDispatchers[3 * iBuild + iDispatcher], 8);
+			CHECK(memcmp(arrPublished, g_arrPublished, sizeof(arrPublished)) == 0 && memcmp(arrCleared, g_arrCleared, sizeof(arrCleared)) == 0);
+		}
+	}
+}
+
+static void RunBenchmark()
+{
+	const unsigned iEventCount = 20000000;
+	const unsigned iWorkCount  = 1000000;
+	static const char* arrBuildNames[] = { "full build", "Skype-only minimal build" };
+	CDispatchInput objInput;
+
+	printf("Sink dispatch, ns per event    %-15s %-15s %-15s\n", g_arrDispatcherNames[0], g_arrDispatcherNames[1], g_arrDispatcherNames[2]);
+	for (size_t iBuild = 0; iBuild < 2; iBuild++)
+	{
+		printf("  %-27s", arrBuildNames[iBuild]);
+		for (size_t iDispatcher = 0; iDispatcher < 3; iDispatcher++)
+		{
+			CBenchTimer objTimer;
+			RunDispatcher(objInput, g_arrDispatchers[3 * iBuild + iDispatcher], iEventCount);
+			printf(" %-15.2f", 1000000.0 * objTimer.GetElapsedMS() / iEventCount);
+		}
+		printf("\n");
+	}
+
+	// Other work of the same event path for scale
+	CRoutingRules objRules;
+	std::vector<std::wstring> arrRules(1, L"skype drop if title = \"Podcast\"");
+	CHECK(objRules.Compile(arrRules));
+
+	CRoutingRules::CDecision arrDecisions[CRoutingRules::SINK_COUNT];
+	CBenchTimer objEvaluateTimer;
+	for (unsigned idx = 0; idx < iWorkCount; idx++) objRules.Evaluate(objInput.arrEvents[idx % 4], arrDecisions);
+	double dEvaluateMS = objEvaluateTimer.GetElapsedMS();
+
+	CBenchTimer objEncodeTimer;
+	for (unsigned idx = 0; idx < iWorkCount; idx++) objInput.objPool.Encode(objInput.arrEvents[idx % 4], objInput.strText.c_str())->Release();
+	double dEncodeMS = objEncodeTimer.GetElapsedMS();
+
+	printf("For scale: routing rules %.0f ns, record encoding %.0f ns per event\n", 1000000.0 * dEvaluateMS / iWorkCount, 1000000.0 * dEncodeMS / iWorkCount);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0) RunBenchmark();
+	else TestSameCalls();
+
+	return TestResult("TestSinkDispatch");
+}
@@ -0,0 +1,249 @@
+//
+// Headless soak test of the portable event path: the synthetic listening history of CSoakTest goes
+// through parsing, title normalization, track expiry, routing rules, record encoding, a private
+// shared memory segment and the Skype4COM stand-in of CSkypeStub.h, and the footprint of the process
+// is sampled after every batch (the app's "/soak" mode without the window and the tray). A run with
+// an injected leak (heap block or COM object) must fail.
+// "/soak[:events]" argument runs a full length soak and prints the report (make bench).
+//
+// The peak working set (RSS) and private bytes of the run are checked against the footprint budget
+// of the minimal build. Like the Minimal configuration this program is linked statically (see
+// Makefile), so the shared pages of libstdc++ are not counted against the budget.
+//
+#include "stdafx.h"
+
+#define LNT_MINIMAL_BUILD
+#include "BuildProfile.h"
+
+#include "CSoakTest.h"
+#include "CTitleNormalizer.h"
+#include "CRoutingRules.h"
+#include "CTrackExpiry.h"
+#include "CNowPlayingSegment.h"
+#include "CSkypeStub.h"
+#include "TestUtil.h"
+
+// Property get and put through IDispatch like VOLE does them (name lookup, then Invoke)
+static HRESULT GetProperty(IDispatch* pObject, const WCHAR* szName, VARIANT& varResult)
+{
+	LPOLESTR   arrNames[1] = { (LPOLESTR) szName };
+	DISPID     dispID;
+	DISPPARAMS objParams = { NULL, NULL, 0, 0 };
+
+	::VariantInit(&varResult);
+	HRESULT hr = pObject->GetIDsOfNames(IID_NULL, arrNames, 1, 0, &dispID);
+	if (SUCCEEDED(hr)) hr = pObject->Invoke(dispID, IID_NULL, 0, DISPATCH_PROPERTYGET | DISPATCH_METHOD, &objParams, &varResult, NULL, NULL);
+	return hr;
+}
+
+static HRESULT PutProperty(IDispatch* pObject, const WCHAR* szName, const WCHAR* szValue)
+{
+	LPOLESTR   arrNames[1] = { (LPOLESTR) szName };
+	DISPID     dispID, dispIDNamed = DISPID_PROPERTYPUT;
+	VARIANT    varValue;
+	DISPPARAMS objParams = { &varValue, &dispIDNamed, 1, 1 };
+
+	HRESULT hr = pObject->GetIDsOfNames(IID_NULL, arrNames, 1, 0, &dispID);
+	if (FAILED(hr)) return hr;
+
+	::VariantInit(&varValue);
+	varValue.vt = VT_BSTR;
+	varValue.bstrVal = ::SysAllocString(szValue);
+	hr = pObject->Invoke(dispID, IID_NULL, 0, DISPATCH_PROPERTYPUT, &objParams, NULL, NULL, NULL);
+	::VariantClear(&varValue);
+	return hr;
+}
+
+// Event path of ProcessNowPlayingEvent without the window and the tray and broadcast sinks. Skype
+// routing rules which delay the track publish it at once (held tracks need the timers of the app).
+class CSoakEventPath
+{
+  protected:
+	CTitleNormalizer   m_objNormalizer;
+	CRoutingRules      m_objRoutingRules;
+	CTrackExpiry       m_objTrackExpiry;
+	CEventRecordPool   m_objRecordPool;
+	CNowPlayingSegment m_objSegment;
+	CTrackEvent        m_objEvent;
+	std::wstring       m_strListeningText;
+	CSkypeStubFactory  m_objSkypeFactory;
+	std::vector<void*> m_arrLeaked;
+	DWORD              m_dwLeakEvery;		// Injected leak: 256 bytes every this many events (0 = No leak)
+	DWORD              m_dwLeakProfileAt;	// Injected leak: profile object of this event is not released (0 = No leak)
+	DWORD              m_dwEventCount;
+
+  public:
+	CSoakEventPath(DWORD dwLeakEvery, DWORD dwLeakProfileAt)
+	{
+		m_dwLeakEvery = dwLeakEvery;
+		m_dwLeakProfileAt = dwLeakProfileAt;
+		m_dwEventCount = 0;
+		m_strListeningText.reserve(200);
+		m_arrLeaked.reserve(100000);
+
+		std::vector<std::wstring> arrRules;
+		arrRules.push_back(L"skype delay 20");
+		arrRules.push_back(L"all drop if artist in (\"Artist 13\", \"Artist 77\")");
+		m_objRoutingRules.Compile(arrRules);
+		m_objNormalizer.Compile(CTitleNormalizer::GetDefaultRules(), false);
+
+		WCHAR szName[64];
+		_snwprintf_s(szName, _TRUNCATE, L"Local\\lnt-test-%u-soak", ::GetCurrentProcessId());
+		CHECK(m_objSegment.Open(szName));
+	}
+
+	~CSoakEventPath()
+	{
+		for (size_t idx = 0; idx < m_arrLeaked.size(); idx++) free(m_arrLeaked[idx]);
+	}
+
+	void ProcessEvent(const WCHAR* pData, size_t iDataLen, DWORD dwNowMS)
+	{
+		WCHAR szBuffer[200];
+
+		if (!m_objEvent.Parse(pData, iDataLen)) return;
+		wcsncpy_s(m_objEvent.m_szSource, L"soak.exe", _TRUNCATE);
+
+		if (!m_objEvent.IsStopped()) m_objNormalizer.NormalizeEvent(m_objEvent);
+		m_objTrackExpiry.OnEvent(m_objEvent, dwNowMS);
+
+		_snwprintf_s(szBuffer, _TRUNCATE, L"%s - %s", m_objEvent.m_szArtist, m_objEvent.m_szTitle);
+		m_strListeningText.assign(szBuffer);
+
+		CEventRecord* pRecord = m_objRecordPool.Encode(m_objEvent, m_objEvent.IsStopped() ? L"" : m_strListeningText.c_str());
+
+		CRoutingRules::CDecision arrDecisions[CRoutingRules::SINK_COUNT];
+		if (!m_objEvent.IsStopped()) m_objRoutingRules.Evaluate(m_objEvent, arrDecisions);
+
+		if (m_objEvent.IsStopped() || arrDecisions[CRoutingRules::SINK_SHARED_MEMORY].eAction == CRoutingRules::ACTION_PUBLISH)
+			m_objSegment.Publish(m_objEvent, m_objEvent.IsStopped() ? L"" : m_strListeningText.c_str(), pRecord);
+		else
+			m_objSegment.SetStopped();
+
+		m_dwEventCount++;
+
+		if (m_objEvent.IsStopped() || arrDecisions[CRoutingRules::SINK_SKYPE].eAction == CRoutingRules::ACTION_DROP)
+			UpdateMoodText(L"");
+		else
+			UpdateMoodText(m_strListeningText.c_str());
+
+		pRecord->Release();
+
+		if (m_dwLeakEvery > 0 && m_dwEventCount % m_dwLeakEvery == 0) m_arrLeaked.push_back(malloc(256));
+	}
+
+	// Compressed clock: the watchdog deadline is checked when the time until the next event has passed
+	void CheckExpired(DWORD dwNowMS)
+	{
+		if (m_objTrackExpiry.CheckExpired(dwNowMS))
+		{
+			m_objSegment.SetStopped();
+			UpdateMoodText(L"");
+		}
+	}
+
+  protected:
+	// UpdateSkypeMoodText: new Skype, Client and CurrentUserProfile objects on every update
+	void UpdateMoodText(const WCHAR* szMoodText)
+	{
+		IDispatch* pSkype = NULL;
+		VARIANT    varClient, varRunning, varProfile;
+
+		if (FAILED(m_objSkypeFactory.CreateInstance(NULL, IID_IDispatch, (void**) &pSkype)))
+		{
+			CHECK(!"Skype stand-in not created");
+			return;
+		}
+
+		::VariantInit(&varRunning);
+		CHECK(SUCCEEDED(GetProperty(pSkype, L"Client", varClient)) && varClient.vt == VT_DISPATCH &&
+			SUCCEEDED(GetProperty(varClient.pdispVal, L"IsRunning", varRunning)) && varRunning.vt == VT_BOOL && varRunning.boolVal == VARIANT_TRUE);
+		CHECK(SUCCEEDED(GetProperty(pSkype, L"CurrentUserProfile", varProfile)) && varProfile.vt == VT_DISPATCH &&
+			SUCCEEDED(PutProperty(varProfile.pdispVal, L"MoodText", szMoodText)));
+		CHECK(CSkypeStub::GetMoodText() == szMoodText);
+
+		if (m_dwEventCount != m_dwLeakProfileAt) ::VariantClear(&varProfile);
+		::VariantClear(&varRunning);
+		::VariantClear(&varClient);
+		pSkype->Release();
+	}
+};
+
+static bool RunSoak(DWORD dwEventCount, DWORD dwLeakEvery, DWORD dwLeakProfileAt, SIZE_T iWorkingSetBudgetKB, bool bReport)
+{
+	CSoakTest objSoak;
+	CSoakEventPath objEventPath(dwLeakEvery, dwLeakProfileAt);
+	DWORD dwMoodTextChanges = CSkypeStub::GetMoodTextChanges();
+	LONG  lLiveObjects = CSkypeStub::GetLiveObjectCount();		// Objects leaked by the previous run
+	DWORD dwNowMS = 0xFFFFFFFF - 60 * 60 * 1000;		// Tick count wraps around during the run
+
+	objSoak.Enable(dwEventCount);
+	objSoak.SetFootprintBudget(iWorkingSetBudgetKB, LNT_PRIVATEBYTES_BUDGET_KB);
+
+	while (!objSoak.IsCompleted())
+	{
+		for (int idx = 0; idx < CSoakTest::BATCH_EVENTS && !objSoak.IsCompleted(); idx++)
+		{
+			LARGE_INTEGER liStart, liEnd;
+			size_t        iDataLen;
+			DWORD         dwGapMS;
+			const WCHAR*  pData = objSoak.NextEvent(iDataLen, dwGapMS);
+
+			::QueryPerformanceCounter(&liStart);
+			objEventPath.ProcessEvent(pData, iDataLen, dwNowMS);
+			::QueryPerformanceCounter(&liEnd);
+			objSoak.AddLatency(liEnd.QuadPart - liStart.QuadPart);
+
+			dwNowMS += dwGapMS;
+			objEventPath.CheckExpired(dwNowMS);
+		}
+
+		CProcessStats objStats;
+		objStats.Sample();
+		objStats.SampleHeaps();
+		objSoak.AddSample(objStats);
+	}
+
+	objSoak.SetComObjects(CSkypeStub::GetMoodTextChanges() - dwMoodTextChanges, CSkypeStub::GetLiveObjectCount() - lLiveObjects);
+
+	bool bPassed = objSoak.Analyze();
+	if (bReport) printf("%ls\n", objSoak.GetReport().substr(0, objSoak.GetReport().find(L"\n\n")).c_str());
+	return bPassed;
+}
+
+int main(int argc, char* argv[])
+{
+	WCHAR szOption[64];
+	DWORD dwEventCount;
+	if (argc > 1 && ::MultiByteToWideChar(CP_UTF8, 0, argv[1], -1, szOption, 64) > 0 && CSoakTest::ParseOption(szOption, dwEventCount))
+		return (dwEventCount > 0 && RunSoak(dwEventCount, 0, 0, LNT_WORKINGSET_BUDGET_KB, true) ? 0 : 1);
+
+	// "/soak[:events]" must be a word of its own with a valid event count
+	CHECK(!CSoakTest::ParseOption(NULL, dwEventCount));
+	CHECK(!CSoakTest::ParseOption(L"/trace", dwEventCount));
+	CHECK(!CSoakTest::ParseOption(L"/soaked", dwEventCount));
+	CHECK(!CSoakTest::ParseOption(L"C:\\x/soak", dwEventCount));
+	CHECK(CSoakTest::ParseOption(L"/soak", dwEventCount) && dwEventCount == CSoakTest::DEFAULT_EVENT_COUNT);
+	CHECK(CSoakTest::ParseOption(L"/trace /soak", dwEventCount) && dwEventCount == CSoakTest::DEFAULT_EVENT_COUNT);
+	CHECK(CSoakTest::ParseOption(L"/soakx /soak:500 /trace", dwEventCount) && dwEventCount == 500);
+	CHECK(CSoakTest::ParseOption(L"/soak:10000000", dwEventCount) && dwEventCount == 10000000);
+	CHECK(CSoakTest::ParseOption(L"/soak:0", dwEventCount) && dwEventCount == 0);
+	CHECK(CSoakTest::ParseOption(L"/soak:", dwEventCount) && dwEventCount == 0);
+	CHECK(CSoakTest::ParseOption(L"/soak:12x", dwEventCount) && dwEventCount == 0);
+	CHECK(CSoakTest::ParseOption(L"/soak:-5", dwEventCount) && dwEventCount == 0);
+	CHECK(CSoakTest::ParseOption(L"/soak:10000001", dwEventCount) && dwEventCount == 0);
+	CHECK(CSoakTest::ParseOption(L"/soak:99999999999999999999999", dwEventCount) && dwEventCount == 0);
+
+	CHECK(RunSoak(5000, 0, 0, LNT_WORKINGSET_BUDGET_KB, false));
+
+	// 256 bytes every 10 events is a leak of about 100 KB during the measured part of the run
+	CHECK(!RunSoak(5000, 10, 0, LNT_WORKINGSET_BUDGET_KB, false));
+
+	// One profile object of the mood text updates is not released (too small for the trend lines)
+	CHECK(!RunSoak(5000, 0, 2500, LNT_WORKINGSET_BUDGET_KB, false));
+
+	// The budget is checked against the real RSS of the process (no process fits in 64 KB)
+	CHECK(!RunSoak(1000, 0, 0, 64, false));
+
+	return TestResult("TestSoak");
+}
@@ -0,0 +1,344 @@
+//
+// Tests of CStartupTrace and CThread (trace marks from several threads, thread stop logic, startup
+// budget) and a cold start of the portable startup path: a new process starts listening, buffers an
+// early event, runs the deferred initialization and processes the event. The process start to the
+// first processed event must stay within the budget. "/bench" argument reports the cold start times.
+//
+#include "stdafx.h"
+#include "BuildProfile.h"
+#include "CThread.h"
+#include "CStartupTrace.h"
+#include "CTitleNormalizer.h"
+#include "CRoutingRules.h"
+#include "CStateCheckpoint.h"
+#include "CEventRecord.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <sys/wait.h>
+
+// Budget of the whole cold start (process start until the first event is processed)
+const DWORD COLDSTART_BUDGET_MS = 250;
+
+// Private messages of the cold start process (same roles as in MainWnd.cpp)
+const UINT WM_APP_DEFERRED_INIT = WM_APP + 10;
+const UINT WM_APP_NOWPLAYING    = WM_APP + 20;
+
+static CStartupTrace g_objTrace;
+
+static unsigned __stdcall TraceThread(void* pArg)
+{
+	CThreadContext* pCtx = (CThreadContext*) pArg;
+
+	g_objTrace.Mark(_T("Worker thread started"));
+
+	// Quit when the main thread posts the stop event
+	DWORD dwResult = ::WaitForSingleObject(pCtx->m_hStopEvent, 5000);
+	_endthreadex(dwResult == WAIT_OBJECT_0 ? 7 : 1);
+	return 0;
+}
+
+static void TestDisabledTrace()
+{
+	CStartupTrace objTrace;
+	objTrace.Mark(_T("Ignored"));
+	objTrace.Note(L"Ignored");
+
+	std::wstring strFileName = GetTestFileName(L"disabled.log");
+	objTrace.Save(strFileName);
+
+	// Disabled trace writes no log file
+	FILE* pFile = NULL;
+	CHECK(_wfopen_s(&pFile, strFileName.c_str(), L"rt") != 0);
+	if (pFile != NULL) fclose(pFile);
+}
+
+static void TestTimeline()
+{
+	CThread objThread(TraceThread);
+
+	g_objTrace.Enable(true);
+	g_objTrace.Mark(_T("WinMain"));
+
+	CHECK(objThread.Start() == 0);
+	::Sleep(20);
+	g_objTrace.Note(L"Working set 1024 KB");
+
+	// Graceful stop: the thread sees the stop event and exits with code 7
+	CHECK(objThread.Stop(true) == 7);
+	CHECK(objThread.GetHandle() == NULL);
+
+	std::wstring strFileName = GetTestFileName(L"startup.log");
+	g_objTrace.Save(strFileName);
+
+	FILE* pFile = NULL;
+	CHECK(_wfopen_s(&pFile, strFileName.c_str(), L"rt") == 0 && pFile != NULL);
+	if (pFile == NULL) return;
+
+	std::wstring strLog;
+	WCHAR szLine[256];
+	while (fgetws(szLine, 256, pFile) != NULL) strLog += szLine;
+	fclose(pFile);
+	::DeleteFile(strFileName.c_str());
+
+	CHECK(strLog.find(L"ms since WinMain") != std::wstring::npos);
+	CHECK(strLog.find(L"WinMain\n") != std::wstring::npos);
+	CHECK(strLog.find(L"Worker thread started\n") != std::wstring::npos);
+	CHECK(strLog.find(L"[startup] Working set 1024 KB\n") != std::wstring::npos);
+
+	// The first mark is the zero point of the timeline
+	CHECK(strLog.find(L"[startup]      0.000 ms") != std::wstring::npos);
+}
+
+static std::wstring ReadLog(const std::wstring& strFileName)
+{
+	std::wstring strLog;
+	FILE* pFile = NULL;
+	if (_wfopen_s(&pFile, strFileName.c_str(), L"rt") != 0 || pFile == NULL) return strLog;
+
+	WCHAR szLine[256];
+	while (fgetws(szLine, 256, pFile) != NULL) strLog += szLine;
+	fclose(pFile);
+	return strLog;
+}
+
+static void TestBudget()
+{
+	CStartupTrace objTrace;
+	CHECK(objTrace.CheckBudget(_T("Disabled"), 0));
+
+	objTrace.Enable(true);
+	objTrace.Mark(_T("WinMain"));
+	CHECK(objTrace.CheckBudget(_T("Fast phase"), 10000));
+
+	::Sleep(30);
+	CHECK(objTrace.GetElapsedMS() >= 30.0);
+	CHECK(!objTrace.CheckBudget(_T("Slow phase"), 10));
+
+	std::wstring strFileName = GetTestFileName(L"budget.log");
+	objTrace.Save(strFileName);
+	std::wstring strLog = ReadLog(strFileName);
+	::DeleteFile(strFileName.c_str());
+
+	CHECK(strLog.find(L"ERROR: Slow phase took ") != std::wstring::npos);
+	CHECK(strLog.find(L"Fast phase") == std::wstring::npos);
+}
+
+// Trace with a slot reserved by a thread which is not yet done with the entry (preempted in Mark)
+class CPreemptedTrace : public CStartupTrace
+{
+  public:
+	void ReserveSlot() { ::InterlockedIncrement(&m_iPhaseCount); }
+};
+
+// Timeline saved while another thread is in the middle of Mark has complete entries only
+static void TestSaveDuringMark()
+{
+	CPreemptedTrace objTrace;
+	objTrace.Enable(true);
+	objTrace.Mark(_T("WinMain"));
+	objTrace.ReserveSlot();
+	objTrace.Mark(_T("Next phase"));
+
+	std::wstring strFileName = GetTestFileName(L"preempted.log");
+	objTrace.Save(strFileName);
+	std::wstring strLog = ReadLog(strFileName);
+	::DeleteFile(strFileName.c_str());
+
+	int iLines = 0;
+	for (size_t iPos = strLog.find(L"tid="); iPos != std::wstring::npos; iPos = strLog.find(L"tid=", iPos + 1)) iLines++;
+
+	CHECK(iLines == 2);
+	CHECK(strLog.find(L"WinMain\n") != std::wstring::npos);
+	CHECK(strLog.find(L"Next phase\n") != std::wstring::npos);
+}
+
+//
+// Cold start process. The same steps as WinMain and InitApplicationDeferred of MainWnd.cpp, without
+// the window, tray icon, OLE and threads: the message queue is up first, an event arriving during
+// the initialization is buffered as a record, and the deferred part compiles the rules, opens the
+// checkpoint and replays the buffered event. Writes the QueryPerformanceCounter timestamps of WinMain
+// entry, listening and the first processed event (and the processed text) to the pipe.
+//
+static int RunColdStartProcess(int iPipe)
+{
+	CStartupTrace objTrace;
+	LARGE_INTEGER liEntered, liListening, liDispatched;
+
+	objTrace.Enable(true);
+	objTrace.Mark(_T("WinMain entered"));
+	::QueryPerformanceCounter(&liEntered);
+
+	CMutex objProcessMutex(GetTestFileName(L"coldstart-mutex").c_str());
+	if (objProcessMutex.GetShareCount() != 1) return 1;
+	objTrace.Mark(_T("Single instance mutex created"));
+
+	// Message queue of the process is the "message window"
+	MSG msg;
+	::PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE);
+	objTrace.Mark(_T("Message window listening"));
+	::QueryPerformanceCounter(&liListening);
+	if (!objTrace.CheckBudget(_T("Message window listening"), LNT_LISTENING_BUDGET_MS)) return 2;
+
+	// A player sends the event right away, the deferred initialization is queued after it
+	static const WCHAR szData[] = L"\\0Music\\01\\0{0} - {1}\\0Song (feat. Guest) - 2009 Remaster\\0Artist\\0Album\\0";
+	::PostMessage(NULL, WM_APP_NOWPLAYING, 0, 0);
+	::PostMessage(NULL, WM_APP_DEFERRED_INIT, 0, 0);
+
+	CEventRecordPool objRecordPool;
+	CEventRecord*    pPendingRecord = NULL;
+	CTitleNormalizer objNormalizer;
+	CRoutingRules    objRoutingRules;
+	CStateCheckpoint objCheckpoint;
+	CTrackEvent      objEvent;
+	bool             bInitialized = false;
+	std::wstring     strCheckpointFile = GetTestFileName(L"coldstart.state");
+
+	while (::PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+	{
+		if (msg.message == WM_APP_NOWPLAYING && !bInitialized)
+		{
+			if (!objEvent.Parse(szData, wcslen(szData))) return 1;
+			pPendingRecord = objRecordPool.Encode(objEvent, L"");
+			objTrace.Mark(_T("First now playing event received"));
+		}
+		else if (msg.message == WM_APP_DEFERRED_INIT)
+		{
+			std::vector<std::wstring> arrRules;
+			arrRules.push_back(L"skype delay 20");
+			objNormalizer.Compile(CTitleNormalizer::GetDefaultRules(), false);
+			objRoutingRules.Compile(arrRules);
+			objTrace.Mark(_T("Rules compiled"));
+
+			if (!objCheckpoint.Open(strCheckpointFile)) return 1;
+			objTrace.Mark(_T("State checkpoint loaded"));
+			bInitialized = true;
+
+			if (pPendingRecord != NULL)
+			{
+				WCHAR szText[200];
+				CRoutingRules::CDecision arrDecisions[CRoutingRules::SINK_COUNT];
+
+				objEvent.Clear();
+				CEventRecord::Decode(pPendingRecord->GetView(), objEvent);
+				pPendingRecord->Release();
+
+				objNormalizer.NormalizeEvent(objEvent);
+				objRoutingRules.Evaluate(objEvent, arrDecisions);
+				_snwprintf_s(szText, _TRUNCATE, L"%s - %s", objEvent.m_szArtist, objEvent.m_szTitle);
+				objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, szText);
+				objTrace.Mark(_T("First event dispatched"));
+				::QueryPerformanceCounter(&liDispatched);
+
+				char szReport[320];
+				int iLen = _snprintf_s(szReport, sizeof(szReport), _TRUNCATE, "%lld %lld %lld %ls\n",
+					(long long) liEntered.QuadPart, (long long) liListening.QuadPart, (long long) liDispatched.QuadPart, szText);
+				if (write(iPipe, szReport, iLen) != iLen) return 1;
+			}
+		}
+	}
+
+	objCheckpoint.Close();
+	::DeleteFile(strCheckpointFile.c_str());
+	return 0;
+}
+
+struct CColdStart
+{
+	double dEnteredMS;		// Process start until WinMain entry (exec and the loader)
+	double dListeningMS;	// Process start until the message queue is listening
+	double dDispatchedMS;	// Process start until the first event is processed
+};
+
+// Start a new process of this program (not a fork: the loader and static init are part of a cold start)
+static bool RunColdStart(CColdStart& objResult)
+{
+	int arrPipe[2];
+	if (pipe(arrPipe) != 0) return false;
+
+	LARGE_INTEGER liFrequency, liStart;
+	::QueryPerformanceFrequency(&liFrequency);
+	::QueryPerformanceCounter(&liStart);
+
+	pid_t iChild = fork();
+	if (iChild == 0)
+	{
+		char szPipe[16];
+		close(arrPipe[0]);
+		_snprintf_s(szPipe, sizeof(szPipe), _TRUNCATE, "%d", arrPipe[1]);
+		execl("/proc/self/exe", "TestStartupTrace", "/coldstart", szPipe, (char*) NULL);
+		_exit(1);
+	}
+	close(arrPipe[1]);
+
+	char szReport[320];
+	ssize_t iLen = 0, iRead;
+	while (iLen < (ssize_t) sizeof(szReport) - 1 && (iRead = read(arrPipe[0], szReport + iLen, sizeof(szReport) - 1 - iLen)) > 0) iLen += iRead;
+	szReport[iLen] = '\0';
+	close(arrPipe[0]);
+
+	int iStatus = 0;
+	waitpid(iChild, &iStatus, 0);
+	CHECK(WIFEXITED(iStatus) && WEXITSTATUS(iStatus) == 0);
+
+	long long llEntered = 0, llListening = 0, llDispatched = 0;
+	int iTextPos = 0;
+	if (sscanf(szReport, "%lld %lld %lld %n", &llEntered, &llListening, &llDispatched, &iTextPos) != 3) return false;
+
+	// The early event was buffered and processed with the normalization rules of the deferred initialization
+	CHECK(strcmp(szReport + iTextPos, "Artist, Guest - Song\n") == 0);
+
+	double dTicksPerMS = (double) liFrequency.QuadPart / 1000.0;
+	objResult.dEnteredMS    = (double) (llEntered - liStart.QuadPart) / dTicksPerMS;
+	objResult.dListeningMS  = (double) (llListening - liStart.QuadPart) / dTicksPerMS;
+	objResult.dDispatchedMS = (double) (llDispatched - liStart.QuadPart) / dTicksPerMS;
+	return true;
+}
+
+static bool CompareDispatched(const CColdStart& objA, const CColdStart& objB) { return objA.dDispatchedMS < objB.dDispatchedMS; }
+
+static void TestColdStart(int iRuns, bool bReport)
+{
+	std::vector<CColdStart> arrRuns;
+	for (int idx = 0; idx < iRuns; idx++)
+	{
+		CColdStart objRun = { 0.0, 0.0, 0.0 };
+		CHECK(RunColdStart(objRun));
+		CHECK(objRun.dListeningMS - objRun.dEnteredMS <= (double) LNT_LISTENING_BUDGET_MS);
+		arrRuns.push_back(objRun);
+	}
+	if (arrRuns.empty()) return;
+
+	std::sort(arrRuns.begin(), arrRuns.end(), CompareDispatched);
+	const CColdStart& objMedian = arrRuns[arrRuns.size() / 2];
+	const CColdStart& objSlowest = arrRuns.back();
+
+	// Median so that a single run delayed by the scheduler does not fail the test
+	CHECK(objMedian.dDispatchedMS <= (double) COLDSTART_BUDGET_MS);
+
+	if (bReport)
+	{
+		printf("Cold start (%d runs, ms since process start)   median   slowest\n", iRuns);
+		printf("  WinMain entered                        %8.3f  %8.3f\n", objMedian.dEnteredMS, objSlowest.dEnteredMS);
+		printf("  Message window listening               %8.3f  %8.3f   budget %u ms after WinMain\n", objMedian.dListeningMS, objSlowest.dListeningMS, (unsigned) LNT_LISTENING_BUDGET_MS);
+		printf("  First event dispatched                 %8.3f  %8.3f   budget %u ms\n", objMedian.dDispatchedMS, objSlowest.dDispatchedMS, (unsigned) COLDSTART_BUDGET_MS);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2 && strcmp(argv[1], "/coldstart") == 0) return RunColdStartProcess(atoi(argv[2]));
+
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0)
+	{
+		TestColdStart(50, true);
+		return (g_iTestFailures == 0 ? 0 : 1);
+	}
+
+	TestDisabledTrace();
+	TestTimeline();
+	TestBudget();
+	TestSaveDuringMark();
+	TestColdStart(5, false);
+	return TestResult("TestStartupTrace");
+}
@@ -0,0 +1,225 @@
+//
+// Tests of CStateCheckpoint: texts survive a killed process, a torn slot falls back to the previous state,
+// two threads can update sinks at the same time. "/bench" argument reports the checkpoint cost per event.
+//
+#include "stdafx.h"
+#include "CStateCheckpoint.h"
+#include "TestUtil.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+// Checkpoint with access to the file layout (torn write simulation)
+class CTestCheckpoint : public CStateCheckpoint
+{
+  public:
+	void TearLatestSlot()
+	{
+		CSlot& objSlot = m_pView->arrSlots[m_objState.lSequence & 1];
+		objSlot.arrSinks[SINK_SKYPE].szText[0] ^= 1;
+	}
+};
+
+static void TestCleanRoundTrip(const std::wstring& strFileName)
+{
+	CStateCheckpoint objCheckpoint;
+	CHECK(objCheckpoint.Open(strFileName));
+	CHECK(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE).empty());
+
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, L"Listening now: Artist - Title");
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, L"Artist - Title");
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, L"Artist - Title");
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, L"");
+	objCheckpoint.Close();
+
+	CHECK(objCheckpoint.Open(strFileName));
+	CHECK_TEXT(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE), L"Listening now: Artist - Title");
+	CHECK_TEXT(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY), L"Artist - Title");
+	CHECK(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_BROADCAST).empty());
+	CHECK(objCheckpoint.GetSinkText(CStateCheckpoint::MAX_SINKS).empty());
+
+	// Too long text is truncated
+	std::wstring strLong(1000, L'x');
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, strLong.c_str());
+	CHECK(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE).size() == CStateCheckpoint::MAX_TEXT_LEN - 1);
+	objCheckpoint.Close();
+}
+
+static void TestTornSlot(const std::wstring& strFileName)
+{
+	CTestCheckpoint objCheckpoint;
+	CHECK(objCheckpoint.Open(strFileName));
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, L"Old text");
+	objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, L"New text");
+	objCheckpoint.TearLatestSlot();
+	objCheckpoint.Close();
+
+	CHECK(objCheckpoint.Open(strFileName));
+	CHECK_TEXT(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE), L"Old text");
+	objCheckpoint.Close();
+}
+
+// Child process publishes tracks until it is killed. The next instance must find a consistent state:
+// every sink has a complete text of one of the tracks, the latest committed one or the one before.
+static void TestKillRecovery(const std::wstring& strFileName)
+{
+	::DeleteFile(strFileName.c_str());
+
+	for (int iRound = 0; iRound < 20; iRound++)
+	{
+		pid_t iChild = fork();
+		if (iChild == 0)
+		{
+			CStateCheckpoint objCheckpoint;
+			if (!objCheckpoint.Open(strFileName)) _exit(1);
+
+			WCHAR szText[64];
+			for (unsigned iTrack = 1; ; iTrack++)
+			{
+				_snwprintf_s(szText, _TRUNCATE, L"Artist %u - Track %u", iTrack, iTrack);
+				objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, szText);
+				objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, szText);
+				objCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, szText);
+			}
+		}
+
+		CHECK(iChild > 0);
+		::Sleep(20 + iRound * 3);
+		kill(iChild, SIGKILL);
+		waitpid(iChild, NULL, 0);
+
+		CStateCheckpoint objCheckpoint;
+		CHECK(objCheckpoint.Open(strFileName));
+
+		unsigned arrTracks[3];
+		int arrSinks[3] = { CStateCheckpoint::SINK_SKYPE, CStateCheckpoint::SINK_SHARED_MEMORY, CStateCheckpoint::SINK_BROADCAST };
+
+		for (int idx = 0; idx < 3; idx++)
+		{
+			std::wstring strText = objCheckpoint.GetSinkText(arrSinks[idx]);
+			unsigned iArtist = 0;
+
+			CHECK(swscanf(strText.c_str(), L"Artist %u - Track %u", &iArtist, &arrTracks[idx]) == 2 && iArtist == arrTracks[idx]);
+		}
+
+		// Sinks are committed one at a time, in this order
+		CHECK(arrTracks[0] >= arrTracks[1] && arrTracks[1] >= arrTracks[2] && arrTracks[0] - arrTracks[2] <= 1);
+
+		// Recovery clears the stale texts (as the next app instance does)
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, L"");
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, L"");
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, L"");
+		objCheckpoint.Close();
+
+		CHECK(objCheckpoint.Open(strFileName));
+		CHECK(objCheckpoint.GetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY).empty());
+		objCheckpoint.Close();
+	}
+}
+
+// Main thread publishes to shared memory while the watchdog thread clears Skype (see MainWnd.cpp)
+static CStateCheckpoint g_objSharedCheckpoint;
+const unsigned THREAD_UPDATES = 20000;
+
+static unsigned __stdcall SkypeThread(void* /*pArg*/)
+{
+	WCHAR szText[64];
+	for (unsigned iTrack = 1; iTrack <= THREAD_UPDATES; iTrack++)
+	{
+		_snwprintf_s(szText, _TRUNCATE, L"Skype %u", iTrack);
+		g_objSharedCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, szText);
+	}
+	return 0;
+}
+
+static void TestConcurrentSinks(const std::wstring& strFileName)
+{
+	::DeleteFile(strFileName.c_str());
+	CHECK(g_objSharedCheckpoint.Open(strFileName));
+
+	CThread objThread(SkypeThread);
+	CHECK(objThread.Start() == 0);
+
+	WCHAR szText[64];
+	for (unsigned iTrack = 1; iTrack <= THREAD_UPDATES; iTrack++)
+	{
+		_snwprintf_s(szText, _TRUNCATE, L"Shared %u", iTrack);
+		g_objSharedCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, szText);
+		g_objSharedCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE);
+	}
+
+	::WaitForSingleObject(objThread.GetHandle(), INFINITE);
+	objThread.Stop(true);
+	g_objSharedCheckpoint.Close();
+
+	// The last commit has both final texts. A commit mixed with the other thread's state would have
+	// a bad checksum (the previous slot is loaded) or the same sequence number in both slots.
+	_snwprintf_s(szText, _TRUNCATE, L"Skype %u", THREAD_UPDATES);
+	CHECK(g_objSharedCheckpoint.Open(strFileName));
+	CHECK_TEXT(g_objSharedCheckpoint.GetSinkText(CStateCheckpoint::SINK_SKYPE), szText);
+	_snwprintf_s(szText, _TRUNCATE, L"Shared %u", THREAD_UPDATES);
+	CHECK_TEXT(g_objSharedCheckpoint.GetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY), szText);
+	g_objSharedCheckpoint.Close();
+}
+
+// Cost of the checkpoint per event: every track change commits the Skype, shared memory and broadcast
+// texts; a repeated event (same text) is compared only
+static void RunBenchmark(const std::wstring& strFileName)
+{
+	const unsigned EVENT_COUNT = 200000;
+	WCHAR szText[128];
+	CStateCheckpoint objCheckpoint;
+
+	::DeleteFile(strFileName.c_str());
+	CHECK(objCheckpoint.Open(strFileName));
+
+	CBenchTimer objChangedTimer;
+	for (unsigned iTrack = 0; iTrack < EVENT_COUNT; iTrack++)
+	{
+		_snwprintf_s(szText, _TRUNCATE, L"Listening now: Artist %u - Some Track Title %u", iTrack % 400, iTrack);
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, szText);
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, szText);
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, szText);
+	}
+	double dChangedMS = objChangedTimer.GetElapsedMS();
+
+	CBenchTimer objFormatTimer;
+	for (unsigned iTrack = 0; iTrack < EVENT_COUNT; iTrack++)
+		_snwprintf_s(szText, _TRUNCATE, L"Listening now: Artist %u - Some Track Title %u", iTrack % 400, iTrack);
+	double dFormatMS = objFormatTimer.GetElapsedMS();
+
+	CBenchTimer objSameTimer;
+	for (unsigned iTrack = 0; iTrack < EVENT_COUNT; iTrack++)
+	{
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SKYPE, szText);
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_SHARED_MEMORY, szText);
+		objCheckpoint.SetSinkText(CStateCheckpoint::SINK_BROADCAST, szText);
+	}
+	double dSameMS = objSameTimer.GetElapsedMS();
+
+	objCheckpoint.Close();
+
+	printf("Checkpoint cost per event (%u events, 3 sinks, no flush)\n", EVENT_COUNT);
+	printf("  Track changed (3 commits)   %8.1f ns\n", 1000000.0 * (dChangedMS - dFormatMS) / EVENT_COUNT);
+	printf("  Same text (3 compares)      %8.1f ns\n", 1000000.0 * dSameMS / EVENT_COUNT);
+}
+
+int main(int argc, char* argv[])
+{
+	std::wstring strFileName = GetTestFileName(L"checkpoint.state");
+
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0)
+	{
+		RunBenchmark(strFileName);
+		::DeleteFile(strFileName.c_str());
+		return (g_iTestFailures == 0 ? 0 : 1);
+	}
+
+	TestCleanRoundTrip(strFileName);
+	TestTornSlot(strFileName);
+	TestKillRecovery(strFileName);
+	TestConcurrentSinks(strFileName);
+
+	::DeleteFile(strFileName.c_str());
+	return TestResult("TestStateCheckpoint");
+}
@@ -0,0 +1,230 @@
+//
+// Tests of CTitleNormalizer: built-in rules, rule actions, greedy "#", featured artists and DFA size limit.
+// "/bench" argument runs the benchmark instead: cost per title and DFA size as the rule count grows (make bench).
+//
+#include "stdafx.h"
+#include "CTitleNormalizer.h"
+#include "TestUtil.h"
+
+static CTrackEvent MakeEvent(const WCHAR* szArtist, const WCHAR* szTitle)
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, L"1", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szArtist, szArtist, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szTitle, szTitle, _TRUNCATE);
+	return objEvent;
+}
+
+static std::wstring Normalize(const CTitleNormalizer& objNormalizer, const WCHAR* szText)
+{
+	WCHAR szOutput[CTrackEvent::MAX_FIELD_LEN];
+	if (!objNormalizer.NormalizeField(szText, szOutput, CTrackEvent::MAX_FIELD_LEN, NULL, 0)) return std::wstring(szText);
+	return std::wstring(szOutput);
+}
+
+static void TestDefaultRules()
+{
+	CTitleNormalizer objNormalizer;
+	CHECK(objNormalizer.Compile(CTitleNormalizer::GetDefaultRules(), false));
+	CHECK(objNormalizer.GetStats().dwRuleCount == CTitleNormalizer::GetDefaultRules().size());
+	CHECK(objNormalizer.GetStats().dwInvalidRuleCount == 0);
+	CHECK(!objNormalizer.GetStats().bTooManyStates);
+
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - 2009 Remaster"), L"Song");
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - 2009 REMASTERED Version"), L"Song");
+	CHECK_TEXT(Normalize(objNormalizer, L"Song (Deluxe Edition)"), L"Song");
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - Live at Wembley"), L"Song");
+	CHECK_TEXT(Normalize(objNormalizer, L"Plain Song"), L"Plain Song");
+
+	CTrackEvent objEvent = MakeEvent(L"Artist", L"Song (feat. Somebody) - 2011 Remaster");
+	objNormalizer.NormalizeEvent(objEvent);
+	CHECK_TEXT(objEvent.m_szTitle, L"Song");
+	CHECK_TEXT(objEvent.m_szArtist, L"Artist, Somebody");
+
+	objEvent = MakeEvent(L"Artist feat. Other", L"Song [feat. Somebody]");
+	objNormalizer.NormalizeEvent(objEvent);
+	CHECK_TEXT(objEvent.m_szTitle, L"Song");
+	CHECK_TEXT(objEvent.m_szArtist, L"Artist, Somebody, Other");
+}
+
+static void TestActions()
+{
+	std::vector<std::wstring> arrRules;
+	arrRules.push_back(L"strip \" [Explicit]\"");
+	arrRules.push_back(L"rewrite \" & \" \" and \"");
+	arrRules.push_back(L"strip \" - #\"");
+	arrRules.push_back(L"rewrite \" Vol. #\" \" Volume\"");
+	arrRules.push_back(L"bogus \"x\"");
+	arrRules.push_back(L"strip \"1#\"");
+	arrRules.push_back(L"cut \"\"");
+
+	CTitleNormalizer objNormalizer;
+	CHECK(objNormalizer.Compile(arrRules, false));
+	CHECK(objNormalizer.GetStats().dwRuleCount == 4);
+	CHECK(objNormalizer.GetStats().dwInvalidRuleCount == 3);
+
+	CHECK_TEXT(Normalize(objNormalizer, L"Rock & Roll [Explicit]"), L"Rock and Roll");
+	CHECK_TEXT(Normalize(objNormalizer, L"Rock & Roll [EXPLICIT] & More"), L"Rock and Roll and More");
+
+	// Trailing "#" takes the whole number, not only its first digit
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - 2009"), L"Song");
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - 2009 Mix"), L"Song Mix");
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - 12 - 2011"), L"Song");
+	CHECK_TEXT(Normalize(objNormalizer, L"Hits Vol. 12 Disc"), L"Hits Volume Disc");
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - Live"), L"Song - Live");
+
+	// Case folding changes every field
+	CHECK(objNormalizer.Compile(arrRules, true));
+	CHECK_TEXT(Normalize(objNormalizer, L"Plain SONG"), L"plain song");
+}
+
+// A field which matches a rule as a whole is kept as such, featured artists included
+static void TestFeaturedArtists()
+{
+	CTitleNormalizer objNormalizer;
+	CHECK(objNormalizer.Compile(CTitleNormalizer::GetDefaultRules(), false));
+
+	WCHAR szOutput[CTrackEvent::MAX_FIELD_LEN];
+	WCHAR szFeatured[CTrackEvent::MAX_FIELD_LEN] = L"";
+
+	CHECK(!objNormalizer.NormalizeField(L" (feat. Somebody)", szOutput, CTrackEvent::MAX_FIELD_LEN, szFeatured, CTrackEvent::MAX_FIELD_LEN));
+	CHECK_TEXT(szFeatured, L"");
+
+	CHECK(objNormalizer.NormalizeField(L"Song (feat. A) (feat. B)", szOutput, CTrackEvent::MAX_FIELD_LEN, szFeatured, CTrackEvent::MAX_FIELD_LEN));
+	CHECK_TEXT(szOutput, L"Song");
+	CHECK_TEXT(szFeatured, L"A, B");
+
+	CTrackEvent objEvent = MakeEvent(L"Artist", L" (feat. Somebody)");
+	objNormalizer.NormalizeEvent(objEvent);
+	CHECK_TEXT(objEvent.m_szTitle, L" (feat. Somebody)");
+	CHECK_TEXT(objEvent.m_szArtist, L"Artist");
+
+	// Non-ASCII pattern chars match upper- and lowercase text
+	std::vector<std::wstring> arrRules(1, L"strip \" (\x00C4\x00E4ni)\"");
+	CHECK(objNormalizer.Compile(arrRules, false));
+	CHECK_TEXT(Normalize(objNormalizer, L"Laulu (\x00E4\x00C4NI)"), L"Laulu");
+}
+
+// Rules whose DFA doesn't fit in MAX_DFA_STATES disable the normalizer (and are reported)
+static void TestStateLimit()
+{
+	std::vector<std::wstring> arrRules(1, L"strip \"x???????????????y\"");
+
+	CTitleNormalizer objNormalizer;
+	CHECK(!objNormalizer.Compile(arrRules, false));
+	CHECK(objNormalizer.GetStats().bTooManyStates);
+	CHECK(!objNormalizer.IsEnabled());
+	CHECK_TEXT(Normalize(objNormalizer, L"Song - 2009 Remaster"), L"Song - 2009 Remaster");
+
+	CHECK(objNormalizer.Compile(CTitleNormalizer::GetDefaultRules(), false));
+	CHECK(!objNormalizer.GetStats().bTooManyStates);
+
+	CHECK(!objNormalizer.Compile(std::vector<std::wstring>(), false));
+	CHECK(!objNormalizer.GetStats().bTooManyStates);
+}
+
+// Built-in rules plus generated rules of the kinds seen in INI files: edition and version suffixes
+// (cut), tags (strip), spelling rewrites and a few "#" and "?" patterns. Rule iRule is the same in
+// every set, so a bigger set contains the smaller ones.
+static std::vector<std::wstring> MakeRuleSet(unsigned iRuleCount)
+{
+	static const WCHAR* arrWords[] = { L"Remix", L"Edit", L"Mix", L"Version", L"Session", L"Take", L"Demo", L"Mono",
+		L"Stereo", L"Acoustic", L"Instrumental", L"Radio", L"Club", L"Extended", L"Bonus", L"Anniversary" };
+	const unsigned iWordCount = sizeof(arrWords) / sizeof(arrWords[0]);
+
+	std::vector<std::wstring> arrRules = CTitleNormalizer::GetDefaultRules();
+	WCHAR szRule[128];
+
+	for (unsigned iRule = 0; arrRules.size() < iRuleCount; iRule++)
+	{
+		const WCHAR* szWord = arrWords[iRule % iWordCount];
+		unsigned iVariant = iRule / iWordCount;
+
+		switch (iRule % 5)
+		{
+			case 0:  _snwprintf_s(szRule, _TRUNCATE, L"cut \" - %s %u\"", szWord, iVariant); break;
+			case 1:  _snwprintf_s(szRule, _TRUNCATE, L"strip \" [%s %u]\"", szWord, iVariant); break;
+			case 2:  _snwprintf_s(szRule, _TRUNCATE, L"rewrite \"%s%u \" \"%s \"", szWord, iVariant, szWord); break;
+			case 3:  _snwprintf_s(szRule, _TRUNCATE, L"cut \" (%s %u #\"", szWord, iVariant); break;
+			default: _snwprintf_s(szRule, _TRUNCATE, L"strip \" - %s?%u\"", szWord, iVariant); break;
+		}
+		arrRules.push_back(szRule);
+	}
+
+	return arrRules;
+}
+
+// Compile and normalize cost as the rule count grows (one NormalizeEvent call per title)
+static void RunBenchmark()
+{
+	static const WCHAR* arrTitles[] = {
+		L"Some Long Song Title (feat. Somebody) - 2009 Remaster",
+		L"Another Song - Live at Wembley Stadium",
+		L"Plain Song Title Without Any Suffix",
+		L"Song [Deluxe Edition] (Explicit)",
+		L"Yet Another Song - Acoustic 3",
+		L"Track [Club 7] - Version 12",
+	};
+	static const unsigned arrRuleCounts[] = { 15, 100, 300, 600 };
+	const unsigned iTitleCount = sizeof(arrTitles) / sizeof(arrTitles[0]);
+	const unsigned iEventCount = 1000000;
+
+	std::vector<CTrackEvent> arrEvents;
+	for (unsigned idx = 0; idx < iTitleCount; idx++) arrEvents.push_back(MakeEvent(L"Artist", arrTitles[idx]));
+
+	printf("Rules  States  Classes  Table KB  Compile ms  ns per event (title, artist and album)\n");
+
+	for (unsigned iSet = 0; iSet < sizeof(arrRuleCounts) / sizeof(arrRuleCounts[0]); iSet++)
+	{
+		CTitleNormalizer objNormalizer;
+		CBenchTimer objCompileTimer;
+		bool bCompiled = objNormalizer.Compile(MakeRuleSet(arrRuleCounts[iSet]), false);
+		double dCompileMS = objCompileTimer.GetElapsedMS();
+
+		const CTitleNormalizer::CCompileStats& objStats = objNormalizer.GetStats();
+		CHECK(bCompiled && objStats.dwRuleCount == arrRuleCounts[iSet]);
+		if (!bCompiled)
+		{
+			printf("%5u  over %u states, normalization disabled\n", arrRuleCounts[iSet], (unsigned) CTitleNormalizer::MAX_DFA_STATES);
+			continue;
+		}
+
+		CTrackEvent objEvent;
+		CBenchTimer objNormalizeTimer;
+		for (unsigned idx = 0; idx < iEventCount; idx++)
+		{
+			objEvent = arrEvents[idx % iTitleCount];
+			objNormalizer.NormalizeEvent(objEvent);
+		}
+		double dNormalizeMS = objNormalizeTimer.GetElapsedMS();
+
+		printf("%5u  %6u  %7u  %8u  %10.2f  %6.0f\n", objStats.dwRuleCount, objStats.dwStateCount, objStats.dwClassCount,
+			objStats.dwTableBytes / 1024, dCompileMS, 1000000.0 * dNormalizeMS / iEventCount);
+	}
+
+	// The state count grows with the "?" elements of a rule, not with the number of rules
+	printf("\n300 rules + strip \"x<n * ?>y\"   States\n");
+	for (unsigned iAnyCount = 2; iAnyCount <= 14; iAnyCount += 4)
+	{
+		std::vector<std::wstring> arrRules = MakeRuleSet(300);
+		arrRules.push_back(L"strip \"x" + std::wstring(iAnyCount, L'?') + L"y\"");
+
+		CTitleNormalizer objNormalizer;
+		if (objNormalizer.Compile(arrRules, false)) printf("  n = %2u                        %6u\n", iAnyCount, objNormalizer.GetStats().dwStateCount);
+		else printf("  n = %2u                        over %u, normalization disabled\n", iAnyCount, (unsigned) CTitleNormalizer::MAX_DFA_STATES);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "/bench") == 0) RunBenchmark();
+	else
+	{
+		TestDefaultRules();
+		TestActions();
+		TestFeaturedArtists();
+		TestStateLimit();
+	}
+
+	return TestResult("TestTitleNormalizer");
+}
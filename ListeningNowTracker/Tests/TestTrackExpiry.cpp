@@ -0,0 +1,301 @@
+//
+// Tests of CTrackExpiry: prediction sources, learning from expired deadlines, saved state, and a
+// simulated listening history comparing the adaptive policy with the fixed timeout.
+// "/sim" argument prints the simulation results per policy and library coverage (make bench).
+//
+#include "stdafx.h"
+#include "CTrackExpiry.h"
+#include "TestUtil.h"
+
+static const DWORD FIXED_TIMEOUT_MS = 10 * 60 * 1000;
+
+static CTrackEvent MakeEvent(const WCHAR* szArtist, const WCHAR* szTitle, DWORD dwDurationMS = 0)
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, L"1", _TRUNCATE);
+	wcsncpy_s(objEvent.m_szArtist, szArtist, _TRUNCATE);
+	wcsncpy_s(objEvent.m_szTitle, szTitle, _TRUNCATE);
+	objEvent.m_dwDurationMS = dwDurationMS;
+	return objEvent;
+}
+
+static CTrackEvent MakeStopEvent()
+{
+	CTrackEvent objEvent;
+	wcsncpy_s(objEvent.m_szStatus, L"0", _TRUNCATE);
+	return objEvent;
+}
+
+static void TestTrackKey()
+{
+	CHECK(CTrackEvent::MakeTrackKey(L"The Band", L"Song (Live)") == CTrackEvent::MakeTrackKey(L"the band", L"SONG - LIVE"));
+	CHECK(CTrackEvent::MakeTrackKey(L"The Band", L"Song") != CTrackEvent::MakeTrackKey(L"The Ban", L"dSong"));
+	CHECK(CTrackEvent::MakeTrackKey(L"", L"") != 0);
+}
+
+static void TestPredictions()
+{
+	CTrackExpiry objExpiry;
+	objExpiry.SetPolicy(true, FIXED_TIMEOUT_MS);
+	DWORD dwNowMS = 1000;
+
+	// Duration of the library index wins, margin is at least 30 secs
+	CHECK(objExpiry.OnEvent(MakeEvent(L"A", L"Short", 120 * 1000), dwNowMS) == CTrackExpiry::SOURCE_DURATION);
+	CHECK(objExpiry.GetWaitMS(dwNowMS, 0) == 150 * 1000);
+	CHECK(!objExpiry.CheckExpired(dwNowMS + 149 * 1000));
+	CHECK(objExpiry.CheckExpired(dwNowMS + 150 * 1000) && objExpiry.IsExpired());
+	CHECK(!objExpiry.CheckExpired(dwNowMS + 151 * 1000));
+
+	// Fixed timeout until the distribution has enough plays
+	dwNowMS += 200 * 1000;
+	CHECK(objExpiry.OnEvent(MakeEvent(L"A", L"Track 0"), dwNowMS) == CTrackExpiry::SOURCE_FIXED);
+	CHECK(!objExpiry.IsExpired());
+
+	for (int idx = 1; idx <= CTrackExpiry::MIN_SAMPLE_COUNT; idx++)
+	{
+		WCHAR szTitle[32];
+		_snwprintf_s(szTitle, _TRUNCATE, L"Track %d", idx);
+		dwNowMS += 3 * 60 * 1000 + 5000;
+		objExpiry.OnEvent(MakeEvent(L"A", szTitle), dwNowMS);
+	}
+
+	// 90th percentile of 3:05 plays (and the missed deadline of the short track) is the 3:10 bucket edge + 30 secs
+	CHECK(objExpiry.GetStats().dwSampleCount == CTrackExpiry::MIN_SAMPLE_COUNT + 1);
+	dwNowMS += 3 * 60 * 1000 + 5000;
+	CHECK(objExpiry.OnEvent(MakeEvent(L"B", L"New"), dwNowMS) == CTrackExpiry::SOURCE_DISTRIBUTION);
+	CHECK(objExpiry.GetWaitMS(dwNowMS, 0) == (3 * 60 + 10 + 30) * 1000);
+
+	// A play which outlived its deadline may be a crash gap, so the track learns nothing from it
+	CHECK(objExpiry.CheckExpired(dwNowMS + (3 * 60 + 40) * 1000));
+	dwNowMS += 20 * 60 * 1000;
+	objExpiry.OnEvent(MakeEvent(L"C", L"Other"), dwNowMS);
+	dwNowMS += 4 * 60 * 1000;
+	CHECK(objExpiry.OnEvent(MakeEvent(L"B", L"new"), dwNowMS) == CTrackExpiry::SOURCE_DISTRIBUTION);
+	CHECK(objExpiry.GetWaitMS(dwNowMS, 0) == (3 * 60 + 40) * 1000);
+
+	// A long play which ended before its deadline is learned
+	objExpiry.OnEvent(MakeEvent(L"D", L"Long", 20 * 60 * 1000), dwNowMS);
+	dwNowMS += 20 * 60 * 1000;
+	objExpiry.OnEvent(MakeEvent(L"C", L"Other"), dwNowMS);
+	dwNowMS += 4 * 60 * 1000;
+	CHECK(objExpiry.OnEvent(MakeEvent(L"D", L"long"), dwNowMS) == CTrackExpiry::SOURCE_LEARNED);
+	CHECK(objExpiry.GetWaitMS(dwNowMS, 0) == 23 * 60 * 1000);
+
+	// Stop event clears the deadline
+	CHECK(objExpiry.OnEvent(MakeStopEvent(), dwNowMS + 1000) == CTrackExpiry::SOURCE_NONE);
+	CHECK(objExpiry.GetWaitMS(dwNowMS + 1000, 12345) == 12345);
+
+	// Tick count wraps around
+	CTrackExpiry objWrap;
+	objWrap.OnEvent(MakeEvent(L"A", L"Wrap", 60 * 1000), 0xFFFFF000);
+	CHECK(objWrap.GetWaitMS(0xFFFFF000, 0) == 90 * 1000);
+	CHECK(!objWrap.CheckExpired(0x00001000) && objWrap.CheckExpired(0xFFFFF000 + 90 * 1000));
+
+	// Fixed policy ignores the duration
+	objWrap.SetPolicy(false, FIXED_TIMEOUT_MS);
+	CHECK(objWrap.OnEvent(MakeEvent(L"A", L"Fixed", 60 * 1000), 0) == CTrackExpiry::SOURCE_FIXED);
+	CHECK(objWrap.GetWaitMS(0, 0) == FIXED_TIMEOUT_MS);
+}
+
+static void WriteFileBytes(const std::wstring& strFileName, const std::vector<BYTE>& arrData)
+{
+	HANDLE hFile = ::CreateFile(strFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD dwWritten = 0;
+	::WriteFile(hFile, &arrData[0], (DWORD) arrData.size(), &dwWritten, NULL);
+	::CloseHandle(hFile);
+}
+
+static std::vector<BYTE> ReadFileBytes(const std::wstring& strFileName)
+{
+	std::vector<BYTE> arrData(1024 * 1024);
+	HANDLE hFile = ::CreateFile(strFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD dwRead = 0;
+	if (hFile == INVALID_HANDLE_VALUE) return std::vector<BYTE>();
+	::ReadFile(hFile, &arrData[0], (DWORD) arrData.size(), &dwRead, NULL);
+	::CloseHandle(hFile);
+	arrData.resize(dwRead);
+	return arrData;
+}
+
+static void TestSaveLoad(const std::wstring& strFileName)
+{
+	CTrackExpiry objExpiry;
+	DWORD dwNowMS = 1000;
+
+	CHECK(!objExpiry.Load(strFileName));
+	CHECK(objExpiry.Save(strFileName));		// Nothing learned, nothing written
+	CHECK(ReadFileBytes(strFileName).empty());
+
+	for (int idx = 0; idx < 30; idx++)
+	{
+		WCHAR szTitle[32];
+		_snwprintf_s(szTitle, _TRUNCATE, L"Track %d", idx % 10);
+		objExpiry.OnEvent(MakeEvent(L"A", szTitle), dwNowMS);
+		dwNowMS += (idx == 3 ? 9 : 4) * 60 * 1000;
+	}
+	CHECK(objExpiry.Save(strFileName));
+
+	CTrackExpiry objLoaded;
+	CHECK(objLoaded.Load(strFileName));
+	CHECK(objLoaded.GetStats().dwSampleCount == 29 && objLoaded.GetStats().dwLearnedTracks == 10);
+	CHECK(objLoaded.OnEvent(MakeEvent(L"A", L"Track 3"), 0) == CTrackExpiry::SOURCE_LEARNED);
+	CHECK(objLoaded.GetWaitMS(0, 0) == 9 * 60 * 1000 + 81 * 1000);
+
+	// Sample count of the header must match the distribution
+	std::vector<BYTE> arrData = ReadFileBytes(strFileName);
+	CHECK(arrData.size() > 5 * sizeof(DWORD));
+
+	std::vector<BYTE> arrDamaged = arrData;
+	((DWORD*) &arrDamaged[0])[4] += 1;
+	WriteFileBytes(strFileName, arrDamaged);
+	CHECK(!CTrackExpiry().Load(strFileName));
+
+	// Truncated file, other version
+	arrDamaged = arrData;
+	arrDamaged.resize(arrData.size() - 1);
+	WriteFileBytes(strFileName, arrDamaged);
+	CHECK(!CTrackExpiry().Load(strFileName));
+
+	arrDamaged = arrData;
+	((DWORD*) &arrDamaged[0])[1] += 1;
+	WriteFileBytes(strFileName, arrDamaged);
+	CHECK(!CTrackExpiry().Load(strFileName));
+
+	WriteFileBytes(strFileName, arrData);
+	CHECK(CTrackExpiry().Load(strFileName));
+	::DeleteFile(strFileName.c_str());
+}
+
+//
+// Simulated listening history: sessions of 3..22 plays of a library where popular tracks repeat,
+// 5% of the tracks are 12..25 mins long and 15% of the plays are skips. 30% of the sessions end
+// with a player crash (no stop event). The results are the time a stale text stays after a crash
+// and the number of texts cleared while the track was still playing.
+//
+struct CSimResult
+{
+	DWORD  dwPlays;
+	DWORD  dwCrashes;
+	DWORD  dwFalseClears;
+	double dStaleSecs;
+};
+
+static DWORD g_dwRandomState;
+
+static DWORD NextRandom(DWORD dwRange)
+{
+	g_dwRandomState = g_dwRandomState * 1103515245 + 12345;
+	return (g_dwRandomState >> 8) % dwRange;
+}
+
+static CSimResult RunSimulation(bool bAdaptive, DWORD dwLibraryPercent)
+{
+	const int TRACK_COUNT = 600;
+	std::vector<DWORD> arrTrackMS(TRACK_COUNT);
+
+	g_dwRandomState = 7;
+	for (int idx = 0; idx < TRACK_COUNT; idx++)
+		arrTrackMS[idx] = (NextRandom(100) < 5 ? 12 * 60 * 1000 + NextRandom(13 * 60 * 1000) : 2 * 60 * 1000 + NextRandom(5 * 60 * 1000));
+
+	CTrackExpiry objExpiry;
+	objExpiry.SetPolicy(bAdaptive, FIXED_TIMEOUT_MS);
+
+	CSimResult objResult = { 0, 0, 0, 0.0 };
+	DWORD dwNowMS = 1000;
+
+	for (int iSession = 0; iSession < 2000; iSession++)
+	{
+		int iPlayCount = 3 + (int) NextRandom(20);
+		bool bCrashed = false;
+
+		for (int iPlay = 0; iPlay < iPlayCount && !bCrashed; iPlay++)
+		{
+			DWORD dwRank = NextRandom(1000);
+			int iTrack = (int) ((ULONGLONG) dwRank * dwRank * TRACK_COUNT / 1000000);
+			WCHAR szTitle[16];
+			_snwprintf_s(szTitle, _TRUNCATE, L"T%d", iTrack);
+
+			objExpiry.OnEvent(MakeEvent(L"A", szTitle, (NextRandom(100) < dwLibraryPercent ? arrTrackMS[iTrack] : 0)), dwNowMS);
+			DWORD dwWaitMS = objExpiry.GetWaitMS(dwNowMS, 0);
+			DWORD dwPlayMS = (NextRandom(100) < 15 ? 5000 + NextRandom(35000) : arrTrackMS[iTrack]);
+			objResult.dwPlays++;
+
+			if (iPlay == iPlayCount - 1 && NextRandom(100) < 30)
+			{
+				bCrashed = true;
+				dwPlayMS = NextRandom(dwPlayMS);
+				objResult.dwCrashes++;
+				objResult.dStaleSecs += (dwWaitMS > dwPlayMS ? dwWaitMS - dwPlayMS : 0) / 1000.0;
+				objExpiry.CheckExpired(dwNowMS + dwWaitMS);
+			}
+			else if (dwPlayMS > dwWaitMS)
+			{
+				objResult.dwFalseClears++;
+				objExpiry.CheckExpired(dwNowMS + dwWaitMS);
+			}
+
+			dwNowMS += dwPlayMS;
+		}
+
+		if (bCrashed) dwNowMS += 60 * 1000 + NextRandom(30 * 60 * 1000);
+		else
+		{
+			objExpiry.OnEvent(MakeStopEvent(), dwNowMS);
+			dwNowMS += 10 * 60 * 1000;
+		}
+	}
+
+	return objResult;
+}
+
+static void TestSimulation()
+{
+	CSimResult objFixed    = RunSimulation(false, 0);
+	CSimResult objAdaptive = RunSimulation(true, 0);
+	CSimResult objHalf     = RunSimulation(true, 50);
+	CSimResult objLibrary  = RunSimulation(true, 100);
+
+	CHECK(objAdaptive.dwCrashes == objFixed.dwCrashes && objAdaptive.dwCrashes > 0);
+
+	// Without durations the adaptive policy is never worse than the fixed timeout: the distribution
+	// clears a stale text sooner, and long tracks are cleared as often as before (nothing to learn from)
+	CHECK(objAdaptive.dStaleSecs <= objFixed.dStaleSecs);
+	CHECK(objAdaptive.dwFalseClears <= objFixed.dwFalseClears);
+
+	// Plays with a duration teach the long tracks, which then aren't cleared when the duration is missing
+	CHECK(objHalf.dStaleSecs <= objAdaptive.dStaleSecs && objHalf.dwFalseClears < objFixed.dwFalseClears / 4);
+
+	// Durations of the library index beat the fixed timeout on both counts
+	CHECK(objLibrary.dStaleSecs < objFixed.dStaleSecs / 2 && objLibrary.dwFalseClears == 0);
+}
+
+static void RunSimulationReport()
+{
+	for (int iPolicy = 0; iPolicy < 2; iPolicy++)
+	{
+		for (DWORD dwLibraryPercent = 0; dwLibraryPercent <= 100; dwLibraryPercent += 50)
+		{
+			if (iPolicy == 0 && dwLibraryPercent > 0) break;
+
+			CSimResult objResult = RunSimulation(iPolicy == 1, dwLibraryPercent);
+			printf("%-8s library %3u%%: %u plays, %u crashes, stale text %.0f secs per crash, %u false clears (%.2f%%)\n",
+				(iPolicy == 0 ? "fixed" : "adaptive"), (unsigned) dwLibraryPercent, (unsigned) objResult.dwPlays, (unsigned) objResult.dwCrashes,
+				objResult.dStaleSecs / objResult.dwCrashes, (unsigned) objResult.dwFalseClears, 100.0 * objResult.dwFalseClears / objResult.dwPlays);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "/sim") == 0)
+	{
+		RunSimulationReport();
+		return 0;
+	}
+
+	TestTrackKey();
+	TestPredictions();
+	TestSaveLoad(GetTestFileName(L"expiry.dat"));
+	TestSimulation();
+	return TestResult("TestTrackExpiry");
+}
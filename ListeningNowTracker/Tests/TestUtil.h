@@ -0,0 +1,69 @@
+#ifndef __TESTUTIL_H__
+#define __TESTUTIL_H__
+
+#include <stdio.h>
+#include <string>
+
+/*
+ * Minimal support code of the test programs (one Test<Name>.cpp program per header, see Makefile).
+ * A failed CHECK prints the expression and the test goes on. Exit code of the program is 1 when
+ * any check failed.
+*/
+
+static int g_iTestFailures = 0;
+
+inline void ReportFailure(const char* szFile, int iLine, const char* szExpression)
+{
+	fprintf(stderr, "%s:%d: CHECK(%s) failed\n", szFile, iLine, szExpression);
+	g_iTestFailures++;
+}
+
+inline void ReportTextFailure(const char* szFile, int iLine, const std::wstring& strActual, const std::wstring& strExpected)
+{
+	fprintf(stderr, "%s:%d: got \"%ls\", expected \"%ls\"\n", szFile, iLine, strActual.c_str(), strExpected.c_str());
+	g_iTestFailures++;
+}
+
+#define CHECK(expr) ((expr) ? (void) 0 : ReportFailure(__FILE__, __LINE__, #expr))
+#define CHECK_TEXT(actual, expected) ((std::wstring(actual) == std::wstring(expected)) ? (void) 0 : ReportTextFailure(__FILE__, __LINE__, (actual), (expected)))
+
+inline int TestResult(const char* szTestName)
+{
+	printf("%-24s %s\n", szTestName, (g_iTestFailures == 0 ? "ok" : "FAILED"));
+	return (g_iTestFailures == 0 ? 0 : 1);
+}
+
+// Unique file name in the temp folder for the files of a test (pid keeps parallel runs apart)
+inline std::wstring GetTestFileName(const WCHAR* szName)
+{
+	WCHAR szTempPath[MAX_PATH];
+	WCHAR szFileName[MAX_PATH];
+
+	::GetTempPath(MAX_PATH, szTempPath);
+	_snwprintf_s(szFileName, _TRUNCATE, L"%slnt-test-%u-%s", szTempPath, ::GetCurrentProcessId(), szName);
+	return std::wstring(szFileName);
+}
+
+// Elapsed time of a benchmark loop
+class CBenchTimer
+{
+  protected:
+	LARGE_INTEGER m_liFrequency;
+	LARGE_INTEGER m_liStart;
+
+  public:
+	CBenchTimer()
+	{
+		::QueryPerformanceFrequency(&m_liFrequency);
+		::QueryPerformanceCounter(&m_liStart);
+	}
+
+	double GetElapsedMS() const
+	{
+		LARGE_INTEGER liNow;
+		::QueryPerformanceCounter(&liNow);
+		return 1000.0 * (double) (liNow.QuadPart - m_liStart.QuadPart) / (double) m_liFrequency.QuadPart;
+	}
+};
+
+#endif //__TESTUTIL_H__
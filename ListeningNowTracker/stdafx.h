@@ -11,5 +11,6 @@
 #include <wchar.h> 
 
 #include <string> 
+#include <vector> 
 
 